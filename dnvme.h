@@ -33,6 +33,7 @@ enum controller_reg {
 };
 
 #define NVME_CAP_MQES(cap)      ((cap) & 0xffff)
+#define NVME_CAP_AMS(cap)       (((cap) >> 17) & 0x3)
 #define NVME_CAP_TIMEOUT(cap)   (((cap) >> 24) & 0xff)
 #define NVME_CAP_STRIDE(cap)    (((cap) >> 32) & 0xf)
 #define NVME_CAP_NSSRC(cap)     (((cap) >> 36) & 0x1)
@@ -70,6 +71,7 @@ enum controller_control {
     NVME_CC_AMS_RR          = (0 << NVME_CC_AMS_SHIFT),
     NVME_CC_AMS_WRRU        = (1 << NVME_CC_AMS_SHIFT),
     NVME_CC_AMS_VS          = (7 << NVME_CC_AMS_SHIFT),
+    NVME_CC_AMS_MASK        = (7 << NVME_CC_AMS_SHIFT),
     NVME_CC_SHN_NONE        = (0 << NVME_CC_SHN_SHIFT),
     NVME_CC_SHN_NORMAL      = (1 << NVME_CC_SHN_SHIFT),
     NVME_CC_SHN_ABRUPT      = (2 << NVME_CC_SHN_SHIFT),
@@ -134,6 +136,19 @@ enum {
     NVME_NS_DPS_PI_TYPE3    = 3,
 };
 
+enum {
+    NVME_CTRL_ONCS_COMPARE              = (1 << 0),
+    NVME_CTRL_ONCS_WRITE_UNCORRECTABLE  = (1 << 1),
+    NVME_CTRL_ONCS_DSM                  = (1 << 2),
+    NVME_CTRL_ONCS_WRITE_ZEROES         = (1 << 3),
+    NVME_NS_DLFEAT_READ_MASK            = 0x7,
+    NVME_NS_DLFEAT_READ_ZEROES          = 0x1,
+    NVME_NS_DLFEAT_WZ_DEAC              = (1 << 3),
+    NVME_DSMGMT_IDR                     = (1 << 0),
+    NVME_DSMGMT_IDW                     = (1 << 1),
+    NVME_DSMGMT_AD                      = (1 << 2),
+};
+
 enum nvme_async_event_type {
     NVME_AER_TYPE_ERROR     = 0,
     NVME_AER_TYPE_SMART     = 1,
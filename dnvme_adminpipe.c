@@ -0,0 +1,125 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_adminpipe.c
+ * Description: admin commands submitted together and completed with one doorbell.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_adminpipe.h"
+#include "dnvme_commands.h"
+#include "dnvme_cqe.h"
+#include "dnvme_ioctrl.h"
+
+/* The admin SQ cannot hold more than this, so neither can one flush. */
+#define DNVME_ADMIN_PIPE_DEPTH      (NVME_QUEUE_ELEMENTS-1)
+
+static void dnvme_admin_pipe_done(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    if (ctx)
+        memcpy(ctx, cqe, sizeof(*cqe));
+}
+
+int dnvme_admin_pipe_init(struct dnvme_admin_pipe *pipe, int fd)
+{
+    int ret;
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->fd = fd;
+    ret = dnvme_inflight_init(&pipe->inflight, 0, DNVME_ADMIN_PIPE_DEPTH);
+    if (ret)
+        return ret;
+    pipe->reap_buffer = calloc(DNVME_ADMIN_PIPE_DEPTH, NVME_IOCQ_ELEMENT_SIZE);
+    if (!pipe->reap_buffer)
+    {
+        dnvme_inflight_free(&pipe->inflight);
+        return -ENOMEM;
+    }
+    return SUCCESS;
+}
+
+void dnvme_admin_pipe_free(struct dnvme_admin_pipe *pipe)
+{
+    dnvme_inflight_free(&pipe->inflight);
+    free(pipe->reap_buffer);
+    pipe->reap_buffer = NULL;
+}
+
+/*
+ * Register the command the calling thread just queued, e.g.
+ *     dnvme_admin_pipe_add(&pipe, dnvme_admin_identify_ctrl(fd, 0, 0, 0, buffer), &cqe);
+ * 'send_ret' is what the dnvme_admin_*() call returned; a failed send is
+ * remembered and reported by the next flush. 'cqe' may be NULL.
+ */
+int dnvme_admin_pipe_add(struct dnvme_admin_pipe *pipe, int send_ret, struct nvme_completion *cqe)
+{
+    int ret = send_ret;
+    if (ret == 0)
+        ret = dnvme_inflight_add(&pipe->inflight, ioctl_last_unique_id(), dnvme_admin_pipe_done, cqe);
+    if (ret < 0)
+    {
+        if (!pipe->error)
+            pipe->error = ret;
+        return ret;
+    }
+    pipe->pending++;
+    pipe->commands++;
+    return SUCCESS;
+}
+
+/*
+ * Ring the admin doorbell once and reap until every registered command
+ * completed. Returns SUCCESS, the first send error, -EIO when a CQE
+ * carried an error status (the CQEs are filled in either way), or the
+ * wait error. After a failed wait the registrations are dropped so late
+ * completions cannot land in CQEs the caller no longer owns.
+ */
+int dnvme_admin_pipe_flush(struct dnvme_admin_pipe *pipe)
+{
+    uint64_t start = dnvme_get_time_ns();
+    struct dnvme_cqe_view view;
+    int ret = SUCCESS;
+    int remaining;
+
+    pipe->failed = 0;
+    if (pipe->pending)
+        ret = dnvme_ring_doorbell(pipe->fd, 0);
+    while (ret == SUCCESS && pipe->inflight.count)
+    {
+        remaining = dnvme_cq_wait(pipe->fd, 0, pipe->inflight.count, 0, NULL);
+        if (remaining < 0)
+        {
+            ret = remaining;
+            break;
+        }
+        if (remaining > DNVME_ADMIN_PIPE_DEPTH)
+            remaining = DNVME_ADMIN_PIPE_DEPTH;
+        ret = dnvme_cq_reap(pipe->fd, 0, remaining, pipe->reap_buffer, remaining*NVME_IOCQ_ELEMENT_SIZE);
+        if (ret < 0)
+            break;
+        ret = SUCCESS;
+        dnvme_cqe_view_init(&view, pipe->reap_buffer, remaining);
+        pipe->failed += dnvme_cqe_failures(&view, NULL, 0);
+        dnvme_inflight_dispatch(&pipe->inflight, pipe->reap_buffer, remaining);
+    }
+    if (ret < 0 && pipe->inflight.count)
+    {
+        dnvme_inflight_free(&pipe->inflight);
+        if (dnvme_inflight_init(&pipe->inflight, 0, DNVME_ADMIN_PIPE_DEPTH))
+            ret = -ENOMEM;
+    }
+    if (pipe->error)
+        ret = pipe->error;
+    else if (ret == SUCCESS && pipe->failed)
+        ret = -EIO;
+    pipe->error = 0;
+    pipe->pending = 0;
+    pipe->flushes++;
+    pipe->elapsed_ns += dnvme_get_time_ns() - start;
+    return ret;
+}
@@ -0,0 +1,40 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_adminpipe.h
+ * Description: admin commands submitted together and completed with one doorbell.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_ADMINPIPE_H__
+#define __DNVME_ADMINPIPE_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+#include "dnvme_inflight.h"
+
+/**
+ * Commands queued with the dnvme_admin_*() calls are registered with
+ * dnvme_admin_pipe_add() and completed together by dnvme_admin_pipe_flush():
+ * one doorbell, one wait, one reap, every CQE routed to its command by
+ * command id. A flush is the only ordering point, so commands that depend
+ * on each other (Create IOCQ before the IOSQ on it) go in separate flushes
+ * and everything else shares one.
+ */
+struct dnvme_admin_pipe {
+    int fd;
+    int error;                      /* first send error since the last flush */
+    uint16_t pending;               /* commands queued since the last flush */
+    uint16_t failed;                /* CQEs with a non-success status */
+    uint32_t flushes;
+    uint32_t commands;
+    uint64_t elapsed_ns;            /* time spent in flushes */
+    struct dnvme_inflight inflight;
+    uint8_t *reap_buffer;
+};
+
+int dnvme_admin_pipe_init(struct dnvme_admin_pipe *pipe, int fd);
+void dnvme_admin_pipe_free(struct dnvme_admin_pipe *pipe);
+int dnvme_admin_pipe_add(struct dnvme_admin_pipe *pipe, int send_ret, struct nvme_completion *cqe);
+int dnvme_admin_pipe_flush(struct dnvme_admin_pipe *pipe);
+
+#endif
@@ -0,0 +1,231 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_bar.c
+ * Description: controller registers through a memory mapped BAR0.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dnvme_bar.h"
+
+static struct dnvme_bar bars[DNVME_BAR_MAX_DEVICES] = {
+    [0 ... DNVME_BAR_MAX_DEVICES-1] = { .fd = -1 },
+};
+static pthread_mutex_t bars_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bars_released = PTHREAD_COND_INITIALIZER;
+
+/* sysfs resource0 of the PCI function 'bdf', e.g. "0000:01:00.0". */
+int dnvme_bar_resource_path(const char *bdf, char *path, size_t size)
+{
+    int len = snprintf(path, size, "/sys/bus/pci/devices/%s/resource0", bdf);
+    return len < 0 || (size_t)len >= size ? -ENAMETOOLONG : 0;
+}
+
+/*
+ * Map 'path' as BAR0 of the controller behind 'fd' and make it the active
+ * register backend. A regular file of the BAR size works as well, which is
+ * how the path is exercised without hardware.
+ */
+int dnvme_bar_map(int fd, const char *path)
+{
+    struct dnvme_bar *slot = NULL;
+    struct stat st;
+    void *base;
+    int bar_fd, i;
+
+    bar_fd = open(path, O_RDWR | O_SYNC);
+    if (bar_fd < 0)
+        return -errno;
+    if (fstat(bar_fd, &st) || st.st_size < 4)
+    {
+        close(bar_fd);
+        return -EINVAL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, bar_fd, 0);
+    close(bar_fd);
+    if (base == MAP_FAILED)
+        return -errno;
+
+    dnvme_bar_unmap(fd);
+    pthread_mutex_lock(&bars_lock);
+    for (i=0; i<DNVME_BAR_MAX_DEVICES; i++)
+    {
+        if (bars[i].fd < 0)
+        {
+            slot = &bars[i];
+            break;
+        }
+    }
+    if (!slot)
+    {
+        pthread_mutex_unlock(&bars_lock);
+        munmap(base, st.st_size);
+        return -ENOSPC;
+    }
+    slot->base = base;
+    slot->size = st.st_size;
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    slot->active = 1;
+    slot->refs = 0;
+    slot->fd = fd;
+    pthread_mutex_unlock(&bars_lock);
+    return 0;
+}
+
+void dnvme_bar_unmap(int fd)
+{
+    int i;
+    pthread_mutex_lock(&bars_lock);
+    for (i=0; i<DNVME_BAR_MAX_DEVICES; i++)
+    {
+        if (bars[i].fd == fd)
+        {
+            /* No new users once inactive; wait out the ones still accessing it. */
+            bars[i].active = 0;
+            while (bars[i].refs)
+                pthread_cond_wait(&bars_released, &bars_lock);
+            bars[i].fd = -1;
+            munmap((void *)bars[i].base, bars[i].size);
+            bars[i].base = NULL;
+            bars[i].size = 0;
+            bars[i].active = 0;
+        }
+    }
+    pthread_mutex_unlock(&bars_lock);
+}
+
+/* Switch between the mapping and the ioctl path without unmapping. */
+int dnvme_bar_set_active(int fd, int active)
+{
+    int i, ret = -ENODEV;
+    pthread_mutex_lock(&bars_lock);
+    for (i=0; i<DNVME_BAR_MAX_DEVICES; i++)
+    {
+        if (bars[i].fd == fd)
+        {
+            bars[i].active = active;
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bars_lock);
+    return ret;
+}
+
+/*
+ * The active mapping of 'fd' with a reference taken, NULL when registers
+ * go through the driver. Every non-NULL result needs a dnvme_bar_put().
+ */
+struct dnvme_bar *dnvme_bar_get(int fd)
+{
+    struct dnvme_bar *bar = NULL;
+    int i;
+    pthread_mutex_lock(&bars_lock);
+    for (i=0; i<DNVME_BAR_MAX_DEVICES; i++)
+    {
+        if (bars[i].fd == fd)
+        {
+            if (bars[i].active)
+            {
+                bar = &bars[i];
+                bar->refs++;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bars_lock);
+    return bar;
+}
+
+void dnvme_bar_put(struct dnvme_bar *bar)
+{
+    pthread_mutex_lock(&bars_lock);
+    if (--bar->refs == 0)
+        pthread_cond_broadcast(&bars_released);
+    pthread_mutex_unlock(&bars_lock);
+}
+
+/*
+ * Registers are read with naturally aligned 64 and 32 bit loads. Byte and
+ * word accesses, and the unaligned ends of a block, go through the dword
+ * that contains them since controllers are not required to decode them.
+ */
+int dnvme_bar_read(struct dnvme_bar *bar, uint32_t offset, uint32_t bytes, uint8_t *data)
+{
+    if ((uint64_t)offset + bytes > bar->size || (uint64_t)(offset & ~3U) + 4 > bar->size)
+        return -EINVAL;
+    while (bytes)
+    {
+        uint32_t n;
+        if (!(offset & 7) && bytes >= 8)
+        {
+            uint64_t value = *(volatile uint64_t *)(bar->base + offset);
+            memcpy(data, &value, 8);
+            n = 8;
+        }
+        else if (!(offset & 3) && bytes >= 4)
+        {
+            uint32_t value = *(volatile uint32_t *)(bar->base + offset);
+            memcpy(data, &value, 4);
+            n = 4;
+        }
+        else
+        {
+            uint32_t value = *(volatile uint32_t *)(bar->base + (offset & ~3U));
+            n = 4 - (offset & 3) < bytes ? 4 - (offset & 3) : bytes;
+            memcpy(data, (uint8_t *)&value + (offset & 3), n);
+        }
+        offset += n;
+        data += n;
+        bytes -= n;
+    }
+    return 0;
+}
+
+/* Partial dwords are merged into the current register value before the store. */
+int dnvme_bar_write(struct dnvme_bar *bar, uint32_t offset, uint32_t bytes, const uint8_t *data)
+{
+    if ((uint64_t)offset + bytes > bar->size || (uint64_t)(offset & ~3U) + 4 > bar->size)
+        return -EINVAL;
+    while (bytes)
+    {
+        uint32_t n;
+        if (!(offset & 7) && bytes >= 8)
+        {
+            uint64_t value;
+            memcpy(&value, data, 8);
+            *(volatile uint64_t *)(bar->base + offset) = value;
+            n = 8;
+        }
+        else if (!(offset & 3) && bytes >= 4)
+        {
+            uint32_t value;
+            memcpy(&value, data, 4);
+            *(volatile uint32_t *)(bar->base + offset) = value;
+            n = 4;
+        }
+        else
+        {
+            volatile uint32_t *reg = (volatile uint32_t *)(bar->base + (offset & ~3U));
+            uint32_t value = *reg;
+            n = 4 - (offset & 3) < bytes ? 4 - (offset & 3) : bytes;
+            memcpy((uint8_t *)&value + (offset & 3), data, n);
+            *reg = value;
+        }
+        offset += n;
+        data += n;
+        bytes -= n;
+    }
+    __sync_synchronize();
+    return 0;
+}
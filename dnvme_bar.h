@@ -0,0 +1,43 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_bar.h
+ * Description: controller registers through a memory mapped BAR0.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_BAR_H__
+#define __DNVME_BAR_H__
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNVME_BAR_MAX_DEVICES       16
+#define DNVME_BAR_PATH_LEN          256
+
+/**
+ * BAR0 of the controller behind a dnvme fd, mapped from the PCI sysfs
+ * resource0 file or any file standing in for it. While 'active' is set
+ * the dnvme_controller_reg_* calls use plain loads and stores instead of
+ * NVME_IOCTL_READ/WRITE_GENERIC. Every dnvme_bar_get() that returned the
+ * mapping holds a reference until dnvme_bar_put(); dnvme_bar_unmap()
+ * waits for them before the munmap().
+ */
+struct dnvme_bar {
+    int fd;                     /* dnvme fd the mapping belongs to, -1 = free slot */
+    int active;
+    int refs;
+    volatile uint8_t *base;
+    size_t size;
+    char path[DNVME_BAR_PATH_LEN];
+};
+
+int dnvme_bar_resource_path(const char *bdf, char *path, size_t size);
+int dnvme_bar_map(int fd, const char *path);
+void dnvme_bar_unmap(int fd);
+int dnvme_bar_set_active(int fd, int active);
+struct dnvme_bar *dnvme_bar_get(int fd);
+void dnvme_bar_put(struct dnvme_bar *bar);
+int dnvme_bar_read(struct dnvme_bar *bar, uint32_t offset, uint32_t bytes, uint8_t *data);
+int dnvme_bar_write(struct dnvme_bar *bar, uint32_t offset, uint32_t bytes, const uint8_t *data);
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_batch.c
+ * Description: batched command submission with one doorbell per batch.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_batch.h"
+#include "dnvme_commands.h"
+#include "dnvme_ioctrl.h"
+
+int dnvme_batch_init(struct dnvme_batch *batch, uint16_t q_id, uint16_t capacity)
+{
+    memset(batch, 0, sizeof(*batch));
+    if (capacity == 0)
+        return -EINVAL;
+    batch->cmds = calloc(capacity, DNVME_CMD_SIZE);
+    batch->sends = calloc(capacity, sizeof(struct nvme_64b_send));
+    batch->unique_ids = calloc(capacity, sizeof(uint16_t));
+    if (!batch->cmds || !batch->sends || !batch->unique_ids)
+    {
+        dnvme_batch_free(batch);
+        return -ENOMEM;
+    }
+    batch->q_id = q_id;
+    batch->capacity = capacity;
+    return SUCCESS;
+}
+
+void dnvme_batch_free(struct dnvme_batch *batch)
+{
+    free(batch->cmds);
+    free(batch->sends);
+    free(batch->unique_ids);
+    memset(batch, 0, sizeof(*batch));
+}
+
+void dnvme_batch_reset(struct dnvme_batch *batch)
+{
+    batch->count = 0;
+    batch->submitted = 0;
+}
+
+/* Returns the index of the command inside the batch or -ENOSPC when full. */
+int dnvme_batch_add(struct dnvme_batch *batch, const void *cmd, enum send_64b_bitmask bit_mask, uint8_t *buffer,
+    uint32_t buffer_size, uint8_t data_dir)
+{
+    uint16_t idx = batch->count;
+    uint8_t *copy;
+    if (idx >= batch->capacity)
+        return -ENOSPC;
+    copy = batch->cmds + (uint32_t)idx*DNVME_CMD_SIZE;
+    memcpy(copy, cmd, DNVME_CMD_SIZE);
+    batch->sends[idx] = (struct nvme_64b_send) {
+        .q_id = batch->q_id,
+        .bit_mask = buffer ? bit_mask : MASK_NON_PRP,
+        .cmd_buf_ptr = copy,
+        .data_buf_size = buffer ? buffer_size : 0,
+        .data_buf_ptr = buffer,
+        .data_dir = buffer ? data_dir : DATA_DIR_NONE,
+    };
+    batch->count++;
+    return idx;
+}
+
+int dnvme_batch_add_io(struct dnvme_batch *batch, const struct nvme_io_cmd *cmd, uint8_t *buffer, uint32_t buffer_size,
+    uint8_t data_dir)
+{
+    return dnvme_batch_add(batch, cmd, DNVME_PRP_ANY, buffer, buffer_size, data_dir);
+}
+
+int dnvme_batch_add_admin(struct dnvme_batch *batch, const struct nvme_admin_cmd *cmd, uint8_t *buffer,
+    uint32_t buffer_size, uint8_t data_dir)
+{
+    return dnvme_batch_add(batch, cmd, MASK_PRP1_PAGE, buffer, buffer_size, data_dir);
+}
+
+/*
+ * Push every collected command to the SQ and ring its doorbell exactly once.
+ * The whole batch is refused with -ENOSPC if the SQ cannot hold it. When the
+ * driver rejects a command part way, the commands already queued are still
+ * rung so they are not stranded in the SQ, and the send error is returned.
+ * Returns the number of commands submitted on success.
+ */
+int dnvme_batch_submit(int fd, struct dnvme_batch *batch)
+{
+    int ret = 0;
+    int free_slots;
+    uint16_t i;
+
+    batch->submitted = 0;
+    if (batch->count == 0)
+        return 0;
+    free_slots = dnvme_sq_free_slots(fd, batch->q_id);
+    if (free_slots < 0)
+        return free_slots;
+    if (free_slots < batch->count)
+        return -ENOSPC;
+    for (i=0; i<batch->count; i++)
+    {
+        ret = ioctl_send_command(fd, &batch->sends[i]);
+        if (ret < 0)
+            break;
+        batch->unique_ids[i] = batch->sends[i].unique_id;
+        batch->submitted++;
+    }
+    if (batch->submitted)
+    {
+        int err = ioctl_ring_doorbell(fd, batch->q_id);
+        if (ret >= 0)
+            ret = err;
+    }
+    return ret < 0 ? ret : batch->submitted;
+}
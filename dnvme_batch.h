@@ -0,0 +1,38 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_batch.h
+ * Description: batched command submission with one doorbell per batch.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_BATCH_H__
+#define __DNVME_BATCH_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+
+#define DNVME_CMD_SIZE      64
+#define DNVME_PRP_ANY       (MASK_PRP1_PAGE | MASK_PRP1_LIST | MASK_PRP2_PAGE | MASK_PRP2_LIST)
+
+struct dnvme_batch {
+    uint16_t q_id;                  /* SQ the batch is pushed to */
+    uint16_t count;                 /* commands collected so far */
+    uint16_t capacity;              /* maximum commands per batch */
+    uint16_t submitted;             /* commands accepted by the driver */
+    uint8_t *cmds;                  /* private copy of every 64B command */
+    struct nvme_64b_send *sends;    /* send descriptors, one per command */
+    uint16_t *unique_ids;           /* unique_id returned for every command */
+};
+
+int dnvme_batch_init(struct dnvme_batch *batch, uint16_t q_id, uint16_t capacity);
+void dnvme_batch_free(struct dnvme_batch *batch);
+void dnvme_batch_reset(struct dnvme_batch *batch);
+int dnvme_batch_add(struct dnvme_batch *batch, const void *cmd, enum send_64b_bitmask bit_mask, uint8_t *buffer,
+    uint32_t buffer_size, uint8_t data_dir);
+int dnvme_batch_add_io(struct dnvme_batch *batch, const struct nvme_io_cmd *cmd, uint8_t *buffer, uint32_t buffer_size,
+    uint8_t data_dir);
+int dnvme_batch_add_admin(struct dnvme_batch *batch, const struct nvme_admin_cmd *cmd, uint8_t *buffer,
+    uint32_t buffer_size, uint8_t data_dir);
+int dnvme_batch_submit(int fd, struct dnvme_batch *batch);
+
+#endif
@@ -0,0 +1,839 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_bench.c
+ * Description: fio-style workload generator on top of the dnvme library.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dnvme.h"
+#include "dnvme_ioctrl.h"
+#include "dnvme_commands.h"
+#include "dnvme_engine.h"
+#include "dnvme_irqtune.h"
+#include "dnvme_latency.h"
+#include "dnvme_cqe.h"
+#include "dnvme_pattern.h"
+#include "dnvme_pi.h"
+#include "dnvme_pool.h"
+#include "dnvme_qos.h"
+#include "dnvme_sim.h"
+#include "dnvme_trace.h"
+#include "dnvme_xfer.h"
+
+#define DEVICE_FILE_NAME "/dev/nvme0"
+
+struct bench_options {
+    char *dev;
+    int sim;
+    struct dnvme_sim_config sim_config;
+    int random;
+    uint32_t read_pct;      /* 100 = all reads, 0 = all writes */
+    uint32_t bs;            /* bytes per IO */
+    uint16_t qd;            /* IOs in flight per queue */
+    uint16_t queues;
+    uint32_t runtime_s;
+    uint64_t ios;           /* total IOs, 0 = run for runtime_s */
+    uint64_t lba_start;
+    uint64_t lba_count;     /* 0 = up to the end of the namespace */
+    uint32_t nsid;
+    uint64_t pool_cap;      /* buffer memory per queue, 0 = unlimited */
+    uint8_t backing;        /* enum dnvme_pool_backing of the IO buffers */
+    char *hugetlbfs;
+    uint32_t irq_tune_us;   /* p99 target of the coalescing sweep, 0 = no sweep */
+    uint8_t cq_mode;        /* enum dnvme_cq_mode */
+    int qos;                /* queues per priority class under weighted round robin */
+    struct dnvme_qos_config qos_config;
+    char *trace;            /* binary trace of the measured run, see dnvme-trace */
+    int fill;               /* write 'pattern' instead of whatever the buffers hold */
+    int verify;             /* check reads of blocks this run wrote against 'pattern' */
+    struct dnvme_pattern pattern;
+    struct dnvme_pi_format format;  /* of the namespace; PI is generated and checked along with the pattern */
+    uint64_t *written;      /* one bit per IO sized block of the range, set once a write completed */
+};
+
+struct bench_job;
+
+struct bench_slot {
+    struct bench_job *job;
+    uint8_t *buffer;
+    uint16_t index;
+    uint8_t opcode;
+    uint8_t verify;         /* a read of a block written before it was sent */
+    uint64_t lba;
+};
+
+struct bench_job {
+    const struct bench_options *opts;
+    uint32_t lba_size;
+    uint32_t nlb;           /* LBAs per IO */
+    uint64_t first_lba;     /* sequential slice of this queue */
+    uint64_t blocks;        /* IO sized blocks in the slice */
+    uint64_t next_block;
+    uint64_t range_blocks;  /* IO sized blocks in the whole range */
+    uint64_t rng;
+    uint64_t target;        /* IOs to issue, 0 = time based */
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t elapsed_ns;
+    uint64_t cpu_ns;        /* CPU time of the worker thread */
+    uint64_t verified;      /* reads checked against the pattern */
+    uint64_t mismatched;    /* of them, reads with bad data */
+    uint64_t bad_lba;       /* first bad read and what was wrong with it */
+    struct dnvme_pattern_check bad;
+    struct dnvme_pi_error bad_pi;
+    struct dnvme_lat_hist hist;
+    struct bench_slot *slots;
+    uint16_t *free_slots;
+    uint16_t nr_free;
+};
+
+static uint64_t bench_rand(struct bench_job *job)
+{
+    uint64_t x = job->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    job->rng = x;
+    return x;
+}
+
+static uint64_t bench_block(struct bench_job *job, uint64_t lba)
+{
+    return (lba - job->opts->lba_start)/job->nlb;
+}
+
+/* Reference tag of type 1 PI is the low 32 bits of the LBA; types 2 and 3 take it too. */
+static void bench_tags(uint64_t lba, struct dnvme_pi_tags *tags)
+{
+    tags->ref = lba;
+    tags->app = 0;
+    tags->app_mask = 0xFFFF;
+    tags->check = DNVME_PI_PRCHK_ALL;
+}
+
+static void bench_check(struct bench_job *job, struct bench_slot *slot)
+{
+    const struct bench_options *opts = job->opts;
+    struct dnvme_pattern_check check;
+    struct dnvme_pi_error error;
+    struct dnvme_pi_tags tags;
+    job->verified++;
+    bench_tags(slot->lba, &tags);
+    if (dnvme_pi_verify(&opts->format, &opts->pattern, slot->buffer, NULL, job->nlb, slot->lba, &tags, &error,
+        &check) == SUCCESS)
+        return;
+    if (!job->mismatched++)
+    {
+        job->bad_lba = slot->lba;
+        job->bad = check;
+        job->bad_pi = error;
+    }
+}
+
+static void bench_complete(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    struct bench_slot *slot = ctx;
+    struct bench_job *job = slot->job;
+    const struct bench_options *opts = job->opts;
+    uint64_t block;
+    if (NVME_CQE_STATUS(cqe) != NVME_SC_SUCCESS)
+    {
+        job->errors++;
+    }
+    else
+    {
+        job->bytes += opts->bs;
+        if (opts->verify && slot->opcode == NVME_CMD_WRITE)
+        {
+            block = bench_block(job, slot->lba);
+            __atomic_fetch_or(&opts->written[block/64], 1ULL << (block%64), __ATOMIC_RELAXED);
+        }
+        else if (slot->verify)
+        {
+            bench_check(job, slot);
+        }
+    }
+    dnvme_lat_add(&job->hist, latency_ns);
+    job->completed++;
+    job->free_slots[job->nr_free++] = slot->index;
+}
+
+static void bench_prepare_io(struct bench_job *job, struct bench_slot *slot, struct nvme_io_cmd *cmd, uint8_t *dir)
+{
+    const struct bench_options *opts = job->opts;
+    struct dnvme_pi_tags tags;
+    uint64_t lba, block;
+    uint8_t opcode;
+    if (opts->random)
+    {
+        lba = opts->lba_start + (bench_rand(job) % job->range_blocks)*job->nlb;
+    }
+    else
+    {
+        lba = job->first_lba + job->next_block*job->nlb;
+        job->next_block = (job->next_block+1) % job->blocks;
+    }
+    if (opts->read_pct == 100 || (opts->read_pct && bench_rand(job) % 100 < opts->read_pct))
+    {
+        opcode = NVME_CMD_READ;
+        *dir = DATA_DIR_FROM_DEVICE;
+    }
+    else
+    {
+        opcode = NVME_CMD_WRITE;
+        *dir = DATA_DIR_TO_DEVICE;
+    }
+    /*
+     * The pattern and PI only depend on the LBA, so overlapping writes from
+     * other queues put the same data down and any block marked written must
+     * match. The controller checks the PI of what we write and of what we
+     * read back from blocks we wrote.
+     */
+    slot->opcode = opcode;
+    slot->lba = lba;
+    slot->verify = 0;
+    bench_tags(lba, &tags);
+    if (opcode == NVME_CMD_WRITE && opts->fill)
+        dnvme_pi_generate(&opts->format, &opts->pattern, slot->buffer, NULL, job->nlb, lba, &tags);
+    else if (opcode == NVME_CMD_READ && opts->verify)
+    {
+        block = bench_block(job, lba);
+        slot->verify = (__atomic_load_n(&opts->written[block/64], __ATOMIC_RELAXED) >> (block%64)) & 1;
+    }
+    dnvme_nvm_rw_prepare(cmd, opcode, opts->nsid, lba, job->nlb);
+    if (opts->format.type && (slot->verify || (opcode == NVME_CMD_WRITE && opts->fill)))
+        dnvme_pi_set_tags(cmd, &tags, DNVME_PI_PRCHK_ALL);
+}
+
+static int bench_worker(struct dnvme_queue *queue, void *arg)
+{
+    struct bench_job *job = &((struct bench_job *)arg)[queue->index];
+    const struct bench_options *opts = job->opts;
+    void **ctx = calloc(opts->qd, sizeof(void *));
+    uint64_t start = dnvme_get_time_ns();
+    uint64_t cpu_start = dnvme_thread_cpu_ns();
+    uint64_t deadline = start + (uint64_t)opts->runtime_s*1000000000;
+    struct nvme_io_cmd cmd;
+    uint8_t dir;
+    int stop = 0;
+    int ret = 0;
+
+    if (!ctx)
+        return -ENOMEM;
+    while (ret >= 0)
+    {
+        uint16_t n = 0;
+        if (!stop)
+            stop = job->target ? job->submitted >= job->target : dnvme_get_time_ns() >= deadline;
+        while (!stop && job->nr_free && (!job->target || job->submitted < job->target))
+        {
+            struct bench_slot *slot = &job->slots[job->free_slots[--job->nr_free]];
+            bench_prepare_io(job, slot, &cmd, &dir);
+            dnvme_batch_add_io(&queue->batch, &cmd, slot->buffer, opts->bs, dir);
+            ctx[n++] = slot;
+            job->submitted++;
+        }
+        if (n)
+        {
+            uint16_t submitted = dnvme_queue_submit(queue, bench_complete, ctx, &ret);
+            /* slots that never went out go back unused */
+            for (; submitted<n; submitted++)
+            {
+                job->free_slots[job->nr_free++] = ((struct bench_slot *)ctx[submitted])->index;
+                job->submitted--;
+            }
+            if (ret < 0)
+                break;
+        }
+        if (job->submitted == job->completed)
+        {
+            if (stop)
+                break;
+            continue;
+        }
+        ret = dnvme_queue_wait(queue, 1, 0);
+    }
+    job->elapsed_ns = dnvme_get_time_ns() - start;
+    job->cpu_ns = dnvme_thread_cpu_ns() - cpu_start;
+    free(ctx);
+    if (ret < 0)
+        fprintf(stderr, "queue %d stopped: %s\n", queue->index, strerror(ret == -1 ? errno : -ret));
+    return ret < 0 ? ret : 0;
+}
+
+struct bench_tune {
+    struct dnvme_engine *engine;
+    struct bench_job *jobs;
+};
+
+/* One coalescing trial: the configured workload from a clean slate. */
+static int bench_tune_workload(void *arg, struct dnvme_lat_hist *hist, uint64_t *ios)
+{
+    struct bench_tune *tune = arg;
+    uint16_t i;
+    int ret;
+    for (i=0; i<tune->engine->nr_queues; i++)
+    {
+        struct bench_job *job = &tune->jobs[i];
+        job->submitted = 0;
+        job->completed = 0;
+        job->errors = 0;
+        job->bytes = 0;
+        job->elapsed_ns = 0;
+        job->verified = job->mismatched = 0;
+        dnvme_lat_init(&job->hist);
+    }
+    ret = dnvme_engine_run(tune->engine, bench_worker, tune->jobs);
+    *ios = 0;
+    for (i=0; i<tune->engine->nr_queues; i++)
+    {
+        dnvme_lat_merge(hist, &tune->jobs[i].hist);
+        *ios += tune->jobs[i].completed;
+        if (ret == 0 && tune->jobs[i].errors)
+            ret = -EIO;
+    }
+    return ret;
+}
+
+static int bench_irq_tune(struct dnvme_engine *engine, struct bench_job *jobs, uint32_t target_us)
+{
+    struct bench_tune tune = {
+        .engine = engine,
+        .jobs = jobs,
+    };
+    struct dnvme_irq_tuner tuner = {
+        .fd = engine->fd,
+        .nr_cqs = engine->nr_queues,
+        .target_ns = (uint64_t)target_us*1000,
+        .workload = bench_tune_workload,
+        .arg = &tune,
+    };
+    uint16_t cq_ids[engine->nr_queues];
+    uint32_t i;
+    int ret;
+    for (i=0; i<engine->nr_queues; i++)
+        cq_ids[i] = engine->queues[i].cq_id;
+    tuner.cq_ids = cq_ids;
+    ret = dnvme_irq_tune(&tuner);
+    printf("%-8s %8s %10s %10s %9s %9s %9s\n", "entries", "time(us)", "ios", "irqs", "ios/irq", "p50(us)",
+        "p99(us)");
+    for (i=0; i<tuner.nr_settings && (tuner.trials[i].ios || tuner.trials[i].ret); i++)
+    {
+        const struct dnvme_irq_trial *trial = &tuner.trials[i];
+        if (trial->ret)
+        {
+            printf("%-8d %8d failed: %d\n", trial->setting.entries, trial->setting.time_us, trial->ret);
+            continue;
+        }
+        printf("%-8d %8d %10lu %10lu %9.1f %9.1f %9.1f%s\n", trial->setting.entries, trial->setting.time_us,
+            trial->ios, trial->interrupts, trial->per_irq, trial->p50_ns/1e3, trial->p99_ns/1e3,
+            (int)i == ret ? "  <- chosen" : "");
+    }
+    if (ret == -ERANGE)
+        printf("No coalescing setting kept p99 under %dus, left unchanged\n", target_us);
+    return ret < 0 && ret != -ERANGE ? ret : 0;
+}
+
+static void bench_show(const char *name, const struct dnvme_lat_hist *hist, uint64_t ios, uint64_t bytes,
+    uint64_t errors, uint64_t elapsed_ns, uint64_t cpu_ns)
+{
+    double seconds = elapsed_ns ? elapsed_ns/1e9 : 1;
+    printf("%-9s %10lu %12.0f %10.2f %9.1f %9.1f %9.1f %9.1f %9.1f %6lu %10.2f\n", name, ios, ios/seconds,
+        bytes/seconds/(1024*1024), dnvme_lat_mean(hist)/1e3, dnvme_lat_percentile(hist, 50)/1e3,
+        dnvme_lat_percentile(hist, 99)/1e3, dnvme_lat_percentile(hist, 99.9)/1e3, hist->max_ns/1e3, errors,
+        ios ? cpu_ns/1e3/ios : 0);
+}
+
+static uint64_t bench_parse_size(const char *arg)
+{
+    char *end;
+    uint64_t value = strtoull(arg, &end, 0);
+    switch (*end)
+    {
+    case 'g': case 'G':
+        value <<= 10;
+        /* fall through */
+    case 'm': case 'M':
+        value <<= 10;
+        /* fall through */
+    case 'k': case 'K':
+        value <<= 10;
+        break;
+    }
+    return value;
+}
+
+static int bench_parse_rw(struct bench_options *opts, const char *arg)
+{
+    if (!strcmp(arg, "read") || !strcmp(arg, "randread"))
+        opts->read_pct = 100;
+    else if (!strcmp(arg, "write") || !strcmp(arg, "randwrite"))
+        opts->read_pct = 0;
+    else if (!strcmp(arg, "rw") || !strcmp(arg, "randrw"))
+        opts->read_pct = 50;
+    else
+        return -EINVAL;
+    opts->random = !strncmp(arg, "rand", 4);
+    return 0;
+}
+
+/* "u:h:m:l" queue counts, or "hpw:mpw:lpw[:burst]" weights. */
+static int bench_parse_list(const char *arg, uint32_t *values, int max)
+{
+    char *end;
+    int count = 0;
+    while (count < max)
+    {
+        values[count++] = strtoul(arg, &end, 0);
+        if (*end != ':')
+            break;
+        arg = end+1;
+    }
+    return *end ? -EINVAL : count;
+}
+
+static void bench_usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+        "  --dev=PATH          dnvme device (default " DEVICE_FILE_NAME ")\n"
+        "  --sim               run against the userspace stand-in controller\n"
+        "  --sim-media=MEDIA   ram: keep written data, null: move no data (default ram)\n"
+        "  --sim-read-lat=LAT  simulated read latency, DIST:MEAN_US[:DEV_US] with DIST fixed|uniform|normal|\n"
+        "                      exponential, or MEAN_US (default 0, complete at the doorbell)\n"
+        "  --sim-write-lat=LAT simulated latency of every other IO command, as --sim-read-lat\n"
+        "  --sim-bw=SIZE       simulated data path bandwidth per second (default unlimited)\n"
+        "  --sim-lbaf=FMT      simulated LBA format LBA_SIZE[+META_SIZE[:PI_TYPE[:first]]], e.g. 512+8:1\n"
+        "  --rw=MODE           read|write|rw|randread|randwrite|randrw (default randread)\n"
+        "  --rwmixread=PCT     read percentage for rw/randrw (default 50)\n"
+        "  --bs=SIZE           IO size (default 4k)\n"
+        "  --qd=N              IOs in flight per queue (default 32)\n"
+        "  --queues=N          IO queue pairs, one thread each (default 1)\n"
+        "  --runtime=SEC       run time (default 10)\n"
+        "  --ios=N             total IO count, overrides runtime\n"
+        "  --lba-start=LBA     first LBA of the range (default 0)\n"
+        "  --lba-count=N       LBAs in the range (default rest of namespace)\n"
+        "  --nsid=N            namespace (default 1)\n"
+        "  --pool-cap=SIZE     buffer memory per queue (default unlimited)\n"
+        "  --hugepages=SIZE    back IO buffers with 2m or 1g hugepages, falling back to 4k\n"
+        "  --hugetlbfs=PATH    take hugepages from files on this hugetlbfs mount\n"
+        "  --irq-tune=US       first sweep interrupt coalescing, one full run per setting, and keep the\n"
+        "                      setting with the fewest interrupts whose p99 stays under US\n"
+        "  --cq=MODE           irq|polled|hybrid completion queues (default irq)\n"
+        "  --qos=U:H:M:L       weighted round robin with this many queues per class, overrides --queues\n"
+        "  --arb=H:M:L[:B]     high/medium/low weights and log2 arbitration burst (default 1:1:1:0)\n"
+        "  --trace=PATH        record every command and completion of the measured run to PATH\n"
+        "  --pattern=P[:SEED]  write data pattern fixed|incr|random|lba (default zeroes, lba with --verify)\n"
+        "  --verify            check every read of a block this run wrote against the pattern\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"dev", required_argument, NULL, 'd'},
+        {"sim", no_argument, NULL, 'S'},
+        {"sim-media", required_argument, NULL, 'D'},
+        {"sim-read-lat", required_argument, NULL, 'R'},
+        {"sim-write-lat", required_argument, NULL, 'W'},
+        {"sim-bw", required_argument, NULL, 'B'},
+        {"sim-lbaf", required_argument, NULL, 'L'},
+        {"rw", required_argument, NULL, 'w'},
+        {"rwmixread", required_argument, NULL, 'm'},
+        {"bs", required_argument, NULL, 'b'},
+        {"qd", required_argument, NULL, 'q'},
+        {"queues", required_argument, NULL, 'Q'},
+        {"runtime", required_argument, NULL, 't'},
+        {"ios", required_argument, NULL, 'n'},
+        {"lba-start", required_argument, NULL, 's'},
+        {"lba-count", required_argument, NULL, 'c'},
+        {"nsid", required_argument, NULL, 'N'},
+        {"pool-cap", required_argument, NULL, 'P'},
+        {"hugepages", required_argument, NULL, 'H'},
+        {"hugetlbfs", required_argument, NULL, 'F'},
+        {"irq-tune", required_argument, NULL, 'I'},
+        {"cq", required_argument, NULL, 'M'},
+        {"qos", required_argument, NULL, 'C'},
+        {"arb", required_argument, NULL, 'A'},
+        {"trace", required_argument, NULL, 'T'},
+        {"pattern", required_argument, NULL, 'p'},
+        {"verify", no_argument, NULL, 'V'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct bench_options opts = {
+        .dev = DEVICE_FILE_NAME,
+        .random = 1,
+        .read_pct = 100,
+        .bs = 4096,
+        .qd = 32,
+        .queues = 1,
+        .runtime_s = 10,
+        .nsid = 1,
+        .pattern = {.type = DNVME_PATTERN_LBA},
+    };
+    struct dnvme_engine_config config = {0};
+    struct dnvme_engine plain;
+    struct dnvme_engine *engine = &plain;
+    struct dnvme_qos qos;
+    struct dnvme_xfer_limits limits;
+    struct bench_job *jobs;
+    struct dnvme_lat_hist total;
+    uint32_t list[DNVME_QOS_CLASSES];
+    uint32_t mix = 0;
+    uint32_t lba_size = 0;
+    uint64_t nsze = 0;
+    uint64_t ios = 0, bytes = 0, errors = 0, elapsed = 0, cpu = 0, polls = 0, reaps = 0, sleeps = 0;
+    uint64_t verified = 0, mismatched = 0;
+    struct bench_job *bad = NULL;
+    char name[64];
+    uint16_t i, j;
+    int fd, opt, ret;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': opts.dev = optarg; break;
+        case 'S': opts.sim = 1; break;
+        case 'D':
+            if (!strcmp(optarg, "ram"))
+                opts.sim_config.media = DNVME_SIM_MEDIA_RAM;
+            else if (!strcmp(optarg, "null"))
+                opts.sim_config.media = DNVME_SIM_MEDIA_NULL;
+            else
+            {
+                fprintf(stderr, "Unknown simulator media: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'R':
+        case 'W':
+            if (dnvme_sim_parse_latency(optarg, opt == 'R' ? &opts.sim_config.read : &opts.sim_config.write))
+            {
+                fprintf(stderr, "Bad simulator latency: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'B': opts.sim_config.bandwidth = bench_parse_size(optarg); break;
+        case 'L':
+            if (dnvme_sim_parse_format(optarg, &opts.sim_config))
+            {
+                fprintf(stderr, "Bad simulator LBA format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'w':
+            if (bench_parse_rw(&opts, optarg))
+            {
+                fprintf(stderr, "Unknown rw mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'm': mix = strtoul(optarg, NULL, 0); break;
+        case 'b': opts.bs = bench_parse_size(optarg); break;
+        case 'q': opts.qd = strtoul(optarg, NULL, 0); break;
+        case 'Q': opts.queues = strtoul(optarg, NULL, 0); break;
+        case 't': opts.runtime_s = strtoul(optarg, NULL, 0); break;
+        case 'n': opts.ios = strtoull(optarg, NULL, 0); break;
+        case 's': opts.lba_start = strtoull(optarg, NULL, 0); break;
+        case 'c': opts.lba_count = strtoull(optarg, NULL, 0); break;
+        case 'N': opts.nsid = strtoul(optarg, NULL, 0); break;
+        case 'P': opts.pool_cap = bench_parse_size(optarg); break;
+        case 'H':
+            if (bench_parse_size(optarg) == DNVME_POOL_SLAB_SIZE)
+                opts.backing = DNVME_BACKING_2M;
+            else if (bench_parse_size(optarg) == 1UL << 30)
+                opts.backing = DNVME_BACKING_1G;
+            else if (bench_parse_size(optarg) != 4096)
+            {
+                fprintf(stderr, "Unsupported hugepage size: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'F': opts.hugetlbfs = optarg; break;
+        case 'I': opts.irq_tune_us = strtoul(optarg, NULL, 0); break;
+        case 'M':
+            for (opts.cq_mode=0; opts.cq_mode<DNVME_CQ_MODES; opts.cq_mode++)
+            {
+                if (!strcmp(optarg, dnvme_cq_mode_name(opts.cq_mode)))
+                    break;
+            }
+            if (opts.cq_mode == DNVME_CQ_MODES)
+            {
+                fprintf(stderr, "Unknown completion queue mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'C':
+            if (bench_parse_list(optarg, list, DNVME_QOS_CLASSES) != DNVME_QOS_CLASSES)
+            {
+                fprintf(stderr, "--qos takes four queue counts: %s\n", optarg);
+                return -1;
+            }
+            opts.qos = 1;
+            for (opts.queues=0, i=0; i<DNVME_QOS_CLASSES; i++)
+            {
+                opts.qos_config.queues[i] = list[i];
+                opts.queues += list[i];
+            }
+            break;
+        case 'A':
+            ret = bench_parse_list(optarg, list, 4);
+            if (ret < 3)
+            {
+                fprintf(stderr, "--arb takes three weights and an optional burst: %s\n", optarg);
+                return -1;
+            }
+            opts.qos_config.arb.hpw = list[0];
+            opts.qos_config.arb.mpw = list[1];
+            opts.qos_config.arb.lpw = list[2];
+            opts.qos_config.arb.burst = ret > 3 ? list[3] : 0;
+            break;
+        case 'T': opts.trace = optarg; break;
+        case 'p':
+            if (dnvme_pattern_parse(optarg, &opts.pattern))
+            {
+                fprintf(stderr, "Unknown data pattern: %s\n", optarg);
+                return -1;
+            }
+            opts.fill = 1;
+            break;
+        case 'V': opts.verify = opts.fill = 1; break;
+        default:
+            bench_usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (mix && opts.read_pct == 50)
+        opts.read_pct = mix > 100 ? 100 : mix;
+    if (opts.qd == 0 || opts.queues == 0 || opts.bs == 0)
+    {
+        bench_usage(argv[0]);
+        return -1;
+    }
+
+    if (opts.sim)
+    {
+        dnvme_sim_configure(&opts.sim_config);
+        ioctl_set_backend(&dnvme_sim_backend);
+        opts.dev = DNVME_SIM_PATH;
+    }
+    fd = open_dev(opts.dev);
+    if (fd < 0)
+    {
+        printf("Can't open device: %s\n", opts.dev);
+        return -1;
+    }
+    ret = init_drive(fd);
+    if (ret)
+    {
+        printf("Init drive failed: %d\n", ret);
+        return ret;
+    }
+    ret = dnvme_xfer_get_limits(fd, opts.nsid, &limits);
+    if (ret == 0)
+        ret = dnvme_pi_get_format(fd, opts.nsid, &opts.format);
+    if (ret)
+    {
+        printf("Identify namespace %d failed: %d\n", opts.nsid, ret);
+        return ret;
+    }
+    lba_size = limits.lba_size;
+    nsze = limits.nsze;
+    if (opts.bs % lba_size || opts.bs/lba_size > limits.max_lbas)
+    {
+        printf("Block size %d must be a multiple of the %d byte LBA and at most %d LBAs\n", opts.bs, lba_size,
+            limits.max_lbas);
+        return -1;
+    }
+    if (opts.lba_count == 0 || opts.lba_start + opts.lba_count > nsze)
+        opts.lba_count = nsze > opts.lba_start ? nsze - opts.lba_start : 0;
+    if (opts.lba_count < (uint64_t)opts.queues*opts.bs/lba_size)
+    {
+        printf("LBA range too small for %d queues of %d byte IOs\n", opts.queues, opts.bs);
+        return -1;
+    }
+    if (opts.fill && opts.format.ms && !opts.format.extended)
+    {
+        printf("Namespace %d keeps metadata in a separate buffer, which bench IOs do not carry\n", opts.nsid);
+        return -1;
+    }
+    opts.pattern.lba_size = opts.format.lba_size;
+    if (opts.verify)
+    {
+        opts.written = calloc((opts.lba_count/(opts.bs/lba_size) + 63)/64, sizeof(uint64_t));
+        if (!opts.written)
+            return -ENOMEM;
+    }
+
+    config.nr_queues = opts.queues;
+    config.qdepth = opts.qd+1;
+    config.contig = 1;
+    config.max_io_size = opts.bs;
+    config.pool_cap = opts.pool_cap;
+    config.backing = opts.backing;
+    config.hugetlbfs = opts.hugetlbfs;
+    config.cq_mode = opts.cq_mode;
+    if (opts.qos)
+    {
+        opts.qos_config.engine = config;
+        ret = dnvme_qos_init(&qos, fd, &opts.qos_config);
+        if (ret == 0)
+        {
+            engine = &qos.engine;
+            printf("Weighted round robin: HPW %d MPW %d LPW %d, burst %d\n", qos.arb.hpw, qos.arb.mpw, qos.arb.lpw,
+                1 << qos.arb.burst);
+        }
+    }
+    else
+    {
+        ret = dnvme_engine_init(&plain, fd, &config);
+    }
+    if (ret)
+    {
+        printf("Engine init failed: %d\n", ret);
+        return ret;
+    }
+    if (engine->nr_queues < opts.queues)
+        printf("Controller granted %d of %d queues\n", engine->nr_queues, opts.queues);
+    if (engine->queues[0].depth-1 < opts.qd)
+        opts.qd = engine->queues[0].depth-1;
+
+    jobs = calloc(engine->nr_queues, sizeof(struct bench_job));
+    if (!jobs)
+        return -ENOMEM;
+    for (i=0; i<engine->nr_queues; i++)
+    {
+        struct bench_job *job = &jobs[i];
+        job->opts = &opts;
+        job->lba_size = lba_size;
+        job->nlb = opts.bs/lba_size;
+        job->range_blocks = opts.lba_count/job->nlb;
+        job->blocks = job->range_blocks/engine->nr_queues;
+        job->first_lba = opts.lba_start + (uint64_t)i*job->blocks*job->nlb;
+        job->rng = 0x9E3779B97F4A7C15ULL*(i+1);
+        if (opts.ios)
+            job->target = opts.ios/engine->nr_queues + (i < opts.ios%engine->nr_queues);
+        dnvme_lat_init(&job->hist);
+        job->slots = calloc(opts.qd, sizeof(struct bench_slot));
+        job->free_slots = calloc(opts.qd, sizeof(uint16_t));
+        if (!job->slots || !job->free_slots)
+            return -ENOMEM;
+        for (j=0; j<opts.qd; j++)
+        {
+            job->slots[j].job = job;
+            job->slots[j].index = j;
+            job->slots[j].buffer = dnvme_pool_alloc(engine->queues[i].pool, opts.bs);
+            if (!job->slots[j].buffer)
+            {
+                printf("Queue %d: no buffer for slot %d, pool cap too small?\n", engine->queues[i].sq_id, j);
+                return -ENOMEM;
+            }
+            memset(job->slots[j].buffer, 0, opts.bs);
+            job->free_slots[job->nr_free++] = j;
+        }
+    }
+
+    printf("%s: %s %d%% read, bs %d, qd %d, %d %s queue(s), LBA %lu+%lu, %s buffers\n",
+        opts.sim ? "simulator" : opts.dev, opts.random ? "random" : "sequential", opts.read_pct, opts.bs, opts.qd,
+        engine->nr_queues, dnvme_cq_mode_name(opts.cq_mode), opts.lba_start, opts.lba_count,
+        dnvme_pool_backing_name(dnvme_pool_backing_of(jobs[0].slots[0].buffer)));
+    if (opts.irq_tune_us)
+    {
+        ret = bench_irq_tune(engine, jobs, opts.irq_tune_us);
+        if (ret)
+            printf("Interrupt coalescing sweep failed: %d\n", ret);
+        for (i=0; i<engine->nr_queues; i++)
+        {
+            jobs[i].submitted = jobs[i].completed = jobs[i].errors = jobs[i].bytes = 0;
+            jobs[i].verified = jobs[i].mismatched = 0;
+            dnvme_lat_init(&jobs[i].hist);
+        }
+    }
+    for (i=0; i<engine->nr_queues; i++)
+        engine->queues[i].polls = engine->queues[i].reaps = engine->queues[i].sleeps = 0;
+    if (opts.trace)
+    {
+        ret = dnvme_trace_start(opts.trace, 0);
+        if (ret)
+            printf("Trace to %s failed: %d\n", opts.trace, ret);
+    }
+    ret = dnvme_engine_run(engine, bench_worker, jobs);
+    if (opts.trace && dnvme_trace_stop() == SUCCESS)
+    {
+        struct dnvme_trace_stats stats;
+        dnvme_trace_get_stats(&stats);
+        printf("Trace %s: %lu records from %d thread(s), %lu dropped\n", opts.trace, stats.records, stats.rings,
+            stats.dropped);
+    }
+
+    printf("%-9s %10s %12s %10s %9s %9s %9s %9s %9s %6s %10s\n", "queue", "ios", "IOPS", "MiB/s", "mean(us)",
+        "p50(us)", "p99(us)", "p99.9(us)", "max(us)", "errors", "cpu/io(us)");
+    dnvme_lat_init(&total);
+    for (i=0; i<engine->nr_queues; i++)
+    {
+        struct bench_job *job = &jobs[i];
+        char name[16];
+        if (opts.qos)
+            snprintf(name, sizeof(name), "%d/%s", engine->queues[i].sq_id,
+                dnvme_qos_class_name(dnvme_qos_class_of(&qos, &engine->queues[i])));
+        else
+            snprintf(name, sizeof(name), "%d", engine->queues[i].sq_id);
+        bench_show(name, &job->hist, job->completed, job->bytes, job->errors, job->elapsed_ns, job->cpu_ns);
+        dnvme_lat_merge(&total, &job->hist);
+        cpu += job->cpu_ns;
+        polls += engine->queues[i].polls;
+        reaps += engine->queues[i].reaps;
+        sleeps += engine->queues[i].sleeps;
+        ios += job->completed;
+        bytes += job->bytes;
+        errors += job->errors;
+        verified += job->verified;
+        mismatched += job->mismatched;
+        if (job->mismatched && !bad)
+            bad = job;
+        if (job->elapsed_ns > elapsed)
+            elapsed = job->elapsed_ns;
+        for (j=0; j<opts.qd; j++)
+            free_buffer(job->slots[j].buffer);
+        free(job->slots);
+        free(job->free_slots);
+    }
+    bench_show("total", &total, ios, bytes, errors, elapsed, cpu);
+    printf("%s completion: %.2f reaps, %.2f inquiries and %.2f sleeps per IO\n", dnvme_cq_mode_name(opts.cq_mode),
+        ios ? (double)reaps/ios : 0, ios ? (double)polls/ios : 0, ios ? (double)sleeps/ios : 0);
+    if (opts.fill)
+        printf("Data pattern %s seed 0x%lx, %s\n", dnvme_pattern_name(opts.pattern.type), opts.pattern.seed,
+            dnvme_pattern_isa());
+    if (opts.fill && opts.format.type)
+        printf("LBA format %s, guard %s\n", dnvme_pi_format_name(&opts.format, name, sizeof(name)), dnvme_pi_isa());
+    if (opts.verify)
+    {
+        printf("verify: %lu reads checked, %lu mismatched\n", verified, mismatched);
+        if (bad && bad->bad.mismatches)
+            printf("First bad read: LBA %lu, %lu bad bytes from offset %lu, expected 0x%08x got 0x%08x\n",
+                bad->bad_lba, bad->bad.mismatches, bad->bad.offset, bad->bad.expected, bad->bad.actual);
+        if (bad && bad->bad_pi.status)
+            printf("First bad PI: LBA %lu, %s, expected 0x%x got 0x%x\n", bad->bad_lba + bad->bad_pi.index,
+                dnvme_status_name(bad->bad_pi.status), bad->bad_pi.expected, bad->bad_pi.actual);
+        if (mismatched && ret == 0)
+            ret = -EIO;
+    }
+    for (i=0; i<engine->nr_queues; i++)
+        dnvme_pool_report(engine->queues[i].pool);
+    free(opts.written);
+    free(jobs);
+    dnvme_engine_destroy(engine);
+    close_dev(fd);
+    return ret;
+}
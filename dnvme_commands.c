@@ -12,45 +12,60 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <dnvme.h>
 #include "dnvme_commands.h"
 #include "dnvme_ioctrl.h"
-
+#include "dnvme_pool.h"
+#include "dnvme_bar.h"
+#include "dnvme_regcache.h"
+#include "dnvme_pci.h"
+#include "dnvme_ctrlstate.h"
+#include "dnvme_trace.h"
+
+static struct dnvme_wait_policy wait_policy = {
+    .spin_ns = DNVME_WAIT_SPIN_NS,
+    .min_sleep_ns = DNVME_WAIT_MIN_SLEEP_NS,
+    .max_sleep_ns = DNVME_WAIT_MAX_SLEEP_NS,
+};
+
+/* Open 'dev' on the current backend, see ioctl_set_backend(). */
 int open_dev(char *dev)
 {
-    int err, fd;
-    struct stat nvme_stat;
-    //char *devicename = basename(dev);
-    err = open(dev, O_RDONLY);
-    if (err < 0)
-    {
-        perror(dev);
-        return err;
-    }
-    fd = err;
-    err = fstat(fd, &nvme_stat);
-    if (err < 0)
+    int fd = ioctl_get_backend()->open(dev);
+    if (fd < 0)
     {
-        perror(dev);
-        return err;
-    }
-    if (!S_ISCHR(nvme_stat.st_mode) && !S_ISBLK(nvme_stat.st_mode)) {
-        fprintf(stderr, "%s is not a block or character device\n", dev);
-        return -ENODEV;
+        fprintf(stderr, "%s: %s\n", dev, fd == -ENODEV ? "not a dnvme controller" : strerror(-fd));
+        return fd;
     }
+    if (dnvme_trace_start_env())
+        fprintf(stderr, "Can't trace to %s\n", getenv("DNVME_TRACE"));
     return fd;
 }
 
+/* Drop what the library keeps per fd, then hand the fd back to the backend that opened it. */
+void close_dev(int fd)
+{
+    dnvme_regcache_release(fd);
+    dnvme_pci_release(fd);
+    dnvme_bar_unmap(fd);
+    ioctl_get_backend()->close(fd);
+}
+
+/* The driver programs AQA/ASQ/ACQ, so their shadow copies go stale. */
 int dnvme_create_admin_cq(int fd)
 {
+    dnvme_regcache_written(fd, NVME_REG_AQA, NVME_REG_CMBLOC-NVME_REG_AQA);
     return ioctl_create_admin_cq(fd);
 }
 
 int dnvme_create_admin_sq(int fd)
 {
+    dnvme_regcache_written(fd, NVME_REG_AQA, NVME_REG_CMBLOC-NVME_REG_AQA);
     return ioctl_create_admin_sq(fd);
 }
 
@@ -63,10 +78,10 @@ int dnvme_set_irq(int fd, uint16_t num_irqs, enum nvme_irq_type irq_type)
     return ioctl_set_irq(fd, &irqs);
 }
 
+/* Buffers come from the calling thread's pool, see dnvme_pool_set_thread(). */
 int malloc_4k_aligned_buffer(void **buffer, uint32_t element_size, uint32_t elements)
 {
-    *buffer = NULL;
-    posix_memalign(buffer, 4096, element_size*elements);
+    *buffer = dnvme_pool_alloc(dnvme_pool_thread(), element_size*elements);
     if (*buffer)
     {
         return SUCCESS;
@@ -109,18 +124,26 @@ void set_data(void* buffer, int buffer_len, int index, uint8_t value)
 
 void free_buffer(void* buffer)
 {
-    if (buffer != NULL)
-    {
-        free(buffer);
-        buffer = NULL;
-    }
+    dnvme_pool_free(buffer);
 }
 
-int init_drive(int fd)
-{
+/*
+ * Bring the controller up with arbitration mechanism 'ams' (NVME_CC_AMS_*).
+ * CC.AMS may only change while the controller is disabled, so picking WRR
+ * means going through a full reset; IO queues that existed are gone.
+ */
+int dnvme_init_drive_arbitration(int fd, uint32_t ams, struct dnvme_init_stats *stats)
+{
+    struct dnvme_ctrl_sm sm;
+    uint64_t start = dnvme_get_time_ns();
+    uint64_t t;
     uint16_t msix_cap = dnvme_pcie_msix_capability(fd);
     uint16_t msix_entry_count = dnvme_pcie_msix_get_entry_count(fd, msix_cap);
-    int ret = dnvme_controller_disable(fd);
+    int ret;
+    t = dnvme_get_time_ns();
+    ret = dnvme_controller_disable(fd);
+    if (stats)
+        stats->disable_ns = dnvme_get_time_ns() - t;
     if (ret)
         return DISABLE_CONTROLLER_ERROR;
     ret = dnvme_set_irq(fd, msix_entry_count, INT_MSIX);
@@ -132,32 +155,116 @@ int init_drive(int fd)
     ret = dnvme_create_admin_sq(fd);
     if (ret)
         return CREATE_ADMIN_SQ_ERROR;
-    ret = dnvme_controller_enable(fd);
+    ret = dnvme_controller_set_arbitration(fd, ams);
+    if (ret)
+        return ret == -EOPNOTSUPP ? ARBITRATION_ERROR : ENABLE_CONTROLLER_ERROR;
+    /* MSI-X is a function setting, so it is switched on while CSTS.RDY is pending. */
+    dnvme_ctrl_sm_init(&sm, fd);
+    ret = dnvme_ctrl_start(&sm, DNVME_CTRL_ENABLE);
+    if (ret == SUCCESS || ret == -EINPROGRESS)
+    {
+        dnvme_pcie_msix_enable(fd, msix_cap);
+        ret = dnvme_ctrl_wait(&sm);
+    }
+    if (stats)
+        stats->enable_ns = sm.last_ns[DNVME_CTRL_ENABLE];
     if (ret)
         return ENABLE_CONTROLLER_ERROR;
-    dnvme_pcie_msix_enable(fd, msix_cap);
-    ioctl_device_metrics(fd);
+    dnvme_controller_cache_regs(fd);
+    if (stats)
+        stats->total_ns = dnvme_get_time_ns() - start;
     return SUCCESS;
 }
 
+/* Bring the controller up from any state; 'stats' (may be NULL) gets the time of each CC.EN transition. */
+int dnvme_init_drive_timed(int fd, struct dnvme_init_stats *stats)
+{
+    return dnvme_init_drive_arbitration(fd, NVME_CC_AMS_RR, stats);
+}
+
+int init_drive(int fd)
+{
+    int ret = dnvme_init_drive_timed(fd, NULL);
+    if (ret == SUCCESS)
+        ioctl_device_metrics(fd);
+    return ret;
+}
+
 int dnvme_ring_doorbell(int fd, uint16_t sq_id)
 {
     return ioctl_ring_doorbell(fd, sq_id);
 }
 
+/* One slot always stays empty so a full SQ can be told apart from an empty one. */
+int dnvme_sq_free_slots(int fd, uint16_t sq_id)
+{
+    struct nvme_gen_sq sq;
+    uint32_t used;
+    int ret = ioctl_get_sq_metrics(fd, sq_id, &sq);
+    if (ret < 0)
+        return ret;
+    if (sq.elements == 0)
+        return -EINVAL;
+    used = (sq.tail_ptr_virt + sq.elements - sq.head_ptr) % sq.elements;
+    return sq.elements - 1 - used;
+}
+
+uint64_t dnvme_get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* User plus system CPU time the calling thread has consumed. */
+uint64_t dnvme_thread_cpu_ns(void)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage))
+        return 0;
+    return ((uint64_t)usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)*1000000000 +
+        ((uint64_t)usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)*1000;
+}
+
 /************************************* Register commands ************************************/
 int dnvme_controller_enable(int fd)
 {
-    return ioctl(fd, NVME_IOCTL_DEVICE_STATE, ST_ENABLE);
+    dnvme_regcache_invalidate(fd);
+    return ioctl_device_state(fd, ST_ENABLE);
 }
 
 int dnvme_controller_disable(int fd)
 {
-    return ioctl(fd, NVME_IOCTL_DEVICE_STATE, ST_DISABLE);
+    dnvme_regcache_invalidate(fd);
+    return ioctl_device_state(fd, ST_DISABLE);
 }
 
-int dnvme_controller_reg_read_block(int fd, uint32_t offset, uint32_t bytes, uint8_t *data)
+/* Select the arbitration mechanism for the next enable; CAP.AMS must offer it and CC.EN must be 0. */
+int dnvme_controller_set_arbitration(int fd, uint32_t ams)
+{
+    uint64_t cap = dnvme_controller_get_cap(fd);
+    uint32_t cc;
+    int ret;
+    if ((ams & ~NVME_CC_AMS_MASK) ||
+        (ams == NVME_CC_AMS_WRRU && !(NVME_CAP_AMS(cap) & 1)) ||
+        (ams == NVME_CC_AMS_VS && !(NVME_CAP_AMS(cap) & 2)) ||
+        (ams != NVME_CC_AMS_RR && ams != NVME_CC_AMS_WRRU && ams != NVME_CC_AMS_VS))
+        return -EOPNOTSUPP;
+    ret = dnvme_controller_reg_read_dword(fd, NVME_REG_CC, &cc);
+    if (ret)
+        return ret;
+    if (cc & NVME_CC_ENABLE)
+        return -EBUSY;
+    if ((cc & NVME_CC_AMS_MASK) == ams)
+        return SUCCESS;
+    cc = (cc & ~NVME_CC_AMS_MASK) | ams;
+    return dnvme_controller_reg_write_dword(fd, NVME_REG_CC, &cc);
+}
+
+/* Register access goes through the mapped BAR when one is active, see dnvme_bar_map(). */
+static int dnvme_controller_reg_fetch(int fd, uint32_t offset, uint32_t bytes, uint8_t *data)
 {
+    struct dnvme_bar *bar = dnvme_bar_get(fd);
     struct rw_generic read_param = {
         .type = NVMEIO_BAR01,
         .offset = offset,
@@ -165,7 +272,26 @@ int dnvme_controller_reg_read_block(int fd, uint32_t offset, uint32_t bytes, uin
         .acc_type = BYTE_LEN,
         .buffer = data,
     };
-    return ioctl(fd, NVME_IOCTL_READ_GENERIC, &read_param);
+    int ret;
+    if (!bar)
+        return ioctl_read_generic(fd, &read_param);
+    ret = dnvme_bar_read(bar, offset, bytes, data);
+    dnvme_bar_put(bar);
+    return ret;
+}
+
+/* Reads inside the register block are served by the shadow cache once dnvme_controller_cache_regs() ran. */
+int dnvme_controller_reg_read_block(int fd, uint32_t offset, uint32_t bytes, uint8_t *data)
+{
+    int ret = dnvme_regcache_read(fd, offset, bytes, data, dnvme_controller_reg_fetch);
+    if (ret != -ENOENT)
+        return ret;
+    return dnvme_controller_reg_fetch(fd, offset, bytes, data);
+}
+
+int dnvme_controller_cache_regs(int fd)
+{
+    return dnvme_regcache_init(fd, dnvme_controller_reg_fetch);
 }
 
 int dnvme_controller_reg_read_byte(int fd, uint32_t offset, uint8_t *data)
@@ -185,6 +311,7 @@ int dnvme_controller_reg_read_dword(int fd, uint32_t offset, uint32_t *data)
 
 int dnvme_controller_reg_write_block(int fd, uint32_t offset, uint32_t bytes, uint8_t *data)
 {
+    struct dnvme_bar *bar = dnvme_bar_get(fd);
     struct rw_generic write_param = {
         .type = NVMEIO_BAR01,
         .offset = offset,
@@ -192,7 +319,16 @@ int dnvme_controller_reg_write_block(int fd, uint32_t offset, uint32_t bytes, ui
         .acc_type = BYTE_LEN,
         .buffer = data,
     };
-    return ioctl(fd, NVME_IOCTL_WRITE_GENERIC, &write_param);
+    int ret;
+    if (bar)
+    {
+        ret = dnvme_bar_write(bar, offset, bytes, data);
+        dnvme_bar_put(bar);
+    }
+    else
+        ret = ioctl_write_generic(fd, &write_param);
+    dnvme_regcache_written(fd, offset, bytes);
+    return ret;
 }
 
 int dnvme_controller_reg_write_byte(int fd, uint32_t offset, uint8_t *data)
@@ -219,6 +355,40 @@ uint32_t dnvme_controller_get_ctrl_status(int fd)
     return cc;
 }
 
+uint64_t dnvme_controller_get_cap(int fd)
+{
+    uint64_t cap = 0;
+    int ret = dnvme_controller_reg_read_block(fd, NVME_REG_CAP, 8, (uint8_t *)&cap);
+    if (ret)
+        return 0;
+    return cap;
+}
+
+/* CAP.TO is reported in 500ms units; a zero value is treated as one unit. */
+uint32_t dnvme_controller_get_timeout_ms(int fd)
+{
+    uint32_t timeout = NVME_CAP_TIMEOUT(dnvme_controller_get_cap(fd));
+    if (timeout == 0)
+        timeout = 1;
+    return timeout*500;
+}
+
+/* MDTS in bytes from Identify Controller, 0 = no limit or unknown. Uses the admin queue. */
+uint32_t dnvme_controller_get_max_transfer(int fd)
+{
+    uint64_t cap = dnvme_controller_get_cap(fd);
+    struct nvme_id_ctrl *ctrl = create_buffer(sizeof(struct nvme_id_ctrl), 1);
+    struct nvme_completion cqe;
+    uint64_t bytes = 0;
+    if (!ctrl)
+        return 0;
+    if (dnvme_admin_identify_ctrl(fd, 0, 0, 0, (uint8_t *)ctrl) == 0 && dnvme_admin_complete(fd, &cqe) == 0 &&
+        NVME_CQE_STATUS(&cqe) == NVME_SC_SUCCESS && ctrl->mdts)
+        bytes = ((uint64_t)4096 << NVME_CAP_MPSMIN(cap)) << ctrl->mdts;
+    free_buffer(ctrl);
+    return bytes > UINT32_MAX ? UINT32_MAX : bytes;
+}
+
 int dnvme_pcie_capability_read_block(int fd, uint32_t offset, uint32_t bytes, uint8_t *data)
 {
     struct rw_generic read_param = {
@@ -228,7 +398,7 @@ int dnvme_pcie_capability_read_block(int fd, uint32_t offset, uint32_t bytes, ui
         .acc_type = BYTE_LEN,
         .buffer = data,
     };
-    return ioctl(fd, NVME_IOCTL_READ_GENERIC, &read_param);
+    return ioctl_read_generic(fd, &read_param);
 }
 
 int dnvme_pcie_capability_read_byte(int fd, uint32_t offset, uint8_t *data)
@@ -255,7 +425,10 @@ int dnvme_pcie_capability_write_block(int fd, uint32_t offset, uint32_t bytes, u
         .acc_type = BYTE_LEN,
         .buffer = data,
     };
-    return ioctl(fd, NVME_IOCTL_WRITE_GENERIC, &write_param);
+    int ret = ioctl_write_generic(fd, &write_param);
+    if (ret == 0)
+        dnvme_pci_written(fd, offset, bytes, data);
+    return ret;
 }
 
 int dnvme_pcie_capability_write_byte(int fd, uint32_t offset, uint8_t *data)
@@ -273,10 +446,25 @@ int dnvme_pcie_capability_write_dword(int fd, uint32_t offset, uint32_t *data)
     return dnvme_pcie_capability_write_block(fd, offset, 4, (uint8_t *)data);
 }
 
+/* Snapshot the configuration space so capability lookups stop costing config cycles. */
+int dnvme_pcie_capability_snapshot(int fd)
+{
+    return dnvme_pci_snapshot(fd, dnvme_pcie_capability_read_block);
+}
+
+static const struct dnvme_pci_config *dnvme_pcie_config(int fd)
+{
+    const struct dnvme_pci_config *cfg = dnvme_pci_get(fd);
+    if (!cfg && dnvme_pcie_capability_snapshot(fd) == 0)
+        cfg = dnvme_pci_get(fd);
+    return cfg;
+}
+
+/* Offset of the MSI-X capability, 0 when the function has none. */
 uint16_t dnvme_pcie_msix_capability(int fd)
 {
-    uint16_t offset = 0x50;
-    return offset;
+    const struct dnvme_pci_config *cfg = dnvme_pcie_config(fd);
+    return cfg ? dnvme_pci_find_cap(cfg, PCI_CAP_ID_MSIX) : 0;
 }
 
 uint16_t dnvme_pcie_msix_get_ctrl(int fd, uint16_t msix_cap)
@@ -295,18 +483,26 @@ void dnvme_pcie_msix_set_ctrl(int fd, uint16_t msix_cap, uint16_t value)
         exit(-1);
 }
 
+/* Table Size is read only, so it comes from the snapshot when 'msix_cap' is the indexed one. */
 uint16_t dnvme_pcie_msix_get_entry_count(int fd, uint16_t msix_cap)
 {
-    uint16_t msix_ctrl = dnvme_pcie_msix_get_ctrl(fd, msix_cap);
-    uint16_t msix_entry_count = (msix_ctrl&0x3F)+1;
-    return msix_entry_count;
+    const struct dnvme_pci_config *cfg = dnvme_pcie_config(fd);
+    uint16_t msix_ctrl;
+    if (!msix_cap)
+        return 0;
+    if (cfg && dnvme_pci_find_cap(cfg, PCI_CAP_ID_MSIX) == msix_cap)
+        return dnvme_pci_msix_table_size(cfg);
+    msix_ctrl = dnvme_pcie_msix_get_ctrl(fd, msix_cap);
+    return (msix_ctrl&0x7FF)+1;
 }
 
 void dnvme_pcie_msix_enable(int fd, uint16_t msix_cap)
 {
-    uint16_t msix_ctrl = dnvme_pcie_msix_get_ctrl(fd, msix_cap);
-    uint16_t value = msix_ctrl|0x80;
-    dnvme_pcie_msix_set_ctrl(fd, msix_cap, value);
+    uint16_t msix_ctrl;
+    if (!msix_cap)
+        return;
+    msix_ctrl = dnvme_pcie_msix_get_ctrl(fd, msix_cap);
+    dnvme_pcie_msix_set_ctrl(fd, msix_cap, msix_ctrl|0x8000);
 }
 
 /************************************** Admin commands **************************************/
@@ -319,6 +515,20 @@ int dnvme_admin_create_iocq(
     uint16_t qsize,
     uint8_t contig,
     void *buffer)
+{
+    return dnvme_admin_create_iocq_irq(fd, nsid, cq_id, 1, int_no, qsize, contig, buffer);
+}
+
+/* 'int_en' 0 creates a CQ that never raises an interrupt and has to be polled; 'int_no' is ignored then. */
+int dnvme_admin_create_iocq_irq(
+    int fd,
+    uint32_t nsid,
+    uint16_t cq_id,
+    uint8_t int_en,
+    uint16_t int_no,
+    uint16_t qsize,
+    uint8_t contig,
+    void *buffer)
 {
     struct nvme_admin_cmd cmd = {
         .opcode = NVME_ADMIN_CREATE_IOCQ,
@@ -327,8 +537,8 @@ int dnvme_admin_create_iocq(
         //.prp1 = (uint64_t)buffer,
         .cdw10.create_iocq.qid = cq_id,
         .cdw10.create_iocq.qsize = qsize,
-        .cdw11.create_iocq.int_en = 1,
-        .cdw11.create_iocq.int_no = int_no,
+        .cdw11.create_iocq.int_en = int_en ? 1 : 0,
+        .cdw11.create_iocq.int_no = int_en ? int_no : 0,
         .cdw11.create_iocq.contig= contig,
     };
     int ret = ioctl_create_iocq(fd, &cmd, buffer);
@@ -514,6 +724,139 @@ int dnvme_get_power_state(int fd, uint32_t nsid, uint8_t select)
         dw13.value, dw14.value, dw15.value, NULL, 0);
 }
 
+/*
+ * Number of Queues values are 0's based both in DW11 and in the completion
+ * DW0. A controller that refuses the set (it may only be set once after a
+ * reset) is asked for the current allocation instead.
+ */
+int dnvme_admin_set_num_queues(int fd, uint16_t nr_sq, uint16_t nr_cq, uint16_t *granted_sq, uint16_t *granted_cq)
+{
+    struct nvme_completion cqe;
+    union dw11_u dw11 = {
+        .feature.noq.num_sq = nr_sq-1,
+        .feature.noq.num_cq = nr_cq-1,
+    };
+    int ret = dnvme_admin_set_feature(fd, 0, NVME_FEATURE_NUM_QUEUES, 0, dw11.value, 0, 0, 0, 0, NULL, 0);
+    if (ret < 0)
+        return ret;
+    ret = dnvme_admin_complete(fd, &cqe);
+    if (ret < 0)
+        return ret;
+    if (NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+    {
+        ret = dnvme_admin_get_feature(fd, 0, NVME_FEATURE_NUM_QUEUES, 0, 0, 0, 0, 0, 0, NULL, 0);
+        if (ret < 0)
+            return ret;
+        ret = dnvme_admin_complete(fd, &cqe);
+        if (ret < 0)
+            return ret;
+        if (NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+            return -EIO;
+    }
+    *granted_sq = (cqe.result & 0xFFFF)+1;
+    *granted_cq = (cqe.result >> 16)+1;
+    return SUCCESS;
+}
+
+/* Send a Set/Get Features and wait for it; 'result' (may be NULL) gets completion DW0. */
+static int dnvme_admin_feature_complete(int fd, int send_ret, uint32_t *result)
+{
+    struct nvme_completion cqe;
+    int ret = send_ret;
+    if (ret < 0)
+        return ret;
+    ret = dnvme_admin_complete(fd, &cqe);
+    if (ret < 0)
+        return ret;
+    if (NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+        return -EIO;
+    if (result)
+        *result = cqe.result;
+    return SUCCESS;
+}
+
+/*
+ * Interrupt Coalescing applies to every IO completion queue vector.
+ * 'entries' is the aggregation threshold in completions (1-256, 1 turns
+ * coalescing off) and 'time_us' the aggregation time, rounded down to the
+ * 100us granularity of the feature (0-25500).
+ */
+int dnvme_admin_set_irq_coalescing(int fd, uint8_t save, uint16_t entries, uint32_t time_us)
+{
+    union dw11_u dw11 = {0};
+    if (entries == 0 || entries > 256 || time_us > 255*100)
+        return -EINVAL;
+    dw11.feature.ic.threshold = entries-1;
+    dw11.feature.ic.time = time_us/100;
+    return dnvme_admin_feature_complete(fd, dnvme_admin_set_feature(fd, 0, NVME_FEATURE_IRQ_COALESCE, save,
+        dw11.value, 0, 0, 0, 0, NULL, 0), NULL);
+}
+
+int dnvme_admin_get_irq_coalescing(int fd, uint8_t select, uint16_t *entries, uint32_t *time_us)
+{
+    union dw11_u dw0;
+    int ret = dnvme_admin_feature_complete(fd, dnvme_admin_get_feature(fd, 0, NVME_FEATURE_IRQ_COALESCE, select,
+        0, 0, 0, 0, 0, NULL, 0), &dw0.value);
+    if (ret)
+        return ret;
+    *entries = dw0.feature.ic.threshold+1;
+    *time_us = dw0.feature.ic.time*100;
+    return SUCCESS;
+}
+
+/* Arbitration weights apply only while CC.AMS selects weighted round robin. */
+int dnvme_admin_set_arbitration(int fd, uint8_t save, const struct dnvme_arbitration *arb)
+{
+    union dw11_u dw11 = {0};
+    if (arb->burst > 7 || !arb->hpw || arb->hpw > 256 || !arb->mpw || arb->mpw > 256 || !arb->lpw || arb->lpw > 256)
+        return -EINVAL;
+    dw11.feature.arb.arb_burst = arb->burst;
+    dw11.feature.arb.hpw = arb->hpw-1;
+    dw11.feature.arb.mpw = arb->mpw-1;
+    dw11.feature.arb.lpw = arb->lpw-1;
+    return dnvme_admin_feature_complete(fd, dnvme_admin_set_feature(fd, 0, NVME_FEATURE_ARBITRATION, save,
+        dw11.value, 0, 0, 0, 0, NULL, 0), NULL);
+}
+
+int dnvme_admin_get_arbitration(int fd, uint8_t select, struct dnvme_arbitration *arb)
+{
+    union dw11_u dw0;
+    int ret = dnvme_admin_feature_complete(fd, dnvme_admin_get_feature(fd, 0, NVME_FEATURE_ARBITRATION, select,
+        0, 0, 0, 0, 0, NULL, 0), &dw0.value);
+    if (ret)
+        return ret;
+    arb->burst = dw0.feature.arb.arb_burst;
+    arb->hpw = dw0.feature.arb.hpw+1;
+    arb->mpw = dw0.feature.arb.mpw+1;
+    arb->lpw = dw0.feature.arb.lpw+1;
+    return SUCCESS;
+}
+
+/* Interrupt Vector Configuration: 'disable' exempts 'vector' from coalescing. Vector 0 never coalesces. */
+int dnvme_admin_set_irq_vector_config(int fd, uint8_t save, uint16_t vector, uint8_t disable)
+{
+    union dw11_u dw11 = {
+        .feature.ivc.vector = vector,
+        .feature.ivc.disable = disable ? 1 : 0,
+    };
+    return dnvme_admin_feature_complete(fd, dnvme_admin_set_feature(fd, 0, NVME_FEATURE_IRQ_CONFIG, save,
+        dw11.value, 0, 0, 0, 0, NULL, 0), NULL);
+}
+
+int dnvme_admin_get_irq_vector_config(int fd, uint8_t select, uint16_t vector, uint8_t *disable)
+{
+    union dw11_u dw11 = {
+        .feature.ivc.vector = vector,
+    };
+    union dw11_u dw0;
+    int ret = dnvme_admin_feature_complete(fd, dnvme_admin_get_feature(fd, 0, NVME_FEATURE_IRQ_CONFIG, select,
+        dw11.value, 0, 0, 0, 0, NULL, 0), &dw0.value);
+    if (ret)
+        return ret;
+    *disable = dw0.feature.ivc.disable;
+    return SUCCESS;
+}
+
 int dnvme_admin_async_event_request(int fd, uint32_t nsid)
 {
     struct nvme_admin_cmd cmd = {
@@ -633,6 +976,17 @@ int dnvme_nvm_write(int fd, struct nvme_64b_send *cmd)
     return ret;
 }
 
+/* Fill the common fields of a read/write style command, n_lba is a plain count. */
+void dnvme_nvm_rw_prepare(struct nvme_io_cmd *cmd, uint8_t opcode, uint32_t nsid, uint64_t start_lba, uint32_t n_lba)
+{
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->opcode = opcode;
+    cmd->nsid = nsid;
+    cmd->cdw10.read.start_lba_low = start_lba & 0xFFFFFFFF;
+    cmd->cdw11.read.start_lba_up = (start_lba>>32) & 0xFFFFFFFF;
+    cmd->cdw12.read.nlb = n_lba-1;
+}
+
 int dnvme_nvm_read(int fd, uint16_t qid, uint32_t nsid, uint64_t start_lba, uint16_t n_lba, uint8_t protect_info, uint8_t fua,
     uint8_t limit_retry, uint8_t dataset_management, uint32_t expected_init_blk_ref_tag, uint16_t expected_blk_app_tag,
     uint16_t expected_blk_app_tag_mask, uint8_t *buffer, uint32_t buffer_size)
@@ -667,16 +1021,60 @@ int dnvme_nvm_compare(int fd, struct nvme_64b_send *cmd)
     return ret;
 }
 
-int dnvme_nvm_write_zeroes(int fd, struct nvme_64b_send *cmd)
+int dnvme_nvm_write_zeroes(int fd, uint16_t qid, uint32_t nsid, uint64_t start_lba, uint16_t n_lba, uint8_t deallocate,
+    uint8_t protect_info, uint8_t fua, uint8_t limit_retry, uint32_t init_blk_ref_tag, uint16_t blk_app_tag,
+    uint16_t blk_app_tag_mask)
 {
-    int ret = 0;
-    return ret;
+    struct nvme_io_cmd cmd = {
+        .opcode = NVME_CMD_WRITE_ZEROES,
+        .flags = 0,
+        .nsid = nsid,
+        .cdw10.write_zeros.start_lba_low = start_lba & 0xFFFFFFFF,
+        .cdw11.write_zeros.start_lba_up = (start_lba>>32) & 0xFFFFFFFF,
+        .cdw12.write_zeros.nlb = n_lba,
+        .cdw12.write_zeros.deallocate = deallocate,
+        .cdw12.write_zeros.prinfo = protect_info,
+        .cdw12.write_zeros.fua = fua,
+        .cdw12.write_zeros.lr = limit_retry,
+        .cdw14.write_zeros.ilbrt = init_blk_ref_tag,
+        .cdw15.write_zeros.lbat = blk_app_tag,
+        .cdw15.write_zeros.lbatm = blk_app_tag_mask,
+    };
+    return ioctl_write_zeros(fd, &cmd, qid);
 }
 
-int dnvme_nvm_dataset_management(int fd, struct nvme_64b_send *cmd)
+/* 'nr_ranges' is 1's based here and turned into the 0's based NR of CDW10. */
+int dnvme_nvm_dataset_management(int fd, uint16_t qid, uint32_t nsid, uint8_t attributes, struct nvme_dsm_range *ranges,
+    uint16_t nr_ranges)
 {
-    int ret = 0;
-    return ret;
+    struct nvme_io_cmd cmd = {
+        .opcode = NVME_CMD_DATASET_MANAGEMENT,
+        .flags = 0,
+        .nsid = nsid,
+        .prp1 = (uint64_t)(uintptr_t)ranges,
+        .cdw10.dataset_management.nr = nr_ranges-1,
+        .cdw11.dataset_management.idr = !!(attributes & NVME_DSMGMT_IDR),
+        .cdw11.dataset_management.idw = !!(attributes & NVME_DSMGMT_IDW),
+        .cdw11.dataset_management.deallocate = !!(attributes & NVME_DSMGMT_AD),
+    };
+    if (nr_ranges == 0 || nr_ranges > 256)
+        return -EINVAL;
+    return ioctl_dataset_management(fd, &cmd, nr_ranges*sizeof(struct nvme_dsm_range), qid);
+}
+
+/*
+ * Ring the admin doorbell and reap the single completion of the admin command
+ * just sent. Only meant for bring-up paths with nothing else outstanding.
+ */
+int dnvme_admin_complete(int fd, struct nvme_completion *cqe)
+{
+    int ret = dnvme_ring_doorbell(fd, 0);
+    if (ret < 0)
+        return ret;
+    ret = dnvme_cq_wait(fd, 0, 1, 0, NULL);
+    if (ret < 0)
+        return ret;
+    return dnvme_cq_reap(fd, 0, 1, (uint8_t *)cqe, sizeof(*cqe));
 }
 
 int dnvme_cq_remain(int fd, uint16_t q_id)
@@ -684,10 +1082,111 @@ int dnvme_cq_remain(int fd, uint16_t q_id)
     return ioctl_cq_remain(fd, q_id);
 }
 
+/* Interrupts the driver took for q_id so far. */
+int dnvme_cq_isr_count(int fd, uint16_t q_id, uint32_t *isr_count)
+{
+    struct nvme_reap_inquiry inquiry = {
+        .q_id = q_id,
+    };
+    int ret = ioctl_cq_inquiry(fd, &inquiry);
+    if (ret < 0)
+        return ret;
+    *isr_count = inquiry.isr_count;
+    return SUCCESS;
+}
+
 int dnvme_cq_reap(int fd, uint16_t q_id, uint16_t remaining, uint8_t *buffer, uint32_t size)
 {
     return ioctl_cq_reap(fd, q_id, remaining, buffer, size);
 }
 
+/*
+ * Reap up to 'elements' CQEs without asking first how many are there; one
+ * ioctl instead of an inquiry plus a reap. Returns the number reaped and
+ * stores how many are still waiting in 'remaining' (may be NULL).
+ */
+int dnvme_cq_reap_direct(int fd, uint16_t q_id, uint8_t *buffer, uint32_t elements, uint32_t *remaining)
+{
+    struct nvme_reap reap = {
+        .q_id = q_id,
+        .elements = elements,
+        .buffer = buffer,
+        .size = elements*NVME_IOCQ_ELEMENT_SIZE,
+    };
+    int ret = ioctl_cq_reap_into(fd, &reap);
+    if (ret < 0)
+        return ret;
+    if (remaining)
+        *remaining = reap.num_remaining;
+    return reap.num_reaped;
+}
 
+void dnvme_cq_wait_policy(struct dnvme_wait_policy *policy)
+{
+    *policy = wait_policy;
+}
 
+void dnvme_cq_set_wait_policy(const struct dnvme_wait_policy *policy)
+{
+    wait_policy = *policy;
+    if (wait_policy.min_sleep_ns == 0)
+        wait_policy.min_sleep_ns = DNVME_WAIT_MIN_SLEEP_NS;
+    if (wait_policy.max_sleep_ns < wait_policy.min_sleep_ns)
+        wait_policy.max_sleep_ns = wait_policy.min_sleep_ns;
+}
+
+/*
+ * Wait until at least 'expected' completions are waiting on q_id. The queue is
+ * polled with reap inquiry for the spin budget, then with exponentially growing
+ * sleeps. A zero timeout_ms uses the controller CAP.TO value.
+ * Returns the number of completions waiting, -ETIMEDOUT or the inquiry error.
+ */
+int dnvme_cq_wait(int fd, uint16_t q_id, uint16_t expected, uint32_t timeout_ms, struct dnvme_wait_stats *stats)
+{
+    struct dnvme_wait_stats local;
+    struct timespec delay;
+    uint64_t start = dnvme_get_time_ns();
+    uint64_t elapsed = 0;
+    uint64_t sleep_ns = wait_policy.min_sleep_ns;
+    int remaining = 0;
+    int ret = 0;
+
+    if (stats == NULL)
+        stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    if (timeout_ms == 0)
+        timeout_ms = dnvme_controller_get_timeout_ms(fd);
+    stats->timeout_ns = (uint64_t)timeout_ms*1000000;
+    if (expected == 0)
+        expected = 1;
+    for (;;)
+    {
+        ret = ioctl_cq_remain(fd, q_id);
+        stats->inquiries++;
+        elapsed = dnvme_get_time_ns() - start;
+        if (ret < 0)
+            break;
+        remaining = ret;
+        if (remaining >= expected)
+            break;
+        if (elapsed >= stats->timeout_ns)
+        {
+            ret = -ETIMEDOUT;
+            break;
+        }
+        if (elapsed < wait_policy.spin_ns)
+            continue;
+        if (sleep_ns > stats->timeout_ns - elapsed)
+            sleep_ns = stats->timeout_ns - elapsed;
+        delay.tv_sec = sleep_ns/1000000000;
+        delay.tv_nsec = sleep_ns%1000000000;
+        nanosleep(&delay, NULL);
+        stats->sleeps++;
+        sleep_ns <<= 1;
+        if (sleep_ns > wait_policy.max_sleep_ns)
+            sleep_ns = wait_policy.max_sleep_ns;
+    }
+    stats->elapsed_ns = elapsed;
+    stats->remaining = remaining;
+    return ret;
+}
@@ -11,6 +11,8 @@
 #include <stdint.h>
 #include "inc/dnvme_interface.h"
 
+#define NVME_CQE_STATUS(cqe)    (((cqe)->status >> 1) & 0x7FFF)
+
 enum status_type {
     SUCCESS = 0,
     MALLOC_BUFFER_ERROR,
@@ -21,12 +23,52 @@ enum status_type {
     CREATE_ADMIN_CQ_ERROR,
     CREATE_ADMIN_SQ_ERROR,
     ENABLE_CONTROLLER_ERROR,
+    ARBITRATION_ERROR,
     INIT_DRIVE_ERROR_MAX
 };
 
+/* Default completion wait tuning: spin on reap inquiry, then back off with sleeps. */
+#define DNVME_WAIT_SPIN_NS          20000
+#define DNVME_WAIT_MIN_SLEEP_NS     1000
+#define DNVME_WAIT_MAX_SLEEP_NS     1000000
+
+struct dnvme_wait_policy {
+    uint64_t spin_ns;       /* busy-poll budget before the first sleep */
+    uint64_t min_sleep_ns;  /* first back-off sleep, doubled on every retry */
+    uint64_t max_sleep_ns;  /* back-off sleep ceiling */
+};
+
+struct dnvme_wait_stats {
+    uint64_t elapsed_ns;    /* time from entry until the wait finished */
+    uint64_t timeout_ns;    /* timeout applied to this wait */
+    uint32_t inquiries;     /* number of NVME_IOCTL_REAP_INQUIRY issued */
+    uint32_t sleeps;        /* number of back-off sleeps taken */
+    uint32_t remaining;     /* completions waiting to be reaped at exit */
+};
+
+struct dnvme_init_stats {
+    uint64_t disable_ns;    /* CC.EN=0 until CSTS.RDY=0 */
+    uint64_t enable_ns;     /* CC.EN=1 until CSTS.RDY=1 */
+    uint64_t total_ns;      /* whole bring-up */
+};
+
+/* Arbitration feature: weights are commands per round (1-256), burst is log2 of commands per fetch, 7 = no limit. */
+struct dnvme_arbitration {
+    uint8_t burst;
+    uint16_t hpw;
+    uint16_t mpw;
+    uint16_t lpw;
+};
+
 int open_dev(char *dev);
+void close_dev(int fd);
 int init_drive(int fd);
+int dnvme_init_drive_timed(int fd, struct dnvme_init_stats *stats);
+int dnvme_init_drive_arbitration(int fd, uint32_t ams, struct dnvme_init_stats *stats);
 int dnvme_ring_doorbell(int fd, uint16_t sq_id);
+int dnvme_sq_free_slots(int fd, uint16_t sq_id);
+uint64_t dnvme_get_time_ns(void);
+uint64_t dnvme_thread_cpu_ns(void);
 int malloc_4k_aligned_buffer(void **buffer, uint32_t element_size, uint32_t elements);
 void* create_buffer(uint32_t element_size, uint32_t elements);
 int dump_data(void* buffer, int buffer_len, int index);
@@ -35,6 +77,11 @@ void free_buffer(void* buffer);
 
 int dnvme_controller_enable(int fd);
 int dnvme_controller_disable(int fd);
+int dnvme_controller_set_arbitration(int fd, uint32_t ams);
+uint64_t dnvme_controller_get_cap(int fd);
+uint32_t dnvme_controller_get_timeout_ms(int fd);
+uint32_t dnvme_controller_get_max_transfer(int fd);
+int dnvme_controller_cache_regs(int fd);
 int dnvme_controller_reg_read_block(int fd, uint32_t offset, uint32_t bytes, uint8_t *data);
 int dnvme_controller_reg_read_byte(int fd, uint32_t offset, uint8_t *data);
 int dnvme_controller_reg_read_word(int fd, uint32_t offset, uint16_t *data);
@@ -51,12 +98,15 @@ int dnvme_pcie_capability_write_block(int fd, uint32_t offset, uint32_t bytes, u
 int dnvme_pcie_capability_write_byte(int fd, uint32_t offset, uint8_t *data);
 int dnvme_pcie_capability_write_word(int fd, uint32_t offset, uint16_t *data);
 int dnvme_pcie_capability_write_dword(int fd, uint32_t offset, uint32_t *data);
+int dnvme_pcie_capability_snapshot(int fd);
 uint16_t dnvme_pcie_msix_capability(int fd);
 uint16_t dnvme_pcie_msix_get_entry_count(int fd, uint16_t msix_cap);
 void dnvme_pcie_msix_enable(int fd, uint16_t msix_cap);
 
 
 int dnvme_admin_create_iocq(int fd, uint32_t nsid, uint16_t cq_id, uint16_t int_no, uint16_t qsize, uint8_t contig, void *buffer);
+int dnvme_admin_create_iocq_irq(int fd, uint32_t nsid, uint16_t cq_id, uint8_t int_en, uint16_t int_no, uint16_t qsize,
+    uint8_t contig, void *buffer);
 int dnvme_admin_create_iosq(int fd, uint32_t nsid, uint16_t sq_id, uint16_t cq_id, uint16_t qsize, uint8_t contig, void *buffer,
     uint8_t qprio, uint16_t nvmsetid);
 int dnvme_admin_delete_iosq(int fd, uint32_t nsid, uint16_t sq_id);
@@ -81,12 +131,32 @@ int dnvme_admin_format_nvm(int fd, uint32_t nsid, uint8_t lbaf, uint8_t mset, ui
 int dnvme_admin_sanitize(int fd, uint32_t nsid, uint8_t action, uint8_t ause, uint8_t owpass, uint8_t owipbp, uint8_t ndas,
     uint32_t ovrpat, uint8_t *buffer, uint32_t buffer_size);
 
+void dnvme_nvm_rw_prepare(struct nvme_io_cmd *cmd, uint8_t opcode, uint32_t nsid, uint64_t start_lba, uint32_t n_lba);
 int dnvme_nvm_read(int fd, uint16_t qid, uint32_t nsid, uint64_t start_lba, uint16_t n_lba, uint8_t protect_info, uint8_t fua,
     uint8_t limit_retry, uint8_t dataset_management, uint32_t expected_init_blk_ref_tag, uint16_t expected_blk_app_tag,
     uint16_t expected_blk_app_tag_mask, uint8_t *buffer, uint32_t buffer_size);
+int dnvme_nvm_write_zeroes(int fd, uint16_t qid, uint32_t nsid, uint64_t start_lba, uint16_t n_lba, uint8_t deallocate,
+    uint8_t protect_info, uint8_t fua, uint8_t limit_retry, uint32_t init_blk_ref_tag, uint16_t blk_app_tag,
+    uint16_t blk_app_tag_mask);
+int dnvme_nvm_dataset_management(int fd, uint16_t qid, uint32_t nsid, uint8_t attributes, struct nvme_dsm_range *ranges,
+    uint16_t nr_ranges);
+
+int dnvme_admin_complete(int fd, struct nvme_completion *cqe);
+int dnvme_admin_set_num_queues(int fd, uint16_t nr_sq, uint16_t nr_cq, uint16_t *granted_sq, uint16_t *granted_cq);
+int dnvme_admin_set_arbitration(int fd, uint8_t save, const struct dnvme_arbitration *arb);
+int dnvme_admin_get_arbitration(int fd, uint8_t select, struct dnvme_arbitration *arb);
+int dnvme_admin_set_irq_coalescing(int fd, uint8_t save, uint16_t entries, uint32_t time_us);
+int dnvme_admin_get_irq_coalescing(int fd, uint8_t select, uint16_t *entries, uint32_t *time_us);
+int dnvme_admin_set_irq_vector_config(int fd, uint8_t save, uint16_t vector, uint8_t disable);
+int dnvme_admin_get_irq_vector_config(int fd, uint8_t select, uint16_t vector, uint8_t *disable);
 
 int dnvme_cq_remain(int fd, uint16_t q_id);
 int dnvme_cq_reap(int fd, uint16_t q_id, uint16_t remaining, uint8_t *buffer, uint32_t size);
+int dnvme_cq_isr_count(int fd, uint16_t q_id, uint32_t *isr_count);
+int dnvme_cq_reap_direct(int fd, uint16_t q_id, uint8_t *buffer, uint32_t elements, uint32_t *remaining);
+void dnvme_cq_wait_policy(struct dnvme_wait_policy *policy);
+void dnvme_cq_set_wait_policy(const struct dnvme_wait_policy *policy);
+int dnvme_cq_wait(int fd, uint16_t q_id, uint16_t expected, uint32_t timeout_ms, struct dnvme_wait_stats *stats);
 
 
 #endif
@@ -0,0 +1,285 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_cqe.c
+ * Description: typed view of reaped completions, batch status scan and status decode.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_cqe.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DNVME_CQE_X86
+#endif
+
+/* Everything of the status field but the phase tag. */
+#define DNVME_CQE_STATUS_MASK       0xFFFE
+
+/* Scan in groups of this many CQEs; a group with a failure is looked at entry by entry. */
+#define DNVME_CQE_GROUP             8
+
+typedef uint32_t (*dnvme_cqe_scan)(const struct nvme_completion *cqe, uint32_t count);
+
+static const char *const dnvme_status_names[4][256] = {
+    [NVME_SCT_GENERIC] = {
+        [0x00] = "Successful Completion",
+        [0x01] = "Invalid Command Opcode",
+        [0x02] = "Invalid Field in Command",
+        [0x03] = "Command ID Conflict",
+        [0x04] = "Data Transfer Error",
+        [0x05] = "Commands Aborted due to Power Loss Notification",
+        [0x06] = "Internal Error",
+        [0x07] = "Command Abort Requested",
+        [0x08] = "Command Aborted due to SQ Deletion",
+        [0x09] = "Command Aborted due to Failed Fused Command",
+        [0x0a] = "Command Aborted due to Missing Fused Command",
+        [0x0b] = "Invalid Namespace or Format",
+        [0x0c] = "Command Sequence Error",
+        [0x0d] = "Invalid SGL Segment Descriptor",
+        [0x0e] = "Invalid Number of SGL Descriptors",
+        [0x0f] = "Data SGL Length Invalid",
+        [0x10] = "Metadata SGL Length Invalid",
+        [0x11] = "SGL Descriptor Type Invalid",
+        [0x12] = "Invalid Use of Controller Memory Buffer",
+        [0x13] = "PRP Offset Invalid",
+        [0x14] = "Atomic Write Unit Exceeded",
+        [0x15] = "Operation Denied",
+        [0x16] = "SGL Offset Invalid",
+        [0x18] = "Host Identifier Inconsistent Format",
+        [0x19] = "Keep Alive Timer Expired",
+        [0x1a] = "Keep Alive Timeout Invalid",
+        [0x1b] = "Command Aborted due to Preempt and Abort",
+        [0x1c] = "Sanitize Failed",
+        [0x1d] = "Sanitize In Progress",
+        [0x1e] = "SGL Data Block Granularity Invalid",
+        [0x1f] = "Command Not Supported for Queue in CMB",
+        [0x20] = "Namespace is Write Protected",
+        [0x21] = "Command Interrupted",
+        [0x22] = "Transient Transport Error",
+        [0x80] = "LBA Out of Range",
+        [0x81] = "Capacity Exceeded",
+        [0x82] = "Namespace Not Ready",
+        [0x83] = "Reservation Conflict",
+        [0x84] = "Format In Progress",
+    },
+    [NVME_SCT_COMMAND_SPECIFIC] = {
+        [0x00] = "Completion Queue Invalid",
+        [0x01] = "Invalid Queue Identifier",
+        [0x02] = "Invalid Queue Size",
+        [0x03] = "Abort Command Limit Exceeded",
+        [0x04] = "Abort Command Is Missing",
+        [0x05] = "Asynchronous Event Request Limit Exceeded",
+        [0x06] = "Invalid Firmware Slot",
+        [0x07] = "Invalid Firmware Image",
+        [0x08] = "Invalid Interrupt Vector",
+        [0x09] = "Invalid Log Page",
+        [0x0a] = "Invalid Format",
+        [0x0b] = "Firmware Activation Requires Conventional Reset",
+        [0x0c] = "Invalid Queue Deletion",
+        [0x0d] = "Feature Identifier Not Saveable",
+        [0x0e] = "Feature Not Changeable",
+        [0x0f] = "Feature Not Namespace Specific",
+        [0x10] = "Firmware Activation Requires NVM Subsystem Reset",
+        [0x11] = "Firmware Activation Requires Controller Level Reset",
+        [0x12] = "Firmware Activation Requires Maximum Time Violation",
+        [0x13] = "Firmware Activation Prohibited",
+        [0x14] = "Overlapping Range",
+        [0x15] = "Namespace Insufficient Capacity",
+        [0x16] = "Namespace Identifier Unavailable",
+        [0x18] = "Namespace Already Attached",
+        [0x19] = "Namespace Is Private",
+        [0x1a] = "Namespace Not Attached",
+        [0x1b] = "Thin Provisioning Not Supported",
+        [0x1c] = "Controller List Invalid",
+        [0x1d] = "Device Self-test In Progress",
+        [0x1e] = "Boot Partition Write Prohibited",
+        [0x1f] = "Invalid Controller Identifier",
+        [0x20] = "Invalid Secondary Controller State",
+        [0x21] = "Invalid Number of Controller Resources",
+        [0x22] = "Invalid Resource Identifier",
+        [0x80] = "Conflicting Attributes",
+        [0x81] = "Invalid Protection Information",
+        [0x82] = "Attempted Write to Read Only Range",
+    },
+    [NVME_SCT_MEDIA] = {
+        [0x80] = "Write Fault",
+        [0x81] = "Unrecovered Read Error",
+        [0x82] = "End-to-end Guard Check Error",
+        [0x83] = "End-to-end Application Tag Check Error",
+        [0x84] = "End-to-end Reference Tag Check Error",
+        [0x85] = "Compare Failure",
+        [0x86] = "Access Denied",
+        [0x87] = "Deallocated or Unwritten Logical Block",
+    },
+    [NVME_SCT_PATH] = {
+        [0x00] = "Internal Path Error",
+        [0x01] = "Asymmetric Access Persistent Loss",
+        [0x02] = "Asymmetric Access Inaccessible",
+        [0x03] = "Asymmetric Access Transition",
+        [0x60] = "Controller Pathing Error",
+        [0x70] = "Host Pathing Error",
+        [0x71] = "Command Aborted By Host",
+    },
+};
+
+void dnvme_cqe_view_init(struct dnvme_cqe_view *view, const uint8_t *buffer, uint32_t count)
+{
+    view->cqe = (const struct nvme_completion *)buffer;
+    view->count = count;
+}
+
+static uint32_t dnvme_cqe_scan_scalar(const struct nvme_completion *cqe, uint32_t count)
+{
+    uint32_t i;
+    for (i=0; i<count; i++)
+    {
+        if (cqe[i].status & DNVME_CQE_STATUS_MASK)
+            break;
+    }
+    return i;
+}
+
+#ifdef DNVME_CQE_X86
+/*
+ * A CQE is exactly one 128 bit lane with the status in the top 16 bits,
+ * so OR-ing a group of CQEs together and testing the status bits of the
+ * result answers "all successful?" for the group with one branch.
+ */
+__attribute__((target("sse2")))
+static uint32_t dnvme_cqe_scan_sse2(const struct nvme_completion *cqe, uint32_t count)
+{
+    const __m128i mask = _mm_set_epi16((short)DNVME_CQE_STATUS_MASK, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t i, j;
+    for (i=0; i+DNVME_CQE_GROUP<=count; i+=DNVME_CQE_GROUP)
+    {
+        __m128i acc = _mm_loadu_si128((const __m128i *)&cqe[i]);
+        for (j=1; j<DNVME_CQE_GROUP; j++)
+            acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)&cqe[i+j]));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(acc, mask), zero)) != 0xFFFF)
+            return i + dnvme_cqe_scan_scalar(&cqe[i], DNVME_CQE_GROUP);
+    }
+    return i + dnvme_cqe_scan_scalar(&cqe[i], count-i);
+}
+
+/* Same with two CQEs per register and VPTEST doing the AND and the compare. */
+__attribute__((target("avx2")))
+static uint32_t dnvme_cqe_scan_avx2(const struct nvme_completion *cqe, uint32_t count)
+{
+    const __m256i mask = _mm256_set_epi16((short)DNVME_CQE_STATUS_MASK, 0, 0, 0, 0, 0, 0, 0,
+        (short)DNVME_CQE_STATUS_MASK, 0, 0, 0, 0, 0, 0, 0);
+    uint32_t i, j;
+    for (i=0; i+DNVME_CQE_GROUP<=count; i+=DNVME_CQE_GROUP)
+    {
+        __m256i acc = _mm256_loadu_si256((const __m256i *)&cqe[i]);
+        for (j=2; j<DNVME_CQE_GROUP; j+=2)
+            acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *)&cqe[i+j]));
+        if (!_mm256_testz_si256(acc, mask))
+            return i + dnvme_cqe_scan_scalar(&cqe[i], DNVME_CQE_GROUP);
+    }
+    return i + dnvme_cqe_scan_scalar(&cqe[i], count-i);
+}
+#endif
+
+static dnvme_cqe_scan dnvme_cqe_scanner(const char **isa)
+{
+#ifdef DNVME_CQE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *isa = "avx2";
+        return dnvme_cqe_scan_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *isa = "sse2";
+        return dnvme_cqe_scan_sse2;
+    }
+#endif
+    *isa = "scalar";
+    return dnvme_cqe_scan_scalar;
+}
+
+static const char *scan_isa;
+static dnvme_cqe_scan scan_fn;
+
+/* Index of the first CQE with a non-success status (DNR included), 'count' when all succeeded. */
+uint32_t dnvme_cqe_first_error(const struct nvme_completion *cqe, uint32_t count)
+{
+    dnvme_cqe_scan scan = __atomic_load_n(&scan_fn, __ATOMIC_ACQUIRE);
+    const char *isa;
+    if (!scan)
+    {
+        scan = dnvme_cqe_scanner(&isa);
+        __atomic_store_n(&scan_isa, isa, __ATOMIC_RELAXED);
+        __atomic_store_n(&scan_fn, scan, __ATOMIC_RELEASE);
+    }
+    return scan(cqe, count);
+}
+
+const char *dnvme_cqe_scan_isa(void)
+{
+    if (!__atomic_load_n(&scan_fn, __ATOMIC_ACQUIRE))
+        dnvme_cqe_first_error(NULL, 0);
+    return __atomic_load_n(&scan_isa, __ATOMIC_RELAXED);
+}
+
+/*
+ * Decode every failed CQE of the view into 'failures' (up to 'max', may be
+ * NULL to only count) and return how many failed. The batch scan skips
+ * straight over runs of successful entries.
+ */
+uint32_t dnvme_cqe_failures(const struct dnvme_cqe_view *view, struct dnvme_cqe_failure *failures, uint32_t max)
+{
+    uint32_t index = 0, failed = 0;
+    while ((index += dnvme_cqe_first_error(&view->cqe[index], view->count-index)) < view->count)
+    {
+        const struct nvme_completion *cqe = &view->cqe[index];
+        if (failures && failed < max)
+        {
+            struct dnvme_cqe_failure *failure = &failures[failed];
+            failure->index = index;
+            failure->sq_id = cqe->sq_id;
+            failure->command_id = cqe->command_id;
+            failure->status = NVME_CQE_STATUS(cqe) & 0x7FF;
+            failure->dnr = NVME_CQE_DNR(cqe);
+            failure->more = NVME_CQE_MORE(cqe);
+            failure->crd = NVME_CQE_CRD(cqe);
+            failure->name = dnvme_status_name(failure->status);
+        }
+        failed++;
+        index++;
+    }
+    return failed;
+}
+
+/* 'status' is SCT << 8 | SC as in NVME_SC_*; higher bits are ignored. */
+const char *dnvme_status_name(uint16_t status)
+{
+    uint8_t sct = (status >> 8) & 0x7;
+    uint8_t sc = status & 0xFF;
+    if (sct == NVME_SCT_VENDOR)
+        return "Vendor Specific";
+    if (sct >= sizeof(dnvme_status_names)/sizeof(dnvme_status_names[0]) || !dnvme_status_names[sct][sc])
+        return sc >= 0xC0 ? "Vendor Specific" : "Reserved";
+    return dnvme_status_names[sct][sc];
+}
+
+const char *dnvme_status_type_name(uint8_t sct)
+{
+    static const char *names[8] = {
+        [NVME_SCT_GENERIC] = "Generic Command Status",
+        [NVME_SCT_COMMAND_SPECIFIC] = "Command Specific Status",
+        [NVME_SCT_MEDIA] = "Media and Data Integrity Errors",
+        [NVME_SCT_PATH] = "Path Related Status",
+        [4] = "Reserved",
+        [5] = "Reserved",
+        [6] = "Reserved",
+        [NVME_SCT_VENDOR] = "Vendor Specific",
+    };
+    return names[sct & 0x7];
+}
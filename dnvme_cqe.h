@@ -0,0 +1,57 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_cqe.h
+ * Description: typed view of reaped completions, batch status scan and status decode.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_CQE_H__
+#define __DNVME_CQE_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+#include "dnvme_commands.h"
+
+/* Fields of NVME_CQE_STATUS(): SC 7:0, SCT 10:8, CRD 12:11, More 13, DNR 14. */
+#define NVME_CQE_SC(cqe)        (NVME_CQE_STATUS(cqe) & 0xFF)
+#define NVME_CQE_SCT(cqe)       ((NVME_CQE_STATUS(cqe) >> 8) & 0x7)
+#define NVME_CQE_CRD(cqe)       ((NVME_CQE_STATUS(cqe) >> 11) & 0x3)
+#define NVME_CQE_MORE(cqe)      ((NVME_CQE_STATUS(cqe) >> 13) & 0x1)
+#define NVME_CQE_DNR(cqe)       ((NVME_CQE_STATUS(cqe) >> 14) & 0x1)
+
+enum nvme_status_type {
+    NVME_SCT_GENERIC            = 0,
+    NVME_SCT_COMMAND_SPECIFIC   = 1,
+    NVME_SCT_MEDIA              = 2,
+    NVME_SCT_PATH               = 3,
+    NVME_SCT_VENDOR             = 7,
+};
+
+/**
+ * The reap buffer seen as CQEs in place; nothing is copied. The buffer
+ * must stay untouched for as long as the view is used.
+ */
+struct dnvme_cqe_view {
+    const struct nvme_completion *cqe;
+    uint32_t count;
+};
+
+struct dnvme_cqe_failure {
+    uint32_t index;                 /* position in the view */
+    uint16_t sq_id;
+    uint16_t command_id;            /* unique_id the command was sent with */
+    uint16_t status;                /* SCT << 8 | SC, comparable with NVME_SC_* */
+    uint8_t dnr;
+    uint8_t more;
+    uint8_t crd;
+    const char *name;
+};
+
+void dnvme_cqe_view_init(struct dnvme_cqe_view *view, const uint8_t *buffer, uint32_t count);
+uint32_t dnvme_cqe_first_error(const struct nvme_completion *cqe, uint32_t count);
+uint32_t dnvme_cqe_failures(const struct dnvme_cqe_view *view, struct dnvme_cqe_failure *failures, uint32_t max);
+const char *dnvme_cqe_scan_isa(void);
+const char *dnvme_status_name(uint16_t status);
+const char *dnvme_status_type_name(uint8_t sct);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_ctrlstate.c
+ * Description: non-blocking controller enable/disable/shutdown state machine.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <dnvme.h>
+#include "dnvme_commands.h"
+#include "dnvme_regcache.h"
+#include "dnvme_ctrlstate.h"
+
+int dnvme_ctrl_sm_init(struct dnvme_ctrl_sm *sm, int fd)
+{
+    memset(sm, 0, sizeof(*sm));
+    sm->fd = fd;
+    sm->state = DNVME_CTRL_IDLE;
+    sm->timeout_ns = (uint64_t)dnvme_controller_get_timeout_ms(fd)*1000000;
+    return SUCCESS;
+}
+
+/* Whether CSTS shows the end of the transition in progress. */
+static int dnvme_ctrl_reached(enum dnvme_ctrl_op op, uint32_t csts)
+{
+    switch (op)
+    {
+    case DNVME_CTRL_ENABLE:
+        return csts & NVME_CSTS_RDY;
+    case DNVME_CTRL_DISABLE:
+        return !(csts & NVME_CSTS_RDY);
+    default:
+        return (csts & NVME_CSTS_SHST_MASK) == NVME_CSTS_SHST_CMPLT;
+    }
+}
+
+static int dnvme_ctrl_finish(struct dnvme_ctrl_sm *sm, int ret, uint64_t now)
+{
+    uint64_t latency = now - sm->start_ns;
+    sm->state = ret == SUCCESS ? DNVME_CTRL_DONE : DNVME_CTRL_FAILED;
+    sm->ret = ret;
+    if (ret == SUCCESS)
+    {
+        sm->last_ns[sm->op] = latency;
+        if (latency > sm->max_ns[sm->op])
+            sm->max_ns[sm->op] = latency;
+        sm->count[sm->op]++;
+    }
+    return ret;
+}
+
+/*
+ * Write CC for 'op' and take the first look at CSTS. Enabling requires
+ * CSTS.RDY to have dropped from any earlier disable, as the spec asks.
+ * Returns SUCCESS when the controller got there at once, -EINPROGRESS
+ * while it has not, or an error.
+ */
+int dnvme_ctrl_start(struct dnvme_ctrl_sm *sm, enum dnvme_ctrl_op op)
+{
+    uint32_t cc, csts;
+    int ret;
+    if (sm->state == DNVME_CTRL_PENDING)
+        return -EBUSY;
+    if (op >= DNVME_CTRL_OP_COUNT)
+        return -EINVAL;
+    ret = dnvme_controller_reg_read_dword(sm->fd, NVME_REG_CC, &cc);
+    if (ret == 0)
+        ret = dnvme_controller_reg_read_dword(sm->fd, NVME_REG_CSTS, &csts);
+    if (ret)
+        return ret;
+    if (op == DNVME_CTRL_ENABLE && !(cc & NVME_CC_ENABLE) && (csts & NVME_CSTS_RDY))
+        return -EBUSY;
+
+    switch (op)
+    {
+    case DNVME_CTRL_ENABLE:
+        cc = (cc & ~NVME_CC_SHN_MASK) | NVME_CC_ENABLE | NVME_CC_IOSQES | NVME_CC_IOCQES;
+        break;
+    case DNVME_CTRL_DISABLE:
+        cc &= ~(NVME_CC_ENABLE | NVME_CC_SHN_MASK);
+        break;
+    case DNVME_CTRL_SHUTDOWN:
+        cc = (cc & ~NVME_CC_SHN_MASK) | NVME_CC_SHN_NORMAL;
+        break;
+    default:
+        cc = (cc & ~NVME_CC_SHN_MASK) | NVME_CC_SHN_ABRUPT;
+        break;
+    }
+    dnvme_regcache_invalidate(sm->fd);
+    sm->op = op;
+    sm->polls = 0;
+    sm->start_ns = dnvme_get_time_ns();
+    sm->deadline_ns = sm->start_ns + sm->timeout_ns;
+    sm->next_poll_ns = sm->start_ns;
+    sm->backoff_ns = DNVME_WAIT_MIN_SLEEP_NS;
+    ret = dnvme_controller_reg_write_dword(sm->fd, NVME_REG_CC, &cc);
+    if (ret)
+        return dnvme_ctrl_finish(sm, ret, sm->start_ns);
+    sm->state = DNVME_CTRL_PENDING;
+    sm->ret = -EINPROGRESS;
+    return dnvme_ctrl_poll(sm);
+}
+
+/*
+ * Read CSTS if the back-off delay has passed. After a disable the driver
+ * is told as well so it drops the IO queues it was tracking; the
+ * controller is already idle by then and the ioctl returns at once.
+ */
+int dnvme_ctrl_poll(struct dnvme_ctrl_sm *sm)
+{
+    uint64_t now;
+    int ret;
+    if (sm->state != DNVME_CTRL_PENDING)
+        return sm->ret;
+    now = dnvme_get_time_ns();
+    if (now < sm->next_poll_ns)
+        return -EINPROGRESS;
+    ret = dnvme_controller_reg_read_dword(sm->fd, NVME_REG_CSTS, &sm->csts);
+    sm->polls++;
+    now = dnvme_get_time_ns();
+    if (ret)
+        return dnvme_ctrl_finish(sm, ret, now);
+    if (sm->csts == 0xFFFFFFFF)
+        return dnvme_ctrl_finish(sm, -ENODEV, now);
+    if (sm->op != DNVME_CTRL_DISABLE && (sm->csts & NVME_CSTS_CFS))
+        return dnvme_ctrl_finish(sm, -EIO, now);
+    if (dnvme_ctrl_reached(sm->op, sm->csts))
+    {
+        if (sm->op == DNVME_CTRL_DISABLE)
+            ret = dnvme_controller_disable(sm->fd);
+        return dnvme_ctrl_finish(sm, ret, now);
+    }
+    if (now >= sm->deadline_ns)
+        return dnvme_ctrl_finish(sm, -ETIMEDOUT, now);
+    sm->next_poll_ns = now + sm->backoff_ns;
+    sm->backoff_ns <<= 1;
+    if (sm->backoff_ns > DNVME_WAIT_MAX_SLEEP_NS)
+        sm->backoff_ns = DNVME_WAIT_MAX_SLEEP_NS;
+    return -EINPROGRESS;
+}
+
+/* Sleep between polls until the transition finished or failed. */
+int dnvme_ctrl_wait(struct dnvme_ctrl_sm *sm)
+{
+    struct timespec delay;
+    uint64_t now;
+    int ret;
+    while ((ret = dnvme_ctrl_poll(sm)) == -EINPROGRESS)
+    {
+        now = dnvme_get_time_ns();
+        if (sm->next_poll_ns <= now)
+            continue;
+        delay.tv_sec = (sm->next_poll_ns - now)/1000000000;
+        delay.tv_nsec = (sm->next_poll_ns - now)%1000000000;
+        nanosleep(&delay, NULL);
+    }
+    return ret;
+}
+
+const char *dnvme_ctrl_op_name(enum dnvme_ctrl_op op)
+{
+    static const char *names[DNVME_CTRL_OP_COUNT] = {
+        [DNVME_CTRL_ENABLE] = "enable",
+        [DNVME_CTRL_DISABLE] = "disable",
+        [DNVME_CTRL_SHUTDOWN] = "shutdown",
+        [DNVME_CTRL_SHUTDOWN_ABRUPT] = "abrupt shutdown",
+    };
+    return op < DNVME_CTRL_OP_COUNT ? names[op] : "unknown";
+}
@@ -0,0 +1,58 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_ctrlstate.h
+ * Description: non-blocking controller enable/disable/shutdown state machine.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_CTRLSTATE_H__
+#define __DNVME_CTRLSTATE_H__
+#include <stdint.h>
+
+enum dnvme_ctrl_op {
+    DNVME_CTRL_ENABLE,              /* CC.EN=1, wait CSTS.RDY=1 */
+    DNVME_CTRL_DISABLE,             /* CC.EN=0, wait CSTS.RDY=0 */
+    DNVME_CTRL_SHUTDOWN,            /* CC.SHN=01b, wait CSTS.SHST=10b */
+    DNVME_CTRL_SHUTDOWN_ABRUPT,     /* CC.SHN=10b, wait CSTS.SHST=10b */
+    DNVME_CTRL_OP_COUNT
+};
+
+enum dnvme_ctrl_state {
+    DNVME_CTRL_IDLE,
+    DNVME_CTRL_PENDING,             /* CC written, CSTS not there yet */
+    DNVME_CTRL_DONE,
+    DNVME_CTRL_FAILED,
+};
+
+/**
+ * One transition of one controller. dnvme_ctrl_start() writes CC and
+ * returns at once; dnvme_ctrl_poll() reads CSTS only when the back-off
+ * delay has passed, so it can be called from a loop doing other setup
+ * work. The wait is bounded by CAP.TO and ends early on CSTS.CFS.
+ * Latencies of finished transitions are kept per operation.
+ */
+struct dnvme_ctrl_sm {
+    int fd;
+    enum dnvme_ctrl_op op;
+    enum dnvme_ctrl_state state;
+    int ret;                        /* SUCCESS, -EINPROGRESS, -ETIMEDOUT, -EIO on CFS, -ENODEV */
+    uint32_t csts;                  /* last CSTS value read */
+    uint32_t polls;                 /* CSTS reads of the current transition */
+    uint64_t start_ns;
+    uint64_t deadline_ns;
+    uint64_t next_poll_ns;
+    uint64_t backoff_ns;
+    uint64_t timeout_ns;            /* CAP.TO */
+    uint64_t last_ns[DNVME_CTRL_OP_COUNT];
+    uint64_t max_ns[DNVME_CTRL_OP_COUNT];
+    uint32_t count[DNVME_CTRL_OP_COUNT];
+};
+
+int dnvme_ctrl_sm_init(struct dnvme_ctrl_sm *sm, int fd);
+int dnvme_ctrl_start(struct dnvme_ctrl_sm *sm, enum dnvme_ctrl_op op);
+int dnvme_ctrl_poll(struct dnvme_ctrl_sm *sm);
+int dnvme_ctrl_wait(struct dnvme_ctrl_sm *sm);
+const char *dnvme_ctrl_op_name(enum dnvme_ctrl_op op);
+
+#endif
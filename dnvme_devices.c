@@ -0,0 +1,167 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_devices.c
+ * Description: concurrent bring-up of many controllers and a handle table.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "dnvme_devices.h"
+
+struct dnvme_devices_job {
+    struct dnvme_devices *devs;
+    dnvme_device_worker worker;
+    void *arg;
+    uint32_t next;                  /* next entry to hand out */
+    int *results;                   /* per entry, NULL = bring-up, results go to dev->ret */
+};
+
+/* /dev/nvme0 .. /dev/nvme<max-1>, skipping numbers that do not exist. */
+int dnvme_devices_scan(char paths[][DNVME_DEVICE_PATH_LEN], uint32_t max)
+{
+    uint32_t i, count = 0;
+    for (i=0; i<DNVME_DEVICES_MAX && count<max; i++)
+    {
+        snprintf(paths[count], DNVME_DEVICE_PATH_LEN, "/dev/nvme%u", i);
+        if (access(paths[count], F_OK) == 0)
+            count++;
+    }
+    return count;
+}
+
+/* Workers take the next entry until none is left, so a slow controller only holds up its own thread. */
+static void *dnvme_devices_thread(void *arg)
+{
+    struct dnvme_devices_job *job = arg;
+    uint32_t index;
+    while ((index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->devs->count)
+    {
+        struct dnvme_device *dev = &job->devs->dev[index];
+        if (!job->results)
+            dev->ret = job->worker(dev, job->arg);
+        else if (dev->ret == SUCCESS)
+            job->results[index] = job->worker(dev, job->arg);
+    }
+    return NULL;
+}
+
+static void dnvme_devices_dispatch(struct dnvme_devices_job *job)
+{
+    uint32_t nr = job->devs->threads < job->devs->count ? job->devs->threads : job->devs->count;
+    pthread_t threads[DNVME_DEVICES_MAX];
+    uint32_t i, started = 0;
+    for (i=0; i<nr; i++)
+    {
+        if (pthread_create(&threads[i], NULL, dnvme_devices_thread, job) != 0)
+            break;
+        started++;
+    }
+    /*
+     * pthread_create() failing only leaves fewer workers; without a single
+     * one the caller does the work itself, so every entry is still handled.
+     */
+    if (started == 0)
+        dnvme_devices_thread(job);
+    for (i=0; i<started; i++)
+        pthread_join(threads[i], NULL);
+}
+
+static int dnvme_devices_bring_up(struct dnvme_device *dev, void *arg)
+{
+    (void)arg;
+    dev->fd = open_dev(dev->path);
+    if (dev->fd < 0)
+    {
+        int ret = dev->fd;
+        dev->fd = -1;
+        return ret;
+    }
+    return dnvme_init_drive_timed(dev->fd, &dev->init);
+}
+
+/*
+ * Open and initialize 'count' controllers with up to 'threads' of them in
+ * flight at once (0 = all), through open_dev() on the current backend.
+ * 'paths' NULL scans /dev/nvme*. Every entry keeps its own result; the
+ * return value is the number that came up, or a negative errno when
+ * nothing could be attempted.
+ */
+int dnvme_devices_open(struct dnvme_devices *devs, const char *const *paths, uint32_t count, uint32_t threads)
+{
+    char scanned[DNVME_DEVICES_MAX][DNVME_DEVICE_PATH_LEN];
+    struct dnvme_devices_job job = {
+        .devs = devs,
+        .worker = dnvme_devices_bring_up,
+    };
+    uint32_t i;
+
+    memset(devs, 0, sizeof(*devs));
+    if (!paths)
+        count = dnvme_devices_scan(scanned, count && count < DNVME_DEVICES_MAX ? count : DNVME_DEVICES_MAX);
+    if (count == 0 || count > DNVME_DEVICES_MAX)
+        return count ? -E2BIG : -ENODEV;
+    devs->count = count;
+    devs->threads = threads ? threads : count;
+    for (i=0; i<count; i++)
+    {
+        const char *path = paths ? paths[i] : scanned[i];
+        if (strlen(path) >= DNVME_DEVICE_PATH_LEN)
+            return -ENAMETOOLONG;
+        strcpy(devs->dev[i].path, path);
+        devs->dev[i].fd = -1;
+        devs->dev[i].ret = SUCCESS;
+    }
+    dnvme_devices_dispatch(&job);
+    return dnvme_devices_ready(devs);
+}
+
+uint32_t dnvme_devices_ready(const struct dnvme_devices *devs)
+{
+    uint32_t i, ready = 0;
+    for (i=0; i<devs->count; i++)
+    {
+        if (devs->dev[i].ret == SUCCESS)
+            ready++;
+    }
+    return ready;
+}
+
+/* Run 'worker' on every controller that came up, in parallel; returns the first failure in table order. */
+int dnvme_devices_run(struct dnvme_devices *devs, dnvme_device_worker worker, void *arg)
+{
+    struct dnvme_devices_job job = {
+        .devs = devs,
+        .worker = worker,
+        .arg = arg,
+    };
+    uint32_t i;
+    int ret = SUCCESS;
+    job.results = calloc(devs->count, sizeof(*job.results));
+    if (!job.results)
+        return -ENOMEM;
+    dnvme_devices_dispatch(&job);
+    for (i=0; ret == SUCCESS && i<devs->count; i++)
+        ret = job.results[i];
+    free(job.results);
+    return ret;
+}
+
+void dnvme_devices_close(struct dnvme_devices *devs)
+{
+    uint32_t i;
+    for (i=0; i<devs->count; i++)
+    {
+        if (devs->dev[i].fd < 0)
+            continue;
+        close_dev(devs->dev[i].fd);
+        devs->dev[i].fd = -1;
+    }
+    devs->count = 0;
+}
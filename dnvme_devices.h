@@ -0,0 +1,44 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_devices.h
+ * Description: concurrent bring-up of many controllers and a handle table.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_DEVICES_H__
+#define __DNVME_DEVICES_H__
+#include <stdint.h>
+#include "dnvme_commands.h"
+
+#define DNVME_DEVICES_MAX           64
+#define DNVME_DEVICE_PATH_LEN       64
+
+struct dnvme_device {
+    char path[DNVME_DEVICE_PATH_LEN];
+    int fd;                         /* -1 when the open failed */
+    int ret;                        /* SUCCESS, a status_type or a negative errno */
+    struct dnvme_init_stats init;
+};
+
+/**
+ * Handle table of a shelf of controllers. dnvme_devices_open() opens and
+ * initializes every entry on a pool of 'threads' workers, so the CSTS.RDY
+ * waits of all controllers overlap; dnvme_devices_run() fans later work
+ * out over the entries that came up the same way.
+ */
+struct dnvme_devices {
+    uint32_t count;
+    uint32_t threads;
+    struct dnvme_device dev[DNVME_DEVICES_MAX];
+};
+
+typedef int (*dnvme_device_worker)(struct dnvme_device *dev, void *arg);
+
+int dnvme_devices_scan(char paths[][DNVME_DEVICE_PATH_LEN], uint32_t max);
+int dnvme_devices_open(struct dnvme_devices *devs, const char *const *paths, uint32_t count, uint32_t threads);
+uint32_t dnvme_devices_ready(const struct dnvme_devices *devs);
+int dnvme_devices_run(struct dnvme_devices *devs, dnvme_device_worker worker, void *arg);
+void dnvme_devices_close(struct dnvme_devices *devs);
+
+#endif
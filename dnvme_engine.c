@@ -0,0 +1,401 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_engine.c
+ * Description: per-core multi-queue IO engine.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dnvme.h>
+#include "dnvme_engine.h"
+#include "dnvme_commands.h"
+#include "dnvme_adminpipe.h"
+
+struct dnvme_worker_arg {
+    struct dnvme_queue *queue;
+    dnvme_queue_worker worker;
+    void *arg;
+    int ret;
+};
+
+/* Pool and ring memory of one queue; the queue pair itself comes from dnvme_engine_create_queues(). */
+static int dnvme_engine_setup_queue(struct dnvme_queue *queue, const struct dnvme_engine_config *config,
+    uint32_t max_io_size)
+{
+    char name[DNVME_POOL_NAME_LEN];
+    int ret;
+    snprintf(name, sizeof(name), "queue-%d", queue->sq_id);
+    queue->pool = dnvme_pool_create(name, max_io_size, config->pool_cap);
+    if (!queue->pool)
+        return -ENOMEM;
+    ret = dnvme_pool_set_backing(queue->pool, config->backing, config->hugetlbfs);
+    if (ret)
+        return ret;
+    if (!config->contig)
+    {
+        queue->cq_buffer = dnvme_pool_alloc(queue->pool, NVME_IOCQ_ELEMENT_SIZE*queue->depth);
+        if (!queue->cq_buffer)
+            return -ENOMEM;
+        queue->sq_buffer = dnvme_pool_alloc(queue->pool, NVME_IOSQ_ELEMENT_SIZE*queue->depth);
+        if (!queue->sq_buffer)
+            return -ENOMEM;
+    }
+    ret = dnvme_batch_init(&queue->batch, queue->sq_id, queue->depth-1);
+    if (ret)
+        return ret;
+    ret = dnvme_inflight_init(&queue->inflight, queue->sq_id, queue->depth);
+    if (ret)
+        return ret;
+    queue->reap_buffer = calloc(queue->depth, NVME_IOCQ_ELEMENT_SIZE);
+    if (!queue->reap_buffer)
+        return -ENOMEM;
+    return SUCCESS;
+}
+
+static void dnvme_engine_free_queue(struct dnvme_queue *queue)
+{
+    dnvme_batch_free(&queue->batch);
+    dnvme_inflight_free(&queue->inflight);
+    free(queue->reap_buffer);
+    free_buffer(queue->sq_buffer);
+    free_buffer(queue->cq_buffer);
+    if (queue->pool)
+        dnvme_pool_destroy(queue->pool);
+}
+
+/*
+ * Every CQ goes out in one admin flush and every SQ in a second one, the
+ * only ordering the spec asks for, instead of a round trip per command.
+ * A queue counts as created only once its CQE came back with success, so
+ * after a partial failure dnvme_engine_destroy() deletes just those.
+ */
+static int dnvme_engine_create_queues(struct dnvme_engine *engine, const struct dnvme_engine_config *config)
+{
+    struct dnvme_admin_pipe pipe;
+    struct nvme_completion *cqes;
+    uint16_t i;
+    int ret;
+
+    cqes = malloc(engine->nr_queues*sizeof(*cqes));
+    if (!cqes)
+        return -ENOMEM;
+    ret = dnvme_admin_pipe_init(&pipe, engine->fd);
+    if (ret)
+    {
+        free(cqes);
+        return ret;
+    }
+    /* CQEs a flush never filled keep an error status */
+    memset(cqes, 0xFF, engine->nr_queues*sizeof(*cqes));
+    for (i=0; i<engine->nr_queues; i++)
+    {
+        struct dnvme_queue *queue = &engine->queues[i];
+        dnvme_admin_pipe_add(&pipe, dnvme_admin_create_iocq_irq(engine->fd, 0, queue->cq_id,
+            queue->cq_mode == DNVME_CQ_IRQ, queue->vector, queue->depth-1, config->contig, queue->cq_buffer), &cqes[i]);
+    }
+    ret = dnvme_admin_pipe_flush(&pipe);
+    for (i=0; i<engine->nr_queues; i++)
+        engine->queues[i].cq_created = NVME_CQE_STATUS(&cqes[i]) == 0;
+    memset(cqes, 0xFF, engine->nr_queues*sizeof(*cqes));
+    for (i=0; ret == SUCCESS && i<engine->nr_queues; i++)
+    {
+        struct dnvme_queue *queue = &engine->queues[i];
+        dnvme_admin_pipe_add(&pipe, dnvme_admin_create_iosq(engine->fd, 0, queue->sq_id, queue->cq_id,
+            queue->depth-1, config->contig, queue->sq_buffer, queue->qprio >> 1, 0), &cqes[i]);
+    }
+    if (ret == SUCCESS)
+    {
+        ret = dnvme_admin_pipe_flush(&pipe);
+        for (i=0; i<engine->nr_queues; i++)
+            engine->queues[i].sq_created = NVME_CQE_STATUS(&cqes[i]) == 0;
+    }
+    dnvme_admin_pipe_free(&pipe);
+    free(cqes);
+    return ret;
+}
+
+/*
+ * Negotiate the number of IO queues and create one SQ/CQ pair per worker,
+ * each CQ on its own MSI-X vector. Vector 0 stays with the admin CQ. The
+ * controller has to be up with admin queues, as left by init_drive().
+ */
+int dnvme_engine_init(struct dnvme_engine *engine, int fd, const struct dnvme_engine_config *config)
+{
+    uint64_t cap = dnvme_controller_get_cap(fd);
+    uint16_t nr_queues = config->nr_queues;
+    uint32_t depth = config->qdepth ? config->qdepth : DNVME_ENGINE_DEFAULT_QDEPTH;
+    uint32_t max_io_size = config->max_io_size;
+    long nr_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint16_t i;
+    int ret;
+
+    memset(engine, 0, sizeof(*engine));
+    engine->fd = fd;
+    if (nr_queues == 0)
+        nr_queues = nr_cpus;
+    if (depth > NVME_CAP_MQES(cap)+1)
+        depth = NVME_CAP_MQES(cap)+1;
+    if (depth < 2)
+        return -EINVAL;
+    engine->nr_vectors = dnvme_pcie_msix_get_entry_count(fd, dnvme_pcie_msix_capability(fd));
+    engine->max_transfer = dnvme_controller_get_max_transfer(fd);
+    if (max_io_size == 0)
+        max_io_size = engine->max_transfer;
+    ret = dnvme_admin_set_num_queues(fd, nr_queues, nr_queues, &engine->granted_sq, &engine->granted_cq);
+    if (ret)
+        return ret;
+    if (nr_queues > engine->granted_sq)
+        nr_queues = engine->granted_sq;
+    if (nr_queues > engine->granted_cq)
+        nr_queues = engine->granted_cq;
+    engine->queues = calloc(nr_queues, sizeof(struct dnvme_queue));
+    if (!engine->queues)
+        return -ENOMEM;
+    for (i=0; i<nr_queues; i++)
+    {
+        struct dnvme_queue *queue = &engine->queues[i];
+        queue->fd = fd;
+        queue->index = i;
+        queue->sq_id = i+1;
+        queue->cq_id = i+1;
+        queue->vector = config->vectors ? config->vectors[i] : i+1;
+        queue->depth = depth;
+        queue->qprio = config->qprio ? config->qprio[i] : NVME_SQ_PRIO_MEDIUM;
+        queue->cq_mode = config->cq_mode;
+        queue->timeout_ms = (NVME_CAP_TIMEOUT(cap) ? NVME_CAP_TIMEOUT(cap) : 1)*500;
+        queue->cpu = config->cpus ? config->cpus[i] : i%nr_cpus;
+        if (queue->cq_mode == DNVME_CQ_IRQ && queue->vector >= engine->nr_vectors)
+        {
+            fprintf(stderr, "Queue %d vector %d exceeds MSI-X table size %d\n", i, queue->vector, engine->nr_vectors);
+            ret = -EINVAL;
+            break;
+        }
+        ret = dnvme_engine_setup_queue(queue, config, max_io_size);
+        if (ret)
+        {
+            dnvme_engine_free_queue(queue);
+            break;
+        }
+        engine->nr_queues++;
+    }
+    if (ret == SUCCESS)
+        ret = dnvme_engine_create_queues(engine, config);
+    if (ret)
+        dnvme_engine_destroy(engine);
+    return ret;
+}
+
+void dnvme_engine_destroy(struct dnvme_engine *engine)
+{
+    struct nvme_completion cqe;
+    uint16_t i;
+    for (i=0; i<engine->nr_queues; i++)
+    {
+        struct dnvme_queue *queue = &engine->queues[i];
+        if (queue->sq_created && dnvme_admin_delete_iosq(engine->fd, 0, queue->sq_id) == 0)
+            dnvme_admin_complete(engine->fd, &cqe);
+        if (queue->cq_created && dnvme_admin_delete_iocq(engine->fd, 0, queue->cq_id) == 0)
+            dnvme_admin_complete(engine->fd, &cqe);
+        dnvme_engine_free_queue(queue);
+    }
+    free(engine->queues);
+    engine->queues = NULL;
+    engine->nr_queues = 0;
+}
+
+struct dnvme_queue *dnvme_engine_queue(struct dnvme_engine *engine, uint16_t index)
+{
+    if (index >= engine->nr_queues)
+        return NULL;
+    return &engine->queues[index];
+}
+
+static void *dnvme_engine_thread(void *data)
+{
+    struct dnvme_worker_arg *worker = data;
+    struct dnvme_queue *queue = worker->queue;
+    cpu_set_t cpus;
+    if (queue->cpu >= 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(queue->cpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    dnvme_pool_set_thread(queue->pool);
+    worker->ret = worker->worker(queue, worker->arg);
+    return NULL;
+}
+
+/* Run 'worker' once per queue, each on its own pinned thread, and wait for all of them. */
+int dnvme_engine_run(struct dnvme_engine *engine, dnvme_queue_worker worker, void *arg)
+{
+    struct dnvme_worker_arg *workers;
+    pthread_t *threads;
+    uint16_t i;
+    uint16_t started = 0;
+    int ret = SUCCESS;
+
+    workers = calloc(engine->nr_queues, sizeof(*workers));
+    threads = calloc(engine->nr_queues, sizeof(*threads));
+    if (!workers || !threads)
+    {
+        free(workers);
+        free(threads);
+        return -ENOMEM;
+    }
+    for (i=0; i<engine->nr_queues; i++)
+    {
+        workers[i].queue = &engine->queues[i];
+        workers[i].worker = worker;
+        workers[i].arg = arg;
+        ret = -pthread_create(&threads[i], NULL, dnvme_engine_thread, &workers[i]);
+        if (ret)
+            break;
+        started++;
+    }
+    for (i=0; i<started; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (ret == SUCCESS)
+            ret = workers[i].ret;
+    }
+    free(workers);
+    free(threads);
+    return ret;
+}
+
+/*
+ * Submit the commands collected in queue->batch and track them in the
+ * in-flight table. Returns how many went out: ctx[0] up to that count get
+ * their callback, the rest were never sent and belong to the caller again.
+ * A send or tracking error is stored in 'error', 0 when there was none.
+ */
+int dnvme_queue_submit(struct dnvme_queue *queue, dnvme_cmd_callback callback, void **ctx, int *error)
+{
+    int ret = dnvme_batch_submit(queue->fd, &queue->batch);
+    int err = dnvme_inflight_add_batch(&queue->inflight, &queue->batch, callback, ctx);
+    int submitted = queue->batch.submitted;
+    dnvme_batch_reset(&queue->batch);
+    queue->submit_ns = dnvme_get_time_ns();
+    *error = ret < 0 ? ret : err;
+    return submitted;
+}
+
+/* Reap whatever is waiting on the CQ and dispatch it, returns the number reaped. */
+int dnvme_queue_reap(struct dnvme_queue *queue)
+{
+    uint32_t remaining;
+    int reaped, total = 0;
+    do
+    {
+        reaped = dnvme_cq_reap_direct(queue->fd, queue->cq_id, queue->reap_buffer, queue->depth, &remaining);
+        queue->reaps++;
+        if (reaped < 0)
+            return reaped;
+        dnvme_inflight_dispatch(&queue->inflight, queue->reap_buffer, reaped);
+        total += reaped;
+    } while (reaped && remaining);
+    return total;
+}
+
+/* Running mean over the last ~8 samples; a sample stretched by preemption moves it by at most 1/8. */
+static void dnvme_queue_learn(uint64_t *mean, uint64_t sample)
+{
+    if (*mean == 0)
+        *mean = sample;
+    else
+        *mean += ((int64_t)(sample < 2**mean ? sample : 2**mean) - (int64_t)*mean)/8;
+}
+
+/*
+ * Spin on reap until 'expected' completions were dispatched. A hybrid
+ * queue first sleeps until half of its mean service time has passed since
+ * the last submission, when the answer is unlikely to be there yet. Sleeps
+ * shorter than the timer overshoot are skipped, and only completions that
+ * were not already waiting after the sleep count towards the mean, so an
+ * oversleep cannot inflate the next sleep.
+ */
+static int dnvme_queue_poll(struct dnvme_queue *queue, uint16_t expected, uint32_t timeout_ms)
+{
+    uint64_t start = dnvme_get_time_ns();
+    uint64_t deadline = start + (uint64_t)timeout_ms*1000000;
+    uint64_t elapsed = start - queue->submit_ns;
+    uint64_t sleep_ns = 0;
+    uint32_t polls = 0;
+    struct timespec delay;
+    int reaped = 0;
+    int ret;
+
+    if (queue->cq_mode == DNVME_CQ_HYBRID && queue->service_ns/2 > elapsed + queue->oversleep_ns)
+    {
+        sleep_ns = queue->service_ns/2 - elapsed - queue->oversleep_ns;
+        delay.tv_sec = sleep_ns/1000000000;
+        delay.tv_nsec = sleep_ns%1000000000;
+        nanosleep(&delay, NULL);
+        elapsed = dnvme_get_time_ns() - start;
+        dnvme_queue_learn(&queue->oversleep_ns, elapsed > sleep_ns ? elapsed - sleep_ns : 1);
+        queue->sleeps++;
+    }
+    for (;;)
+    {
+        ret = dnvme_queue_reap(queue);
+        polls++;
+        if (ret < 0)
+            return ret;
+        reaped += ret;
+        if (reaped >= (expected ? expected : 1))
+            break;
+        if (dnvme_get_time_ns() >= deadline)
+            return -ETIMEDOUT;
+    }
+    if (queue->cq_mode == DNVME_CQ_HYBRID && (sleep_ns == 0 || polls > 1))
+        dnvme_queue_learn(&queue->service_ns, dnvme_get_time_ns() - queue->submit_ns);
+    return reaped;
+}
+
+/*
+ * Dispatch at least 'expected' completions, returns how many were. An
+ * interrupt driven queue tries a reap first, which at high IOPS finds
+ * enough already, and only falls back to the inquiry back-off wait when
+ * it did not.
+ */
+int dnvme_queue_wait(struct dnvme_queue *queue, uint16_t expected, uint32_t timeout_ms)
+{
+    struct dnvme_wait_stats stats;
+    int reaped, ret;
+    if (timeout_ms == 0)
+        timeout_ms = queue->timeout_ms;
+    if (expected == 0)
+        expected = 1;
+    if (queue->cq_mode != DNVME_CQ_IRQ)
+        return dnvme_queue_poll(queue, expected, timeout_ms);
+    reaped = dnvme_queue_reap(queue);
+    if (reaped < 0 || reaped >= expected)
+        return reaped;
+    ret = dnvme_cq_wait(queue->fd, queue->cq_id, expected-reaped, timeout_ms, &stats);
+    queue->polls += stats.inquiries;
+    queue->sleeps += stats.sleeps;
+    if (ret < 0)
+        return ret;
+    ret = dnvme_queue_reap(queue);
+    return ret < 0 ? ret : reaped+ret;
+}
+
+const char *dnvme_cq_mode_name(enum dnvme_cq_mode mode)
+{
+    static const char *names[DNVME_CQ_MODES] = {
+        [DNVME_CQ_IRQ] = "irq",
+        [DNVME_CQ_POLLED] = "polled",
+        [DNVME_CQ_HYBRID] = "hybrid",
+    };
+    return mode < DNVME_CQ_MODES ? names[mode] : "unknown";
+}
@@ -0,0 +1,94 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_engine.h
+ * Description: per-core multi-queue IO engine.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_ENGINE_H__
+#define __DNVME_ENGINE_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+#include "dnvme_batch.h"
+#include "dnvme_inflight.h"
+#include "dnvme_pool.h"
+
+#define DNVME_ENGINE_DEFAULT_QDEPTH     256
+
+enum dnvme_cq_mode {
+    DNVME_CQ_IRQ,               /* interrupt driven CQ, waits back off into sleeps */
+    DNVME_CQ_POLLED,            /* CQ without interrupts, waits spin */
+    DNVME_CQ_HYBRID,            /* CQ without interrupts, waits sleep part of the service time, then spin */
+    DNVME_CQ_MODES
+};
+
+struct dnvme_engine_config {
+    uint16_t nr_queues;         /* SQ/CQ pairs, 0 = one per online CPU */
+    uint16_t qdepth;            /* entries per queue, 0 = default */
+    uint8_t contig;             /* let the driver allocate contiguous queues */
+    const uint16_t *vectors;    /* MSI-X vector per queue, NULL = queue index+1 */
+    const int *cpus;            /* CPU per worker, NULL = queue index */
+    const uint8_t *qprio;       /* NVME_SQ_PRIO_* per SQ, NULL = medium; only honoured under WRR arbitration */
+    uint8_t cq_mode;            /* enum dnvme_cq_mode of every queue */
+    uint32_t max_io_size;       /* largest pooled data buffer, 0 = MDTS */
+    uint64_t pool_cap;          /* buffer memory per queue, 0 = unlimited */
+    uint8_t backing;            /* enum dnvme_pool_backing of the queue pools */
+    const char *hugetlbfs;      /* hugetlbfs mount for hugepage backing, NULL = MAP_HUGETLB */
+};
+
+/**
+ * One IO SQ/CQ pair owned by exactly one worker thread. Nothing in here is
+ * shared between queues, so submission and completion need no locking.
+ */
+struct dnvme_queue {
+    int fd;
+    uint16_t index;             /* position in the engine */
+    uint16_t sq_id;
+    uint16_t cq_id;
+    uint16_t vector;            /* MSI-X vector of the CQ */
+    uint16_t depth;             /* entries in SQ and CQ */
+    uint8_t qprio;              /* NVME_SQ_PRIO_* of the SQ */
+    uint8_t cq_mode;            /* enum dnvme_cq_mode */
+    uint8_t cq_created;         /* the controller completed Create IOCQ successfully */
+    uint8_t sq_created;         /* the controller completed Create IOSQ successfully */
+    uint64_t submit_ns;         /* last dnvme_queue_submit() */
+    uint64_t service_ns;        /* hybrid: running mean of submit to completion */
+    uint64_t oversleep_ns;      /* hybrid: running mean of how much longer sleeps take than asked */
+    uint64_t polls;             /* reap inquiries issued by waits */
+    uint64_t reaps;             /* reap ioctls */
+    uint64_t sleeps;            /* sleeps taken by waits */
+    int cpu;                    /* CPU the worker is pinned to, -1 = none */
+    uint32_t timeout_ms;        /* completion timeout derived from CAP.TO */
+    void *sq_buffer;            /* user memory for non-contiguous SQ */
+    void *cq_buffer;            /* user memory for non-contiguous CQ */
+    uint8_t *reap_buffer;       /* room for 'depth' CQEs */
+    struct dnvme_batch batch;
+    struct dnvme_inflight inflight;
+    struct dnvme_pool *pool;    /* data buffers of this queue, current pool of its worker */
+    void *priv;                 /* owned by the worker */
+};
+
+struct dnvme_engine {
+    int fd;
+    uint16_t nr_queues;
+    uint16_t granted_sq;        /* IO SQs allocated by the controller */
+    uint16_t granted_cq;        /* IO CQs allocated by the controller */
+    uint16_t nr_vectors;        /* MSI-X table size */
+    uint32_t max_transfer;      /* MDTS in bytes, 0 = no limit */
+    struct dnvme_queue *queues;
+};
+
+typedef int (*dnvme_queue_worker)(struct dnvme_queue *queue, void *arg);
+
+int dnvme_engine_init(struct dnvme_engine *engine, int fd, const struct dnvme_engine_config *config);
+void dnvme_engine_destroy(struct dnvme_engine *engine);
+struct dnvme_queue *dnvme_engine_queue(struct dnvme_engine *engine, uint16_t index);
+int dnvme_engine_run(struct dnvme_engine *engine, dnvme_queue_worker worker, void *arg);
+
+int dnvme_queue_submit(struct dnvme_queue *queue, dnvme_cmd_callback callback, void **ctx, int *error);
+int dnvme_queue_reap(struct dnvme_queue *queue);
+int dnvme_queue_wait(struct dnvme_queue *queue, uint16_t expected, uint32_t timeout_ms);
+const char *dnvme_cq_mode_name(enum dnvme_cq_mode mode);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_inflight.c
+ * Description: in-flight command table keyed on unique_id.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_inflight.h"
+#include "dnvme_commands.h"
+
+/* The table is kept at most half full so probe sequences stay short. */
+int dnvme_inflight_init(struct dnvme_inflight *table, uint16_t q_id, uint32_t depth)
+{
+    uint32_t size = 16;
+    memset(table, 0, sizeof(*table));
+    while (size < depth*2)
+        size <<= 1;
+    table->entries = calloc(size, sizeof(struct dnvme_inflight_entry));
+    if (!table->entries)
+        return -ENOMEM;
+    table->q_id = q_id;
+    table->mask = size-1;
+    return SUCCESS;
+}
+
+void dnvme_inflight_free(struct dnvme_inflight *table)
+{
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
+
+int dnvme_inflight_add(struct dnvme_inflight *table, uint16_t cid, dnvme_cmd_callback callback, void *ctx)
+{
+    uint32_t idx = cid & table->mask;
+    struct dnvme_inflight_entry *entry;
+    if (table->count >= (table->mask+1)/2)
+        return -ENOSPC;
+    for (;;)
+    {
+        entry = &table->entries[idx];
+        if (!entry->used)
+            break;
+        if (entry->cid == cid)
+            return -EEXIST;
+        idx = (idx+1) & table->mask;
+    }
+    entry->callback = callback;
+    entry->ctx = ctx;
+    entry->submit_ns = dnvme_get_time_ns();
+    entry->cid = cid;
+    entry->used = 1;
+    table->count++;
+    return SUCCESS;
+}
+
+/* Register every command a submitted batch handed to the driver, ctx is indexed like the batch. */
+int dnvme_inflight_add_batch(struct dnvme_inflight *table, const struct dnvme_batch *batch, dnvme_cmd_callback callback,
+    void **ctx)
+{
+    uint16_t i;
+    int ret;
+    for (i=0; i<batch->submitted; i++)
+    {
+        ret = dnvme_inflight_add(table, batch->unique_ids[i], callback, ctx ? ctx[i] : NULL);
+        if (ret)
+            return ret;
+    }
+    return SUCCESS;
+}
+
+struct dnvme_inflight_entry *dnvme_inflight_find(struct dnvme_inflight *table, uint16_t cid)
+{
+    uint32_t idx = cid & table->mask;
+    struct dnvme_inflight_entry *entry;
+    for (;;)
+    {
+        entry = &table->entries[idx];
+        if (!entry->used)
+            return NULL;
+        if (entry->cid == cid)
+            return entry;
+        idx = (idx+1) & table->mask;
+    }
+}
+
+/* Backward shift deletion keeps every probe chain intact without tombstones. */
+static void dnvme_inflight_remove(struct dnvme_inflight *table, struct dnvme_inflight_entry *entry)
+{
+    uint32_t hole = entry - table->entries;
+    uint32_t idx = hole;
+    uint32_t home;
+    for (;;)
+    {
+        idx = (idx+1) & table->mask;
+        entry = &table->entries[idx];
+        if (!entry->used)
+            break;
+        home = entry->cid & table->mask;
+        if (((idx - home) & table->mask) >= ((idx - hole) & table->mask))
+        {
+            table->entries[hole] = *entry;
+            hole = idx;
+        }
+    }
+    table->entries[hole].used = 0;
+    table->count--;
+}
+
+/* Hand one CQE to its callback and retire the entry, -ENOENT if nothing matches. */
+int dnvme_inflight_complete(struct dnvme_inflight *table, const struct nvme_completion *cqe)
+{
+    struct dnvme_inflight_entry *entry;
+    struct dnvme_inflight_entry done;
+    if (cqe->sq_id != table->q_id)
+        entry = NULL;
+    else
+        entry = dnvme_inflight_find(table, cqe->command_id);
+    if (!entry)
+    {
+        table->orphans++;
+        return -ENOENT;
+    }
+    done = *entry;
+    dnvme_inflight_remove(table, entry);
+    if (done.callback)
+        done.callback(done.ctx, cqe, dnvme_get_time_ns() - done.submit_ns);
+    return SUCCESS;
+}
+
+/* Dispatch 'count' reaped CQEs, returns the number matched to a command. */
+int dnvme_inflight_dispatch(struct dnvme_inflight *table, const uint8_t *buffer, uint32_t count)
+{
+    const struct nvme_completion *cqe = (const struct nvme_completion *)buffer;
+    uint32_t i;
+    int matched = 0;
+    for (i=0; i<count; i++)
+    {
+        if (dnvme_inflight_complete(table, &cqe[i]) == SUCCESS)
+            matched++;
+    }
+    return matched;
+}
@@ -0,0 +1,46 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_inflight.h
+ * Description: in-flight command table keyed on unique_id.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_INFLIGHT_H__
+#define __DNVME_INFLIGHT_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+#include "dnvme_batch.h"
+
+typedef void (*dnvme_cmd_callback)(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns);
+
+struct dnvme_inflight_entry {
+    dnvme_cmd_callback callback;    /* invoked once the CQE is reaped */
+    void *ctx;                      /* caller context handed to callback */
+    uint64_t submit_ns;             /* dnvme_get_time_ns() at submission */
+    uint16_t cid;                   /* unique_id returned by the driver */
+    uint8_t used;
+};
+
+/**
+ * Open-addressed table of outstanding commands of one SQ. The slot is picked
+ * by the low bits of the command id and collisions are linearly probed.
+ */
+struct dnvme_inflight {
+    uint16_t q_id;                  /* SQ the commands were issued to */
+    uint32_t mask;                  /* table size - 1, size is a power of 2 */
+    uint32_t count;                 /* commands currently outstanding */
+    uint64_t orphans;               /* CQEs without a matching entry */
+    struct dnvme_inflight_entry *entries;
+};
+
+int dnvme_inflight_init(struct dnvme_inflight *table, uint16_t q_id, uint32_t depth);
+void dnvme_inflight_free(struct dnvme_inflight *table);
+int dnvme_inflight_add(struct dnvme_inflight *table, uint16_t cid, dnvme_cmd_callback callback, void *ctx);
+int dnvme_inflight_add_batch(struct dnvme_inflight *table, const struct dnvme_batch *batch, dnvme_cmd_callback callback,
+    void **ctx);
+struct dnvme_inflight_entry *dnvme_inflight_find(struct dnvme_inflight *table, uint16_t cid);
+int dnvme_inflight_complete(struct dnvme_inflight *table, const struct nvme_completion *cqe);
+int dnvme_inflight_dispatch(struct dnvme_inflight *table, const uint8_t *buffer, uint32_t count);
+
+#endif
@@ -18,10 +18,91 @@
 #include <sys/stat.h>
 #include "inc/dnvme_interface.h"
 #include "dnvme_ioctrl.h"
+#include "dnvme_trace.h"
+
+/* The dnvme driver shows up as a character device; anything else is not a controller. */
+static int ioctl_backend_open(const char *path)
+{
+    struct stat nvme_stat;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    if (fstat(fd, &nvme_stat) < 0 || (!S_ISCHR(nvme_stat.st_mode) && !S_ISBLK(nvme_stat.st_mode)))
+    {
+        close(fd);
+        return -ENODEV;
+    }
+    return fd;
+}
+
+static void ioctl_backend_close(int fd)
+{
+    close(fd);
+}
+
+static int ioctl_backend_ioctl(int fd, unsigned long request, void *arg)
+{
+    return ioctl(fd, request, arg);
+}
+
+const struct dnvme_backend_ops dnvme_ioctl_backend = {
+    .name = "dnvme",
+    .open = ioctl_backend_open,
+    .close = ioctl_backend_close,
+    .ioctl = ioctl_backend_ioctl,
+};
+
+static const struct dnvme_backend_ops *ioctl_backend = &dnvme_ioctl_backend;
+
+/* Route every request to 'ops' from now on, NULL restores the dnvme driver. */
+void ioctl_set_backend(const struct dnvme_backend_ops *ops)
+{
+    ioctl_backend = ops ? ops : &dnvme_ioctl_backend;
+}
+
+const struct dnvme_backend_ops *ioctl_get_backend(void)
+{
+    return ioctl_backend;
+}
+
+int ioctl_dispatch(int fd, unsigned long request, void *arg)
+{
+    return ioctl_backend->ioctl(fd, request, arg);
+}
+
+/* unique_id the driver gave the last command this thread sent, see ioctl_last_unique_id(). */
+static __thread uint16_t last_unique_id;
 
 int ioctl_send_command(int fd, struct nvme_64b_send *cmd)
 {
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, cmd);
+    int ret = ioctl_dispatch(fd, NVME_IOCTL_SEND_64B_CMD, cmd);
+    if (ret == 0)
+    {
+        last_unique_id = cmd->unique_id;
+        dnvme_trace_sqe(cmd->q_id, cmd->unique_id, cmd->cmd_buf_ptr);
+    }
+    return ret;
+}
+
+/* Lets callers of the ioctl_* wrappers, which keep the send descriptor local, match the CQE later. */
+uint16_t ioctl_last_unique_id(void)
+{
+    return last_unique_id;
+}
+
+int ioctl_device_state(int fd, enum nvme_state state)
+{
+    return ioctl_dispatch(fd, NVME_IOCTL_DEVICE_STATE, (void *)(uintptr_t)state);
+}
+
+int ioctl_read_generic(int fd, struct rw_generic *param)
+{
+    return ioctl_dispatch(fd, NVME_IOCTL_READ_GENERIC, param);
+}
+
+int ioctl_write_generic(int fd, struct rw_generic *param)
+{
+    return ioctl_dispatch(fd, NVME_IOCTL_WRITE_GENERIC, param);
 }
 
 int ioctl_create_admin_cq(int fd)
@@ -30,7 +111,7 @@ int ioctl_create_admin_cq(int fd)
         .type = ADMIN_CQ,
         .elements = NVME_QUEUE_ELEMENTS,
     };
-    return ioctl(fd, NVME_IOCTL_CREATE_ADMN_Q, &cmd);
+    return ioctl_dispatch(fd, NVME_IOCTL_CREATE_ADMN_Q, &cmd);
 }
 
 int ioctl_create_admin_sq(int fd)
@@ -39,34 +120,35 @@ int ioctl_create_admin_sq(int fd)
         .type = ADMIN_SQ,
         .elements = NVME_QUEUE_ELEMENTS,
     };
-    return ioctl(fd, NVME_IOCTL_CREATE_ADMN_Q, &cmd);
+    return ioctl_dispatch(fd, NVME_IOCTL_CREATE_ADMN_Q, &cmd);
 }
 
 int ioctl_create_iocq(int fd, struct nvme_admin_cmd *cmd, uint8_t *buffer)
 {
     int ret = 0;
+    /* QSIZE is 0's based, the driver wants the real number of entries */
     struct nvme_prep_cq prep_cmd = {
-        .elements = cmd->cdw10.create_iosq.qsize,
-        .cq_id = cmd->cdw10.create_iosq.qid,
-        .contig = cmd->cdw11.create_iosq.contig,
+        .elements = cmd->cdw10.create_iocq.qsize+1,
+        .cq_id = cmd->cdw10.create_iocq.qid,
+        .contig = cmd->cdw11.create_iocq.contig,
     };
     struct nvme_64b_send user_cmd = {
         .q_id = 0,
         .bit_mask = MASK_PRP1_LIST,
         .cmd_buf_ptr = (uint8_t *)cmd,
-        .data_buf_size = cmd->cdw10.create_iocq.qsize*NVME_IOCQ_ELEMENT_SIZE,
+        .data_buf_size = (cmd->cdw10.create_iocq.qsize+1)*NVME_IOCQ_ELEMENT_SIZE,
         .data_buf_ptr = buffer,
         .data_dir = DATA_DIR_NONE,
     };
-    if (cmd->cdw11.create_iosq.contig) {
+    if (cmd->cdw11.create_iocq.contig) {
         user_cmd.bit_mask = MASK_PRP1_PAGE;
         user_cmd.data_buf_size = 0;
         user_cmd.data_buf_ptr = NULL;
     }
-    ret = ioctl(fd, NVME_IOCTL_PREPARE_CQ_CREATION, &prep_cmd);
+    ret = ioctl_dispatch(fd, NVME_IOCTL_PREPARE_CQ_CREATION, &prep_cmd);
     if (ret)
         return ret;
-    ret = ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    ret = ioctl_send_command(fd, &user_cmd);
     return ret;
 }
 
@@ -74,7 +156,7 @@ int ioctl_create_iosq(int fd, struct nvme_admin_cmd *cmd, uint8_t *buffer)
 {
     int ret = 0;
     struct nvme_prep_sq prep_cmd = {
-        .elements = cmd->cdw10.create_iosq.qsize,
+        .elements = cmd->cdw10.create_iosq.qsize+1,
         .sq_id = cmd->cdw10.create_iosq.qid,
         .cq_id = cmd->cdw11.create_iosq.cq_id,
         .contig = cmd->cdw11.create_iosq.contig,
@@ -83,7 +165,7 @@ int ioctl_create_iosq(int fd, struct nvme_admin_cmd *cmd, uint8_t *buffer)
         .q_id = 0,
         .bit_mask = MASK_PRP1_LIST,
         .cmd_buf_ptr = (uint8_t *)cmd,
-        .data_buf_size = cmd->cdw10.create_iosq.qsize*NVME_IOSQ_ELEMENT_SIZE,
+        .data_buf_size = (cmd->cdw10.create_iosq.qsize+1)*NVME_IOSQ_ELEMENT_SIZE,
         .data_buf_ptr = buffer,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
@@ -92,10 +174,10 @@ int ioctl_create_iosq(int fd, struct nvme_admin_cmd *cmd, uint8_t *buffer)
         user_cmd.data_buf_size = 0;
         user_cmd.data_buf_ptr = NULL;
     }
-    ret = ioctl(fd, NVME_IOCTL_PREPARE_SQ_CREATION, &prep_cmd);
+    ret = ioctl_dispatch(fd, NVME_IOCTL_PREPARE_SQ_CREATION, &prep_cmd);
     if (ret)
         return ret;
-    ret = ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    ret = ioctl_send_command(fd, &user_cmd);
     return ret;
 }
 
@@ -106,7 +188,7 @@ int ioctl_delete_ioq(int fd, struct nvme_admin_cmd *cmd)
         .bit_mask = MASK_NON_PRP,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_get_log_page(int fd, struct nvme_admin_cmd *cmd)
@@ -119,7 +201,7 @@ int ioctl_get_log_page(int fd, struct nvme_admin_cmd *cmd)
         .data_buf_ptr = NULL,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_identify(int fd, struct nvme_admin_cmd *cmd)
@@ -132,7 +214,7 @@ int ioctl_identify(int fd, struct nvme_admin_cmd *cmd)
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_abort(int fd, struct nvme_admin_cmd *cmd)
@@ -141,7 +223,7 @@ int ioctl_abort(int fd, struct nvme_admin_cmd *cmd)
         .q_id = 0,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_set_feature(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
@@ -154,7 +236,7 @@ int ioctl_set_feature(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_TO_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_get_feature(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
@@ -167,7 +249,7 @@ int ioctl_get_feature(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_async_event_request(int fd, struct nvme_admin_cmd *cmd)
@@ -176,12 +258,12 @@ int ioctl_async_event_request(int fd, struct nvme_admin_cmd *cmd)
         .q_id = 0,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_set_irq(int fd, struct interrupts *irq)
 {
-    return ioctl(fd, NVME_IOCTL_SET_IRQ, irq);
+    return ioctl_dispatch(fd, NVME_IOCTL_SET_IRQ, irq);
 }
 
 int ioctl_firmware_commit(int fd, struct nvme_admin_cmd *cmd)
@@ -190,7 +272,7 @@ int ioctl_firmware_commit(int fd, struct nvme_admin_cmd *cmd)
         .q_id = 0,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_firmware_download(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
@@ -203,7 +285,7 @@ int ioctl_firmware_download(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_TO_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_device_self_test(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
@@ -216,7 +298,7 @@ int ioctl_device_self_test(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_s
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_format_nvm(int fd, struct nvme_admin_cmd *cmd)
@@ -225,7 +307,7 @@ int ioctl_format_nvm(int fd, struct nvme_admin_cmd *cmd)
         .q_id = 0,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_sanitize(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
@@ -238,7 +320,7 @@ int ioctl_sanitize(int fd, struct nvme_admin_cmd *cmd, uint32_t buffer_size)
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_TO_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_compare(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
@@ -251,7 +333,7 @@ int ioctl_compare(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_dataset_management(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
@@ -264,7 +346,7 @@ int ioctl_dataset_management(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_si
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_TO_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_flush(int fd, struct nvme_io_cmd *cmd, uint16_t qid)
@@ -273,7 +355,7 @@ int ioctl_flush(int fd, struct nvme_io_cmd *cmd, uint16_t qid)
         .q_id = qid,
         .cmd_buf_ptr = (uint8_t *)cmd,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_read(int fd, struct nvme_io_cmd *cmd, uint8_t *buffer, uint32_t buffer_size, uint16_t qid)
@@ -286,7 +368,7 @@ int ioctl_read(int fd, struct nvme_io_cmd *cmd, uint8_t *buffer, uint32_t buffer
         .data_buf_ptr = buffer,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_verify(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
@@ -299,7 +381,7 @@ int ioctl_verify(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_write(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
@@ -312,7 +394,7 @@ int ioctl_write(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_write_uncorrectable(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
@@ -325,25 +407,22 @@ int ioctl_write_uncorrectable(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_s
         .data_buf_ptr = (uint8_t *)cmd->prp1,
         .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
-int ioctl_write_zeros(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid)
+/* Write Zeroes carries no data. */
+int ioctl_write_zeros(int fd, struct nvme_io_cmd *cmd, uint16_t qid)
 {
     struct nvme_64b_send user_cmd = {
         .q_id = qid,
-        .bit_mask = MASK_PRP1_PAGE,
         .cmd_buf_ptr = (uint8_t *)cmd,
-        .data_buf_size = buffer_size,
-        .data_buf_ptr = (uint8_t *)cmd->prp1,
-        .data_dir = DATA_DIR_FROM_DEVICE,
     };
-    return ioctl(fd, NVME_IOCTL_SEND_64B_CMD, &user_cmd);
+    return ioctl_send_command(fd, &user_cmd);
 }
 
 int ioctl_ring_doorbell(int fd, uint16_t sq_id)
 {
-    int ret = ioctl(fd, NVME_IOCTL_RING_SQ_DOORBELL, sq_id);
+    int ret = ioctl_dispatch(fd, NVME_IOCTL_RING_SQ_DOORBELL, (void *)(uintptr_t)sq_id);
     if (ret < 0) {
         printf("Ring doorbell failed.\n");
     }
@@ -356,15 +435,28 @@ int ioctl_cq_remain(int fd, uint16_t q_id)
     struct nvme_reap_inquiry inquiry = {
         .q_id = q_id,
     };
-    ret = ioctl(fd, NVME_IOCTL_REAP_INQUIRY, &inquiry);
-    if (ret < 0) {
-        printf("Reap inquiry failed");
-    } else {
+    ret = ioctl_dispatch(fd, NVME_IOCTL_REAP_INQUIRY, &inquiry);
+    if (ret == 0)
         ret = inquiry.num_remaining;
-    }
     return ret;
 }
 
+int ioctl_cq_inquiry(int fd, struct nvme_reap_inquiry *inquiry)
+{
+    return ioctl_dispatch(fd, NVME_IOCTL_REAP_INQUIRY, inquiry);
+}
+
+int ioctl_get_sq_metrics(int fd, uint16_t sq_id, struct nvme_gen_sq *sq)
+{
+    struct nvme_get_q_metrics metrics = {
+        .q_id = sq_id,
+        .type = METRICS_SQ,
+        .nBytes = sizeof(struct nvme_gen_sq),
+        .buffer = (uint8_t *)sq,
+    };
+    return ioctl_dispatch(fd, NVME_IOCTL_GET_Q_METRICS, &metrics);
+}
+
 int ioctl_cq_reap(int fd, uint16_t q_id, uint16_t remaining, uint8_t *buffer, uint32_t size)
 {
     struct nvme_reap reap = {
@@ -373,7 +465,19 @@ int ioctl_cq_reap(int fd, uint16_t q_id, uint16_t remaining, uint8_t *buffer, ui
         .buffer = buffer,
         .size = size,
     };
-    return ioctl(fd, NVME_IOCTL_REAP, &reap);
+    int ret = ioctl_dispatch(fd, NVME_IOCTL_REAP, &reap);
+    if (ret == 0)
+        dnvme_trace_cqes(q_id, buffer, reap.num_reaped);
+    return ret;
+}
+
+/* Reap with the caller's struct so num_reaped, num_remaining and isr_count come back. */
+int ioctl_cq_reap_into(int fd, struct nvme_reap *reap)
+{
+    int ret = ioctl_dispatch(fd, NVME_IOCTL_REAP, reap);
+    if (ret == 0)
+        dnvme_trace_cqes(reap->q_id, reap->buffer, reap->num_reaped);
+    return ret;
 }
 
 void ioctl_drive_metrics(int fd)
@@ -381,7 +485,7 @@ void ioctl_drive_metrics(int fd)
     struct metrics_driver get_drv_metrics;
     int ret = -1;
 
-    ret = ioctl(fd, NVME_IOCTL_GET_DRIVER_METRICS, &get_drv_metrics);
+    ret = ioctl_dispatch(fd, NVME_IOCTL_GET_DRIVER_METRICS, &get_drv_metrics);
     if (ret < 0) {
         printf("\tDrive metrics failed!\n");
     }
@@ -394,7 +498,7 @@ void ioctl_device_metrics(int fd)
     struct public_metrics_dev get_dev_metrics;
     int ret = -1;
 
-    ret = ioctl(fd, NVME_IOCTL_GET_DEVICE_METRICS, &get_dev_metrics);
+    ret = ioctl_dispatch(fd, NVME_IOCTL_GET_DEVICE_METRICS, &get_dev_metrics);
     if (ret < 0) {
         printf("\tDevice metrics failed!\n");
     }
@@ -13,7 +13,31 @@
 #include "inc/dnvme_ioctls.h"
 #include "inc/dnvme_interface.h"
 
+/**
+ * What the ioctl_* wrappers talk to: the dnvme driver through ioctl(), or
+ * an in-process stand-in such as the simulated controller. Every request
+ * goes through the current backend, so the library above cannot tell them
+ * apart. open() returns an fd or a negative errno and is reached through
+ * open_dev(), close() through close_dev(). ioctl() follows the ioctl(2)
+ * contract: -1 with errno on failure.
+ */
+struct dnvme_backend_ops {
+    const char *name;
+    int (*open)(const char *path);
+    void (*close)(int fd);
+    int (*ioctl)(int fd, unsigned long request, void *arg);
+};
+
+extern const struct dnvme_backend_ops dnvme_ioctl_backend;
+
+void ioctl_set_backend(const struct dnvme_backend_ops *ops);
+const struct dnvme_backend_ops *ioctl_get_backend(void);
+int ioctl_dispatch(int fd, unsigned long request, void *arg);
 int ioctl_send_command(int fd, struct nvme_64b_send *cmd);
+uint16_t ioctl_last_unique_id(void);
+int ioctl_device_state(int fd, enum nvme_state state);
+int ioctl_read_generic(int fd, struct rw_generic *param);
+int ioctl_write_generic(int fd, struct rw_generic *param);
 int ioctl_create_admin_cq(int fd);
 int ioctl_create_admin_sq(int fd);
 int ioctl_create_iocq(int fd, struct nvme_admin_cmd *cmd, uint8_t *buffer);
@@ -38,12 +62,15 @@ int ioctl_read(int fd, struct nvme_io_cmd *cmd, uint8_t *buffer, uint32_t buffer
 int ioctl_verify(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid);
 int ioctl_write(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid);
 int ioctl_write_uncorrectable(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid);
-int ioctl_write_zeros(int fd, struct nvme_io_cmd *cmd, uint32_t buffer_size, uint16_t qid);
+int ioctl_write_zeros(int fd, struct nvme_io_cmd *cmd, uint16_t qid);
 
 int ioctl_set_irq(int fd, struct interrupts *irq);
 int ioctl_ring_doorbell(int fd, uint16_t sq_id);
 int ioctl_cq_remain(int fd, uint16_t q_id);
+int ioctl_cq_inquiry(int fd, struct nvme_reap_inquiry *inquiry);
+int ioctl_get_sq_metrics(int fd, uint16_t sq_id, struct nvme_gen_sq *sq);
 int ioctl_cq_reap(int fd, uint16_t q_id, uint16_t remaining, uint8_t *buffer, uint32_t size);
+int ioctl_cq_reap_into(int fd, struct nvme_reap *reap);
 
 void ioctl_drive_metrics(int fd);
 void ioctl_device_metrics(int fd);
@@ -0,0 +1,141 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_irqtune.c
+ * Description: interrupt coalescing sweep that picks the cheapest setting within a latency target.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_commands.h"
+#include "dnvme_irqtune.h"
+
+uint32_t dnvme_irq_default_settings(struct dnvme_irq_setting *settings, uint32_t max)
+{
+    static const uint32_t times_us[] = {100, 200, 500, 1000};
+    uint32_t count = 0;
+    uint16_t entries;
+    uint32_t i;
+    if (count < max)
+        settings[count++] = (struct dnvme_irq_setting) {.entries = 1, .time_us = 0};
+    for (entries=2; entries<=64; entries<<=1)
+    {
+        for (i=0; i<sizeof(times_us)/sizeof(times_us[0]) && count<max; i++)
+            settings[count++] = (struct dnvme_irq_setting) {.entries = entries, .time_us = times_us[i]};
+    }
+    return count;
+}
+
+static int dnvme_irq_interrupts(const struct dnvme_irq_tuner *tuner, uint64_t *interrupts)
+{
+    uint32_t isr_count;
+    uint16_t i;
+    int ret;
+    *interrupts = 0;
+    for (i=0; i<tuner->nr_cqs; i++)
+    {
+        ret = dnvme_cq_isr_count(tuner->fd, tuner->cq_ids[i], &isr_count);
+        if (ret)
+            return ret;
+        *interrupts += isr_count;
+    }
+    return SUCCESS;
+}
+
+/*
+ * A setting the controller turns down is skipped rather than ending the
+ * sweep: -EINVAL when it is out of range for the feature, -EIO when Set
+ * Features completed with an error status.
+ */
+#define DNVME_IRQ_TRIAL_SKIPPED     1
+
+static int dnvme_irq_trial_run(struct dnvme_irq_tuner *tuner, struct dnvme_irq_trial *trial, double percentile)
+{
+    struct dnvme_lat_hist hist;
+    uint64_t before, after;
+    int ret;
+
+    dnvme_lat_init(&hist);
+    ret = dnvme_admin_set_irq_coalescing(tuner->fd, 0, trial->setting.entries, trial->setting.time_us);
+    if (ret == -EINVAL || ret == -EIO)
+    {
+        trial->ret = ret;
+        return DNVME_IRQ_TRIAL_SKIPPED;
+    }
+    if (ret == 0)
+        ret = dnvme_irq_interrupts(tuner, &before);
+    if (ret == 0)
+        ret = tuner->workload(tuner->arg, &hist, &trial->ios);
+    if (ret == 0)
+        ret = dnvme_irq_interrupts(tuner, &after);
+    if (ret)
+        return trial->ret = ret;
+    /* isr_count is 32 bits in the driver and wraps */
+    trial->interrupts = (uint32_t)(after - before);
+    trial->per_irq = trial->interrupts ? (double)trial->ios/trial->interrupts : trial->ios;
+    trial->p50_ns = dnvme_lat_percentile(&hist, 50);
+    trial->p99_ns = dnvme_lat_percentile(&hist, 99);
+    trial->p999_ns = dnvme_lat_percentile(&hist, 99.9);
+    trial->target_ns = dnvme_lat_percentile(&hist, percentile);
+    return trial->ret = SUCCESS;
+}
+
+/*
+ * Returns the index of the chosen trial with its setting left applied,
+ * -ERANGE when no setting met the target (the setting found at entry is
+ * put back), or the error that stopped the sweep.
+ */
+int dnvme_irq_tune(struct dnvme_irq_tuner *tuner)
+{
+    struct dnvme_irq_setting defaults[DNVME_IRQ_TUNE_MAX];
+    struct dnvme_irq_setting saved;
+    double percentile = tuner->percentile ? tuner->percentile : 99;
+    int best = -ERANGE;
+    uint32_t i;
+    int ret;
+
+    if (!tuner->workload || !tuner->nr_cqs)
+        return -EINVAL;
+    if (!tuner->settings)
+    {
+        tuner->nr_settings = dnvme_irq_default_settings(defaults, DNVME_IRQ_TUNE_MAX);
+        tuner->settings = defaults;
+    }
+    if (tuner->nr_settings > DNVME_IRQ_TUNE_MAX)
+        tuner->nr_settings = DNVME_IRQ_TUNE_MAX;
+    ret = dnvme_admin_get_irq_coalescing(tuner->fd, 0, &saved.entries, &saved.time_us);
+    if (ret)
+        goto out;
+
+    memset(tuner->trials, 0, sizeof(tuner->trials));
+    for (i=0; i<tuner->nr_settings; i++)
+    {
+        struct dnvme_irq_trial *trial = &tuner->trials[i];
+        trial->setting = tuner->settings[i];
+        ret = dnvme_irq_trial_run(tuner, trial, percentile);
+        if (ret == DNVME_IRQ_TRIAL_SKIPPED)
+            continue;
+        if (ret)
+            goto out;
+        if (trial->target_ns > tuner->target_ns)
+            continue;
+        if (best < 0 || trial->per_irq > tuner->trials[best].per_irq ||
+            (trial->per_irq == tuner->trials[best].per_irq && trial->target_ns < tuner->trials[best].target_ns))
+            best = i;
+    }
+    if (best >= 0)
+        ret = dnvme_admin_set_irq_coalescing(tuner->fd, 0, tuner->trials[best].setting.entries,
+            tuner->trials[best].setting.time_us);
+    else
+        ret = dnvme_admin_set_irq_coalescing(tuner->fd, 0, saved.entries, saved.time_us);
+    if (ret == 0)
+        ret = best;
+out:
+    if (tuner->settings == defaults)
+        tuner->settings = NULL;
+    return ret;
+}
@@ -0,0 +1,59 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_irqtune.h
+ * Description: interrupt coalescing sweep that picks the cheapest setting within a latency target.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_IRQTUNE_H__
+#define __DNVME_IRQTUNE_H__
+#include <stdint.h>
+#include "dnvme_latency.h"
+
+#define DNVME_IRQ_TUNE_MAX          64
+
+struct dnvme_irq_setting {
+    uint16_t entries;               /* aggregation threshold, 1 = coalescing off */
+    uint32_t time_us;               /* aggregation time, multiple of 100us */
+};
+
+struct dnvme_irq_trial {
+    struct dnvme_irq_setting setting;
+    int ret;                        /* of the workload, or of applying the setting */
+    uint64_t ios;
+    uint64_t interrupts;            /* isr_count growth over the tuned CQs */
+    double per_irq;                 /* completions per interrupt */
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t target_ns;             /* latency at the tuner's percentile */
+};
+
+/* Run one trial's worth of IO with the current setting; latencies go to 'hist', the IO count to 'ios'. */
+typedef int (*dnvme_irq_workload)(void *arg, struct dnvme_lat_hist *hist, uint64_t *ios);
+
+/**
+ * Apply every setting in turn, run the workload and count the interrupts
+ * the driver took on 'cq_ids'. The winner is the setting with the most
+ * completions per interrupt whose latency at 'percentile' stays within
+ * 'target_ns'; ties go to the lower latency. 'settings' NULL sweeps the
+ * default grid (off, then 2..64 entries x 100us..1ms).
+ */
+struct dnvme_irq_tuner {
+    int fd;
+    const uint16_t *cq_ids;
+    uint16_t nr_cqs;
+    uint64_t target_ns;
+    double percentile;              /* 0 = 99 */
+    dnvme_irq_workload workload;
+    void *arg;
+    const struct dnvme_irq_setting *settings;
+    uint32_t nr_settings;
+    struct dnvme_irq_trial trials[DNVME_IRQ_TUNE_MAX];
+};
+
+int dnvme_irq_tune(struct dnvme_irq_tuner *tuner);
+uint32_t dnvme_irq_default_settings(struct dnvme_irq_setting *settings, uint32_t max);
+
+#endif
@@ -0,0 +1,103 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_latency.c
+ * Description: latency histogram and percentiles.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_latency.h"
+
+static uint32_t dnvme_lat_index(uint64_t ns)
+{
+    uint32_t msb;
+    uint32_t shift;
+    if (ns < DNVME_LAT_LINEAR)
+        return ns;
+    msb = 63 - __builtin_clzll(ns);
+    shift = msb - DNVME_LAT_SUB_BITS;
+    return DNVME_LAT_LINEAR + (msb - DNVME_LAT_SUB_BITS - 1)*DNVME_LAT_SUB_COUNT
+        + ((ns >> shift) - DNVME_LAT_SUB_COUNT);
+}
+
+/* Middle of the bucket, used as the value reported for a percentile. */
+static uint64_t dnvme_lat_value(uint32_t index)
+{
+    uint32_t group;
+    uint32_t shift;
+    uint64_t base;
+    if (index < DNVME_LAT_LINEAR)
+        return index;
+    index -= DNVME_LAT_LINEAR;
+    group = index / DNVME_LAT_SUB_COUNT;
+    shift = group + 1;
+    base = (uint64_t)(DNVME_LAT_SUB_COUNT + index % DNVME_LAT_SUB_COUNT) << shift;
+    return base + ((1ULL << shift) >> 1);
+}
+
+void dnvme_lat_init(struct dnvme_lat_hist *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+    hist->min_ns = UINT64_MAX;
+}
+
+void dnvme_lat_add(struct dnvme_lat_hist *hist, uint64_t ns)
+{
+    hist->buckets[dnvme_lat_index(ns)]++;
+    hist->count++;
+    hist->sum_ns += ns;
+    if (ns < hist->min_ns)
+        hist->min_ns = ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+void dnvme_lat_merge(struct dnvme_lat_hist *dst, const struct dnvme_lat_hist *src)
+{
+    uint32_t i;
+    for (i=0; i<DNVME_LAT_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    if (src->min_ns < dst->min_ns)
+        dst->min_ns = src->min_ns;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+}
+
+uint64_t dnvme_lat_mean(const struct dnvme_lat_hist *hist)
+{
+    if (hist->count == 0)
+        return 0;
+    return hist->sum_ns / hist->count;
+}
+
+/* percentile is given in percent, e.g. 99.9 */
+uint64_t dnvme_lat_percentile(const struct dnvme_lat_hist *hist, double percentile)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t value;
+    uint32_t i;
+    if (hist->count == 0)
+        return 0;
+    if (percentile >= 100.0)
+        return hist->max_ns;
+    target = (uint64_t)(hist->count*percentile/100.0);
+    if (target == 0)
+        target = 1;
+    for (i=0; i<DNVME_LAT_BUCKETS; i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= target)
+            break;
+    }
+    value = dnvme_lat_value(i);
+    if (value > hist->max_ns)
+        value = hist->max_ns;
+    if (value < hist->min_ns)
+        value = hist->min_ns;
+    return value;
+}
@@ -0,0 +1,36 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_latency.h
+ * Description: latency histogram and percentiles.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_LATENCY_H__
+#define __DNVME_LATENCY_H__
+#include <stdint.h>
+
+/*
+ * Log-linear buckets: values below 64ns are exact, above that every power of
+ * two is split into 32 buckets, which keeps the error of a percentile < 3%.
+ */
+#define DNVME_LAT_SUB_BITS      5
+#define DNVME_LAT_SUB_COUNT     (1 << DNVME_LAT_SUB_BITS)
+#define DNVME_LAT_LINEAR        (2 << DNVME_LAT_SUB_BITS)
+#define DNVME_LAT_BUCKETS       (DNVME_LAT_LINEAR + (64 - DNVME_LAT_SUB_BITS - 1)*DNVME_LAT_SUB_COUNT)
+
+struct dnvme_lat_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t buckets[DNVME_LAT_BUCKETS];
+};
+
+void dnvme_lat_init(struct dnvme_lat_hist *hist);
+void dnvme_lat_add(struct dnvme_lat_hist *hist, uint64_t ns);
+void dnvme_lat_merge(struct dnvme_lat_hist *dst, const struct dnvme_lat_hist *src);
+uint64_t dnvme_lat_mean(const struct dnvme_lat_hist *hist);
+uint64_t dnvme_lat_percentile(const struct dnvme_lat_hist *hist, double percentile);
+
+#endif
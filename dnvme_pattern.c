@@ -0,0 +1,580 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pattern.c
+ * Description: data pattern generator and read-back verifier for integrity workloads.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dnvme_commands.h"
+#include "dnvme_pattern.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DNVME_PATTERN_X86
+#endif
+
+#define DNVME_PATTERN_TAG_WORDS     (DNVME_PATTERN_TAG_SIZE/4)
+
+/*
+ * What the kernels are handed: words whose numbers share the upper 32
+ * bits, so the kernels count in 32 bit lanes and the upper bits are
+ * folded into 'key'. A tagged run starts at an LBA and is whole LBAs.
+ */
+struct dnvme_pattern_run {
+    uint8_t type;
+    uint32_t index;                 /* low 32 bits of the number of the first word */
+    uint32_t key;
+    uint32_t lba_words;             /* words per LBA of a DNVME_PATTERN_LBA run, else 0 */
+    uint64_t lba;                   /* LBA of the first word of a tagged run */
+    uint64_t seed;
+};
+
+/* One LBA of a tagged run, or all of an untagged one: 'tag' (NULL when untagged) replaces the first words. */
+typedef void (*dnvme_pattern_fill_span)(uint8_t type, uint32_t *out, uint32_t count, uint32_t index, uint32_t key,
+    const uint32_t *tag);
+typedef uint32_t (*dnvme_pattern_find_span)(uint8_t type, const uint32_t *in, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag);
+typedef void (*dnvme_pattern_fill_fn)(const struct dnvme_pattern_run *run, uint32_t *out, uint32_t count);
+typedef uint32_t (*dnvme_pattern_find_fn)(const struct dnvme_pattern_run *run, const uint32_t *in, uint32_t count);
+
+struct dnvme_pattern_kernels {
+    const char *isa;
+    dnvme_pattern_fill_fn fill;
+    dnvme_pattern_find_fn find;     /* first word that differs from the pattern, 'count' when none */
+};
+
+static const char *const dnvme_pattern_names[DNVME_PATTERN_TYPES] = {
+    [DNVME_PATTERN_FIXED] = "fixed",
+    [DNVME_PATTERN_INCREMENT] = "incr",
+    [DNVME_PATTERN_RANDOM] = "random",
+    [DNVME_PATTERN_LBA] = "lba",
+};
+
+/* murmur3 finalizer: a bijection on 32 bits, cheap in SIMD lanes. */
+static uint32_t dnvme_pattern_mix(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+}
+
+/* A word outside the LBA tags; DNVME_PATTERN_LBA is random there. */
+static uint32_t dnvme_pattern_word(uint8_t type, uint32_t index, uint32_t key)
+{
+    switch (type)
+    {
+    case DNVME_PATTERN_FIXED:
+        return key;
+    case DNVME_PATTERN_INCREMENT:
+        return key + index;
+    default:
+        return dnvme_pattern_mix(index ^ key);
+    }
+}
+
+static void dnvme_pattern_tag(uint64_t seed, uint64_t lba, uint32_t *tag)
+{
+    tag[0] = (uint32_t)lba;
+    tag[1] = (uint32_t)(lba >> 32);
+    tag[2] = (uint32_t)seed;
+    tag[3] = (uint32_t)(seed >> 32);
+}
+
+static void dnvme_pattern_fill_span_scalar(uint8_t type, uint32_t *out, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag)
+{
+    uint32_t i = 0;
+    if (tag)
+    {
+        for (; i<DNVME_PATTERN_TAG_WORDS; i++)
+            out[i] = tag[i];
+    }
+    for (; i<count; i++)
+        out[i] = dnvme_pattern_word(type, index+i, key);
+}
+
+static uint32_t dnvme_pattern_find_span_scalar(uint8_t type, const uint32_t *in, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag)
+{
+    uint32_t i = 0;
+    if (tag)
+    {
+        for (; i<DNVME_PATTERN_TAG_WORDS; i++)
+        {
+            if (in[i] != tag[i])
+                return i;
+        }
+    }
+    for (; i<count; i++)
+    {
+        if (in[i] != dnvme_pattern_word(type, index+i, key))
+            break;
+    }
+    return i;
+}
+
+/* Hand a run to 'span' whole, or LBA by LBA with its tag when tagged. */
+static void dnvme_pattern_fill_lbas(const struct dnvme_pattern_run *run, uint32_t *out, uint32_t count,
+    dnvme_pattern_fill_span span)
+{
+    uint32_t tag[DNVME_PATTERN_TAG_WORDS];
+    uint32_t done;
+    if (!run->lba_words)
+    {
+        span(run->type, out, count, run->index, run->key, NULL);
+        return;
+    }
+    for (done=0; done<count; done+=run->lba_words)
+    {
+        dnvme_pattern_tag(run->seed, run->lba + done/run->lba_words, tag);
+        span(run->type, &out[done], run->lba_words, run->index+done, run->key, tag);
+    }
+}
+
+static uint32_t dnvme_pattern_find_lbas(const struct dnvme_pattern_run *run, const uint32_t *in, uint32_t count,
+    dnvme_pattern_find_span span)
+{
+    uint32_t tag[DNVME_PATTERN_TAG_WORDS];
+    uint32_t done, at;
+    if (!run->lba_words)
+        return span(run->type, in, count, run->index, run->key, NULL);
+    for (done=0; done<count; done+=run->lba_words)
+    {
+        dnvme_pattern_tag(run->seed, run->lba + done/run->lba_words, tag);
+        at = span(run->type, &in[done], run->lba_words, run->index+done, run->key, tag);
+        if (at < run->lba_words)
+            return done + at;
+    }
+    return count;
+}
+
+static void dnvme_pattern_fill_scalar(const struct dnvme_pattern_run *run, uint32_t *out, uint32_t count)
+{
+    dnvme_pattern_fill_lbas(run, out, count, dnvme_pattern_fill_span_scalar);
+}
+
+static uint32_t dnvme_pattern_find_scalar(const struct dnvme_pattern_run *run, const uint32_t *in, uint32_t count)
+{
+    return dnvme_pattern_find_lbas(run, in, count, dnvme_pattern_find_span_scalar);
+}
+
+#ifdef DNVME_PATTERN_X86
+/*
+ * 'index' holds consecutive word numbers, one per lane; a tag is blended
+ * into the first register of an LBA. LBAs shorter than one register go to
+ * the scalar helpers. The spans end with an explicit VZEROUPPER: GCC
+ * doesn't always emit one here, and the SSE code between the per-LBA
+ * calls then runs at half speed.
+ */
+__attribute__((target("avx2")))
+static __m256i dnvme_pattern_gen_avx2(uint8_t type, __m256i index, __m256i key)
+{
+    __m256i x;
+    switch (type)
+    {
+    case DNVME_PATTERN_FIXED:
+        return key;
+    case DNVME_PATTERN_INCREMENT:
+        return _mm256_add_epi32(key, index);
+    default:
+        x = _mm256_xor_si256(index, key);
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+        x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x85EBCA6B));
+        x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 13));
+        x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0xC2B2AE35));
+        return _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    }
+}
+
+__attribute__((target("avx2")))
+static __m256i dnvme_pattern_tag_avx2(__m256i value, const uint32_t *tag)
+{
+    return _mm256_blend_epi32(value, _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)tag)), 0x0F);
+}
+
+__attribute__((target("avx2")))
+static void dnvme_pattern_fill_span_avx2(uint8_t type, uint32_t *out, uint32_t count, uint32_t index, uint32_t key,
+    const uint32_t *tag)
+{
+    const __m256i step = _mm256_set1_epi32(8);
+    const __m256i k = _mm256_set1_epi32((int)key);
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32((int)index), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i value;
+    uint32_t i;
+    if (tag && count < 8)
+    {
+        dnvme_pattern_fill_span_scalar(type, out, count, index, key, tag);
+        return;
+    }
+    for (i=0; i+8<=count; i+=8)
+    {
+        value = dnvme_pattern_gen_avx2(type, idx, k);
+        if (tag && i == 0)
+            value = dnvme_pattern_tag_avx2(value, tag);
+        _mm256_storeu_si256((__m256i *)&out[i], value);
+        idx = _mm256_add_epi32(idx, step);
+    }
+    _mm256_zeroupper();
+    dnvme_pattern_fill_span_scalar(type, &out[i], count-i, index+i, key, NULL);
+}
+
+__attribute__((target("avx2")))
+static uint32_t dnvme_pattern_find_span_avx2(uint8_t type, const uint32_t *in, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag)
+{
+    const __m256i step = _mm256_set1_epi32(8);
+    const __m256i k = _mm256_set1_epi32((int)key);
+    __m256i idx = _mm256_add_epi32(_mm256_set1_epi32((int)index), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i value;
+    uint32_t i;
+    if (tag && count < 8)
+        return dnvme_pattern_find_span_scalar(type, in, count, index, key, tag);
+    for (i=0; i+8<=count; i+=8)
+    {
+        value = dnvme_pattern_gen_avx2(type, idx, k);
+        if (tag && i == 0)
+            value = dnvme_pattern_tag_avx2(value, tag);
+        value = _mm256_xor_si256(value, _mm256_loadu_si256((const __m256i *)&in[i]));
+        if (!_mm256_testz_si256(value, value))
+            break;
+        idx = _mm256_add_epi32(idx, step);
+    }
+    _mm256_zeroupper();
+    return i + dnvme_pattern_find_span_scalar(type, &in[i], count-i, index+i, key, tag && i == 0 ? tag : NULL);
+}
+
+/* Same with 16 lanes; the tag is a masked load and the compare lands in a mask register. */
+__attribute__((target("avx512f")))
+static __m512i dnvme_pattern_gen_avx512(uint8_t type, __m512i index, __m512i key)
+{
+    __m512i x;
+    switch (type)
+    {
+    case DNVME_PATTERN_FIXED:
+        return key;
+    case DNVME_PATTERN_INCREMENT:
+        return _mm512_add_epi32(key, index);
+    default:
+        x = _mm512_xor_si512(index, key);
+        x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+        x = _mm512_mullo_epi32(x, _mm512_set1_epi32((int)0x85EBCA6B));
+        x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 13));
+        x = _mm512_mullo_epi32(x, _mm512_set1_epi32((int)0xC2B2AE35));
+        return _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void dnvme_pattern_fill_span_avx512(uint8_t type, uint32_t *out, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag)
+{
+    const __m512i step = _mm512_set1_epi32(16);
+    const __m512i k = _mm512_set1_epi32((int)key);
+    __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int)index),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m512i value;
+    uint32_t i;
+    if (tag && count < 16)
+    {
+        dnvme_pattern_fill_span_scalar(type, out, count, index, key, tag);
+        return;
+    }
+    for (i=0; i+16<=count; i+=16)
+    {
+        value = dnvme_pattern_gen_avx512(type, idx, k);
+        if (tag && i == 0)
+            value = _mm512_mask_loadu_epi32(value, 0x000F, tag);
+        _mm512_storeu_si512(&out[i], value);
+        idx = _mm512_add_epi32(idx, step);
+    }
+    _mm256_zeroupper();
+    dnvme_pattern_fill_span_scalar(type, &out[i], count-i, index+i, key, NULL);
+}
+
+__attribute__((target("avx512f")))
+static uint32_t dnvme_pattern_find_span_avx512(uint8_t type, const uint32_t *in, uint32_t count, uint32_t index,
+    uint32_t key, const uint32_t *tag)
+{
+    const __m512i step = _mm512_set1_epi32(16);
+    const __m512i k = _mm512_set1_epi32((int)key);
+    __m512i idx = _mm512_add_epi32(_mm512_set1_epi32((int)index),
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    __m512i value;
+    uint32_t i;
+    if (tag && count < 16)
+        return dnvme_pattern_find_span_scalar(type, in, count, index, key, tag);
+    for (i=0; i+16<=count; i+=16)
+    {
+        value = dnvme_pattern_gen_avx512(type, idx, k);
+        if (tag && i == 0)
+            value = _mm512_mask_loadu_epi32(value, 0x000F, tag);
+        if (_mm512_cmpneq_epi32_mask(_mm512_loadu_si512(&in[i]), value))
+            break;
+        idx = _mm512_add_epi32(idx, step);
+    }
+    _mm256_zeroupper();
+    return i + dnvme_pattern_find_span_scalar(type, &in[i], count-i, index+i, key, tag && i == 0 ? tag : NULL);
+}
+
+static void dnvme_pattern_fill_avx2(const struct dnvme_pattern_run *run, uint32_t *out, uint32_t count)
+{
+    dnvme_pattern_fill_lbas(run, out, count, dnvme_pattern_fill_span_avx2);
+}
+
+static uint32_t dnvme_pattern_find_avx2(const struct dnvme_pattern_run *run, const uint32_t *in, uint32_t count)
+{
+    return dnvme_pattern_find_lbas(run, in, count, dnvme_pattern_find_span_avx2);
+}
+
+static void dnvme_pattern_fill_avx512(const struct dnvme_pattern_run *run, uint32_t *out, uint32_t count)
+{
+    dnvme_pattern_fill_lbas(run, out, count, dnvme_pattern_fill_span_avx512);
+}
+
+static uint32_t dnvme_pattern_find_avx512(const struct dnvme_pattern_run *run, const uint32_t *in, uint32_t count)
+{
+    return dnvme_pattern_find_lbas(run, in, count, dnvme_pattern_find_span_avx512);
+}
+#endif
+
+static const struct dnvme_pattern_kernels dnvme_pattern_kernels_scalar = {
+    .isa = "scalar",
+    .fill = dnvme_pattern_fill_scalar,
+    .find = dnvme_pattern_find_scalar,
+};
+
+#ifdef DNVME_PATTERN_X86
+static const struct dnvme_pattern_kernels dnvme_pattern_kernels_avx2 = {
+    .isa = "avx2",
+    .fill = dnvme_pattern_fill_avx2,
+    .find = dnvme_pattern_find_avx2,
+};
+
+static const struct dnvme_pattern_kernels dnvme_pattern_kernels_avx512 = {
+    .isa = "avx512f",
+    .fill = dnvme_pattern_fill_avx512,
+    .find = dnvme_pattern_find_avx512,
+};
+#endif
+
+static const struct dnvme_pattern_kernels *kernels_fn;
+
+static const struct dnvme_pattern_kernels *dnvme_pattern_kernels(void)
+{
+    const struct dnvme_pattern_kernels *kernels = __atomic_load_n(&kernels_fn, __ATOMIC_ACQUIRE);
+    if (kernels)
+        return kernels;
+    kernels = &dnvme_pattern_kernels_scalar;
+#ifdef DNVME_PATTERN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        kernels = &dnvme_pattern_kernels_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+        kernels = &dnvme_pattern_kernels_avx2;
+#endif
+    __atomic_store_n(&kernels_fn, kernels, __ATOMIC_RELEASE);
+    return kernels;
+}
+
+static uint32_t dnvme_pattern_key(const struct dnvme_pattern *pattern, uint64_t word)
+{
+    if (pattern->type == DNVME_PATTERN_FIXED || pattern->type == DNVME_PATTERN_INCREMENT)
+        return (uint32_t)pattern->seed;
+    return (uint32_t)pattern->seed ^ dnvme_pattern_mix((uint32_t)(word >> 32) ^ (uint32_t)(pattern->seed >> 32));
+}
+
+/* Word 'word' of the namespace, one at a time. */
+static uint32_t dnvme_pattern_expect(const struct dnvme_pattern *pattern, uint64_t word)
+{
+    uint32_t lba_words = pattern->lba_size/4;
+    uint32_t tag[DNVME_PATTERN_TAG_WORDS];
+    if (pattern->type == DNVME_PATTERN_LBA && word % lba_words < DNVME_PATTERN_TAG_WORDS)
+    {
+        dnvme_pattern_tag(pattern->seed, word/lba_words, tag);
+        return tag[word % lba_words];
+    }
+    return dnvme_pattern_word(pattern->type, (uint32_t)word, dnvme_pattern_key(pattern, word));
+}
+
+/*
+ * Set up the longest run from 'word' on, at most 'count' words, and
+ * return its length. 0 means the LBA at 'word' straddles a 2^32 word
+ * boundary, which only LBA sizes that aren't a power of two can do; the
+ * caller does that LBA with dnvme_pattern_expect().
+ */
+static uint32_t dnvme_pattern_run_init(const struct dnvme_pattern *pattern, struct dnvme_pattern_run *run,
+    uint64_t word, uint64_t count)
+{
+    uint64_t span = 0x100000000ULL - (uint32_t)word;
+    if (span > 0x80000000ULL)
+        span = 0x80000000ULL;
+    if (span > count)
+        span = count;
+    run->type = pattern->type;
+    run->index = (uint32_t)word;
+    run->key = dnvme_pattern_key(pattern, word);
+    run->lba_words = 0;
+    run->seed = pattern->seed;
+    if (pattern->type == DNVME_PATTERN_LBA)
+    {
+        run->lba_words = pattern->lba_size/4;
+        run->lba = word/run->lba_words;
+        span -= span % run->lba_words;
+    }
+    return span;
+}
+
+static int dnvme_pattern_check_args(const struct dnvme_pattern *pattern, const void *buffer, uint64_t bytes)
+{
+    if (!pattern || (!buffer && bytes) || pattern->type >= DNVME_PATTERN_TYPES)
+        return -EINVAL;
+    if (!pattern->lba_size || pattern->lba_size % 4 || bytes % 4 || (uintptr_t)buffer % 4)
+        return -EINVAL;
+    if (pattern->type == DNVME_PATTERN_LBA &&
+        (pattern->lba_size < DNVME_PATTERN_TAG_SIZE || bytes % pattern->lba_size))
+        return -EINVAL;
+    return SUCCESS;
+}
+
+/**
+ * Fill 'bytes' of 'buffer' with the pattern as it reads at 'lba'. The
+ * buffer must be 4 byte aligned and 'bytes' a multiple of 4, or of the
+ * LBA size for DNVME_PATTERN_LBA.
+ */
+int dnvme_pattern_fill(const struct dnvme_pattern *pattern, void *buffer, uint64_t bytes, uint64_t lba)
+{
+    const struct dnvme_pattern_kernels *kernels = dnvme_pattern_kernels();
+    struct dnvme_pattern_run run;
+    uint32_t *words = buffer;
+    uint64_t word, count, done, end;
+    uint32_t n;
+    int ret;
+
+    ret = dnvme_pattern_check_args(pattern, buffer, bytes);
+    if (ret)
+        return ret;
+    word = lba*(pattern->lba_size/4);
+    count = bytes/4;
+    for (done=0; done<count; done+=n)
+    {
+        n = dnvme_pattern_run_init(pattern, &run, word+done, count-done);
+        if (n)
+        {
+            kernels->fill(&run, &words[done], n);
+            continue;
+        }
+        for (end=done+pattern->lba_size/4; done<end; done++)
+            words[done] = dnvme_pattern_expect(pattern, word+done);
+    }
+    return SUCCESS;
+}
+
+static void dnvme_pattern_mismatch(struct dnvme_pattern_check *check, uint64_t offset, uint32_t expected,
+    uint32_t actual)
+{
+    uint32_t diff = expected ^ actual;
+    int byte;
+    for (byte=0; byte<4; byte++)
+    {
+        if (!((diff >> byte*8) & 0xFF))
+            continue;
+        if (!check->mismatches++)
+        {
+            check->offset = offset + byte;
+            check->expected = expected;
+            check->actual = actual;
+        }
+    }
+}
+
+/**
+ * Compare 'bytes' of 'buffer' with the pattern as it reads at 'lba'.
+ * Returns SUCCESS when they match and -EIO when they don't, with the
+ * first mismatch and the number of bad bytes in 'check' (may be NULL).
+ * The kernels only stop at a bad word; the rest of its LBA is looked at
+ * word by word before they take over again.
+ */
+int dnvme_pattern_verify(const struct dnvme_pattern *pattern, const void *buffer, uint64_t bytes, uint64_t lba,
+    struct dnvme_pattern_check *check)
+{
+    const struct dnvme_pattern_kernels *kernels = dnvme_pattern_kernels();
+    const uint32_t *words = buffer;
+    struct dnvme_pattern_check local;
+    struct dnvme_pattern_run run;
+    uint64_t word, count, done, end;
+    uint32_t n, at, expected;
+    int ret;
+
+    ret = dnvme_pattern_check_args(pattern, buffer, bytes);
+    if (ret)
+        return ret;
+    if (!check)
+        check = &local;
+    memset(check, 0, sizeof(*check));
+    check->offset = bytes;
+    word = lba*(pattern->lba_size/4);
+    count = bytes/4;
+    done = 0;
+    while (done < count)
+    {
+        n = dnvme_pattern_run_init(pattern, &run, word+done, count-done);
+        at = n ? kernels->find(&run, &words[done], n) : 0;
+        if (n && at == n)
+        {
+            done += n;
+            continue;
+        }
+        done += at;
+        end = pattern->type == DNVME_PATTERN_LBA ? done - done % run.lba_words + run.lba_words : done+1;
+        for (; done<end; done++)
+        {
+            expected = dnvme_pattern_expect(pattern, word+done);
+            if (words[done] != expected)
+                dnvme_pattern_mismatch(check, done*4, expected, words[done]);
+        }
+    }
+    return check->mismatches ? -EIO : SUCCESS;
+}
+
+/* "TYPE[:SEED]"; leaves lba_size alone. */
+int dnvme_pattern_parse(const char *arg, struct dnvme_pattern *pattern)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    char *end;
+    uint8_t type;
+
+    for (type=0; type<DNVME_PATTERN_TYPES; type++)
+    {
+        if (strlen(dnvme_pattern_names[type]) == len && !strncmp(arg, dnvme_pattern_names[type], len))
+            break;
+    }
+    if (type == DNVME_PATTERN_TYPES)
+        return -EINVAL;
+    pattern->type = type;
+    pattern->seed = 0;
+    if (colon)
+    {
+        pattern->seed = strtoull(colon+1, &end, 0);
+        if (end == colon+1 || *end)
+            return -EINVAL;
+    }
+    return SUCCESS;
+}
+
+const char *dnvme_pattern_name(uint8_t type)
+{
+    return type < DNVME_PATTERN_TYPES ? dnvme_pattern_names[type] : "unknown";
+}
+
+const char *dnvme_pattern_isa(void)
+{
+    return dnvme_pattern_kernels()->isa;
+}
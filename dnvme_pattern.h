@@ -0,0 +1,51 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pattern.h
+ * Description: data pattern generator and read-back verifier for integrity workloads.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_PATTERN_H__
+#define __DNVME_PATTERN_H__
+#include <stdint.h>
+
+/* Bytes of the tag at the start of every LBA of a DNVME_PATTERN_LBA buffer. */
+#define DNVME_PATTERN_TAG_SIZE      16
+
+/**
+ * Every pattern is a function of the position on the namespace only, so a
+ * buffer can be filled or checked on its own as long as the caller says
+ * which LBA it starts at. Patterns are built from little endian 32 bit
+ * words; word n of the namespace is at byte 4*n of LBA 0.
+ */
+enum dnvme_pattern_type {
+    DNVME_PATTERN_FIXED,            /* the low 32 bits of the seed in every word */
+    DNVME_PATTERN_INCREMENT,        /* the low 32 bits of the seed plus the word number */
+    DNVME_PATTERN_RANDOM,           /* hash of the word number and the seed */
+    DNVME_PATTERN_LBA,              /* random, but every LBA starts with its LBA and the seed, 64 bits each */
+    DNVME_PATTERN_TYPES,
+};
+
+struct dnvme_pattern {
+    uint8_t type;                   /* enum dnvme_pattern_type */
+    uint32_t lba_size;              /* bytes per LBA, a multiple of 4 */
+    uint64_t seed;
+};
+
+/* Result of dnvme_pattern_verify(). */
+struct dnvme_pattern_check {
+    uint64_t offset;                /* first mismatching byte in the buffer, the buffer size when none */
+    uint64_t mismatches;            /* bytes that differ */
+    uint32_t expected;              /* 32 bit word holding the first mismatch */
+    uint32_t actual;
+};
+
+int dnvme_pattern_fill(const struct dnvme_pattern *pattern, void *buffer, uint64_t bytes, uint64_t lba);
+int dnvme_pattern_verify(const struct dnvme_pattern *pattern, const void *buffer, uint64_t bytes, uint64_t lba,
+    struct dnvme_pattern_check *check);
+int dnvme_pattern_parse(const char *arg, struct dnvme_pattern *pattern);
+const char *dnvme_pattern_name(uint8_t type);
+const char *dnvme_pattern_isa(void);
+
+#endif
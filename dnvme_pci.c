@@ -0,0 +1,240 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pci.c
+ * Description: PCI configuration space snapshot and capability index.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_pci.h"
+
+#define PCI_STATUS                  0x06
+#define PCI_STATUS_CAP_LIST         0x10
+#define PCI_CAPABILITY_LIST         0x34
+#define PCI_EXP_LNKCAP              0x0C
+#define PCI_EXP_LNKSTA              0x12
+#define PCI_MSIX_FLAGS              0x02
+#define PCI_MSIX_FLAGS_QSIZE        0x07FF
+
+static struct dnvme_pci_config configs[DNVME_PCI_MAX_DEVICES] = {
+    [0 ... DNVME_PCI_MAX_DEVICES-1] = { .fd = -1 },
+};
+static pthread_mutex_t configs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dnvme_pci_config *dnvme_pci_find(int fd)
+{
+    int i;
+    for (i=0; i<DNVME_PCI_MAX_DEVICES; i++)
+    {
+        if (__atomic_load_n(&configs[i].fd, __ATOMIC_ACQUIRE) == fd)
+            return &configs[i];
+    }
+    return NULL;
+}
+
+static uint16_t dnvme_pci_word(const struct dnvme_pci_config *cfg, uint32_t offset)
+{
+    uint16_t value;
+    memcpy(&value, &cfg->space[offset], 2);
+    return value;
+}
+
+static uint32_t dnvme_pci_dword(const struct dnvme_pci_config *cfg, uint32_t offset)
+{
+    uint32_t value;
+    memcpy(&value, &cfg->space[offset], 4);
+    return value;
+}
+
+/*
+ * Both lists are bounded by the number of entries that fit in their space,
+ * so a looping or corrupt chain ends the walk instead of hanging it. The
+ * first occurrence of an ID wins, as with the kernel's pci_find_capability.
+ */
+static void dnvme_pci_index(struct dnvme_pci_config *cfg)
+{
+    uint32_t offset, header;
+    int budget;
+
+    memset(cfg->cap, 0, sizeof(cfg->cap));
+    memset(cfg->ext_cap, 0, sizeof(cfg->ext_cap));
+    if (dnvme_pci_word(cfg, PCI_STATUS) & PCI_STATUS_CAP_LIST)
+    {
+        offset = cfg->space[PCI_CAPABILITY_LIST] & ~3U;
+        for (budget=48; offset >= 0x40 && budget; budget--)
+        {
+            uint8_t id = cfg->space[offset];
+            if (id == 0xFF)
+                break;
+            if (!cfg->cap[id])
+                cfg->cap[id] = offset;
+            offset = cfg->space[offset+1] & ~3U;
+        }
+    }
+    if (cfg->size < DNVME_PCI_CFG_SIZE)
+        return;
+    offset = DNVME_PCI_STD_CFG_SIZE;
+    for (budget=(DNVME_PCI_CFG_SIZE-DNVME_PCI_STD_CFG_SIZE)/8; budget; budget--)
+    {
+        header = dnvme_pci_dword(cfg, offset);
+        if (header == 0 || header == 0xFFFFFFFF)
+            break;
+        if ((header & 0xFFFF) < DNVME_PCI_EXT_CAP_IDS && !cfg->ext_cap[header & 0xFFFF])
+            cfg->ext_cap[header & 0xFFFF] = offset;
+        offset = (header >> 20) & ~3U;
+        if (offset < DNVME_PCI_STD_CFG_SIZE)
+            break;
+    }
+}
+
+/*
+ * Read the configuration space of 'fd' with one 'reader' call and index
+ * its capabilities, replacing any earlier snapshot. Falls back to the 256
+ * byte conventional space when the extended space is not reachable.
+ */
+int dnvme_pci_snapshot(int fd, dnvme_pci_reader reader)
+{
+    struct dnvme_pci_config *cfg;
+    int ret, i;
+    pthread_mutex_lock(&configs_lock);
+    cfg = dnvme_pci_find(fd);
+    for (i=0; !cfg && i<DNVME_PCI_MAX_DEVICES; i++)
+    {
+        if (configs[i].fd < 0)
+            cfg = &configs[i];
+    }
+    if (!cfg)
+    {
+        pthread_mutex_unlock(&configs_lock);
+        return -ENOSPC;
+    }
+    cfg->size = DNVME_PCI_CFG_SIZE;
+    ret = reader(fd, 0, DNVME_PCI_CFG_SIZE, cfg->space);
+    if (ret)
+    {
+        cfg->size = DNVME_PCI_STD_CFG_SIZE;
+        memset(cfg->space, 0, sizeof(cfg->space));
+        ret = reader(fd, 0, DNVME_PCI_STD_CFG_SIZE, cfg->space);
+    }
+    if (ret == 0)
+    {
+        dnvme_pci_index(cfg);
+        __atomic_store_n(&cfg->fd, fd, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        __atomic_store_n(&cfg->fd, -1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&configs_lock);
+    return ret;
+}
+
+void dnvme_pci_release(int fd)
+{
+    struct dnvme_pci_config *cfg;
+    pthread_mutex_lock(&configs_lock);
+    cfg = dnvme_pci_find(fd);
+    if (cfg)
+        __atomic_store_n(&cfg->fd, -1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&configs_lock);
+}
+
+/* The snapshot of 'fd', NULL until dnvme_pci_snapshot() succeeded. */
+const struct dnvme_pci_config *dnvme_pci_get(int fd)
+{
+    return dnvme_pci_find(fd);
+}
+
+/* Keep the snapshot in step with host writes; a write into a list header re-walks the lists. */
+void dnvme_pci_written(int fd, uint32_t offset, uint32_t bytes, const uint8_t *data)
+{
+    struct dnvme_pci_config *cfg;
+    pthread_mutex_lock(&configs_lock);
+    cfg = dnvme_pci_find(fd);
+    if (cfg && offset < cfg->size)
+    {
+        if ((uint64_t)offset + bytes > cfg->size)
+            bytes = cfg->size - offset;
+        memcpy(&cfg->space[offset], data, bytes);
+        if (offset <= PCI_CAPABILITY_LIST && offset + bytes > PCI_STATUS)
+            dnvme_pci_index(cfg);
+    }
+    pthread_mutex_unlock(&configs_lock);
+}
+
+uint16_t dnvme_pci_find_cap(const struct dnvme_pci_config *cfg, uint8_t id)
+{
+    return cfg->cap[id];
+}
+
+uint16_t dnvme_pci_find_ext_cap(const struct dnvme_pci_config *cfg, uint16_t id)
+{
+    return id < DNVME_PCI_EXT_CAP_IDS ? cfg->ext_cap[id] : 0;
+}
+
+/* Current and maximum link speed/width from Link Status and Link Capabilities. */
+int dnvme_pci_get_link(const struct dnvme_pci_config *cfg, struct dnvme_pci_link *link)
+{
+    uint16_t exp = cfg->cap[PCI_CAP_ID_EXP];
+    uint32_t lnkcap;
+    uint16_t lnksta;
+    if (!exp)
+        return -ENOENT;
+    lnkcap = dnvme_pci_dword(cfg, exp + PCI_EXP_LNKCAP);
+    lnksta = dnvme_pci_word(cfg, exp + PCI_EXP_LNKSTA);
+    link->speed = lnksta & 0xF;
+    link->width = (lnksta >> 4) & 0x3F;
+    link->max_speed = lnkcap & 0xF;
+    link->max_width = (lnkcap >> 4) & 0x3F;
+    return 0;
+}
+
+/* Number of MSI-X table entries, 0 without an MSI-X capability. Table Size is read only. */
+uint16_t dnvme_pci_msix_table_size(const struct dnvme_pci_config *cfg)
+{
+    uint16_t msix = cfg->cap[PCI_CAP_ID_MSIX];
+    if (!msix)
+        return 0;
+    return (dnvme_pci_word(cfg, msix + PCI_MSIX_FLAGS) & PCI_MSIX_FLAGS_QSIZE) + 1;
+}
+
+const char *dnvme_pci_cap_name(uint8_t id)
+{
+    switch (id)
+    {
+    case PCI_CAP_ID_PM:
+        return "Power Management";
+    case PCI_CAP_ID_MSI:
+        return "MSI";
+    case PCI_CAP_ID_EXP:
+        return "PCI Express";
+    case PCI_CAP_ID_MSIX:
+        return "MSI-X";
+    default:
+        return "Unknown";
+    }
+}
+
+const char *dnvme_pci_ext_cap_name(uint16_t id)
+{
+    switch (id)
+    {
+    case PCI_EXT_CAP_ID_AER:
+        return "Advanced Error Reporting";
+    case PCI_EXT_CAP_ID_L1SS:
+        return "L1 PM Substates";
+    default:
+        return "Unknown";
+    }
+}
+
+const char *dnvme_pci_link_speed_name(uint8_t speed)
+{
+    static const char *names[] = { "unknown", "2.5GT/s", "5GT/s", "8GT/s", "16GT/s", "32GT/s", "64GT/s" };
+    return speed < sizeof(names)/sizeof(names[0]) ? names[speed] : names[0];
+}
@@ -0,0 +1,67 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pci.h
+ * Description: PCI configuration space snapshot and capability index.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_PCI_H__
+#define __DNVME_PCI_H__
+#include <stdint.h>
+
+#define DNVME_PCI_CFG_SIZE          4096
+#define DNVME_PCI_STD_CFG_SIZE      256
+#define DNVME_PCI_CAP_IDS           256
+#define DNVME_PCI_EXT_CAP_IDS       64
+#define DNVME_PCI_MAX_DEVICES       16
+
+/* Standard capability IDs */
+#define PCI_CAP_ID_PM               0x01
+#define PCI_CAP_ID_MSI              0x05
+#define PCI_CAP_ID_EXP              0x10
+#define PCI_CAP_ID_MSIX             0x11
+
+/* Extended capability IDs */
+#define PCI_EXT_CAP_ID_AER          0x0001
+#define PCI_EXT_CAP_ID_L1SS         0x001E
+
+/**
+ * One read of the whole configuration space of a controller, with the
+ * standard and extended capability lists walked into tables indexed by
+ * capability ID so lookups need no further config cycles. 'size' is 256
+ * when the extended space could not be read. Writes made through
+ * dnvme_pcie_capability_write_*() are copied into 'space'; fields the
+ * device changes on its own (status bits, link retraining) are only as
+ * fresh as the last dnvme_pci_snapshot().
+ */
+struct dnvme_pci_config {
+    int fd;                                 /* -1 = free slot */
+    uint32_t size;
+    uint16_t cap[DNVME_PCI_CAP_IDS];        /* offset by capability ID, 0 = absent */
+    uint16_t ext_cap[DNVME_PCI_EXT_CAP_IDS];
+    uint8_t space[DNVME_PCI_CFG_SIZE];
+};
+
+struct dnvme_pci_link {
+    uint8_t speed;                          /* 1 = 2.5GT/s ... 6 = 64GT/s */
+    uint8_t width;
+    uint8_t max_speed;
+    uint8_t max_width;
+};
+
+typedef int (*dnvme_pci_reader)(int fd, uint32_t offset, uint32_t bytes, uint8_t *data);
+
+int dnvme_pci_snapshot(int fd, dnvme_pci_reader reader);
+void dnvme_pci_release(int fd);
+const struct dnvme_pci_config *dnvme_pci_get(int fd);
+void dnvme_pci_written(int fd, uint32_t offset, uint32_t bytes, const uint8_t *data);
+uint16_t dnvme_pci_find_cap(const struct dnvme_pci_config *cfg, uint8_t id);
+uint16_t dnvme_pci_find_ext_cap(const struct dnvme_pci_config *cfg, uint16_t id);
+int dnvme_pci_get_link(const struct dnvme_pci_config *cfg, struct dnvme_pci_link *link);
+uint16_t dnvme_pci_msix_table_size(const struct dnvme_pci_config *cfg);
+const char *dnvme_pci_cap_name(uint8_t id);
+const char *dnvme_pci_ext_cap_name(uint16_t id);
+const char *dnvme_pci_link_speed_name(uint8_t speed);
+
+#endif
@@ -0,0 +1,426 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pi.c
+ * Description: T10 protection information generation and checking.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_commands.h"
+#include "dnvme_pi.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DNVME_PI_X86
+#endif
+
+/* CRC16 T10-DIF: x^16 + x^15 + x^11 + x^9 + x^8 + x^7 + x^5 + x^4 + x^2 + x + 1, not reflected, starts at 0. */
+#define DNVME_PI_CRC_POLY       0x8BB7
+
+typedef uint16_t (*dnvme_pi_crc_fn)(uint16_t crc, const uint8_t *buffer, size_t bytes);
+
+struct dnvme_pi_kernels {
+    const char *isa;
+    dnvme_pi_crc_fn crc;
+};
+
+/* dnvme_pi_table[k][b] is the CRC of byte b followed by k zero bytes. */
+static uint16_t dnvme_pi_table[8][256];
+static pthread_once_t dnvme_pi_table_once = PTHREAD_ONCE_INIT;
+
+static void dnvme_pi_table_init(void)
+{
+    uint32_t b, k, bit;
+    uint16_t crc;
+    for (b=0; b<256; b++)
+    {
+        crc = b << 8;
+        for (bit=0; bit<8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ DNVME_PI_CRC_POLY : crc << 1;
+        dnvme_pi_table[0][b] = crc;
+    }
+    for (k=1; k<8; k++)
+    {
+        for (b=0; b<256; b++)
+        {
+            crc = dnvme_pi_table[k-1][b];
+            dnvme_pi_table[k][b] = (crc << 8) ^ dnvme_pi_table[0][crc >> 8];
+        }
+    }
+}
+
+/* Slicing by 8: eight table lookups per 8 bytes instead of one per byte. */
+static uint16_t dnvme_crc16_slice8(uint16_t crc, const uint8_t *p, size_t bytes)
+{
+    const uint16_t (*t)[256] = dnvme_pi_table;
+    for (; bytes >= 8; p += 8, bytes -= 8)
+    {
+        crc = t[7][p[0] ^ (crc >> 8)] ^ t[6][p[1] ^ (crc & 0xFF)] ^ t[5][p[2]] ^ t[4][p[3]] ^
+            t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for (; bytes; p++, bytes--)
+        crc = (crc << 8) ^ t[0][(crc >> 8) ^ *p];
+    return crc;
+}
+
+#ifdef DNVME_PI_X86
+/*
+ * Folding constants, x^(n+64) mod P in the high half and x^n mod P in the
+ * low half, carry a 128 bit block n bits further down the message.
+ */
+#define DNVME_PI_FOLD_512       0xDD31, 0x1069
+#define DNVME_PI_FOLD_384       0x4A84, 0x84DA
+#define DNVME_PI_FOLD_256       0x7ACC, 0x857D
+#define DNVME_PI_FOLD_128       0x1FAA, 0xA010
+
+/* 16 message bytes as a polynomial: the first byte holds the highest coefficients. */
+__attribute__((target("pclmul,ssse3")))
+static __m128i dnvme_pi_load_pclmul(const uint8_t *p)
+{
+    const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static __m128i dnvme_pi_fold_pclmul(__m128i acc, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x11), _mm_clmulepi64_si128(acc, k, 0x00));
+}
+
+/*
+ * Four 128 bit accumulators each fold 512 bits forward per 64 bytes, then
+ * fold into one that is reduced together with the tail by the tables. The
+ * products stay below 80 bits, so no Barrett step is needed: the reduced
+ * accumulator is congruent to the message and has the same CRC.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint16_t dnvme_crc16_pclmul(uint16_t crc, const uint8_t *p, size_t bytes)
+{
+    __m128i a0, a1, a2, a3, k;
+    uint8_t rest[16];
+    if (bytes < 64)
+        return dnvme_crc16_slice8(crc, p, bytes);
+    a0 = _mm_xor_si128(dnvme_pi_load_pclmul(p), _mm_set_epi64x((uint64_t)crc << 48, 0));
+    a1 = dnvme_pi_load_pclmul(p+16);
+    a2 = dnvme_pi_load_pclmul(p+32);
+    a3 = dnvme_pi_load_pclmul(p+48);
+    k = _mm_set_epi64x(DNVME_PI_FOLD_512);
+    for (p += 64, bytes -= 64; bytes >= 64; p += 64, bytes -= 64)
+    {
+        a0 = _mm_xor_si128(dnvme_pi_fold_pclmul(a0, k), dnvme_pi_load_pclmul(p));
+        a1 = _mm_xor_si128(dnvme_pi_fold_pclmul(a1, k), dnvme_pi_load_pclmul(p+16));
+        a2 = _mm_xor_si128(dnvme_pi_fold_pclmul(a2, k), dnvme_pi_load_pclmul(p+32));
+        a3 = _mm_xor_si128(dnvme_pi_fold_pclmul(a3, k), dnvme_pi_load_pclmul(p+48));
+    }
+    a3 = _mm_xor_si128(a3, dnvme_pi_fold_pclmul(a0, _mm_set_epi64x(DNVME_PI_FOLD_384)));
+    a3 = _mm_xor_si128(a3, dnvme_pi_fold_pclmul(a1, _mm_set_epi64x(DNVME_PI_FOLD_256)));
+    k = _mm_set_epi64x(DNVME_PI_FOLD_128);
+    a3 = _mm_xor_si128(a3, dnvme_pi_fold_pclmul(a2, k));
+    for (; bytes >= 16; p += 16, bytes -= 16)
+        a3 = _mm_xor_si128(dnvme_pi_fold_pclmul(a3, k), dnvme_pi_load_pclmul(p));
+    _mm_storeu_si128((__m128i *)rest, dnvme_pi_load_pclmul((const uint8_t *)&a3));
+    crc = dnvme_crc16_slice8(0, rest, sizeof(rest));
+    return dnvme_crc16_slice8(crc, p, bytes);
+}
+#endif
+
+static const struct dnvme_pi_kernels dnvme_pi_kernels_scalar = {"slice8", dnvme_crc16_slice8};
+#ifdef DNVME_PI_X86
+static const struct dnvme_pi_kernels dnvme_pi_kernels_pclmul = {"pclmul", dnvme_crc16_pclmul};
+#endif
+
+static const struct dnvme_pi_kernels *kernels_fn;
+
+/* The tables are built before the kernels are published, the PCLMUL path needs them for its tail. */
+static const struct dnvme_pi_kernels *dnvme_pi_kernels(void)
+{
+    const struct dnvme_pi_kernels *kernels = __atomic_load_n(&kernels_fn, __ATOMIC_ACQUIRE);
+    if (kernels)
+        return kernels;
+    pthread_once(&dnvme_pi_table_once, dnvme_pi_table_init);
+    kernels = &dnvme_pi_kernels_scalar;
+#ifdef DNVME_PI_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+        kernels = &dnvme_pi_kernels_pclmul;
+#endif
+    __atomic_store_n(&kernels_fn, kernels, __ATOMIC_RELEASE);
+    return kernels;
+}
+
+/* CRC16 T10-DIF of 'bytes' of 'buffer' continuing from 'crc', 0 to start a new guard. */
+uint16_t dnvme_crc16_t10dif(uint16_t crc, const void *buffer, size_t bytes)
+{
+    return dnvme_pi_kernels()->crc(crc, buffer, bytes);
+}
+
+const char *dnvme_pi_isa(void)
+{
+    return dnvme_pi_kernels()->isa;
+}
+
+void dnvme_pi_format_init(struct dnvme_pi_format *format, const struct nvme_id_ns *ns)
+{
+    const struct nvme_lbaf *lbaf = &ns->lbaf[ns->flbas & NVME_NS_FLBAS_LBA_MASK];
+    memset(format, 0, sizeof(*format));
+    format->lba_size = 1 << lbaf->ds;
+    format->ms = lbaf->ms;
+    format->extended = (ns->flbas & NVME_NS_FLBAS_META_EXT) != 0;
+    if (format->ms >= DNVME_PI_SIZE)
+    {
+        format->type = ns->dps & NVME_NS_DPS_PI_MASK;
+        format->first = (ns->dps & NVME_NS_DPS_PI_FIRST) != 0;
+    }
+}
+
+/* Read the LBA format of namespace 'nsid' with Identify Namespace. */
+int dnvme_pi_get_format(int fd, uint32_t nsid, struct dnvme_pi_format *format)
+{
+    struct nvme_completion cqe;
+    struct nvme_id_ns *ns = create_buffer(sizeof(struct nvme_id_ns), 1);
+    int ret;
+    if (!ns)
+        return -ENOMEM;
+    memset(format, 0, sizeof(*format));
+    ret = dnvme_admin_identify_ns(fd, nsid, 0, 0, (uint8_t *)ns);
+    if (ret == 0)
+        ret = dnvme_admin_complete(fd, &cqe);
+    if (ret == 0 && NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+        ret = -EIO;
+    if (ret == 0)
+        dnvme_pi_format_init(format, ns);
+    free_buffer(ns);
+    if (ret)
+        return ret;
+    return format->type > NVME_NS_DPS_PI_TYPE3 ? -EINVAL : SUCCESS;
+}
+
+/* Bytes an LBA takes in the data buffer of a command. */
+uint32_t dnvme_pi_block_size(const struct dnvme_pi_format *format)
+{
+    return format->lba_size + (format->extended ? format->ms : 0);
+}
+
+/* e.g. "512+8 extended, PI type 1 last" */
+const char *dnvme_pi_format_name(const struct dnvme_pi_format *format, char *name, size_t size)
+{
+    int n = snprintf(name, size, "%u", format->lba_size);
+    if (format->ms && n >= 0 && (size_t)n < size)
+        n += snprintf(name+n, size-n, "+%u %s", format->ms, format->extended ? "extended" : "separate");
+    if (format->type && n >= 0 && (size_t)n < size)
+        snprintf(name+n, size-n, ", PI type %u %s", format->type, format->first ? "first" : "last");
+    return name;
+}
+
+/* Set PRINFO and the tag fields of a Read, Write, Compare or Write Zeroes made by dnvme_nvm_rw_prepare(). */
+void dnvme_pi_set_tags(struct nvme_io_cmd *cmd, const struct dnvme_pi_tags *tags, uint8_t prinfo)
+{
+    if (cmd->opcode == NVME_CMD_WRITE || cmd->opcode == NVME_CMD_WRITE_ZEROES)
+    {
+        cmd->cdw12.write.prinfo = prinfo;
+        cmd->cdw14.write.ilbrt = tags->ref;
+        cmd->cdw15.write.lbat = tags->app;
+        cmd->cdw15.write.lbatm = tags->app_mask;
+    }
+    else
+    {
+        cmd->cdw12.read.prinfo = prinfo;
+        cmd->cdw14.read.eilbrt = tags->ref;
+        cmd->cdw15.read.elbat = tags->app;
+        cmd->cdw15.read.elbatm = tags->app_mask;
+    }
+}
+
+static int dnvme_pi_check_args(const struct dnvme_pi_format *format, const struct dnvme_pattern *pattern,
+    const void *data, const void *meta, const struct dnvme_pi_tags *tags)
+{
+    if (!format || !data || !format->lba_size || format->type > NVME_NS_DPS_PI_TYPE3)
+        return -EINVAL;
+    if (format->type && (format->ms < DNVME_PI_SIZE || !tags || (!format->extended && !meta)))
+        return -EINVAL;
+    if (pattern && pattern->lba_size != format->lba_size)
+        return -EINVAL;
+    return SUCCESS;
+}
+
+/*
+ * Guard of one LBA: its data, and for PI in the last bytes of a larger
+ * metadata area also the metadata bytes in front of the PI.
+ */
+static uint16_t dnvme_pi_guard(const struct dnvme_pi_format *format, dnvme_pi_crc_fn crc, const uint8_t *data,
+    const uint8_t *meta)
+{
+    uint16_t guard = crc(0, data, format->lba_size);
+    if (!format->first && format->ms > DNVME_PI_SIZE)
+        guard = crc(guard, meta, format->ms - DNVME_PI_SIZE);
+    return guard;
+}
+
+static const uint8_t *dnvme_pi_tuple(const struct dnvme_pi_format *format, const uint8_t *meta)
+{
+    return format->first ? meta : meta + format->ms - DNVME_PI_SIZE;
+}
+
+/* Types 1 and 2 count the reference tag up by LBA, type 3 leaves it to the host. */
+static uint32_t dnvme_pi_ref(const struct dnvme_pi_format *format, const struct dnvme_pi_tags *tags, uint32_t i)
+{
+    return format->type == NVME_NS_DPS_PI_TYPE3 ? tags->ref : tags->ref + i;
+}
+
+/**
+ * Generate the PI of 'nlb' LBAs starting at 'lba', filling their data with
+ * 'pattern' first when it is not NULL. Each LBA is filled and guarded in
+ * turn so its data is still in cache when the CRC reads it. 'meta' is the
+ * separate metadata buffer, unused for an extended LBA format where the
+ * metadata of an LBA follows its data in 'data'.
+ */
+int dnvme_pi_generate(const struct dnvme_pi_format *format, const struct dnvme_pattern *pattern, void *data,
+    void *meta, uint32_t nlb, uint64_t lba, const struct dnvme_pi_tags *tags)
+{
+    dnvme_pi_crc_fn crc = dnvme_pi_kernels()->crc;
+    uint32_t block = dnvme_pi_block_size(format), i;
+    uint8_t *buf, *md, *pi;
+    uint16_t guard;
+    uint32_t ref;
+    int ret;
+
+    ret = dnvme_pi_check_args(format, pattern, data, meta, tags);
+    if (ret)
+        return ret;
+    if (!format->type && (!format->extended || !format->ms))
+        return pattern ? dnvme_pattern_fill(pattern, data, (uint64_t)nlb*format->lba_size, lba) : SUCCESS;
+    for (i=0; i<nlb; i++)
+    {
+        buf = (uint8_t *)data + (uint64_t)i*block;
+        md = format->extended ? buf + format->lba_size : (uint8_t *)meta + (uint64_t)i*format->ms;
+        if (pattern)
+        {
+            ret = dnvme_pattern_fill(pattern, buf, format->lba_size, lba+i);
+            if (ret)
+                return ret;
+        }
+        if (!format->type)
+            continue;
+        guard = dnvme_pi_guard(format, crc, buf, md);
+        ref = dnvme_pi_ref(format, tags, i);
+        pi = (uint8_t *)dnvme_pi_tuple(format, md);
+        pi[0] = guard >> 8;
+        pi[1] = guard;
+        pi[2] = tags->app >> 8;
+        pi[3] = tags->app;
+        pi[4] = ref >> 24;
+        pi[5] = ref >> 16;
+        pi[6] = ref >> 8;
+        pi[7] = ref;
+    }
+    return SUCCESS;
+}
+
+static void dnvme_pi_fail(struct dnvme_pi_error *error, uint32_t index, uint16_t status, uint32_t expected,
+    uint32_t actual)
+{
+    error->index = index;
+    error->status = status;
+    error->expected = expected;
+    error->actual = actual;
+}
+
+/* Check the tuple of LBA 'i' the way a controller does for PRCHK 'tags->check', returns the status. */
+static uint16_t dnvme_pi_check(const struct dnvme_pi_format *format, dnvme_pi_crc_fn crc, const uint8_t *data,
+    const uint8_t *meta, uint32_t i, const struct dnvme_pi_tags *tags, struct dnvme_pi_error *error)
+{
+    const uint8_t *pi = dnvme_pi_tuple(format, meta);
+    uint16_t guard = (pi[0] << 8) | pi[1], app = (pi[2] << 8) | pi[3], expect;
+    uint32_t ref = ((uint32_t)pi[4] << 24) | (pi[5] << 16) | (pi[6] << 8) | pi[7];
+
+    /* an application tag of all ones turns checking off, for type 3 only together with a reference tag of all ones */
+    if (app == 0xFFFF && (format->type != NVME_NS_DPS_PI_TYPE3 || ref == 0xFFFFFFFF))
+        return NVME_SC_SUCCESS;
+    if (tags->check & DNVME_PI_PRCHK_GUARD)
+    {
+        expect = dnvme_pi_guard(format, crc, data, meta);
+        if (guard != expect)
+        {
+            dnvme_pi_fail(error, i, NVME_SC_GUARD_CHECK, expect, guard);
+            return NVME_SC_GUARD_CHECK;
+        }
+    }
+    if ((tags->check & DNVME_PI_PRCHK_APP) && ((app ^ tags->app) & tags->app_mask))
+    {
+        dnvme_pi_fail(error, i, NVME_SC_APPTAG_CHECK, tags->app, app);
+        return NVME_SC_APPTAG_CHECK;
+    }
+    if ((tags->check & DNVME_PI_PRCHK_REF) && format->type != NVME_NS_DPS_PI_TYPE3 &&
+        ref != dnvme_pi_ref(format, tags, i))
+    {
+        dnvme_pi_fail(error, i, NVME_SC_REFTAG_CHECK, dnvme_pi_ref(format, tags, i), ref);
+        return NVME_SC_REFTAG_CHECK;
+    }
+    return NVME_SC_SUCCESS;
+}
+
+/**
+ * Check 'nlb' LBAs starting at 'lba': the PI fields in 'tags->check' and,
+ * when 'pattern' is not NULL, the data against the pattern, both in one
+ * pass over each LBA. Returns -EIO on the first failure of either kind;
+ * 'error' then holds the first PI failure (status 0 when there was none)
+ * and 'check', which may be NULL, the pattern mismatches with offsets into
+ * 'data'. The reference tag of a type 3 format is not checked.
+ */
+int dnvme_pi_verify(const struct dnvme_pi_format *format, const struct dnvme_pattern *pattern, const void *data,
+    const void *meta, uint32_t nlb, uint64_t lba, const struct dnvme_pi_tags *tags, struct dnvme_pi_error *error,
+    struct dnvme_pattern_check *check)
+{
+    dnvme_pi_crc_fn crc = dnvme_pi_kernels()->crc;
+    uint32_t block = dnvme_pi_block_size(format), i;
+    struct dnvme_pattern_check lba_check, result;
+    const uint8_t *buf, *md;
+    uint16_t status = NVME_SC_SUCCESS;
+    int ret;
+
+    ret = dnvme_pi_check_args(format, pattern, data, meta, tags);
+    if (ret || !error)
+        return ret ? ret : -EINVAL;
+    memset(error, 0, sizeof(*error));
+    memset(&result, 0, sizeof(result));
+    result.offset = (uint64_t)nlb*block;
+    if (!format->type && (!format->extended || !format->ms))
+    {
+        if (!pattern)
+            return SUCCESS;
+        return dnvme_pattern_verify(pattern, data, (uint64_t)nlb*format->lba_size, lba, check ? check : &result);
+    }
+    for (i=0; i<nlb; i++)
+    {
+        buf = (const uint8_t *)data + (uint64_t)i*block;
+        md = format->extended ? buf + format->lba_size : (const uint8_t *)meta + (uint64_t)i*format->ms;
+        if (pattern)
+        {
+            ret = dnvme_pattern_verify(pattern, buf, format->lba_size, lba+i, &lba_check);
+            if (ret == -EIO)
+            {
+                if (!result.mismatches)
+                {
+                    result.offset = (uint64_t)i*block + lba_check.offset;
+                    result.expected = lba_check.expected;
+                    result.actual = lba_check.actual;
+                }
+                result.mismatches += lba_check.mismatches;
+            }
+            else if (ret)
+            {
+                return ret;
+            }
+        }
+        if (format->type && tags->check && status == NVME_SC_SUCCESS)
+            status = dnvme_pi_check(format, crc, buf, md, i, tags, error);
+    }
+    if (check)
+        *check = result;
+    return status != NVME_SC_SUCCESS || result.mismatches ? -EIO : SUCCESS;
+}
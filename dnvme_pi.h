@@ -0,0 +1,66 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pi.h
+ * Description: T10 protection information generation and checking.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_PI_H__
+#define __DNVME_PI_H__
+#include <stddef.h>
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+#include "dnvme_pattern.h"
+
+/* Bytes of one protection information tuple: guard, application tag, reference tag, all big endian. */
+#define DNVME_PI_SIZE           8
+
+/* PRINFO field of Read/Write/Compare/Write Zeroes. */
+#define DNVME_PI_PRCHK_REF      0x1
+#define DNVME_PI_PRCHK_APP      0x2
+#define DNVME_PI_PRCHK_GUARD    0x4
+#define DNVME_PI_PRACT          0x8
+#define DNVME_PI_PRCHK_ALL      (DNVME_PI_PRCHK_REF | DNVME_PI_PRCHK_APP | DNVME_PI_PRCHK_GUARD)
+
+/* Layout of an LBA of a namespace, from its Identify Namespace data. */
+struct dnvme_pi_format {
+    uint32_t lba_size;              /* data bytes per LBA */
+    uint16_t ms;                    /* metadata bytes per LBA, 0 when none */
+    uint8_t type;                   /* NVME_NS_DPS_PI_TYPE1..3, 0 when PI is off */
+    uint8_t first;                  /* PI is the first 8 bytes of the metadata, else the last */
+    uint8_t extended;               /* metadata follows the data of every LBA, else it is a separate buffer */
+};
+
+/* What a command says about the tuples of its LBAs. */
+struct dnvme_pi_tags {
+    uint32_t ref;                   /* reference tag of the first LBA, ILBRT/EILBRT */
+    uint16_t app;                   /* LBAT/ELBAT */
+    uint16_t app_mask;              /* LBATM/ELBATM, set bits are checked */
+    uint8_t check;                  /* DNVME_PI_PRCHK_* fields that dnvme_pi_verify() checks */
+};
+
+/* First failure found by dnvme_pi_verify(). */
+struct dnvme_pi_error {
+    uint32_t index;                 /* LBA within the buffer */
+    uint16_t status;                /* NVME_SC_GUARD_CHECK, NVME_SC_APPTAG_CHECK or NVME_SC_REFTAG_CHECK */
+    uint32_t expected;
+    uint32_t actual;
+};
+
+uint16_t dnvme_crc16_t10dif(uint16_t crc, const void *buffer, size_t bytes);
+const char *dnvme_pi_isa(void);
+
+void dnvme_pi_format_init(struct dnvme_pi_format *format, const struct nvme_id_ns *ns);
+int dnvme_pi_get_format(int fd, uint32_t nsid, struct dnvme_pi_format *format);
+uint32_t dnvme_pi_block_size(const struct dnvme_pi_format *format);
+const char *dnvme_pi_format_name(const struct dnvme_pi_format *format, char *name, size_t size);
+void dnvme_pi_set_tags(struct nvme_io_cmd *cmd, const struct dnvme_pi_tags *tags, uint8_t prinfo);
+
+int dnvme_pi_generate(const struct dnvme_pi_format *format, const struct dnvme_pattern *pattern, void *data,
+    void *meta, uint32_t nlb, uint64_t lba, const struct dnvme_pi_tags *tags);
+int dnvme_pi_verify(const struct dnvme_pi_format *format, const struct dnvme_pattern *pattern, const void *data,
+    const void *meta, uint32_t nlb, uint64_t lba, const struct dnvme_pi_tags *tags, struct dnvme_pi_error *error,
+    struct dnvme_pattern_check *check);
+
+#endif
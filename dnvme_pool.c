@@ -0,0 +1,563 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pool.c
+ * Description: pooled 4K aligned data buffers for DMA.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include "dnvme_pool.h"
+
+#define DNVME_POOL_TAG_MASK         ((uint64_t)DNVME_POOL_MIN_SIZE - 1)
+#define DNVME_POOL_REGISTRY_BITS    14
+#define DNVME_POOL_REGISTRY_SIZE    (1U << DNVME_POOL_REGISTRY_BITS)
+#define DNVME_POOL_KEY_EMPTY        0
+#define DNVME_POOL_KEY_DELETED      UINTPTR_MAX
+#define DNVME_POOL_HUGE_1G          (1UL << 30)
+#define HUGETLBFS_MAGIC             0x958458f6
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT              26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB                (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB                (30 << MAP_HUGE_SHIFT)
+#endif
+
+/*
+ * Memory mapped in one go and cut into slabs: a single 2M block for 4K
+ * pages and 2M hugepages, or a whole 1G hugepage.
+ */
+struct dnvme_pool_region {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    uint8_t backing;
+    uint8_t mapped;             /* from mmap, else from posix_memalign */
+    struct dnvme_pool_region *next;
+};
+
+struct dnvme_pool_slab {
+    void *base;
+    struct dnvme_pool *pool;
+    uint8_t class;
+    uint8_t backing;
+    struct dnvme_pool_slab *next;
+};
+
+/*
+ * Slab lookup by address for dnvme_pool_free(). Every slab is one 2M
+ * aligned block, so its key is the address >> 21. Readers never lock:
+ * a slot is published by storing the key last and retired by a tombstone.
+ */
+struct dnvme_pool_registry_entry {
+    uintptr_t key;
+    struct dnvme_pool_slab *slab;
+};
+
+static struct dnvme_pool_registry_entry registry[DNVME_POOL_REGISTRY_SIZE];
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dnvme_pool *pool_list;
+static pthread_mutex_t pool_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dnvme_pool *default_pool;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+static __thread struct dnvme_pool *thread_pool;
+
+/* Buffers larger than the biggest class come straight from posix_memalign. */
+static uint64_t oversize_allocs;
+static uint64_t oversize_frees;
+
+static uint32_t dnvme_pool_hash(uintptr_t key)
+{
+    return (uint32_t)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - DNVME_POOL_REGISTRY_BITS));
+}
+
+static int dnvme_pool_register(struct dnvme_pool_slab *slab)
+{
+    uintptr_t key = (uintptr_t)slab->base >> DNVME_POOL_SLAB_SHIFT;
+    uint32_t index = dnvme_pool_hash(key);
+    uint32_t i;
+    pthread_mutex_lock(&registry_lock);
+    for (i=0; i<DNVME_POOL_REGISTRY_SIZE; i++)
+    {
+        struct dnvme_pool_registry_entry *entry = &registry[(index+i) & (DNVME_POOL_REGISTRY_SIZE-1)];
+        if (entry->key == DNVME_POOL_KEY_EMPTY || entry->key == DNVME_POOL_KEY_DELETED)
+        {
+            entry->slab = slab;
+            __atomic_store_n(&entry->key, key, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&registry_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&registry_lock);
+    return -ENOSPC;
+}
+
+static struct dnvme_pool_registry_entry *dnvme_pool_lookup(const void *buffer)
+{
+    uintptr_t key = (uintptr_t)buffer >> DNVME_POOL_SLAB_SHIFT;
+    uint32_t index = dnvme_pool_hash(key);
+    uint32_t i;
+    for (i=0; i<DNVME_POOL_REGISTRY_SIZE; i++)
+    {
+        struct dnvme_pool_registry_entry *entry = &registry[(index+i) & (DNVME_POOL_REGISTRY_SIZE-1)];
+        uintptr_t entry_key = __atomic_load_n(&entry->key, __ATOMIC_ACQUIRE);
+        if (entry_key == key)
+            return entry;
+        if (entry_key == DNVME_POOL_KEY_EMPTY)
+            break;
+    }
+    return NULL;
+}
+
+static void dnvme_pool_unregister(struct dnvme_pool_slab *slab)
+{
+    struct dnvme_pool_registry_entry *entry;
+    pthread_mutex_lock(&registry_lock);
+    entry = dnvme_pool_lookup(slab->base);
+    if (entry)
+        __atomic_store_n(&entry->key, DNVME_POOL_KEY_DELETED, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void dnvme_pool_push(struct dnvme_pool_class *cls, void *first, void *last)
+{
+    uint64_t head = __atomic_load_n(&cls->head, __ATOMIC_RELAXED);
+    uint64_t next;
+    do
+    {
+        *(void **)last = (void *)(uintptr_t)(head & ~DNVME_POOL_TAG_MASK);
+        next = (uint64_t)(uintptr_t)first | ((head+1) & DNVME_POOL_TAG_MASK);
+    } while (!__atomic_compare_exchange_n(&cls->head, &head, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * The link read from a buffer another thread has just popped may be
+ * garbage, but then the tag has moved on and the exchange fails. Slab
+ * memory is never unmapped while the pool lives, so the read is safe.
+ */
+static void *dnvme_pool_pop(struct dnvme_pool_class *cls)
+{
+    uint64_t head = __atomic_load_n(&cls->head, __ATOMIC_ACQUIRE);
+    uint64_t next;
+    void *buffer;
+    do
+    {
+        buffer = (void *)(uintptr_t)(head & ~DNVME_POOL_TAG_MASK);
+        if (!buffer)
+            return NULL;
+        next = (uint64_t)(uintptr_t)*(void * volatile *)buffer | ((head+1) & DNVME_POOL_TAG_MASK);
+    } while (!__atomic_compare_exchange_n(&cls->head, &head, next, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return buffer;
+}
+
+static uint8_t *dnvme_pool_map_hugetlbfs(const char *dir, size_t *size, uint8_t *backing)
+{
+    char path[DNVME_POOL_PATH_LEN+32];
+    struct statfs fs;
+    uint8_t *base;
+    int fd;
+    snprintf(path, sizeof(path), "%s/dnvme-pool-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd < 0)
+        return NULL;
+    unlink(path);
+    if (fstatfs(fd, &fs) || (uint32_t)fs.f_type != HUGETLBFS_MAGIC || fs.f_bsize <= 0 ||
+        (size_t)fs.f_bsize < DNVME_POOL_SLAB_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+    *size = fs.f_bsize;
+    *backing = *size >= DNVME_POOL_HUGE_1G ? DNVME_BACKING_1G : DNVME_BACKING_2M;
+    base = ftruncate(fd, *size) ? MAP_FAILED :
+        mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    return base == MAP_FAILED ? NULL : base;
+}
+
+/*
+ * Map a new region with the pool's page size. Hugepages must be reserved
+ * up front (nr_hugepages or a hugetlbfs mount), otherwise this steps down
+ * 1G -> 2M -> 4K and counts the fallback. A 1G page is skipped when it
+ * would not fit the pool cap.
+ */
+static struct dnvme_pool_region *dnvme_pool_region_map(struct dnvme_pool *pool)
+{
+    struct dnvme_pool_region *region = calloc(1, sizeof(*region));
+    int backing = pool->backing;
+    void *base = NULL;
+    if (!region)
+        return NULL;
+    if (backing == DNVME_BACKING_1G && pool->cap_bytes && pool->cap_bytes - pool->slab_bytes < DNVME_POOL_HUGE_1G)
+        backing = DNVME_BACKING_2M;
+    if (backing != DNVME_BACKING_4K && pool->hugetlbfs[0])
+    {
+        base = dnvme_pool_map_hugetlbfs(pool->hugetlbfs, &region->size, &region->backing);
+        if (base && region->backing > backing)
+        {
+            munmap(base, region->size);
+            base = NULL;
+        }
+        backing = base ? region->backing : backing;
+    }
+    for (; !base && backing > DNVME_BACKING_4K; backing--)
+    {
+        region->size = backing == DNVME_BACKING_1G ? DNVME_POOL_HUGE_1G : DNVME_POOL_SLAB_SIZE;
+        base = mmap(NULL, region->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE |
+            MAP_HUGETLB | (backing == DNVME_BACKING_1G ? MAP_HUGE_1GB : MAP_HUGE_2MB), -1, 0);
+        if (base == MAP_FAILED)
+            base = NULL;
+        else
+            break;
+    }
+    if (base)
+    {
+        region->mapped = 1;
+    }
+    else
+    {
+        backing = DNVME_BACKING_4K;
+        region->size = DNVME_POOL_SLAB_SIZE;
+        if (posix_memalign(&base, DNVME_POOL_SLAB_SIZE, DNVME_POOL_SLAB_SIZE))
+        {
+            free(region);
+            return NULL;
+        }
+    }
+    if (backing < pool->backing)
+        pool->fallbacks++;
+    region->base = base;
+    region->backing = backing;
+    region->next = pool->regions;
+    pool->regions = region;
+    return region;
+}
+
+/* Next free 2M slab of the current region, mapping a new region when it is used up. */
+static uint8_t *dnvme_pool_slab_map(struct dnvme_pool *pool, uint8_t *backing)
+{
+    struct dnvme_pool_region *region = pool->regions;
+    uint8_t *base;
+    if (!region || region->used == region->size)
+        region = dnvme_pool_region_map(pool);
+    if (!region)
+        return NULL;
+    base = region->base + region->used;
+    region->used += DNVME_POOL_SLAB_SIZE;
+    *backing = region->backing;
+    return base;
+}
+
+/* Carve a fresh slab for 'cls', hand out its first buffer and free-list the rest. */
+static void *dnvme_pool_refill(struct dnvme_pool *pool, uint8_t class)
+{
+    struct dnvme_pool_class *cls = &pool->classes[class];
+    struct dnvme_pool_slab *slab = NULL;
+    uint8_t *base = NULL;
+    uint32_t count = DNVME_POOL_SLAB_SIZE/cls->size;
+    uint32_t i;
+    void *buffer;
+
+    pthread_mutex_lock(&pool->lock);
+    buffer = dnvme_pool_pop(cls);
+    if (buffer)
+        goto out;
+    if (pool->cap_bytes && pool->slab_bytes + DNVME_POOL_SLAB_SIZE > pool->cap_bytes)
+        goto out;
+    slab = calloc(1, sizeof(*slab));
+    if (!slab)
+        goto out;
+    base = dnvme_pool_slab_map(pool, &slab->backing);
+    if (!base)
+        goto fail;
+    slab->base = base;
+    slab->pool = pool;
+    slab->class = class;
+    if (dnvme_pool_register(slab))
+        goto fail;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    cls->slabs++;
+    pool->backing_slabs[slab->backing]++;
+    __atomic_add_fetch(&pool->slab_bytes, DNVME_POOL_SLAB_SIZE, __ATOMIC_RELAXED);
+    if (count > 1)
+    {
+        for (i=1; i<count-1; i++)
+            *(void **)(base + i*cls->size) = base + (i+1)*cls->size;
+        dnvme_pool_push(cls, base + cls->size, base + (count-1)*cls->size);
+    }
+    buffer = base;
+    goto out;
+fail:
+    free(slab);
+out:
+    pthread_mutex_unlock(&pool->lock);
+    return buffer;
+}
+
+static int dnvme_pool_class_of(uint32_t size)
+{
+    int class = 0;
+    while (class < DNVME_POOL_MAX_CLASSES && (DNVME_POOL_MIN_SIZE << class) < size)
+        class++;
+    return class;
+}
+
+/*
+ * Create a pool with classes 4K, 8K, ... up to 'max_size' (rounded up to a
+ * power of two, at most one slab). 'cap_bytes' limits the slab memory the
+ * pool may hold; it is consumed in whole slabs.
+ */
+struct dnvme_pool *dnvme_pool_create(const char *name, uint32_t max_size, uint64_t cap_bytes)
+{
+    struct dnvme_pool *pool = calloc(1, sizeof(*pool));
+    uint8_t i;
+    if (!pool)
+        return NULL;
+    snprintf(pool->name, sizeof(pool->name), "%s", name ? name : "pool");
+    if (max_size == 0 || max_size > DNVME_POOL_SLAB_SIZE)
+        max_size = DNVME_POOL_SLAB_SIZE;
+    pool->nr_classes = dnvme_pool_class_of(max_size)+1;
+    pool->max_size = DNVME_POOL_MIN_SIZE << (pool->nr_classes-1);
+    pool->cap_bytes = cap_bytes;
+    for (i=0; i<pool->nr_classes; i++)
+        pool->classes[i].size = DNVME_POOL_MIN_SIZE << i;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_lock(&pool_list_lock);
+    pool->next = pool_list;
+    pool_list = pool;
+    pthread_mutex_unlock(&pool_list_lock);
+    return pool;
+}
+
+/*
+ * Release every slab of 'pool'. Buffers still handed out are reported as
+ * leaks and the pool is kept, since freeing the slabs under them would be
+ * worse than holding the memory.
+ */
+int dnvme_pool_destroy(struct dnvme_pool *pool)
+{
+    struct dnvme_pool **link;
+    struct dnvme_pool_slab *slab;
+    struct dnvme_pool_region *region;
+    struct dnvme_pool_stats stats;
+    if (!pool)
+        return 0;
+    dnvme_pool_get_stats(pool, &stats);
+    if (stats.in_use)
+    {
+        fprintf(stderr, "Pool %s: %lu buffers (%lu KiB) still in use, not released\n", pool->name, stats.in_use,
+            stats.in_use_bytes >> 10);
+        return -EBUSY;
+    }
+    pthread_mutex_lock(&pool_list_lock);
+    for (link=&pool_list; *link; link=&(*link)->next)
+    {
+        if (*link == pool)
+        {
+            *link = pool->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_list_lock);
+    while ((slab = pool->slabs))
+    {
+        pool->slabs = slab->next;
+        dnvme_pool_unregister(slab);
+        free(slab);
+    }
+    while ((region = pool->regions))
+    {
+        pool->regions = region->next;
+        if (region->mapped)
+            munmap(region->base, region->size);
+        else
+            free(region->base);
+        free(region);
+    }
+    if (thread_pool == pool)
+        thread_pool = NULL;
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+    return 0;
+}
+
+/*
+ * Back slabs carved from now on with 'backing' pages, from files on the
+ * 'hugetlbfs' mount if given or MAP_HUGETLB otherwise.
+ */
+int dnvme_pool_set_backing(struct dnvme_pool *pool, enum dnvme_pool_backing backing, const char *hugetlbfs)
+{
+    if (backing >= DNVME_BACKING_COUNT)
+        return -EINVAL;
+    pthread_mutex_lock(&pool->lock);
+    pool->backing = backing;
+    snprintf(pool->hugetlbfs, sizeof(pool->hugetlbfs), "%s", hugetlbfs ? hugetlbfs : "");
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* Page size actually behind 'buffer'; unpooled memory is reported as 4K. */
+enum dnvme_pool_backing dnvme_pool_backing_of(const void *buffer)
+{
+    struct dnvme_pool_registry_entry *entry = dnvme_pool_lookup(buffer);
+    return entry ? entry->slab->backing : DNVME_BACKING_4K;
+}
+
+const char *dnvme_pool_backing_name(enum dnvme_pool_backing backing)
+{
+    static const char *names[DNVME_BACKING_COUNT] = {"4K", "2M", "1G"};
+    return backing < DNVME_BACKING_COUNT ? names[backing] : "unknown";
+}
+
+/* 4K aligned buffer of at least 'size' bytes; contents are undefined. */
+void *dnvme_pool_alloc(struct dnvme_pool *pool, uint32_t size)
+{
+    int class = dnvme_pool_class_of(size);
+    struct dnvme_pool_class *cls;
+    uint64_t used, peak;
+    void *buffer;
+
+    if (class >= pool->nr_classes)
+    {
+        buffer = NULL;
+        if (posix_memalign(&buffer, DNVME_POOL_MIN_SIZE, size))
+            return NULL;
+        __atomic_add_fetch(&oversize_allocs, 1, __ATOMIC_RELAXED);
+        return buffer;
+    }
+    cls = &pool->classes[class];
+    buffer = dnvme_pool_pop(cls);
+    if (!buffer)
+        buffer = dnvme_pool_refill(pool, class);
+    if (!buffer)
+    {
+        __atomic_add_fetch(&pool->failures, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_add_fetch(&cls->in_use, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->allocs, 1, __ATOMIC_RELAXED);
+    used = __atomic_add_fetch(&pool->in_use_bytes, cls->size, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&pool->peak_bytes, __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&pool->peak_bytes, &peak, used, 1, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED))
+        ;
+    return buffer;
+}
+
+/* Return a buffer to the pool it came from, whichever thread frees it. */
+void dnvme_pool_free(void *buffer)
+{
+    struct dnvme_pool_registry_entry *entry;
+    struct dnvme_pool_class *cls;
+    struct dnvme_pool *pool;
+    if (!buffer)
+        return;
+    entry = dnvme_pool_lookup(buffer);
+    if (!entry)
+    {
+        __atomic_add_fetch(&oversize_frees, 1, __ATOMIC_RELAXED);
+        free(buffer);
+        return;
+    }
+    pool = entry->slab->pool;
+    cls = &pool->classes[entry->slab->class];
+    __atomic_sub_fetch(&cls->in_use, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool->frees, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pool->in_use_bytes, cls->size, __ATOMIC_RELAXED);
+    dnvme_pool_push(cls, buffer, buffer);
+}
+
+struct dnvme_pool *dnvme_pool_owner(const void *buffer)
+{
+    struct dnvme_pool_registry_entry *entry = dnvme_pool_lookup(buffer);
+    return entry ? entry->slab->pool : NULL;
+}
+
+static void dnvme_pool_default_init(void)
+{
+    default_pool = dnvme_pool_create("default", DNVME_POOL_SLAB_SIZE, 0);
+}
+
+struct dnvme_pool *dnvme_pool_default(void)
+{
+    pthread_once(&default_pool_once, dnvme_pool_default_init);
+    return default_pool;
+}
+
+/* Pool used by malloc_4k_aligned_buffer() on the calling thread. */
+struct dnvme_pool *dnvme_pool_thread(void)
+{
+    return thread_pool ? thread_pool : dnvme_pool_default();
+}
+
+void dnvme_pool_set_thread(struct dnvme_pool *pool)
+{
+    thread_pool = pool;
+}
+
+void dnvme_pool_get_stats(struct dnvme_pool *pool, struct dnvme_pool_stats *stats)
+{
+    uint8_t i;
+    memset(stats, 0, sizeof(*stats));
+    stats->cap_bytes = pool->cap_bytes;
+    stats->slab_bytes = __atomic_load_n(&pool->slab_bytes, __ATOMIC_RELAXED);
+    stats->in_use_bytes = __atomic_load_n(&pool->in_use_bytes, __ATOMIC_RELAXED);
+    stats->peak_bytes = __atomic_load_n(&pool->peak_bytes, __ATOMIC_RELAXED);
+    stats->allocs = __atomic_load_n(&pool->allocs, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&pool->frees, __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n(&pool->failures, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool->lock);
+    memcpy(stats->backing_slabs, pool->backing_slabs, sizeof(stats->backing_slabs));
+    stats->fallbacks = pool->fallbacks;
+    pthread_mutex_unlock(&pool->lock);
+    for (i=0; i<pool->nr_classes; i++)
+        stats->in_use += __atomic_load_n(&pool->classes[i].in_use, __ATOMIC_RELAXED);
+}
+
+void dnvme_pool_report(struct dnvme_pool *pool)
+{
+    struct dnvme_pool_stats stats;
+    uint8_t i;
+    dnvme_pool_get_stats(pool, &stats);
+    printf("Pool %s: held %lu KiB", pool->name, stats.slab_bytes >> 10);
+    if (stats.cap_bytes)
+        printf(" of %lu KiB", stats.cap_bytes >> 10);
+    printf(", in use %lu KiB in %lu buffers, peak %lu KiB, allocs %lu, frees %lu, failures %lu\n",
+        stats.in_use_bytes >> 10, stats.in_use, stats.peak_bytes >> 10, stats.allocs, stats.frees, stats.failures);
+    printf("    backing %s requested, slabs 4K/2M/1G: %u/%u/%u, fallbacks %u\n", dnvme_pool_backing_name(pool->backing),
+        stats.backing_slabs[DNVME_BACKING_4K], stats.backing_slabs[DNVME_BACKING_2M],
+        stats.backing_slabs[DNVME_BACKING_1G], stats.fallbacks);
+    for (i=0; i<pool->nr_classes; i++)
+    {
+        struct dnvme_pool_class *cls = &pool->classes[i];
+        if (cls->slabs)
+            printf("    %6u KiB: %u slabs, %lu in use\n", cls->size >> 10, cls->slabs,
+                __atomic_load_n(&cls->in_use, __ATOMIC_RELAXED));
+    }
+}
+
+void dnvme_pool_report_all(void)
+{
+    struct dnvme_pool *pool;
+    pthread_mutex_lock(&pool_list_lock);
+    for (pool=pool_list; pool; pool=pool->next)
+        dnvme_pool_report(pool);
+    pthread_mutex_unlock(&pool_list_lock);
+    printf("Unpooled buffers: allocs %lu, frees %lu\n", __atomic_load_n(&oversize_allocs, __ATOMIC_RELAXED),
+        __atomic_load_n(&oversize_frees, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,105 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_pool.h
+ * Description: pooled 4K aligned data buffers for DMA.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_POOL_H__
+#define __DNVME_POOL_H__
+#include <pthread.h>
+#include <stdint.h>
+
+#define DNVME_POOL_MIN_SHIFT        12
+#define DNVME_POOL_SLAB_SHIFT       21
+#define DNVME_POOL_MIN_SIZE         (1U << DNVME_POOL_MIN_SHIFT)
+#define DNVME_POOL_SLAB_SIZE        (1UL << DNVME_POOL_SLAB_SHIFT)
+#define DNVME_POOL_MAX_CLASSES      (DNVME_POOL_SLAB_SHIFT - DNVME_POOL_MIN_SHIFT + 1)
+#define DNVME_POOL_NAME_LEN         32
+#define DNVME_POOL_PATH_LEN         256
+
+/* Page size behind a slab. Hugepage modes fall back to the next smaller size. */
+enum dnvme_pool_backing {
+    DNVME_BACKING_4K = 0,
+    DNVME_BACKING_2M,
+    DNVME_BACKING_1G,
+    DNVME_BACKING_COUNT,
+};
+
+struct dnvme_pool_slab;
+struct dnvme_pool_region;
+
+/**
+ * Buffers of one power of two size. Free buffers are kept on a lock-free
+ * stack linked through their first 8 bytes; the low 12 bits of 'head' are
+ * a generation tag against ABA, which is free because every buffer is 4K
+ * aligned.
+ */
+struct dnvme_pool_class {
+    uint64_t head;              /* tagged pointer to the first free buffer */
+    uint32_t size;
+    uint32_t slabs;             /* slabs carved for this class */
+    uint64_t in_use;            /* buffers handed out */
+};
+
+/**
+ * A set of size classes from 4K up to 'max_size', carved from 2M aligned
+ * slabs. Allocation and free never take a lock; only carving a new slab
+ * does. Slabs stay with the pool until it is destroyed, so 'slab_bytes' is
+ * the memory the pool holds and 'cap_bytes' bounds it. Slabs sit on 4K
+ * pages unless dnvme_pool_set_backing() asks for hugepages.
+ */
+struct dnvme_pool {
+    char name[DNVME_POOL_NAME_LEN];
+    uint32_t max_size;          /* largest pooled buffer */
+    uint8_t nr_classes;
+    uint64_t cap_bytes;         /* slab memory limit, 0 = unlimited */
+    uint64_t slab_bytes;        /* slab memory held */
+    uint64_t in_use_bytes;      /* bytes handed out, rounded to the class */
+    uint64_t peak_bytes;
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;          /* allocations refused by the cap or the OS */
+    uint8_t backing;            /* requested enum dnvme_pool_backing */
+    char hugetlbfs[DNVME_POOL_PATH_LEN];    /* hugetlbfs mount for file backed slabs, empty = MAP_HUGETLB */
+    uint32_t backing_slabs[DNVME_BACKING_COUNT];    /* slabs by the backing they got */
+    uint32_t fallbacks;         /* regions mapped with smaller pages than requested */
+    pthread_mutex_t lock;       /* serializes slab carving */
+    struct dnvme_pool_region *regions;
+    struct dnvme_pool_slab *slabs;
+    struct dnvme_pool *next;    /* all live pools */
+    struct dnvme_pool_class classes[DNVME_POOL_MAX_CLASSES];
+};
+
+struct dnvme_pool_stats {
+    uint64_t cap_bytes;
+    uint64_t slab_bytes;
+    uint64_t in_use_bytes;
+    uint64_t peak_bytes;
+    uint64_t in_use;            /* buffers not yet freed */
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t failures;
+    uint32_t backing_slabs[DNVME_BACKING_COUNT];
+    uint32_t fallbacks;
+};
+
+struct dnvme_pool *dnvme_pool_create(const char *name, uint32_t max_size, uint64_t cap_bytes);
+int dnvme_pool_destroy(struct dnvme_pool *pool);
+int dnvme_pool_set_backing(struct dnvme_pool *pool, enum dnvme_pool_backing backing, const char *hugetlbfs);
+enum dnvme_pool_backing dnvme_pool_backing_of(const void *buffer);
+const char *dnvme_pool_backing_name(enum dnvme_pool_backing backing);
+void *dnvme_pool_alloc(struct dnvme_pool *pool, uint32_t size);
+void dnvme_pool_free(void *buffer);
+struct dnvme_pool *dnvme_pool_owner(const void *buffer);
+
+struct dnvme_pool *dnvme_pool_default(void);
+struct dnvme_pool *dnvme_pool_thread(void);
+void dnvme_pool_set_thread(struct dnvme_pool *pool);
+
+void dnvme_pool_get_stats(struct dnvme_pool *pool, struct dnvme_pool_stats *stats);
+void dnvme_pool_report(struct dnvme_pool *pool);
+void dnvme_pool_report_all(void);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_qos.c
+ * Description: weighted round robin arbitration and per priority class IO queues.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_qos.h"
+
+static const uint8_t dnvme_qos_prio[DNVME_QOS_CLASSES] = {
+    [DNVME_QOS_URGENT] = NVME_SQ_PRIO_URGENT,
+    [DNVME_QOS_HIGH] = NVME_SQ_PRIO_HIGH,
+    [DNVME_QOS_MEDIUM] = NVME_SQ_PRIO_MEDIUM,
+    [DNVME_QOS_LOW] = NVME_SQ_PRIO_LOW,
+};
+
+/*
+ * Enabling WRR resets the controller, so this has to come before anything
+ * else creates IO queues on 'fd'. Returns -EOPNOTSUPP when CAP.AMS does
+ * not offer weighted round robin, -ENOSPC when the controller grants
+ * fewer queues than the classes ask for.
+ */
+int dnvme_qos_init(struct dnvme_qos *qos, int fd, const struct dnvme_qos_config *config)
+{
+    struct dnvme_engine_config engine_config = config->engine;
+    struct dnvme_arbitration arb = config->arb;
+    uint8_t *qprio;
+    uint32_t cc;
+    uint16_t total = 0;
+    int class, i;
+    int ret;
+
+    memset(qos, 0, sizeof(*qos));
+    qos->fd = fd;
+    for (class=0; class<DNVME_QOS_CLASSES; class++)
+    {
+        qos->first[class] = total;
+        qos->count[class] = config->queues[class];
+        total += config->queues[class];
+    }
+    if (total == 0)
+        return -EINVAL;
+    if (!(NVME_CAP_AMS(dnvme_controller_get_cap(fd)) & 1))
+        return -EOPNOTSUPP;
+
+    ret = dnvme_controller_reg_read_dword(fd, NVME_REG_CC, &cc);
+    if (ret)
+        return ret;
+    if (!(cc & NVME_CC_ENABLE) || (cc & NVME_CC_AMS_MASK) != NVME_CC_AMS_WRRU)
+    {
+        ret = dnvme_init_drive_arbitration(fd, NVME_CC_AMS_WRRU, NULL);
+        if (ret)
+            return ret == ARBITRATION_ERROR ? -EOPNOTSUPP : -EIO;
+    }
+    if (!arb.hpw && !arb.mpw && !arb.lpw)
+        arb.hpw = arb.mpw = arb.lpw = 1;
+    ret = dnvme_admin_set_arbitration(fd, 0, &arb);
+    if (ret == 0)
+        ret = dnvme_admin_get_arbitration(fd, 0, &qos->arb);
+    if (ret)
+        return ret;
+
+    qprio = malloc(total);
+    if (!qprio)
+        return -ENOMEM;
+    for (class=0; class<DNVME_QOS_CLASSES; class++)
+    {
+        for (i=0; i<qos->count[class]; i++)
+            qprio[qos->first[class]+i] = dnvme_qos_prio[class];
+    }
+    engine_config.nr_queues = total;
+    engine_config.qprio = qprio;
+    ret = dnvme_engine_init(&qos->engine, fd, &engine_config);
+    free(qprio);
+    if (ret)
+        return ret;
+    if (qos->engine.nr_queues < total)
+    {
+        dnvme_engine_destroy(&qos->engine);
+        return -ENOSPC;
+    }
+    return SUCCESS;
+}
+
+void dnvme_qos_destroy(struct dnvme_qos *qos)
+{
+    dnvme_engine_destroy(&qos->engine);
+}
+
+/* The 'index'th queue of 'class', NULL when the class has no such queue. */
+struct dnvme_queue *dnvme_qos_queue(struct dnvme_qos *qos, enum dnvme_qos_class class, uint16_t index)
+{
+    if (class >= DNVME_QOS_CLASSES || index >= qos->count[class])
+        return NULL;
+    return dnvme_engine_queue(&qos->engine, qos->first[class] + index);
+}
+
+enum dnvme_qos_class dnvme_qos_class_of(const struct dnvme_qos *qos, const struct dnvme_queue *queue)
+{
+    int class;
+    for (class=DNVME_QOS_CLASSES-1; class>0; class--)
+    {
+        if (queue->index >= qos->first[class] && qos->count[class])
+            break;
+    }
+    return class;
+}
+
+/* One worker per queue as with dnvme_engine_run(); dnvme_qos_class_of() tells a worker its class. */
+int dnvme_qos_run(struct dnvme_qos *qos, dnvme_queue_worker worker, void *arg)
+{
+    return dnvme_engine_run(&qos->engine, worker, arg);
+}
+
+const char *dnvme_qos_class_name(enum dnvme_qos_class class)
+{
+    static const char *names[DNVME_QOS_CLASSES] = {
+        [DNVME_QOS_URGENT] = "urgent",
+        [DNVME_QOS_HIGH] = "high",
+        [DNVME_QOS_MEDIUM] = "medium",
+        [DNVME_QOS_LOW] = "low",
+    };
+    return class < DNVME_QOS_CLASSES ? names[class] : "unknown";
+}
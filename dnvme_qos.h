@@ -0,0 +1,53 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_qos.h
+ * Description: weighted round robin arbitration and per priority class IO queues.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_QOS_H__
+#define __DNVME_QOS_H__
+#include <stdint.h>
+#include "dnvme_commands.h"
+#include "dnvme_engine.h"
+
+/* In arbitration order: urgent SQs are served before any weighted class. */
+enum dnvme_qos_class {
+    DNVME_QOS_URGENT,
+    DNVME_QOS_HIGH,
+    DNVME_QOS_MEDIUM,
+    DNVME_QOS_LOW,
+    DNVME_QOS_CLASSES
+};
+
+struct dnvme_qos_config {
+    uint16_t queues[DNVME_QOS_CLASSES];     /* SQ/CQ pairs per class */
+    struct dnvme_arbitration arb;           /* HPW/MPW/LPW and burst, all 0 = 1 command per burst, equal weights */
+    struct dnvme_engine_config engine;      /* queue setup; nr_queues and qprio are filled in here */
+};
+
+/**
+ * Brings the controller up under weighted round robin with urgent class,
+ * programs the Arbitration feature and creates the IO queues of every
+ * class in one engine, urgent queues first. Each queue still belongs to a
+ * single worker; callers pick a queue by class and per class index and
+ * never deal with raw queue ids, so latency critical commands sit in SQs
+ * the controller fetches ahead of bulk traffic.
+ */
+struct dnvme_qos {
+    int fd;
+    struct dnvme_arbitration arb;           /* as read back from the controller */
+    uint16_t first[DNVME_QOS_CLASSES];      /* engine index of the first queue of each class */
+    uint16_t count[DNVME_QOS_CLASSES];
+    struct dnvme_engine engine;
+};
+
+int dnvme_qos_init(struct dnvme_qos *qos, int fd, const struct dnvme_qos_config *config);
+void dnvme_qos_destroy(struct dnvme_qos *qos);
+struct dnvme_queue *dnvme_qos_queue(struct dnvme_qos *qos, enum dnvme_qos_class class, uint16_t index);
+enum dnvme_qos_class dnvme_qos_class_of(const struct dnvme_qos *qos, const struct dnvme_queue *queue);
+int dnvme_qos_run(struct dnvme_qos *qos, dnvme_queue_worker worker, void *arg);
+const char *dnvme_qos_class_name(enum dnvme_qos_class class);
+
+#endif
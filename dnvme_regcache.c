@@ -0,0 +1,155 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_regcache.c
+ * Description: shadow copy of the controller register block.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_regcache.h"
+
+/* INTMS, INTMC, CSTS, NSSR and BPINFO change under the host's feet. */
+#define DNVME_REGCACHE_VOLATILE     ((1U << 3) | (1U << 4) | (1U << 7) | (1U << 8) | (1U << 16))
+#define DNVME_REGCACHE_ALL          ((1U << DNVME_REGCACHE_DWORDS) - 1)
+#define DNVME_REGCACHE_NSSR_DWORD   8
+
+static struct dnvme_regcache caches[DNVME_REGCACHE_MAX_DEVICES] = {
+    [0 ... DNVME_REGCACHE_MAX_DEVICES-1] = { .fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER },
+};
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct dnvme_regcache *dnvme_regcache_find(int fd)
+{
+    int i;
+    for (i=0; i<DNVME_REGCACHE_MAX_DEVICES; i++)
+    {
+        if (__atomic_load_n(&caches[i].fd, __ATOMIC_ACQUIRE) == fd)
+            return &caches[i];
+    }
+    return NULL;
+}
+
+/* Dwords touched by [offset, offset+bytes), which must lie inside the block. */
+static uint32_t dnvme_regcache_mask(uint32_t offset, uint32_t bytes)
+{
+    uint32_t first = offset/4;
+    uint32_t last = (offset+bytes-1)/4;
+    return ((2U << last) - 1) & ~((1U << first) - 1);
+}
+
+/* Read the whole register block of 'fd' with one 'reader' call and start serving it. */
+int dnvme_regcache_init(int fd, dnvme_reg_reader reader)
+{
+    struct dnvme_regcache *cache;
+    int ret, i;
+    pthread_mutex_lock(&caches_lock);
+    cache = dnvme_regcache_find(fd);
+    for (i=0; !cache && i<DNVME_REGCACHE_MAX_DEVICES; i++)
+    {
+        if (caches[i].fd < 0)
+            cache = &caches[i];
+    }
+    if (!cache)
+    {
+        pthread_mutex_unlock(&caches_lock);
+        return -ENOSPC;
+    }
+    pthread_mutex_lock(&cache->lock);
+    ret = reader(fd, 0, DNVME_REGCACHE_SIZE, (uint8_t *)cache->regs);
+    if (ret == 0)
+    {
+        cache->stale = 0;
+        cache->hits = 0;
+        cache->fetches = 1;
+        __atomic_store_n(&cache->fd, fd, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    pthread_mutex_unlock(&caches_lock);
+    return ret;
+}
+
+void dnvme_regcache_release(int fd)
+{
+    struct dnvme_regcache *cache;
+    pthread_mutex_lock(&caches_lock);
+    cache = dnvme_regcache_find(fd);
+    if (cache)
+        __atomic_store_n(&cache->fd, -1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&caches_lock);
+}
+
+/* Controller or subsystem reset: nothing cached can be trusted any more. */
+void dnvme_regcache_invalidate(int fd)
+{
+    struct dnvme_regcache *cache = dnvme_regcache_find(fd);
+    if (!cache)
+        return;
+    pthread_mutex_lock(&cache->lock);
+    cache->stale = DNVME_REGCACHE_ALL;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/*
+ * Serve a register read from the shadow copy, fetching the dwords that
+ * are volatile or stale with a single 'reader' call spanning them.
+ * Returns -ENOENT when 'fd' has no cache or the range is outside it.
+ */
+int dnvme_regcache_read(int fd, uint32_t offset, uint32_t bytes, uint8_t *data, dnvme_reg_reader reader)
+{
+    struct dnvme_regcache *cache = dnvme_regcache_find(fd);
+    uint32_t need;
+    int ret = 0;
+    if (!cache || bytes == 0 || (uint64_t)offset + bytes > DNVME_REGCACHE_SIZE)
+        return -ENOENT;
+    pthread_mutex_lock(&cache->lock);
+    need = dnvme_regcache_mask(offset, bytes) & (cache->stale | DNVME_REGCACHE_VOLATILE);
+    if (need)
+    {
+        uint32_t lo = __builtin_ctz(need);
+        uint32_t hi = 31 - __builtin_clz(need);
+        ret = reader(fd, lo*4, (hi-lo+1)*4, (uint8_t *)&cache->regs[lo]);
+        if (ret == 0)
+            cache->stale &= ~dnvme_regcache_mask(lo*4, (hi-lo+1)*4);
+        cache->fetches++;
+    }
+    else
+    {
+        cache->hits++;
+    }
+    if (ret == 0)
+        memcpy(data, (uint8_t *)cache->regs + offset, bytes);
+    pthread_mutex_unlock(&cache->lock);
+    return ret;
+}
+
+/* Called after every register write; a write to NSSR resets the whole subsystem. */
+void dnvme_regcache_written(int fd, uint32_t offset, uint32_t bytes)
+{
+    struct dnvme_regcache *cache = dnvme_regcache_find(fd);
+    uint32_t mask;
+    if (!cache || bytes == 0 || offset >= DNVME_REGCACHE_SIZE)
+        return;
+    if ((uint64_t)offset + bytes > DNVME_REGCACHE_SIZE)
+        bytes = DNVME_REGCACHE_SIZE - offset;
+    mask = dnvme_regcache_mask(offset, bytes);
+    pthread_mutex_lock(&cache->lock);
+    cache->stale |= mask & (1U << DNVME_REGCACHE_NSSR_DWORD) ? DNVME_REGCACHE_ALL : mask;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int dnvme_regcache_stats(int fd, uint64_t *hits, uint64_t *fetches)
+{
+    struct dnvme_regcache *cache = dnvme_regcache_find(fd);
+    if (!cache)
+        return -ENOENT;
+    pthread_mutex_lock(&cache->lock);
+    *hits = cache->hits;
+    *fetches = cache->fetches;
+    pthread_mutex_unlock(&cache->lock);
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_regcache.h
+ * Description: shadow copy of the controller register block.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_REGCACHE_H__
+#define __DNVME_REGCACHE_H__
+#include <pthread.h>
+#include <stdint.h>
+
+#define DNVME_REGCACHE_SIZE         0x50    /* CAP through BPMBL */
+#define DNVME_REGCACHE_DWORDS       (DNVME_REGCACHE_SIZE/4)
+#define DNVME_REGCACHE_MAX_DEVICES  16
+
+/**
+ * Registers 0x00-0x4f of one controller. Dwords in 'stale' are fetched on
+ * the next read; volatile registers (INTMS, INTMC, CSTS, NSSR, BPINFO) are
+ * never served from memory, and host written ones go stale on every write
+ * since the controller may not keep all the bits written.
+ */
+struct dnvme_regcache {
+    int fd;                     /* -1 = free slot */
+    uint32_t stale;             /* one bit per dword */
+    uint64_t hits;              /* reads served without touching the device */
+    uint64_t fetches;           /* reads that went to the device */
+    pthread_mutex_t lock;
+    uint32_t regs[DNVME_REGCACHE_DWORDS];
+};
+
+typedef int (*dnvme_reg_reader)(int fd, uint32_t offset, uint32_t bytes, uint8_t *data);
+
+int dnvme_regcache_init(int fd, dnvme_reg_reader reader);
+void dnvme_regcache_release(int fd);
+void dnvme_regcache_invalidate(int fd);
+int dnvme_regcache_read(int fd, uint32_t offset, uint32_t bytes, uint8_t *data, dnvme_reg_reader reader);
+void dnvme_regcache_written(int fd, uint32_t offset, uint32_t bytes);
+int dnvme_regcache_stats(int fd, uint64_t *hits, uint64_t *fetches);
+
+#endif
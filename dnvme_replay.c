@@ -0,0 +1,567 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_replay.c
+ * Description: re-issues the IO commands of a dnvme_trace file and compares latency with the original run.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dnvme.h"
+#include "dnvme_ioctrl.h"
+#include "dnvme_commands.h"
+#include "dnvme_engine.h"
+#include "dnvme_latency.h"
+#include "dnvme_pool.h"
+#include "dnvme_sim.h"
+#include "dnvme_trace.h"
+#include "dnvme_xfer.h"
+
+#define DEVICE_FILE_NAME    "/dev/nvme0"
+#define REPLAY_LATE_NS      10000       /* a command sent this much after its time counts as late */
+#define REPLAY_SPIN_NS      100000      /* closer to its time than this, a command is waited for by spinning */
+#define REPLAY_MAX_NS       16
+
+enum replay_timing {
+    REPLAY_ORIGINAL,        /* the recorded inter-arrival times, divided by --speed */
+    REPLAY_FAST,            /* back to back, bounded only by the queue depth */
+};
+
+struct replay_options {
+    char *dev;
+    int sim;
+    uint8_t timing;         /* enum replay_timing */
+    double speed;           /* time scale of REPLAY_ORIGINAL, 2 = twice as fast */
+    uint16_t qd;            /* commands in flight per queue */
+};
+
+struct replay_cmd {
+    const struct dnvme_trace_record *record;
+    uint64_t offset_ns;     /* submit time after the first IO command of the trace */
+    uint64_t orig_ns;       /* latency in the trace, 0 = completion not traced */
+    uint32_t size;          /* data bytes */
+    uint8_t dir;
+    uint8_t skip;           /* not replayable, see replay_plan() */
+};
+
+struct replay_job;
+
+struct replay_slot {
+    struct replay_job *job;
+    uint8_t *buffer;
+    uint32_t cmd;
+    uint16_t index;
+};
+
+struct replay_job {
+    const struct replay_options *opts;
+    struct replay_cmd *cmds;
+    uint32_t *order;        /* this queue's commands, in trace order */
+    uint32_t count;
+    uint32_t next;
+    uint32_t max_size;      /* largest data buffer of this queue */
+    uint64_t start_ns;      /* common time zero of all queues */
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t errors;
+    uint64_t late;
+    uint64_t elapsed_ns;
+    uint64_t op_errors[256];
+    struct dnvme_lat_hist *hist[256];   /* replay latency per opcode */
+    struct replay_slot *slots;
+    uint16_t *free_slots;
+    uint16_t nr_free;
+};
+
+static uint16_t queue_of[65536];        /* traced SQ id -> engine queue index + 1 */
+
+static uint32_t replay_dword(const uint8_t *sqe, int dword)
+{
+    uint32_t value;
+    memcpy(&value, sqe + dword*4, sizeof(value));
+    return value;
+}
+
+static struct dnvme_lat_hist *replay_hist(struct dnvme_lat_hist **hist, uint8_t opcode)
+{
+    if (!hist[opcode])
+    {
+        hist[opcode] = malloc(sizeof(struct dnvme_lat_hist));
+        if (!hist[opcode])
+            return NULL;
+        dnvme_lat_init(hist[opcode]);
+    }
+    return hist[opcode];
+}
+
+/* LBA size of every namespace the trace touches, looked up once each. */
+static uint32_t replay_lba_size(int fd, uint32_t nsid)
+{
+    static struct {
+        uint32_t nsid;
+        uint32_t lba_size;
+    } cache[REPLAY_MAX_NS];
+    static int cached;
+    struct dnvme_xfer_limits limits;
+    int i;
+
+    for (i=0; i<cached; i++)
+    {
+        if (cache[i].nsid == nsid)
+            return cache[i].lba_size;
+    }
+    if (dnvme_xfer_get_limits(fd, nsid, &limits))
+        limits.lba_size = 0;
+    if (cached < REPLAY_MAX_NS)
+    {
+        cache[cached].nsid = nsid;
+        cache[cached++].lba_size = limits.lba_size;
+    }
+    return limits.lba_size;
+}
+
+/*
+ * Data size and direction of a traced IO command. Only the SQE is traced,
+ * so commands whose data tells the controller what to do (Dataset
+ * Management ranges, reservation keys) or with separate metadata cannot be
+ * replayed faithfully and are skipped; written data is zeroes.
+ */
+static int replay_plan(int fd, struct replay_cmd *cmd)
+{
+    const uint8_t *sqe = cmd->record->sqe;
+    uint32_t lba_size;
+
+    cmd->size = 0;
+    cmd->dir = DATA_DIR_NONE;
+    if (replay_dword(sqe, 4) || replay_dword(sqe, 5))
+        return -EOPNOTSUPP;
+    switch (sqe[0])
+    {
+    case NVME_CMD_FLUSH:
+    case NVME_CMD_WRITE_ZEROES:
+    case NVME_CMD_WRITE_UNCORRECTABLE:
+        return SUCCESS;
+    case NVME_CMD_READ:
+    case NVME_CMD_WRITE:
+    case NVME_CMD_COMPARE:
+        lba_size = replay_lba_size(fd, replay_dword(sqe, 1));
+        if (!lba_size)
+            return -EINVAL;
+        cmd->size = ((replay_dword(sqe, 12) & 0xFFFF) + 1) * lba_size;
+        cmd->dir = sqe[0] == NVME_CMD_READ ? DATA_DIR_FROM_DEVICE : DATA_DIR_TO_DEVICE;
+        return SUCCESS;
+    default:
+        return -EOPNOTSUPP;
+    }
+}
+
+static void replay_complete(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    struct replay_slot *slot = ctx;
+    struct replay_job *job = slot->job;
+    uint8_t opcode = job->cmds[slot->cmd].record->sqe[0];
+    struct dnvme_lat_hist *hist = replay_hist(job->hist, opcode);
+
+    if (NVME_CQE_STATUS(cqe) != NVME_SC_SUCCESS)
+    {
+        job->errors++;
+        job->op_errors[opcode]++;
+    }
+    if (hist)
+        dnvme_lat_add(hist, latency_ns);
+    job->completed++;
+    job->free_slots[job->nr_free++] = slot->index;
+}
+
+/* The traced SQE with its data pointers cleared; the driver fills in PRPs and the command id. */
+static void replay_prepare_cmd(const struct replay_cmd *cmd, struct nvme_io_cmd *io)
+{
+    memcpy(io, cmd->record->sqe, sizeof(*io));
+    memset((uint8_t *)io + 16, 0, 24);
+}
+
+static int replay_worker(struct dnvme_queue *queue, void *arg)
+{
+    struct replay_job *job = &((struct replay_job *)arg)[queue->index];
+    const struct replay_options *opts = job->opts;
+    void **ctx = calloc(opts->qd, sizeof(void *));
+    struct nvme_io_cmd io;
+    struct timespec pause;
+    uint64_t now, due = 0;
+    int ret = 0;
+
+    if (!ctx)
+        return -ENOMEM;
+    while (ret >= 0 && (job->next < job->count || job->completed < job->submitted))
+    {
+        uint16_t n = 0;
+        int waiting = 0;
+        now = dnvme_get_time_ns();
+        while (job->next < job->count && job->nr_free)
+        {
+            struct replay_cmd *cmd = &job->cmds[job->order[job->next]];
+            struct replay_slot *slot;
+            if (opts->timing == REPLAY_ORIGINAL)
+            {
+                due = job->start_ns + (uint64_t)(cmd->offset_ns / opts->speed);
+                if (due > now)
+                {
+                    waiting = 1;
+                    break;
+                }
+                if (now - due > REPLAY_LATE_NS)
+                    job->late++;
+            }
+            slot = &job->slots[job->free_slots[--job->nr_free]];
+            slot->cmd = job->order[job->next];
+            replay_prepare_cmd(cmd, &io);
+            dnvme_batch_add_io(&queue->batch, &io, cmd->size ? slot->buffer : NULL, cmd->size, cmd->dir);
+            ctx[n++] = slot;
+            job->next++;
+            job->submitted++;
+        }
+        if (n)
+        {
+            uint16_t submitted = dnvme_queue_submit(queue, replay_complete, ctx, &ret);
+            /* commands that never went out are not counted as replayed */
+            for (; submitted<n; submitted++)
+            {
+                job->free_slots[job->nr_free++] = ((struct replay_slot *)ctx[submitted])->index;
+                job->next--;
+                job->submitted--;
+            }
+            if (ret < 0)
+                break;
+        }
+        if (waiting)
+        {
+            /* completions are picked up while the next command is not due yet */
+            if (job->completed < job->submitted)
+            {
+                ret = dnvme_queue_reap(queue);
+            }
+            else if (due - now > REPLAY_SPIN_NS)
+            {
+                pause.tv_sec = (due - now - REPLAY_SPIN_NS) / 1000000000;
+                pause.tv_nsec = (due - now - REPLAY_SPIN_NS) % 1000000000;
+                nanosleep(&pause, NULL);
+            }
+            continue;
+        }
+        if (job->completed < job->submitted)
+            ret = dnvme_queue_wait(queue, 1, 0);
+    }
+    job->elapsed_ns = dnvme_get_time_ns() - job->start_ns;
+    free(ctx);
+    if (ret < 0)
+        fprintf(stderr, "queue %d stopped: %s\n", queue->index, strerror(ret == -1 ? errno : -ret));
+    return ret < 0 ? ret : 0;
+}
+
+static double replay_delta(uint64_t orig, uint64_t replay)
+{
+    return orig ? ((double)replay - orig) * 100.0 / orig : 0;
+}
+
+static void replay_show(const char *name, uint64_t errors, const struct dnvme_lat_hist *orig,
+    const struct dnvme_lat_hist *replay)
+{
+    uint64_t orig_p50 = dnvme_lat_percentile(orig, 50), orig_p99 = dnvme_lat_percentile(orig, 99);
+    uint64_t p50 = dnvme_lat_percentile(replay, 50), p99 = dnvme_lat_percentile(replay, 99);
+
+    printf("%-20s %9lu %7lu %9.1f %9.1f %+7.1f%% %9.1f %9.1f %+7.1f%% %9.1f %9.1f %+7.1f%%\n", name, replay->count,
+        errors, dnvme_lat_mean(orig)/1e3, dnvme_lat_mean(replay)/1e3,
+        replay_delta(dnvme_lat_mean(orig), dnvme_lat_mean(replay)), orig_p50/1e3, p50/1e3,
+        replay_delta(orig_p50, p50), orig_p99/1e3, p99/1e3, replay_delta(orig_p99, p99));
+}
+
+static void replay_usage(const char *name)
+{
+    printf("Usage: %s [options] TRACE\n"
+        "  --dev=PATH          dnvme device (default " DEVICE_FILE_NAME ")\n"
+        "  --sim               replay against the userspace stand-in controller\n"
+        "  --timing=MODE       original: recorded inter-arrival times, fast: back to back (default original)\n"
+        "  --speed=X           divide recorded inter-arrival times by X (default 1)\n"
+        "  --qd=N              commands in flight per queue (default 32)\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"dev", required_argument, NULL, 'd'},
+        {"sim", no_argument, NULL, 'S'},
+        {"timing", required_argument, NULL, 't'},
+        {"speed", required_argument, NULL, 'x'},
+        {"qd", required_argument, NULL, 'q'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct replay_options opts = {
+        .dev = DEVICE_FILE_NAME,
+        .timing = REPLAY_ORIGINAL,
+        .speed = 1,
+        .qd = 32,
+    };
+    struct dnvme_engine_config config = {0};
+    struct dnvme_engine engine;
+    struct dnvme_trace_file trace;
+    struct dnvme_trace_match match;
+    struct dnvme_lat_hist *orig[256] = {0}, *replay[256] = {0};
+    struct dnvme_lat_hist orig_total, replay_total;
+    struct replay_cmd *cmds;
+    struct replay_job *jobs;
+    uint64_t errors[256] = {0};
+    uint64_t i, ns, submit_ns, tag, first_ns = 0, orig_end_ns = 0, elapsed = 0, late = 0, total_errors = 0;
+    uint32_t nr_cmds = 0, skipped = 0, admin = 0, max_size = 0;
+    uint16_t nr_qids = 0;
+    uint16_t q;
+    int fd, opt, ret, op;
+
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd': opts.dev = optarg; break;
+        case 'S': opts.sim = 1; break;
+        case 't':
+            if (!strcmp(optarg, "original"))
+                opts.timing = REPLAY_ORIGINAL;
+            else if (!strcmp(optarg, "fast"))
+                opts.timing = REPLAY_FAST;
+            else
+            {
+                fprintf(stderr, "Unknown timing mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'x': opts.speed = strtod(optarg, NULL); break;
+        case 'q': opts.qd = strtoul(optarg, NULL, 0); break;
+        default:
+            replay_usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc-1 || opts.qd == 0 || opts.speed <= 0)
+    {
+        replay_usage(argv[0]);
+        return -1;
+    }
+
+    ret = dnvme_trace_load(argv[optind], &trace);
+    if (ret)
+    {
+        printf("Can't read trace %s: %s\n", argv[optind], strerror(-ret));
+        return ret;
+    }
+    cmds = calloc(trace.count ? trace.count : 1, sizeof(*cmds));
+    ret = dnvme_trace_match_init(&match, 0);
+    if (!cmds || ret)
+        return -ENOMEM;
+
+    /* IO commands with the latency they saw; admin commands belong to the original setup */
+    for (i=0; i<trace.count; i++)
+    {
+        const struct dnvme_trace_record *record = &trace.records[i];
+        ns = dnvme_trace_time_ns(&trace, record->ts);
+        if (record->type == DNVME_TRACE_SQE)
+        {
+            if (record->qid == 0)
+            {
+                admin++;
+                continue;
+            }
+            if (nr_cmds == 0)
+                first_ns = ns;
+            cmds[nr_cmds].record = record;
+            cmds[nr_cmds].offset_ns = ns - first_ns;
+            dnvme_trace_match_submit(&match, record->qid, record->unique_id, ns, nr_cmds);
+            if (!queue_of[record->qid])
+                queue_of[record->qid] = ++nr_qids;
+            nr_cmds++;
+        }
+        else if (record->type == DNVME_TRACE_CQE)
+        {
+            for (op=0; op<record->count && op<DNVME_TRACE_CQES; op++)
+            {
+                if (record->cqe[op].sq_id == 0 ||
+                    dnvme_trace_match_complete(&match, &record->cqe[op], &submit_ns, &tag))
+                    continue;
+                cmds[tag].orig_ns = ns > submit_ns ? ns - submit_ns : 1;
+                if (ns > orig_end_ns)
+                    orig_end_ns = ns;
+            }
+        }
+    }
+    dnvme_trace_match_free(&match);
+    if (nr_cmds == 0)
+    {
+        printf("No IO commands in %s\n", argv[optind]);
+        return -1;
+    }
+
+    if (opts.sim)
+    {
+        ioctl_set_backend(&dnvme_sim_backend);
+        opts.dev = DNVME_SIM_PATH;
+    }
+    fd = open_dev(opts.dev);
+    if (fd < 0)
+    {
+        printf("Can't open device: %s\n", opts.dev);
+        return -1;
+    }
+    ret = init_drive(fd);
+    if (ret)
+    {
+        printf("Init drive failed: %d\n", ret);
+        return ret;
+    }
+    for (i=0; i<nr_cmds; i++)
+    {
+        cmds[i].skip = replay_plan(fd, &cmds[i]) != SUCCESS;
+        skipped += cmds[i].skip;
+        if (cmds[i].size > max_size)
+            max_size = cmds[i].size;
+    }
+
+    config.nr_queues = nr_qids;
+    config.qdepth = opts.qd+1;
+    config.contig = 1;
+    config.max_io_size = max_size;
+    ret = dnvme_engine_init(&engine, fd, &config);
+    if (ret)
+    {
+        printf("Engine init failed: %d\n", ret);
+        return ret;
+    }
+    if (engine.queues[0].depth-1 < opts.qd)
+        opts.qd = engine.queues[0].depth-1;
+
+    /* traced SQs map onto the engine queues in order of first use, folded if fewer were granted */
+    jobs = calloc(engine.nr_queues, sizeof(*jobs));
+    if (!jobs)
+        return -ENOMEM;
+    for (q=0; q<engine.nr_queues; q++)
+    {
+        jobs[q].opts = &opts;
+        jobs[q].cmds = cmds;
+        jobs[q].order = malloc(nr_cmds * sizeof(uint32_t));
+        if (!jobs[q].order)
+            return -ENOMEM;
+    }
+    for (i=0; i<nr_cmds; i++)
+    {
+        struct replay_job *job;
+        if (cmds[i].skip)
+            continue;
+        job = &jobs[(queue_of[cmds[i].record->qid] - 1) % engine.nr_queues];
+        job->order[job->count++] = i;
+        if (cmds[i].size > job->max_size)
+            job->max_size = cmds[i].size;
+    }
+    for (q=0; q<engine.nr_queues; q++)
+    {
+        struct replay_job *job = &jobs[q];
+        job->slots = calloc(opts.qd, sizeof(struct replay_slot));
+        job->free_slots = calloc(opts.qd, sizeof(uint16_t));
+        if (!job->slots || !job->free_slots)
+            return -ENOMEM;
+        for (i=0; i<opts.qd; i++)
+        {
+            job->slots[i].job = job;
+            job->slots[i].index = i;
+            if (job->max_size)
+            {
+                job->slots[i].buffer = dnvme_pool_alloc(engine.queues[q].pool, job->max_size);
+                if (!job->slots[i].buffer)
+                {
+                    printf("Queue %d: no buffer for slot %lu\n", engine.queues[q].sq_id, i);
+                    return -ENOMEM;
+                }
+                memset(job->slots[i].buffer, 0, job->max_size);
+            }
+            job->free_slots[job->nr_free++] = i;
+        }
+    }
+
+    printf("%s: %d IO commands from %d SQ(s) on %d queue(s), %d admin and %d unsupported skipped\n", argv[optind],
+        nr_cmds - skipped, nr_qids, engine.nr_queues, admin, skipped);
+    if (opts.timing == REPLAY_ORIGINAL)
+        printf("Recorded timing at %.2fx, qd %d\n", opts.speed, opts.qd);
+    else
+        printf("Back to back, qd %d\n", opts.qd);
+    /* one time zero for every queue so they keep their recorded offsets to each other */
+    ns = dnvme_get_time_ns() + 1000000;
+    for (q=0; q<engine.nr_queues; q++)
+        jobs[q].start_ns = ns;
+    ret = dnvme_engine_run(&engine, replay_worker, jobs);
+
+    for (q=0; q<engine.nr_queues; q++)
+    {
+        struct replay_job *job = &jobs[q];
+        for (op=0; op<256; op++)
+        {
+            errors[op] += job->op_errors[op];
+            if (!job->hist[op])
+                continue;
+            if (replay_hist(replay, op))
+                dnvme_lat_merge(replay[op], job->hist[op]);
+            free(job->hist[op]);
+        }
+        for (i=0; i<job->count; i++)
+        {
+            struct replay_cmd *cmd = &cmds[job->order[i]];
+            if (cmd->orig_ns && replay_hist(orig, cmd->record->sqe[0]))
+                dnvme_lat_add(orig[cmd->record->sqe[0]], cmd->orig_ns);
+        }
+        if (job->elapsed_ns > elapsed)
+            elapsed = job->elapsed_ns;
+        late += job->late;
+        total_errors += job->errors;
+        for (i=0; i<opts.qd; i++)
+        {
+            if (job->slots[i].buffer)
+                free_buffer(job->slots[i].buffer);
+        }
+        free(job->slots);
+        free(job->free_slots);
+        free(job->order);
+    }
+    printf("%-20s %9s %7s %9s %9s %8s %9s %9s %8s %9s %9s %8s\n", "opcode", "cmds", "errors", "trace", "mean(us)",
+        "delta", "trace", "p50(us)", "delta", "trace", "p99(us)", "delta");
+    dnvme_lat_init(&orig_total);
+    dnvme_lat_init(&replay_total);
+    for (op=0; op<256; op++)
+    {
+        if (!replay[op])
+            continue;
+        if (!orig[op] && replay_hist(orig, op) == NULL)
+            return -ENOMEM;
+        replay_show(dnvme_trace_opcode_name(1, op), errors[op], orig[op], replay[op]);
+        dnvme_lat_merge(&orig_total, orig[op]);
+        dnvme_lat_merge(&replay_total, replay[op]);
+    }
+    replay_show("total", total_errors, &orig_total, &replay_total);
+    printf("elapsed: trace %.3f ms, replay %.3f ms; %lu command(s) sent over %dus late\n",
+        (orig_end_ns - first_ns)/1e6, elapsed/1e6, late, REPLAY_LATE_NS/1000);
+
+    for (op=0; op<256; op++)
+    {
+        free(orig[op]);
+        free(replay[op]);
+    }
+    free(jobs);
+    free(cmds);
+    dnvme_trace_unload(&trace);
+    dnvme_engine_destroy(&engine);
+    close_dev(fd);
+    return ret;
+}
@@ -0,0 +1,1229 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_sim.c
+ * Description: userspace stand-in for the dnvme driver ioctl interface.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <dnvme.h>
+#include "dnvme_sim.h"
+#include "dnvme_ioctrl.h"
+#include "dnvme_pi.h"
+
+#define SIM_REG_SPACE       0x1000
+#define SIM_PCI_SPACE       0x1000
+#define SIM_PCI_PM_CAP      0x40
+#define SIM_PCI_MSIX_CAP    0x50
+#define SIM_PCI_EXP_CAP     0x70
+#define SIM_PCI_AER_CAP     0x100
+#define SIM_MSIX_ENTRIES    64
+#define SIM_CHUNK_SHIFT     12          /* RAM namespace is allocated in 4K chunks as it is written */
+#define SIM_CHUNK_SIZE      (1u << SIM_CHUNK_SHIFT)
+#define SIM_DIR_SHIFT       18          /* chunks per directory, a directory covers 1G */
+#define SIM_DIR_SIZE        (1u << SIM_DIR_SHIFT)
+
+struct sim_cmd_data {
+    uint8_t *buffer;        /* user data buffer of the command */
+    uint32_t size;
+    uint8_t dir;
+};
+
+struct sim_sq {
+    uint8_t valid;
+    uint16_t cq_id;
+    uint32_t elements;
+    uint32_t head;          /* SQ head reported by the last reaped CQE */
+    uint32_t fetch;         /* next entry the controller will execute */
+    uint32_t tail;          /* last doorbell value */
+    uint32_t tail_virt;     /* next free entry for NVME_IOCTL_SEND_64B_CMD */
+    uint16_t next_cid;
+    uint8_t *entries;
+    struct sim_cmd_data *data;
+};
+
+struct sim_cq {
+    uint8_t valid;
+    uint8_t phase;
+    uint8_t irq_enabled;
+    uint16_t irq_no;
+    uint32_t elements;
+    uint32_t head;
+    uint32_t count;
+    uint32_t isr_count;
+    uint32_t coalesced;     /* completions posted since the last interrupt */
+    uint64_t coalesce_ns;   /* when the first of them was posted */
+    uint32_t inflight;      /* completions held back until due, they have room reserved */
+    struct nvme_completion *entries;
+};
+
+/* A completion waiting for its modelled latency to pass. */
+struct sim_pending {
+    uint64_t due_ns;
+    uint32_t result;
+    uint16_t cq_id;
+    uint16_t sq_id;
+    uint16_t cid;
+    uint16_t status;
+};
+
+enum sim_media_op {
+    SIM_MEDIA_READ,
+    SIM_MEDIA_WRITE,
+    SIM_MEDIA_ZERO,
+    SIM_MEDIA_COMPARE,
+};
+
+static struct sim_ctrl {
+    int fd;
+    struct dnvme_sim_config config;
+    pthread_mutex_t lock;
+    uint8_t bar[SIM_REG_SPACE];
+    uint8_t pci[SIM_PCI_SPACE];
+    struct nvme_prep_sq prep_sq[DNVME_SIM_MAX_QUEUES+1];   /* by queue id, like the driver's queue lists */
+    struct nvme_prep_cq prep_cq[DNVME_SIM_MAX_QUEUES+1];
+    uint16_t nr_queues;     /* IO queues granted, 0 until negotiated */
+    uint32_t features[256];
+    uint8_t coalesce_off[SIM_MSIX_ENTRIES];    /* Interrupt Vector Configuration CD bit per vector */
+    struct interrupts irq;
+    struct sim_sq sq[DNVME_SIM_MAX_QUEUES+1];
+    struct sim_cq cq[DNVME_SIM_MAX_QUEUES+1];
+    uint8_t timed;          /* latency or bandwidth configured, completions may be held back */
+    uint64_t rng;
+    uint64_t link_free_ns;  /* when the data path is idle again */
+    uint8_t ***chunks;      /* RAM namespace by directory and chunk, NULL ones read as zeroes */
+    uint64_t nr_dirs;
+    uint32_t block_size;    /* bytes of an LBA of namespace 1 with its metadata */
+    struct dnvme_pi_format format;
+    struct sim_pending *pending;    /* min-heap on due_ns */
+    uint32_t nr_pending;
+    uint32_t max_pending;
+} sim = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static uint32_t sim_reg_read32(uint32_t offset)
+{
+    uint32_t value;
+    memcpy(&value, &sim.bar[offset], 4);
+    return value;
+}
+
+static void sim_reg_write32(uint32_t offset, uint32_t value)
+{
+    memcpy(&sim.bar[offset], &value, 4);
+}
+
+static void sim_pci_write16(uint32_t offset, uint16_t value)
+{
+    memcpy(&sim.pci[offset], &value, 2);
+}
+
+static void sim_pci_write32(uint32_t offset, uint32_t value)
+{
+    memcpy(&sim.pci[offset], &value, 4);
+}
+
+static void sim_init_regs(void)
+{
+    uint64_t cap = (uint64_t)sim.config.mqes
+        | (1ULL << 16)          /* CQR, queues must be contiguous */
+        | (1ULL << 17)          /* AMS, weighted round robin with urgent class */
+        | (1ULL << 24)          /* TO, 500ms */
+        | (1ULL << 37);         /* CSS, NVM command set */
+    memset(sim.bar, 0, sizeof(sim.bar));
+    memcpy(&sim.bar[NVME_REG_CAP], &cap, 8);
+    sim_reg_write32(NVME_REG_VS, 0x00010400);
+
+    memset(sim.pci, 0, sizeof(sim.pci));
+    sim_pci_write16(0x00, 0x1b36);                          /* vendor id */
+    sim_pci_write16(0x02, 0x0010);                          /* device id */
+    sim_pci_write16(0x06, 0x0010);                          /* status, capability list */
+    sim_pci_write32(0x08, 0x01080200);                      /* class code, NVMe */
+    sim.pci[0x34] = SIM_PCI_PM_CAP;
+    sim_pci_write16(SIM_PCI_PM_CAP, 0x01 | (SIM_PCI_MSIX_CAP << 8));
+    sim_pci_write16(SIM_PCI_PM_CAP+2, 0x0003);
+    sim_pci_write16(SIM_PCI_MSIX_CAP, 0x11 | (SIM_PCI_EXP_CAP << 8));
+    sim_pci_write16(SIM_PCI_MSIX_CAP+2, SIM_MSIX_ENTRIES-1);
+    sim_pci_write32(SIM_PCI_MSIX_CAP+4, 0x2000);            /* table, BIR 0 */
+    sim_pci_write32(SIM_PCI_MSIX_CAP+8, 0x3000);            /* PBA, BIR 0 */
+    sim_pci_write16(SIM_PCI_EXP_CAP, 0x10);
+    sim_pci_write16(SIM_PCI_EXP_CAP+2, 0x0002);
+    sim_pci_write32(SIM_PCI_EXP_CAP+0x0C, 0x44);            /* link cap, Gen4 x4 */
+    sim_pci_write16(SIM_PCI_EXP_CAP+0x12, 0x44);            /* link status, Gen4 x4 */
+    sim_pci_write32(SIM_PCI_AER_CAP, 0x0001 | (2 << 16));   /* AER v2, last */
+}
+
+static const uint8_t sim_zero[SIM_CHUNK_SIZE];
+
+static void sim_pending_sift_down(uint32_t i)
+{
+    struct sim_pending tmp;
+    uint32_t child;
+    for (;;)
+    {
+        child = 2*i + 1;
+        if (child >= sim.nr_pending)
+            break;
+        if (child+1 < sim.nr_pending && sim.pending[child+1].due_ns < sim.pending[child].due_ns)
+            child++;
+        if (sim.pending[i].due_ns <= sim.pending[child].due_ns)
+            break;
+        tmp = sim.pending[i];
+        sim.pending[i] = sim.pending[child];
+        sim.pending[child] = tmp;
+        i = child;
+    }
+}
+
+static int sim_pending_push(const struct sim_pending *pending)
+{
+    struct sim_pending tmp;
+    uint32_t i, parent;
+    if (sim.nr_pending == sim.max_pending)
+    {
+        uint32_t max = sim.max_pending ? sim.max_pending*2 : 1024;
+        struct sim_pending *grown = realloc(sim.pending, max*sizeof(*grown));
+        if (!grown)
+            return -ENOMEM;
+        sim.pending = grown;
+        sim.max_pending = max;
+    }
+    i = sim.nr_pending++;
+    sim.pending[i] = *pending;
+    while (i)
+    {
+        parent = (i-1) / 2;
+        if (sim.pending[parent].due_ns <= sim.pending[i].due_ns)
+            break;
+        tmp = sim.pending[i];
+        sim.pending[i] = sim.pending[parent];
+        sim.pending[parent] = tmp;
+        i = parent;
+    }
+    return 0;
+}
+
+/* A deleted queue never sees the completions still held back for it. */
+static void sim_pending_drop(int sq_id, int cq_id)
+{
+    uint32_t i = 0;
+    int dropped = 0;
+    while (i < sim.nr_pending)
+    {
+        struct sim_pending *pending = &sim.pending[i];
+        if (pending->sq_id != sq_id && pending->cq_id != cq_id)
+        {
+            i++;
+            continue;
+        }
+        if (sim.cq[pending->cq_id].inflight)
+            sim.cq[pending->cq_id].inflight--;
+        *pending = sim.pending[--sim.nr_pending];
+        dropped = 1;
+    }
+    if (!dropped)
+        return;
+    for (i=sim.nr_pending/2; i>0; i--)
+        sim_pending_sift_down(i-1);
+}
+
+static void sim_free_sq(uint16_t qid)
+{
+    sim_pending_drop(qid, -1);
+    free(sim.sq[qid].entries);
+    free(sim.sq[qid].data);
+    memset(&sim.sq[qid], 0, sizeof(sim.sq[qid]));
+}
+
+static void sim_free_cq(uint16_t qid)
+{
+    sim_pending_drop(-1, qid);
+    free(sim.cq[qid].entries);
+    memset(&sim.cq[qid], 0, sizeof(sim.cq[qid]));
+}
+
+static int sim_alloc_sq(uint16_t qid, uint16_t cq_id, uint32_t elements)
+{
+    struct sim_sq *sq = &sim.sq[qid];
+    sq->entries = calloc(elements, NVME_IOSQ_ELEMENT_SIZE);
+    sq->data = calloc(elements, sizeof(struct sim_cmd_data));
+    if (!sq->entries || !sq->data)
+    {
+        sim_free_sq(qid);
+        return -ENOMEM;
+    }
+    sq->cq_id = cq_id;
+    sq->elements = elements;
+    sq->valid = 1;
+    return 0;
+}
+
+static int sim_alloc_cq(uint16_t qid, uint32_t elements, uint8_t irq_enabled, uint16_t irq_no)
+{
+    struct sim_cq *cq = &sim.cq[qid];
+    cq->entries = calloc(elements, sizeof(struct nvme_completion));
+    if (!cq->entries)
+        return -ENOMEM;
+    cq->elements = elements;
+    cq->phase = 1;
+    cq->irq_enabled = irq_enabled;
+    cq->irq_no = irq_no;
+    cq->valid = 1;
+    return 0;
+}
+
+static void sim_reset(int keep_admin)
+{
+    uint16_t qid;
+    sim.nr_pending = 0;
+    for (qid=keep_admin ? 1 : 0; qid<=DNVME_SIM_MAX_QUEUES; qid++)
+    {
+        sim_free_sq(qid);
+        sim_free_cq(qid);
+    }
+    if (keep_admin)
+    {
+        sim.sq[0].head = sim.sq[0].fetch = sim.sq[0].tail = sim.sq[0].tail_virt = 0;
+        sim.cq[0].head = sim.cq[0].count = 0;
+        sim.cq[0].phase = 1;
+    }
+    sim.nr_queues = 0;
+}
+
+static void sim_identify(struct nvme_admin_cmd *cmd, struct sim_cmd_data *data, uint16_t *status)
+{
+    if (!data->buffer)
+    {
+        *status = NVME_SC_INVALID_FIELD;
+        return;
+    }
+    memset(data->buffer, 0, data->size);
+    if (cmd->cdw10.identify.cns == NVME_ID_CNS_CTRL && data->size >= sizeof(struct nvme_id_ctrl))
+    {
+        struct nvme_id_ctrl *ctrl = (struct nvme_id_ctrl *)data->buffer;
+        ctrl->vid = 0x1b36;
+        memcpy(ctrl->sn, "DNVMESIM0001        ", sizeof(ctrl->sn));
+        memset(ctrl->mn, ' ', sizeof(ctrl->mn));
+        memcpy(ctrl->mn, "dnvme simulated controller", 26);
+        memcpy(ctrl->fr, "1.0     ", sizeof(ctrl->fr));
+        ctrl->mdts = sim.config.mdts;
+        ctrl->ver = 0x00010400;
+        ctrl->sqes = (NVME_NVM_IOSQES << 4) | NVME_NVM_IOSQES;
+        ctrl->cqes = (NVME_NVM_IOCQES << 4) | NVME_NVM_IOCQES;
+        ctrl->nn = 1;
+        ctrl->oncs = (1 << 2) | (1 << 3);   /* Dataset Management, Write Zeroes */
+    }
+    else if (cmd->cdw10.identify.cns == NVME_ID_CNS_NS && data->size >= sizeof(struct nvme_id_ns))
+    {
+        struct nvme_id_ns *ns = (struct nvme_id_ns *)data->buffer;
+        if (cmd->nsid != 1)
+        {
+            *status = NVME_SC_INVALID_NAMESPACE;
+            return;
+        }
+        ns->nsze = sim.config.nsze;
+        ns->ncap = sim.config.nsze;
+        ns->nuse = sim.config.nsze;
+        ns->lbaf[0].ds = __builtin_ctz(sim.config.lba_size);
+        ns->lbaf[0].ms = sim.config.ms;
+        if (sim.config.ms)
+        {
+            ns->flbas = NVME_NS_FLBAS_META_EXT;
+            ns->mc = 1;     /* extended LBAs only, there is no metadata pointer to follow */
+        }
+        if (sim.config.pi)
+        {
+            ns->dpc = (1 << (sim.config.pi-1)) | (sim.config.pi_first ? NVME_NS_DPC_PI_FIRST : NVME_NS_DPC_PI_LAST);
+            ns->dps = sim.config.pi | (sim.config.pi_first ? NVME_NS_DPS_PI_FIRST : 0);
+        }
+    }
+    else
+    {
+        *status = NVME_SC_INVALID_FIELD;
+    }
+}
+
+static void sim_admin(struct nvme_admin_cmd *cmd, struct sim_cmd_data *data, uint16_t *status, uint32_t *result)
+{
+    uint16_t qid;
+    uint32_t elements;
+    switch (cmd->opcode)
+    {
+    case NVME_ADMIN_CREATE_IOCQ:
+        qid = cmd->cdw10.create_iocq.qid;
+        elements = cmd->cdw10.create_iocq.qsize+1;
+        if (qid == 0 || qid > sim.nr_queues || sim.cq[qid].valid)
+            *status = NVME_SC_QID_INVALID;
+        else if (sim.prep_cq[qid].cq_id != qid || sim.prep_cq[qid].elements != elements)
+            *status = NVME_SC_INVALID_FIELD;
+        else if (elements > (uint32_t)sim.config.mqes+1)
+            *status = NVME_SC_QUEUE_SIZE;
+        else if (cmd->cdw11.create_iocq.int_en && cmd->cdw11.create_iocq.int_no >= SIM_MSIX_ENTRIES)
+            *status = NVME_SC_INVALID_VECTOR;
+        else if (sim_alloc_cq(qid, elements, cmd->cdw11.create_iocq.int_en, cmd->cdw11.create_iocq.int_no))
+            *status = NVME_SC_INTERNAL;
+        break;
+    case NVME_ADMIN_CREATE_IOSQ:
+        qid = cmd->cdw10.create_iosq.qid;
+        elements = cmd->cdw10.create_iosq.qsize+1;
+        if (qid == 0 || qid > sim.nr_queues || sim.sq[qid].valid)
+            *status = NVME_SC_QID_INVALID;
+        else if (!sim.cq[cmd->cdw11.create_iosq.cq_id].valid || cmd->cdw11.create_iosq.cq_id == 0)
+            *status = NVME_SC_CQ_INVALID;
+        else if (sim.prep_sq[qid].sq_id != qid || sim.prep_sq[qid].elements != elements)
+            *status = NVME_SC_INVALID_FIELD;
+        else if (elements > (uint32_t)sim.config.mqes+1)
+            *status = NVME_SC_QUEUE_SIZE;
+        else if (sim_alloc_sq(qid, cmd->cdw11.create_iosq.cq_id, elements))
+            *status = NVME_SC_INTERNAL;
+        break;
+    case NVME_ADMIN_DELETE_IOSQ:
+        qid = cmd->cdw10.del_ioq.qid;
+        if (qid == 0 || qid > DNVME_SIM_MAX_QUEUES || !sim.sq[qid].valid)
+            *status = NVME_SC_QID_INVALID;
+        else
+            sim_free_sq(qid);
+        break;
+    case NVME_ADMIN_DELETE_IOCQ:
+        qid = cmd->cdw10.del_ioq.qid;
+        if (qid == 0 || qid > DNVME_SIM_MAX_QUEUES || !sim.cq[qid].valid)
+            *status = NVME_SC_QID_INVALID;
+        else
+            sim_free_cq(qid);
+        break;
+    case NVME_ADMIN_IDENTIFY:
+        sim_identify(cmd, data, status);
+        break;
+    case NVME_ADMIN_SET_FEATURE:
+        if (cmd->cdw10.set_feature.fid == NVME_FEATURE_NUM_QUEUES)
+        {
+            uint32_t nr_sq = cmd->cdw11.feature.noq.num_sq+1;
+            uint32_t nr_cq = cmd->cdw11.feature.noq.num_cq+1;
+            if (sim.nr_queues)
+            {
+                *status = NVME_SC_CMD_SEQ_ERROR;
+                break;
+            }
+            sim.nr_queues = nr_sq < nr_cq ? nr_sq : nr_cq;
+            if (sim.nr_queues > sim.config.max_queues)
+                sim.nr_queues = sim.config.max_queues;
+            *result = ((uint32_t)(sim.nr_queues-1) << 16) | (sim.nr_queues-1);
+        }
+        else if (cmd->cdw10.set_feature.fid == NVME_FEATURE_IRQ_CONFIG)
+        {
+            if (cmd->cdw11.feature.ivc.vector >= SIM_MSIX_ENTRIES)
+                *status = NVME_SC_INVALID_FIELD;
+            else
+                sim.coalesce_off[cmd->cdw11.feature.ivc.vector] = cmd->cdw11.feature.ivc.disable;
+        }
+        else
+        {
+            sim.features[cmd->cdw10.set_feature.fid] = cmd->cdw11.value;
+        }
+        break;
+    case NVME_ADMIN_GET_FEATURE:
+        if (cmd->cdw10.get_feature.fid == NVME_FEATURE_NUM_QUEUES)
+        {
+            uint16_t nr_queues = sim.nr_queues ? sim.nr_queues : sim.config.max_queues;
+            *result = ((uint32_t)(nr_queues-1) << 16) | (nr_queues-1);
+        }
+        else if (cmd->cdw10.get_feature.fid == NVME_FEATURE_IRQ_CONFIG)
+        {
+            uint16_t vector = cmd->cdw11.feature.ivc.vector;
+            if (vector >= SIM_MSIX_ENTRIES)
+                *status = NVME_SC_INVALID_FIELD;
+            else
+                *result = vector | ((uint32_t)sim.coalesce_off[vector] << 16);
+        }
+        else
+        {
+            *result = sim.features[cmd->cdw10.get_feature.fid];
+        }
+        break;
+    case NVME_ADMIN_ABORT:
+    case NVME_ADMIN_ASYNC_EVENT_REQUEST:
+    case NVME_ADMIN_GET_LOG_PAGE:
+    case NVME_ADMIN_FIRMWARE_COMMIT:
+    case NVME_ADMIN_FIRMWARE_IMAGE_DOWNLOAD:
+    case NVME_ADMIN_DEVICE_SELF_TEST:
+    case NVME_ADMIN_FORMAT_NVM:
+    case NVME_ADMIN_SANITIZE:
+        break;
+    default:
+        *status = NVME_SC_INVALID_OPCODE;
+        break;
+    }
+}
+
+/* Moves data between a command buffer and the RAM namespace, 'buffer' is unused for SIM_MEDIA_ZERO. */
+static uint16_t sim_media(enum sim_media_op op, uint64_t offset, uint8_t *buffer, uint64_t bytes)
+{
+    while (bytes)
+    {
+        uint64_t index = offset >> SIM_CHUNK_SHIFT;
+        uint8_t **dir = sim.chunks[index >> SIM_DIR_SHIFT];
+        uint32_t start = offset & (SIM_CHUNK_SIZE-1);
+        uint32_t n = bytes < SIM_CHUNK_SIZE-start ? bytes : SIM_CHUNK_SIZE-start;
+        uint8_t *chunk = dir ? dir[index & (SIM_DIR_SIZE-1)] : NULL;
+        switch (op)
+        {
+        case SIM_MEDIA_READ:
+            memcpy(buffer, chunk ? chunk+start : sim_zero, n);
+            break;
+        case SIM_MEDIA_WRITE:
+            if (!dir)
+            {
+                dir = sim.chunks[index >> SIM_DIR_SHIFT] = calloc(SIM_DIR_SIZE, sizeof(*dir));
+                if (!dir)
+                    return NVME_SC_WRITE_FAULT;
+            }
+            if (!chunk)
+            {
+                chunk = dir[index & (SIM_DIR_SIZE-1)] = malloc(SIM_CHUNK_SIZE);
+                if (!chunk)
+                    return NVME_SC_WRITE_FAULT;
+                /* a full chunk write needs no zeroing */
+                if (start || n < SIM_CHUNK_SIZE)
+                    memset(chunk, 0, SIM_CHUNK_SIZE);
+            }
+            memcpy(chunk+start, buffer, n);
+            break;
+        case SIM_MEDIA_ZERO:
+            if (chunk)
+                memset(chunk+start, 0, n);
+            break;
+        case SIM_MEDIA_COMPARE:
+            if (memcmp(buffer, chunk ? chunk+start : sim_zero, n))
+                return NVME_SC_COMPARE_FAILED;
+            break;
+        }
+        if (buffer)
+            buffer += n;
+        offset += n;
+        bytes -= n;
+    }
+    return NVME_SC_SUCCESS;
+}
+
+/* Deallocated ranges of a Dataset Management command read back as zeroes. */
+static uint16_t sim_deallocate(struct nvme_io_cmd *cmd, struct sim_cmd_data *data)
+{
+    const struct nvme_dsm_range *range = (const struct nvme_dsm_range *)data->buffer;
+    uint32_t i, nr = cmd->cdw10.dataset_management.nr+1;
+    if (!cmd->cdw11.dataset_management.deallocate || !sim.chunks)
+        return NVME_SC_SUCCESS;
+    if (!range || data->size < nr*sizeof(*range))
+        return NVME_SC_INVALID_FIELD;
+    for (i=0; i<nr; i++)
+    {
+        if (range[i].slba + range[i].nlb > sim.config.nsze)
+            return NVME_SC_LBA_RANGE;
+        sim_media(SIM_MEDIA_ZERO, range[i].slba*sim.block_size, NULL, (uint64_t)range[i].nlb*sim.block_size);
+    }
+    return NVME_SC_SUCCESS;
+}
+
+/*
+ * A block that was never written, or was deallocated or zeroed, has a PI
+ * tuple of zeroes in the RAM namespace; it reads back with the application
+ * and reference tags all ones, as after a format, so checks skip it.
+ */
+static void sim_pi_unwritten(uint8_t *buffer, uint64_t bytes)
+{
+    static const uint8_t zero[DNVME_PI_SIZE];
+    uint64_t offset;
+    uint8_t *pi;
+    for (offset=0; offset+sim.block_size <= bytes; offset+=sim.block_size)
+    {
+        pi = buffer + offset + sim.config.lba_size + (sim.config.pi_first ? 0 : sim.config.ms-DNVME_PI_SIZE);
+        if (!memcmp(pi, zero, DNVME_PI_SIZE))
+            memset(pi+2, 0xFF, DNVME_PI_SIZE-2);
+    }
+}
+
+/* PRCHK of a Read or Write; the tag fields are at the same bits in both. */
+static uint16_t sim_pi_check(struct nvme_io_cmd *cmd, const uint8_t *buffer, uint64_t bytes, uint64_t slba)
+{
+    struct dnvme_pi_tags tags = {
+        .ref = cmd->cdw14.read.eilbrt,
+        .app = cmd->cdw15.read.elbat,
+        .app_mask = cmd->cdw15.read.elbatm,
+        .check = cmd->cdw12.read.prinfo & DNVME_PI_PRCHK_ALL,
+    };
+    struct dnvme_pi_error error;
+    if (!tags.check)
+        return NVME_SC_SUCCESS;
+    if (dnvme_pi_verify(&sim.format, NULL, buffer, NULL, bytes/sim.block_size, slba, &tags, &error, NULL))
+        return error.status ? error.status : NVME_SC_INTERNAL;
+    return NVME_SC_SUCCESS;
+}
+
+/* Executes an IO command, returns the bytes its data transfer moves. */
+static uint32_t sim_io(struct nvme_io_cmd *cmd, struct sim_cmd_data *data, uint16_t *status)
+{
+    uint64_t slba = ((uint64_t)cmd->cdw11.read.start_lba_up << 32) | cmd->cdw10.read.start_lba_low;
+    uint64_t nlb = cmd->cdw12.read.nlb+1;
+    uint64_t bytes = nlb*sim.block_size;
+    if (cmd->nsid != 1)
+    {
+        *status = NVME_SC_INVALID_NAMESPACE;
+        return 0;
+    }
+    switch (cmd->opcode)
+    {
+    case NVME_CMD_READ:
+    case NVME_CMD_WRITE:
+    case NVME_CMD_COMPARE:
+    case NVME_CMD_WRITE_ZEROES:
+    case NVME_CMD_WRITE_UNCORRECTABLE:
+        if (slba + nlb > sim.config.nsze)
+        {
+            *status = NVME_SC_LBA_RANGE;
+            return 0;
+        }
+        break;
+    case NVME_CMD_FLUSH:
+        return 0;
+    case NVME_CMD_DATASET_MANAGEMENT:
+        *status = sim_deallocate(cmd, data);
+        return 0;
+    default:
+        *status = NVME_SC_INVALID_OPCODE;
+        return 0;
+    }
+    if (cmd->opcode == NVME_CMD_WRITE_UNCORRECTABLE)
+        return 0;
+    if (cmd->opcode == NVME_CMD_WRITE_ZEROES)
+    {
+        if (sim.chunks)
+            sim_media(SIM_MEDIA_ZERO, slba*sim.block_size, NULL, bytes);
+        return 0;
+    }
+    if (!data->buffer)
+        return 0;
+    if (bytes > data->size)
+        bytes = data->size;
+    if (sim.format.type && (cmd->cdw12.read.prinfo & DNVME_PI_PRACT))
+    {
+        *status = NVME_SC_INVALID_FIELD;
+        return 0;
+    }
+    if (!sim.chunks)
+        return bytes;
+    if (cmd->opcode == NVME_CMD_READ)
+    {
+        *status = sim_media(SIM_MEDIA_READ, slba*sim.block_size, data->buffer, bytes);
+        if (sim.format.type && *status == NVME_SC_SUCCESS)
+        {
+            sim_pi_unwritten(data->buffer, bytes);
+            *status = sim_pi_check(cmd, data->buffer, bytes, slba);
+        }
+    }
+    else if (cmd->opcode == NVME_CMD_WRITE)
+    {
+        if (sim.format.type)
+            *status = sim_pi_check(cmd, data->buffer, bytes, slba);
+        if (*status == NVME_SC_SUCCESS)
+            *status = sim_media(SIM_MEDIA_WRITE, slba*sim.block_size, data->buffer, bytes);
+    }
+    else
+    {
+        *status = sim_media(SIM_MEDIA_COMPARE, slba*sim.block_size, data->buffer, bytes);
+    }
+    return bytes;
+}
+
+static void sim_post(struct sim_cq *cq, uint16_t sq_id, uint16_t sq_head, uint16_t cid, uint16_t status, uint32_t result)
+{
+    uint32_t slot = (cq->head + cq->count) % cq->elements;
+    struct nvme_completion *cqe = &cq->entries[slot];
+    cqe->result = result;
+    cqe->rsvd = 0;
+    cqe->sq_head = sq_head;
+    cqe->sq_id = sq_id;
+    cqe->command_id = cid;
+    cqe->status = (status << 1) | cq->phase;
+    cq->count++;
+    if (slot == cq->elements-1)
+        cq->phase ^= 1;
+}
+
+static uint64_t sim_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/* Uniform in [0, 1). */
+static double sim_random(void)
+{
+    uint64_t x = sim.rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sim.rng = x;
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t sim_latency_ns(const struct dnvme_sim_latency *latency)
+{
+    double ns = latency->mean_ns;
+    switch (latency->dist)
+    {
+    case DNVME_SIM_DIST_UNIFORM:
+        ns += (2*sim_random() - 1) * latency->dev_ns;
+        break;
+    case DNVME_SIM_DIST_NORMAL:
+        ns += sqrt(-2*log(1 - sim_random())) * cos(2*M_PI*sim_random()) * latency->dev_ns;
+        break;
+    case DNVME_SIM_DIST_EXPONENTIAL:
+        ns += (-log(1 - sim_random()) - 1) * latency->dev_ns;
+        break;
+    }
+    return ns > 0 ? ns : 0;
+}
+
+/* When an IO command fetched at 'now' completes: media latency, then its data over the shared link. */
+static uint64_t sim_due_ns(uint8_t opcode, uint32_t bytes, uint64_t now)
+{
+    const struct dnvme_sim_latency *latency =
+        opcode == NVME_CMD_READ || opcode == NVME_CMD_COMPARE ? &sim.config.read : &sim.config.write;
+    uint64_t due = now + (latency->mean_ns ? sim_latency_ns(latency) : 0);
+    if (sim.config.bandwidth && bytes)
+    {
+        if (due < sim.link_free_ns)
+            due = sim.link_free_ns;
+        due += (uint64_t)bytes*1000000000 / sim.config.bandwidth;
+        sim.link_free_ns = due;
+    }
+    return due;
+}
+
+/*
+ * Interrupt Coalescing: one interrupt once the aggregation threshold is
+ * reached or the oldest unsignalled completion is older than the
+ * aggregation time. The admin queue and vectors with coalescing disabled
+ * signal every batch. The timer is only looked at when the host touches
+ * the CQ, which is when it could have noticed the interrupt anyway.
+ */
+static void sim_irq_update(uint16_t cq_id, uint32_t posted)
+{
+    struct sim_cq *cq = &sim.cq[cq_id];
+    union dw11_u ic = { .value = sim.features[NVME_FEATURE_IRQ_COALESCE] };
+    uint64_t now;
+    if (!cq->irq_enabled)
+        return;
+    now = sim_time_ns();
+    if (posted && !cq->coalesced)
+        cq->coalesce_ns = now;
+    cq->coalesced += posted;
+    if (!cq->coalesced)
+        return;
+    if (cq_id == 0 || (cq->irq_no < SIM_MSIX_ENTRIES && sim.coalesce_off[cq->irq_no]) ||
+        cq->coalesced > ic.feature.ic.threshold || now - cq->coalesce_ns >= ic.feature.ic.time*100000ULL)
+    {
+        cq->isr_count++;
+        cq->coalesced = 0;
+    }
+}
+
+/*
+ * Execute everything between the fetch pointer and the doorbell while the
+ * CQ has room. With latency or bandwidth configured an IO completion is
+ * held back until it is due and posted by sim_retire(); its CQ slot is
+ * reserved meanwhile.
+ */
+static void sim_process_sq(uint16_t sq_id)
+{
+    struct sim_sq *sq = &sim.sq[sq_id];
+    struct sim_cq *cq = &sim.cq[sq->cq_id];
+    uint64_t now = sim.timed && sq_id ? sim_time_ns() : 0;
+    uint32_t posted = 0;
+    while (sq->valid && cq->valid && sq->fetch != sq->tail && cq->count + cq->inflight < cq->elements-1)
+    {
+        uint8_t *entry = sq->entries + sq->fetch*NVME_IOSQ_ELEMENT_SIZE;
+        struct sim_cmd_data *data = &sq->data[sq->fetch];
+        uint16_t cid = ((struct nvme_gen_cmd *)entry)->command_id;
+        uint16_t status = NVME_SC_SUCCESS;
+        uint32_t result = 0;
+        uint32_t bytes = 0;
+        uint64_t due;
+        if (sq_id == 0)
+            sim_admin((struct nvme_admin_cmd *)entry, data, &status, &result);
+        else
+            bytes = sim_io((struct nvme_io_cmd *)entry, data, &status);
+        sq->fetch = (sq->fetch+1) % sq->elements;
+        /* a delete may have released the queue this command came from */
+        if (!sq->valid || !cq->valid)
+            break;
+        if (now)
+        {
+            due = sim_due_ns(((struct nvme_gen_cmd *)entry)->opcode, bytes, now);
+            if (due > now)
+            {
+                struct sim_pending pending = {
+                    .due_ns = due,
+                    .result = result,
+                    .cq_id = sq->cq_id,
+                    .sq_id = sq_id,
+                    .cid = cid,
+                    .status = status,
+                };
+                if (sim_pending_push(&pending) == 0)
+                {
+                    cq->inflight++;
+                    continue;
+                }
+            }
+        }
+        sim_post(cq, sq_id, sq->fetch, cid, status, result);
+        posted++;
+    }
+    if (posted)
+        sim_irq_update(sq->cq_id, posted);
+}
+
+/* Post the held back completions that are due by now. */
+static void sim_retire(void)
+{
+    uint64_t now;
+    if (!sim.nr_pending)
+        return;
+    now = sim_time_ns();
+    while (sim.nr_pending && sim.pending[0].due_ns <= now)
+    {
+        struct sim_pending pending = sim.pending[0];
+        struct sim_cq *cq = &sim.cq[pending.cq_id];
+        sim.pending[0] = sim.pending[--sim.nr_pending];
+        sim_pending_sift_down(0);
+        cq->inflight--;
+        /* the head as of posting, not of fetching, or it would run backwards on out of order completions */
+        sim_post(cq, pending.sq_id, sim.sq[pending.sq_id].fetch, pending.cid, pending.status, pending.result);
+        sim_irq_update(pending.cq_id, 1);
+    }
+}
+
+static void sim_process_cq(uint16_t cq_id)
+{
+    uint16_t qid;
+    for (qid=0; qid<=DNVME_SIM_MAX_QUEUES; qid++)
+    {
+        if (sim.sq[qid].valid && sim.sq[qid].cq_id == cq_id)
+            sim_process_sq(qid);
+    }
+}
+
+static int sim_send(struct nvme_64b_send *cmd)
+{
+    struct sim_sq *sq;
+    struct nvme_gen_cmd *entry;
+    if (cmd->q_id > DNVME_SIM_MAX_QUEUES || !sim.sq[cmd->q_id].valid || !cmd->cmd_buf_ptr)
+        return -EINVAL;
+    sq = &sim.sq[cmd->q_id];
+    if ((sq->tail_virt+1) % sq->elements == sq->head)
+        return -EBUSY;
+    entry = (struct nvme_gen_cmd *)(sq->entries + sq->tail_virt*NVME_IOSQ_ELEMENT_SIZE);
+    memcpy(entry, cmd->cmd_buf_ptr, NVME_IOSQ_ELEMENT_SIZE);
+    entry->command_id = sq->next_cid++;
+    sq->data[sq->tail_virt] = (struct sim_cmd_data) {
+        .buffer = (uint8_t *)cmd->data_buf_ptr,
+        .size = cmd->data_buf_size,
+        .dir = cmd->data_dir,
+    };
+    cmd->unique_id = entry->command_id;
+    sq->tail_virt = (sq->tail_virt+1) % sq->elements;
+    return 0;
+}
+
+static int sim_reap(struct nvme_reap *reap)
+{
+    struct sim_cq *cq;
+    uint32_t n;
+    uint32_t i;
+    if (reap->q_id > DNVME_SIM_MAX_QUEUES || !sim.cq[reap->q_id].valid)
+        return -EINVAL;
+    sim_retire();
+    cq = &sim.cq[reap->q_id];
+    n = reap->elements;
+    if (n > cq->count)
+        n = cq->count;
+    if (n > reap->size / sizeof(struct nvme_completion))
+        n = reap->size / sizeof(struct nvme_completion);
+    for (i=0; i<n; i++)
+    {
+        struct nvme_completion *cqe = &cq->entries[cq->head];
+        memcpy(reap->buffer + i*sizeof(*cqe), cqe, sizeof(*cqe));
+        if (cqe->sq_id <= DNVME_SIM_MAX_QUEUES && sim.sq[cqe->sq_id].valid)
+            sim.sq[cqe->sq_id].head = cqe->sq_head;
+        cq->head = (cq->head+1) % cq->elements;
+        cq->count--;
+    }
+    reap->num_reaped = n;
+    sim_process_cq(reap->q_id);
+    sim_irq_update(reap->q_id, 0);
+    reap->num_remaining = cq->count;
+    reap->isr_count = cq->isr_count;
+    return 0;
+}
+
+static int sim_rw_generic(struct rw_generic *param, int write)
+{
+    uint8_t *space = param->type == NVMEIO_PCI_HDR ? sim.pci : sim.bar;
+    uint32_t size = param->type == NVMEIO_PCI_HDR ? SIM_PCI_SPACE : SIM_REG_SPACE;
+    uint32_t cc;
+    if (param->type >= NVMEIO_FENCE || param->offset + param->nBytes > size)
+        return -EINVAL;
+    if (!write)
+    {
+        memcpy(param->buffer, space + param->offset, param->nBytes);
+        return 0;
+    }
+    if (param->type == NVMEIO_BAR01 && param->offset < NVME_REG_CSTS+4 && param->offset+param->nBytes > NVME_REG_CSTS)
+        return 0;   /* CSTS is read only */
+    memcpy(space + param->offset, param->buffer, param->nBytes);
+    if (param->type == NVMEIO_BAR01)
+    {
+        cc = sim_reg_read32(NVME_REG_CC);
+        uint32_t csts = cc & NVME_CC_ENABLE ? NVME_CSTS_RDY : 0;
+        if (cc & NVME_CC_SHN_MASK)
+            csts |= NVME_CSTS_SHST_CMPLT;
+        if (!(cc & NVME_CC_ENABLE))
+            sim_reset(1);
+        sim_reg_write32(NVME_REG_CSTS, csts);
+    }
+    return 0;
+}
+
+static int sim_get_q_metrics(struct nvme_get_q_metrics *metrics)
+{
+    if (metrics->q_id > DNVME_SIM_MAX_QUEUES)
+        return -EINVAL;
+    if (metrics->type == METRICS_SQ)
+    {
+        struct sim_sq *sq = &sim.sq[metrics->q_id];
+        struct nvme_gen_sq gen = {
+            .sq_id = metrics->q_id,
+            .cq_id = sq->cq_id,
+            .tail_ptr = sq->tail,
+            .tail_ptr_virt = sq->tail_virt,
+            .head_ptr = sq->head,
+            .elements = sq->elements,
+        };
+        if (!sq->valid)
+            return -EINVAL;
+        memcpy(metrics->buffer, &gen, metrics->nBytes < sizeof(gen) ? metrics->nBytes : sizeof(gen));
+    }
+    else
+    {
+        struct sim_cq *cq = &sim.cq[metrics->q_id];
+        struct nvme_gen_cq gen = {
+            .q_id = metrics->q_id,
+            .tail_ptr = (cq->head + cq->count) % (cq->elements ? cq->elements : 1),
+            .head_ptr = cq->head,
+            .elements = cq->elements,
+            .irq_enabled = cq->irq_enabled,
+            .irq_no = cq->irq_no,
+            .pbit_new_entry = cq->count != 0,
+        };
+        if (!cq->valid)
+            return -EINVAL;
+        memcpy(metrics->buffer, &gen, metrics->nBytes < sizeof(gen) ? metrics->nBytes : sizeof(gen));
+    }
+    return 0;
+}
+
+static int sim_ioctl_locked(unsigned long request, void *arg)
+{
+    uint32_t cc;
+    switch (request)
+    {
+    case NVME_IOCTL_READ_GENERIC:
+        return sim_rw_generic(arg, 0);
+    case NVME_IOCTL_WRITE_GENERIC:
+        return sim_rw_generic(arg, 1);
+    case NVME_IOCTL_DEVICE_STATE:
+        cc = sim_reg_read32(NVME_REG_CC);
+        if ((enum nvme_state)(uintptr_t)arg == ST_ENABLE)
+        {
+            if (!sim.sq[0].valid || !sim.cq[0].valid)
+                return -EINVAL;
+            sim_reg_write32(NVME_REG_CC, cc | NVME_CC_ENABLE | NVME_CC_IOSQES | NVME_CC_IOCQES);
+            sim_reg_write32(NVME_REG_CSTS, NVME_CSTS_RDY);
+        }
+        else
+        {
+            sim_reg_write32(NVME_REG_CC, cc & ~NVME_CC_ENABLE);
+            sim_reg_write32(NVME_REG_CSTS, 0);
+            sim_reset((enum nvme_state)(uintptr_t)arg == ST_DISABLE);
+        }
+        return 0;
+    case NVME_IOCTL_CREATE_ADMN_Q:
+    {
+        struct nvme_create_admn_q *admn = arg;
+        int ret;
+        if (admn->type == ADMIN_SQ)
+        {
+            if (!sim.cq[0].valid)
+                return -EINVAL;
+            sim_free_sq(0);
+            ret = sim_alloc_sq(0, 0, admn->elements);
+        }
+        else
+        {
+            sim_free_cq(0);
+            ret = sim_alloc_cq(0, admn->elements, 1, 0);
+        }
+        return ret;
+    }
+    case NVME_IOCTL_PREPARE_SQ_CREATION:
+    {
+        struct nvme_prep_sq *prep = arg;
+        if (prep->sq_id == 0 || prep->sq_id > DNVME_SIM_MAX_QUEUES)
+            return -EINVAL;
+        sim.prep_sq[prep->sq_id] = *prep;
+        return 0;
+    }
+    case NVME_IOCTL_PREPARE_CQ_CREATION:
+    {
+        struct nvme_prep_cq *prep = arg;
+        if (prep->cq_id == 0 || prep->cq_id > DNVME_SIM_MAX_QUEUES)
+            return -EINVAL;
+        sim.prep_cq[prep->cq_id] = *prep;
+        return 0;
+    }
+    case NVME_IOCTL_SEND_64B_CMD:
+        return sim_send(arg);
+    case NVME_IOCTL_RING_SQ_DOORBELL:
+    {
+        uint16_t sq_id = (uint16_t)(uintptr_t)arg;
+        if (sq_id > DNVME_SIM_MAX_QUEUES || !sim.sq[sq_id].valid)
+            return -EINVAL;
+        sim.sq[sq_id].tail = sim.sq[sq_id].tail_virt;
+        sim_retire();
+        sim_process_sq(sq_id);
+        return 0;
+    }
+    case NVME_IOCTL_REAP_INQUIRY:
+    {
+        struct nvme_reap_inquiry *inquiry = arg;
+        if (inquiry->q_id > DNVME_SIM_MAX_QUEUES || !sim.cq[inquiry->q_id].valid)
+            return -EINVAL;
+        sim_retire();
+        sim_irq_update(inquiry->q_id, 0);
+        inquiry->num_remaining = sim.cq[inquiry->q_id].count;
+        inquiry->isr_count = sim.cq[inquiry->q_id].isr_count;
+        return 0;
+    }
+    case NVME_IOCTL_REAP:
+        return sim_reap(arg);
+    case NVME_IOCTL_GET_Q_METRICS:
+        return sim_get_q_metrics(arg);
+    case NVME_IOCTL_SET_IRQ:
+        sim.irq = *(struct interrupts *)arg;
+        return 0;
+    case NVME_IOCTL_GET_DEVICE_METRICS:
+        ((struct public_metrics_dev *)arg)->irq_active = sim.irq;
+        return 0;
+    case NVME_IOCTL_GET_DRIVER_METRICS:
+        ((struct metrics_driver *)arg)->driver_version = API_VERSION;
+        ((struct metrics_driver *)arg)->api_version = API_VERSION;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+/* Same contract as ioctl(): -1 with errno set on failure. */
+static int sim_ioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+    if (fd < 0 || fd != sim.fd)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    pthread_mutex_lock(&sim.lock);
+    ret = sim_ioctl_locked(request, arg);
+    pthread_mutex_unlock(&sim.lock);
+    if (ret < 0)
+    {
+        errno = -ret;
+        return -1;
+    }
+    return 0;
+}
+
+/* Configuration the next open of DNVME_SIM_PATH starts from. */
+static struct dnvme_sim_config sim_next_config;
+
+/*
+ * Set up the controller the simulator brings up on the next open; NULL
+ * restores the defaults. A controller that is already open keeps its own.
+ */
+void dnvme_sim_configure(const struct dnvme_sim_config *config)
+{
+    if (config)
+        sim_next_config = *config;
+    else
+        memset(&sim_next_config, 0, sizeof(sim_next_config));
+}
+
+/* The returned fd stands for the device; only one controller, at DNVME_SIM_PATH, is simulated. */
+static int sim_open(const char *path)
+{
+    int fd;
+    if (strcmp(path, DNVME_SIM_PATH))
+        return -ENODEV;
+    if (sim.fd >= 0)
+        return -EBUSY;
+    sim.config = sim_next_config;
+    if (sim.config.lba_size == 0)
+        sim.config.lba_size = 512;
+    if (sim.config.nsze == 0)
+        sim.config.nsze = (1ULL << 30) / sim.config.lba_size;
+    if (sim.config.max_queues == 0 || sim.config.max_queues > DNVME_SIM_MAX_QUEUES)
+        sim.config.max_queues = DNVME_SIM_MAX_QUEUES;
+    if (sim.config.mqes == 0)
+        sim.config.mqes = 1023;
+    if (sim.config.mdts == 0)
+        sim.config.mdts = 5;
+    if (sim.config.read.dist >= DNVME_SIM_DISTS || sim.config.write.dist >= DNVME_SIM_DISTS)
+        return -EINVAL;
+    if (sim.config.pi > NVME_NS_DPS_PI_TYPE3 || (sim.config.pi && sim.config.ms < DNVME_PI_SIZE))
+        return -EINVAL;
+    sim.block_size = sim.config.lba_size + sim.config.ms;
+    memset(&sim.format, 0, sizeof(sim.format));
+    sim.format.lba_size = sim.config.lba_size;
+    sim.format.ms = sim.config.ms;
+    sim.format.type = sim.config.pi;
+    sim.format.first = sim.config.pi_first;
+    sim.format.extended = 1;
+    if (sim.config.media == DNVME_SIM_MEDIA_RAM)
+    {
+        sim.nr_dirs = ((sim.config.nsze*sim.block_size >> SIM_CHUNK_SHIFT) >> SIM_DIR_SHIFT) + 1;
+        sim.chunks = calloc(sim.nr_dirs, sizeof(*sim.chunks));
+        if (!sim.chunks)
+            return -ENOMEM;
+    }
+    fd = open("/dev/null", O_RDONLY);
+    if (fd < 0)
+    {
+        free(sim.chunks);
+        sim.chunks = NULL;
+        return -errno;
+    }
+    sim.timed = sim.config.read.mean_ns || sim.config.write.mean_ns || sim.config.bandwidth;
+    sim.rng = 0x9E3779B97F4A7C15ULL;
+    sim.link_free_ns = 0;
+    sim_init_regs();
+    sim_reset(0);
+    memset(sim.features, 0, sizeof(sim.features));
+    memset(sim.coalesce_off, 0, sizeof(sim.coalesce_off));
+    sim.fd = fd;
+    return fd;
+}
+
+static void sim_close(int fd)
+{
+    uint64_t i;
+    uint32_t j;
+    if (fd < 0 || fd != sim.fd)
+        return;
+    sim_reset(0);
+    for (i=0; i<sim.nr_dirs; i++)
+    {
+        for (j=0; sim.chunks[i] && j<SIM_DIR_SIZE; j++)
+            free(sim.chunks[i][j]);
+        free(sim.chunks[i]);
+    }
+    free(sim.chunks);
+    sim.chunks = NULL;
+    sim.nr_dirs = 0;
+    free(sim.pending);
+    sim.pending = NULL;
+    sim.max_pending = 0;
+    close(fd);
+    sim.fd = -1;
+}
+
+/* Install with ioctl_set_backend(), then open_dev(DNVME_SIM_PATH). */
+const struct dnvme_backend_ops dnvme_sim_backend = {
+    .name = "sim",
+    .open = sim_open,
+    .close = sim_close,
+    .ioctl = sim_ioctl,
+};
+
+const char *dnvme_sim_dist_name(enum dnvme_sim_dist dist)
+{
+    static const char *names[DNVME_SIM_DISTS] = {
+        [DNVME_SIM_DIST_FIXED] = "fixed",
+        [DNVME_SIM_DIST_UNIFORM] = "uniform",
+        [DNVME_SIM_DIST_NORMAL] = "normal",
+        [DNVME_SIM_DIST_EXPONENTIAL] = "exponential",
+    };
+    return dist < DNVME_SIM_DISTS ? names[dist] : "unknown";
+}
+
+/* "lba_size[+ms[:pi[:first]]]", e.g. "512+8:1" for type 1 PI in 8 bytes of metadata after each 512 bytes. */
+int dnvme_sim_parse_format(const char *arg, struct dnvme_sim_config *config)
+{
+    char *end;
+
+    config->lba_size = strtoul(arg, &end, 0);
+    config->ms = 0;
+    config->pi = 0;
+    config->pi_first = 0;
+    if (*end == '+')
+        config->ms = strtoul(end+1, &end, 0);
+    if (*end == ':')
+        config->pi = strtoul(end+1, &end, 0);
+    if (!strcmp(end, ":first"))
+    {
+        config->pi_first = 1;
+        end += strlen(end);
+    }
+    if (*end || config->lba_size < 512 || (config->lba_size & (config->lba_size-1)))
+        return -EINVAL;
+    return config->pi > NVME_NS_DPS_PI_TYPE3 || (config->pi && config->ms < DNVME_PI_SIZE) ? -EINVAL : 0;
+}
+
+/* "dist:mean_us[:dev_us]", e.g. "normal:80:10"; a bare "mean_us" is fixed. */
+int dnvme_sim_parse_latency(const char *arg, struct dnvme_sim_latency *latency)
+{
+    const char *colon = strchr(arg, ':');
+    char *end;
+    int dist;
+
+    memset(latency, 0, sizeof(*latency));
+    if (colon)
+    {
+        for (dist=0; dist<DNVME_SIM_DISTS; dist++)
+        {
+            if (!strncmp(arg, dnvme_sim_dist_name(dist), colon-arg) && !dnvme_sim_dist_name(dist)[colon-arg])
+                break;
+        }
+        if (dist == DNVME_SIM_DISTS)
+            return -EINVAL;
+        latency->dist = dist;
+        arg = colon+1;
+    }
+    latency->mean_ns = strtod(arg, &end) * 1000;
+    if (*end == ':')
+        latency->dev_ns = strtod(end+1, &end) * 1000;
+    return *end ? -EINVAL : 0;
+}
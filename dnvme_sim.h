@@ -0,0 +1,60 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_sim.h
+ * Description: userspace stand-in for the dnvme driver ioctl interface.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_SIM_H__
+#define __DNVME_SIM_H__
+#include <stdint.h>
+
+#include "dnvme_ioctrl.h"
+
+#define DNVME_SIM_MAX_QUEUES    64
+#define DNVME_SIM_PATH          "dnvme-sim"     /* what open_dev() takes on dnvme_sim_backend */
+
+enum dnvme_sim_media {
+    DNVME_SIM_MEDIA_RAM,    /* namespace 1 keeps its data in memory, allocated as it is written */
+    DNVME_SIM_MEDIA_NULL,   /* data is neither stored nor moved, for host overhead alone */
+};
+
+enum dnvme_sim_dist {
+    DNVME_SIM_DIST_FIXED,       /* always mean_ns */
+    DNVME_SIM_DIST_UNIFORM,     /* mean_ns +- dev_ns */
+    DNVME_SIM_DIST_NORMAL,      /* mean_ns with standard deviation dev_ns, never below 0 */
+    DNVME_SIM_DIST_EXPONENTIAL, /* mean_ns - dev_ns plus an exponential tail with mean dev_ns */
+    DNVME_SIM_DISTS
+};
+
+/* Media time of a command before its data moves; mean_ns 0 completes at the doorbell. */
+struct dnvme_sim_latency {
+    uint8_t dist;           /* enum dnvme_sim_dist */
+    uint32_t mean_ns;
+    uint32_t dev_ns;
+};
+
+struct dnvme_sim_config {
+    uint32_t lba_size;      /* bytes per LBA of namespace 1, default 512 */
+    uint16_t ms;            /* metadata bytes after the data of every LBA, extended LBA format */
+    uint8_t pi;             /* NVME_NS_DPS_PI_TYPE1..3 in the metadata, checked in the RAM media, 0 = none */
+    uint8_t pi_first;       /* PI in the first 8 bytes of the metadata, else the last */
+    uint64_t nsze;          /* LBAs in namespace 1 */
+    uint16_t max_queues;    /* IO queue pairs granted by Number of Queues */
+    uint16_t mqes;          /* CAP.MQES, 0's based */
+    uint8_t mdts;           /* Identify Controller MDTS, 2^n * 4K */
+    uint8_t media;          /* enum dnvme_sim_media */
+    struct dnvme_sim_latency read;      /* Read and Compare */
+    struct dnvme_sim_latency write;     /* every other IO command */
+    uint64_t bandwidth;     /* bytes/s shared by all data transfers, 0 = unlimited */
+};
+
+extern const struct dnvme_backend_ops dnvme_sim_backend;
+
+void dnvme_sim_configure(const struct dnvme_sim_config *config);
+int dnvme_sim_parse_format(const char *arg, struct dnvme_sim_config *config);
+int dnvme_sim_parse_latency(const char *arg, struct dnvme_sim_latency *latency);
+const char *dnvme_sim_dist_name(enum dnvme_sim_dist dist);
+
+#endif
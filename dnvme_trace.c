@@ -0,0 +1,598 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_trace.c
+ * Description: binary trace of submitted commands and reaped completions.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include <dnvme.h>
+#include "dnvme_commands.h"
+#include "dnvme_trace.h"
+
+/**
+ * Single producer/single consumer ring: the owning thread moves 'head',
+ * the flusher moves 'tail'. Each sits on its own cache line so the hot
+ * path never shares a line the flusher writes.
+ */
+struct dnvme_trace_ring {
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t mask;
+    uint16_t index;
+    uint64_t dropped;
+    struct dnvme_trace_record *records;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_t flusher;
+    FILE *file;
+    int enabled;
+    int stop;
+    uint32_t ring_records;
+    uint32_t nr_rings;
+    uint64_t written;
+    struct dnvme_trace_ring *rings[DNVME_TRACE_MAX_RINGS];
+} trace = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Rings outlive a stop so a thread never sees its pointer go stale. */
+static __thread struct dnvme_trace_ring *trace_ring;
+
+static uint64_t dnvme_trace_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t dnvme_trace_ts(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return dnvme_trace_ns();
+#endif
+}
+
+static uint8_t dnvme_trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return DNVME_TRACE_CLOCK_TSC;
+#else
+    return DNVME_TRACE_CLOCK_MONOTONIC;
+#endif
+}
+
+static struct dnvme_trace_ring *dnvme_trace_attach(void)
+{
+    struct dnvme_trace_ring *ring = NULL;
+
+    pthread_mutex_lock(&trace.lock);
+    if (trace.nr_rings >= DNVME_TRACE_MAX_RINGS)
+        goto out;
+    ring = calloc(1, sizeof(*ring));
+    if (!ring)
+        goto out;
+    ring->records = malloc((size_t)trace.ring_records * sizeof(*ring->records));
+    if (!ring->records)
+    {
+        free(ring);
+        ring = NULL;
+        goto out;
+    }
+    ring->mask = trace.ring_records - 1;
+    ring->index = trace.nr_rings;
+    trace.rings[trace.nr_rings] = ring;
+    __atomic_store_n(&trace.nr_rings, trace.nr_rings + 1, __ATOMIC_RELEASE);
+out:
+    pthread_mutex_unlock(&trace.lock);
+    return ring;
+}
+
+/* The next free slot of this thread's ring, NULL when the record has to be dropped. */
+static struct dnvme_trace_record *dnvme_trace_reserve(struct dnvme_trace_ring **ringp)
+{
+    struct dnvme_trace_ring *ring = trace_ring;
+    uint32_t head;
+
+    if (!ring)
+    {
+        ring = trace_ring = dnvme_trace_attach();
+        if (!ring)
+            return NULL;
+    }
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask)
+    {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    *ringp = ring;
+    return &ring->records[head & ring->mask];
+}
+
+static void dnvme_trace_commit(struct dnvme_trace_ring *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void dnvme_trace_sqe(uint16_t qid, uint16_t unique_id, const void *sqe)
+{
+    struct dnvme_trace_ring *ring;
+    struct dnvme_trace_record *record;
+
+    if (!__atomic_load_n(&trace.enabled, __ATOMIC_RELAXED))
+        return;
+    record = dnvme_trace_reserve(&ring);
+    if (!record)
+        return;
+    record->ts = dnvme_trace_ts();
+    record->type = DNVME_TRACE_SQE;
+    record->count = 1;
+    record->qid = qid;
+    record->unique_id = unique_id;
+    record->thread = ring->index;
+    memcpy(record->sqe, sqe, sizeof(record->sqe));
+    dnvme_trace_commit(ring);
+}
+
+/* Completions of one reap share a timestamp, DNVME_TRACE_CQES per record. */
+void dnvme_trace_cqes(uint16_t qid, const void *cqes, uint32_t count)
+{
+    const struct nvme_completion *cqe = cqes;
+    struct dnvme_trace_ring *ring;
+    struct dnvme_trace_record *record;
+    uint64_t ts;
+    uint32_t n;
+
+    if (!count || !__atomic_load_n(&trace.enabled, __ATOMIC_RELAXED))
+        return;
+    ts = dnvme_trace_ts();
+    while (count)
+    {
+        n = count < DNVME_TRACE_CQES ? count : DNVME_TRACE_CQES;
+        record = dnvme_trace_reserve(&ring);
+        if (!record)
+            return;
+        record->ts = ts;
+        record->type = DNVME_TRACE_CQE;
+        record->count = n;
+        record->qid = qid;
+        record->unique_id = 0;
+        record->thread = ring->index;
+        memcpy(record->cqe, cqe, n * sizeof(*cqe));
+        dnvme_trace_commit(ring);
+        cqe += n;
+        count -= n;
+    }
+}
+
+static uint64_t dnvme_trace_dropped(void)
+{
+    uint32_t i, nr_rings = __atomic_load_n(&trace.nr_rings, __ATOMIC_ACQUIRE);
+    uint64_t dropped = 0;
+
+    for (i=0; i<nr_rings; i++)
+        dropped += __atomic_load_n(&trace.rings[i]->dropped, __ATOMIC_RELAXED);
+    return dropped;
+}
+
+/* Writes out everything the producers committed so far plus a sync record. */
+static void dnvme_trace_drain(void)
+{
+    struct dnvme_trace_record sync;
+    struct dnvme_trace_ring *ring;
+    uint32_t i, nr_rings = __atomic_load_n(&trace.nr_rings, __ATOMIC_ACQUIRE);
+    uint32_t head, tail, n;
+
+    for (i=0; i<nr_rings; i++)
+    {
+        ring = trace.rings[i];
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        tail = ring->tail;
+        while (tail != head)
+        {
+            /* up to the end of the array in one go */
+            n = ring->mask + 1 - (tail & ring->mask);
+            if (n > head - tail)
+                n = head - tail;
+            fwrite(&ring->records[tail & ring->mask], sizeof(*ring->records), n, trace.file);
+            trace.written += n;
+            tail += n;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    memset(&sync, 0, sizeof(sync));
+    sync.ts = dnvme_trace_ts();
+    sync.sync.ns = dnvme_trace_ns();
+    sync.type = DNVME_TRACE_SYNC;
+    sync.sync.dropped = dnvme_trace_dropped();
+    fwrite(&sync, sizeof(sync), 1, trace.file);
+    trace.written++;
+    fflush(trace.file);
+}
+
+static void *dnvme_trace_flusher(void *arg)
+{
+    struct timespec period = {
+        .tv_sec = 0,
+        .tv_nsec = DNVME_TRACE_FLUSH_MS * 1000000L,
+    };
+
+    (void)arg;
+    while (!__atomic_load_n(&trace.stop, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&period, NULL);
+        dnvme_trace_drain();
+    }
+    return NULL;
+}
+
+/**
+ * Starts recording every command sent and every completion reaped through
+ * the ioctl_* wrappers. Each thread fills its own ring of 'ring_records'
+ * records (rounded up to a power of 2, 0 = DNVME_TRACE_RING_RECORDS) without
+ * locks or syscalls; a background thread writes the rings to 'path' every
+ * DNVME_TRACE_FLUSH_MS. Records that find their ring full are dropped and
+ * counted rather than stalling the IO path. Rings made by an earlier run
+ * keep their size.
+ */
+int dnvme_trace_start(const char *path, uint32_t ring_records)
+{
+    struct dnvme_trace_header header;
+    uint32_t i, size = 1;
+    int ret;
+
+    if (!ring_records)
+        ring_records = DNVME_TRACE_RING_RECORDS;
+    while (size < ring_records)
+        size <<= 1;
+
+    pthread_mutex_lock(&trace.lock);
+    if (trace.file)
+    {
+        pthread_mutex_unlock(&trace.lock);
+        return -EBUSY;
+    }
+    trace.file = fopen(path, "wb");
+    if (!trace.file)
+    {
+        pthread_mutex_unlock(&trace.lock);
+        return -errno;
+    }
+    memset(&header, 0, sizeof(header));
+    header.magic = DNVME_TRACE_MAGIC;
+    header.version = DNVME_TRACE_VERSION;
+    header.record_size = sizeof(struct dnvme_trace_record);
+    header.clock = dnvme_trace_clock();
+    header.start_ts = dnvme_trace_ts();
+    header.start_ns = dnvme_trace_ns();
+    fwrite(&header, sizeof(header), 1, trace.file);
+
+    /* leftovers of a previous run are not part of this trace */
+    for (i=0; i<trace.nr_rings; i++)
+    {
+        trace.rings[i]->tail = __atomic_load_n(&trace.rings[i]->head, __ATOMIC_ACQUIRE);
+        trace.rings[i]->dropped = 0;
+    }
+    trace.ring_records = size;
+    trace.written = 0;
+    trace.stop = 0;
+    ret = pthread_create(&trace.flusher, NULL, dnvme_trace_flusher, NULL);
+    if (ret)
+    {
+        fclose(trace.file);
+        trace.file = NULL;
+        pthread_mutex_unlock(&trace.lock);
+        return -ret;
+    }
+    __atomic_store_n(&trace.enabled, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace.lock);
+    return SUCCESS;
+}
+
+static void dnvme_trace_exit(void)
+{
+    dnvme_trace_stop();
+}
+
+/**
+ * DNVME_TRACE=path in the environment traces a whole run without code
+ * changes; the trace is closed at exit. A trace already running is kept.
+ */
+int dnvme_trace_start_env(void)
+{
+    const char *path = getenv("DNVME_TRACE");
+    int ret;
+
+    if (!path || !*path)
+        return SUCCESS;
+    ret = dnvme_trace_start(path, 0);
+    if (ret == SUCCESS)
+        atexit(dnvme_trace_exit);
+    return ret == -EBUSY ? SUCCESS : ret;
+}
+
+/* Records still being written by another thread when this runs may be lost. */
+int dnvme_trace_stop(void)
+{
+    int ret;
+
+    pthread_mutex_lock(&trace.lock);
+    if (!trace.file)
+    {
+        pthread_mutex_unlock(&trace.lock);
+        return -EINVAL;
+    }
+    __atomic_store_n(&trace.enabled, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace.stop, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&trace.lock);
+
+    /* the flusher reads nr_rings without the lock, attaches may still come in */
+    pthread_join(trace.flusher, NULL);
+    pthread_mutex_lock(&trace.lock);
+    dnvme_trace_drain();
+    ret = ferror(trace.file) ? -EIO : SUCCESS;
+    if (fclose(trace.file) && ret == SUCCESS)
+        ret = -errno;
+    trace.file = NULL;
+    pthread_mutex_unlock(&trace.lock);
+    return ret;
+}
+
+void dnvme_trace_get_stats(struct dnvme_trace_stats *stats)
+{
+    pthread_mutex_lock(&trace.lock);
+    stats->records = trace.written;
+    stats->dropped = dnvme_trace_dropped();
+    stats->rings = trace.nr_rings;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/* Sort key of a record: its stamp, then its position in the file. */
+struct dnvme_trace_order {
+    uint64_t ts;
+    uint64_t index;
+};
+
+static int dnvme_trace_compare(const void *a, const void *b)
+{
+    const struct dnvme_trace_order *oa = a, *ob = b;
+    if (oa->ts != ob->ts)
+        return oa->ts < ob->ts ? -1 : 1;
+    return oa->index < ob->index ? -1 : oa->index > ob->index;
+}
+
+/*
+ * Threads are flushed one ring after the other, so order by time. The CQEs
+ * of one reap share a stamp; qsort() is not stable, so ties are broken on
+ * the load index to keep them in file order.
+ */
+static int dnvme_trace_sort(struct dnvme_trace_file *trace)
+{
+    struct dnvme_trace_order *order = malloc((trace->count ? trace->count : 1) * sizeof(*order));
+    struct dnvme_trace_record *sorted = malloc((trace->count ? trace->count : 1) * sizeof(*sorted));
+    uint64_t i;
+
+    if (!order || !sorted)
+    {
+        free(order);
+        free(sorted);
+        return -ENOMEM;
+    }
+    for (i=0; i<trace->count; i++)
+    {
+        order[i].ts = trace->records[i].ts;
+        order[i].index = i;
+    }
+    qsort(order, trace->count, sizeof(*order), dnvme_trace_compare);
+    for (i=0; i<trace->count; i++)
+        sorted[i] = trace->records[order[i].index];
+    free(order);
+    free(trace->records);
+    trace->records = sorted;
+    return SUCCESS;
+}
+
+/* Reads a whole trace into memory with its records in time order. */
+int dnvme_trace_load(const char *path, struct dnvme_trace_file *trace)
+{
+    FILE *file = fopen(path, "rb");
+    long size;
+    uint64_t i;
+
+    memset(trace, 0, sizeof(*trace));
+    if (!file)
+        return -errno;
+    if (fread(&trace->header, sizeof(trace->header), 1, file) != 1 || trace->header.magic != DNVME_TRACE_MAGIC ||
+        trace->header.version != DNVME_TRACE_VERSION ||
+        trace->header.record_size != sizeof(struct dnvme_trace_record))
+    {
+        fclose(file);
+        return -EINVAL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file) - sizeof(trace->header);
+    fseek(file, sizeof(trace->header), SEEK_SET);
+    trace->count = size / sizeof(struct dnvme_trace_record);
+    trace->records = malloc((trace->count ? trace->count : 1) * sizeof(struct dnvme_trace_record));
+    if (!trace->records)
+    {
+        fclose(file);
+        return -ENOMEM;
+    }
+    trace->count = fread(trace->records, sizeof(struct dnvme_trace_record), trace->count, file);
+    fclose(file);
+    if (dnvme_trace_sort(trace))
+    {
+        dnvme_trace_unload(trace);
+        return -ENOMEM;
+    }
+
+    for (i=0; i<trace->count; i++)
+    {
+        if (trace->records[i].type != DNVME_TRACE_SYNC)
+            continue;
+        trace->end_ts = trace->records[i].ts;
+        trace->end_ns = trace->records[i].sync.ns;
+        trace->dropped = trace->records[i].sync.dropped;
+    }
+    return SUCCESS;
+}
+
+void dnvme_trace_unload(struct dnvme_trace_file *trace)
+{
+    free(trace->records);
+    trace->records = NULL;
+    trace->count = 0;
+}
+
+/* A record timestamp as CLOCK_MONOTONIC ns, scaled between the header and the last sync record. */
+uint64_t dnvme_trace_time_ns(const struct dnvme_trace_file *trace, uint64_t ts)
+{
+    double scale;
+
+    if (trace->header.clock == DNVME_TRACE_CLOCK_MONOTONIC || trace->end_ts <= trace->header.start_ts)
+        return ts;
+    scale = (double)(trace->end_ns - trace->header.start_ns) / (trace->end_ts - trace->header.start_ts);
+    return trace->header.start_ns + (int64_t)((double)((int64_t)(ts - trace->header.start_ts)) * scale);
+}
+
+/* sq_id and unique_id in one key; unique_id 0 is valid, so the SQ is biased to keep keys non zero. */
+static uint32_t dnvme_trace_key(uint16_t sq_id, uint16_t unique_id)
+{
+    return ((uint32_t)sq_id + 1) << 16 | unique_id;
+}
+
+static uint32_t dnvme_trace_hash(const struct dnvme_trace_match *match, uint32_t key)
+{
+    return (key * 0x9E3779B1u) >> (32 - match->bits);
+}
+
+int dnvme_trace_match_init(struct dnvme_trace_match *match, uint32_t bits)
+{
+    match->bits = bits ? bits : DNVME_TRACE_MATCH_BITS;
+    match->pending = calloc(1u << match->bits, sizeof(*match->pending));
+    return match->pending ? SUCCESS : -ENOMEM;
+}
+
+void dnvme_trace_match_free(struct dnvme_trace_match *match)
+{
+    free(match->pending);
+    match->pending = NULL;
+}
+
+/* Remembers a command until its completion; a unique_id still open on the SQ is taken over. */
+int dnvme_trace_match_submit(struct dnvme_trace_match *match, uint16_t sq_id, uint16_t unique_id, uint64_t ns,
+    uint64_t tag)
+{
+    uint32_t size = 1u << match->bits, key = dnvme_trace_key(sq_id, unique_id);
+    uint32_t i, hash = dnvme_trace_hash(match, key);
+    struct dnvme_trace_pending *slot;
+
+    for (i=0; i<size; i++)
+    {
+        slot = &match->pending[(hash + i) & (size - 1)];
+        if (slot->key == key || slot->key == 0)
+        {
+            slot->key = key;
+            slot->ns = ns;
+            slot->tag = tag;
+            return SUCCESS;
+        }
+    }
+    return -ENOSPC;
+}
+
+/* Backward shift delete keeps the probe chains intact. */
+static void dnvme_trace_match_remove(struct dnvme_trace_match *match, uint32_t hole)
+{
+    uint32_t mask = (1u << match->bits) - 1, i = hole, home;
+
+    for (;;)
+    {
+        i = (i + 1) & mask;
+        if (match->pending[i].key == 0)
+            break;
+        home = dnvme_trace_hash(match, match->pending[i].key);
+        if (((i - home) & mask) >= ((i - hole) & mask))
+        {
+            match->pending[hole] = match->pending[i];
+            hole = i;
+        }
+    }
+    match->pending[hole].key = 0;
+}
+
+/* The submit time and tag of the command 'cqe' completes, -ENOENT when it was not seen. */
+int dnvme_trace_match_complete(struct dnvme_trace_match *match, const struct nvme_completion *cqe, uint64_t *ns,
+    uint64_t *tag)
+{
+    uint32_t size = 1u << match->bits, key = dnvme_trace_key(cqe->sq_id, cqe->command_id);
+    uint32_t i, index, hash = dnvme_trace_hash(match, key);
+
+    for (i=0; i<size; i++)
+    {
+        index = (hash + i) & (size - 1);
+        if (match->pending[index].key == 0)
+            break;
+        if (match->pending[index].key == key)
+        {
+            *ns = match->pending[index].ns;
+            *tag = match->pending[index].tag;
+            dnvme_trace_match_remove(match, index);
+            return SUCCESS;
+        }
+    }
+    return -ENOENT;
+}
+
+/* Name of the command 'opcode' stands for on SQ 'qid', admin for qid 0. */
+const char *dnvme_trace_opcode_name(uint16_t qid, uint8_t opcode)
+{
+    static const char *admin[256] = {
+        [NVME_ADMIN_DELETE_IOSQ] = "Delete IOSQ",
+        [NVME_ADMIN_CREATE_IOSQ] = "Create IOSQ",
+        [NVME_ADMIN_GET_LOG_PAGE] = "Get Log Page",
+        [NVME_ADMIN_DELETE_IOCQ] = "Delete IOCQ",
+        [NVME_ADMIN_CREATE_IOCQ] = "Create IOCQ",
+        [NVME_ADMIN_IDENTIFY] = "Identify",
+        [NVME_ADMIN_ABORT] = "Abort",
+        [NVME_ADMIN_SET_FEATURE] = "Set Features",
+        [NVME_ADMIN_GET_FEATURE] = "Get Features",
+        [NVME_ADMIN_ASYNC_EVENT_REQUEST] = "Async Event Request",
+        [NVME_ADMIN_NAMESPACE_MANAGEMENT] = "Namespace Management",
+        [NVME_ADMIN_FIRMWARE_COMMIT] = "Firmware Commit",
+        [NVME_ADMIN_FIRMWARE_IMAGE_DOWNLOAD] = "Firmware Download",
+        [NVME_ADMIN_DEVICE_SELF_TEST] = "Device Self-test",
+        [NVME_ADMIN_NAMESPACE_ATTACHMENT] = "Namespace Attachment",
+        [NVME_ADMIN_KEEP_ALIVE] = "Keep Alive",
+        [NVME_ADMIN_FORMAT_NVM] = "Format NVM",
+        [NVME_ADMIN_SANITIZE] = "Sanitize",
+    };
+    static const char *io[256] = {
+        [NVME_CMD_FLUSH] = "Flush",
+        [NVME_CMD_WRITE] = "Write",
+        [NVME_CMD_READ] = "Read",
+        [NVME_CMD_WRITE_UNCORRECTABLE] = "Write Uncorrectable",
+        [NVME_CMD_COMPARE] = "Compare",
+        [NVME_CMD_WRITE_ZEROES] = "Write Zeroes",
+        [NVME_CMD_DATASET_MANAGEMENT] = "Dataset Management",
+    };
+    const char *name = qid ? io[opcode] : admin[opcode];
+    return name ? name : "Unknown";
+}
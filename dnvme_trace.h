@@ -0,0 +1,107 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_trace.h
+ * Description: binary trace of submitted commands and reaped completions.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_TRACE_H__
+#define __DNVME_TRACE_H__
+#include <stdint.h>
+#include "inc/dnvme_interface.h"
+
+#define DNVME_TRACE_MAGIC           0x54564E44      /* "DNVT" */
+#define DNVME_TRACE_VERSION         1
+#define DNVME_TRACE_RING_RECORDS    65536           /* default records per thread ring */
+#define DNVME_TRACE_MAX_RINGS       256
+#define DNVME_TRACE_CQES            4               /* CQEs per completion record */
+#define DNVME_TRACE_FLUSH_MS        10
+#define DNVME_TRACE_MATCH_BITS      16              /* default log2 of open commands a matcher tracks */
+
+enum dnvme_trace_clock {
+    DNVME_TRACE_CLOCK_MONOTONIC,    /* timestamps are CLOCK_MONOTONIC ns */
+    DNVME_TRACE_CLOCK_TSC,          /* timestamps are TSC ticks, convert with the sync records */
+};
+
+enum dnvme_trace_type {
+    DNVME_TRACE_SQE = 1,            /* one 64 byte command as sent */
+    DNVME_TRACE_CQE,                /* up to DNVME_TRACE_CQES completions as reaped */
+    DNVME_TRACE_SYNC,               /* timestamp/CLOCK_MONOTONIC pair written by the flusher */
+};
+
+/* File layout: one header, then records in flush order; records of one thread are in time order. */
+struct dnvme_trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint8_t clock;                  /* enum dnvme_trace_clock */
+    uint8_t rsvd[7];
+    uint64_t start_ts;
+    uint64_t start_ns;
+};
+
+struct dnvme_trace_record {
+    uint64_t ts;
+    uint8_t type;                   /* enum dnvme_trace_type */
+    uint8_t count;                  /* CQEs in a completion record */
+    uint16_t qid;                   /* SQ of a command, CQ of completions */
+    uint16_t unique_id;             /* id the driver gave the command */
+    uint16_t thread;                /* ring the record came from */
+    union {
+        uint8_t sqe[64];
+        struct nvme_completion cqe[DNVME_TRACE_CQES];
+        struct {
+            uint64_t ns;            /* CLOCK_MONOTONIC taken together with 'ts' */
+            uint64_t dropped;       /* records lost to full rings so far */
+        } sync;
+    };
+};
+
+struct dnvme_trace_stats {
+    uint64_t records;               /* written to the file */
+    uint64_t dropped;               /* lost to full rings */
+    uint32_t rings;
+};
+
+/* A trace read back by dnvme_trace_load(), records sorted by time. */
+struct dnvme_trace_file {
+    struct dnvme_trace_header header;
+    struct dnvme_trace_record *records;
+    uint64_t count;
+    uint64_t end_ts;                /* clock pair of the last sync record */
+    uint64_t end_ns;
+    uint64_t dropped;
+};
+
+struct dnvme_trace_pending {
+    uint32_t key;                   /* 0 = free */
+    uint64_t ns;
+    uint64_t tag;
+};
+
+/* Pairs commands with their completions by SQ and unique_id while walking a trace. */
+struct dnvme_trace_match {
+    uint32_t bits;
+    struct dnvme_trace_pending *pending;
+};
+
+int dnvme_trace_start(const char *path, uint32_t ring_records);
+int dnvme_trace_start_env(void);
+int dnvme_trace_stop(void);
+void dnvme_trace_get_stats(struct dnvme_trace_stats *stats);
+void dnvme_trace_sqe(uint16_t qid, uint16_t unique_id, const void *sqe);
+void dnvme_trace_cqes(uint16_t qid, const void *cqes, uint32_t count);
+
+int dnvme_trace_load(const char *path, struct dnvme_trace_file *trace);
+void dnvme_trace_unload(struct dnvme_trace_file *trace);
+uint64_t dnvme_trace_time_ns(const struct dnvme_trace_file *trace, uint64_t ts);
+int dnvme_trace_match_init(struct dnvme_trace_match *match, uint32_t bits);
+void dnvme_trace_match_free(struct dnvme_trace_match *match);
+int dnvme_trace_match_submit(struct dnvme_trace_match *match, uint16_t sq_id, uint16_t unique_id, uint64_t ns,
+    uint64_t tag);
+int dnvme_trace_match_complete(struct dnvme_trace_match *match, const struct nvme_completion *cqe, uint64_t *ns,
+    uint64_t *tag);
+const char *dnvme_trace_opcode_name(uint16_t qid, uint8_t opcode);
+
+#endif
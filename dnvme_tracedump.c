@@ -0,0 +1,180 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_tracedump.c
+ * Description: decoder for dnvme_trace files: event listing, command latency and a summary.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dnvme.h"
+#include "dnvme_cqe.h"
+#include "dnvme_latency.h"
+#include "dnvme_trace.h"
+
+struct trace_summary {
+    uint64_t sqes;
+    uint64_t cqes;
+    uint64_t failed;
+    uint64_t unmatched;
+    struct dnvme_lat_hist admin;
+    struct dnvme_lat_hist io;
+    struct dnvme_trace_match match;
+};
+
+static uint32_t trace_dword(const uint8_t *sqe, int dword)
+{
+    uint32_t value;
+    memcpy(&value, sqe + dword*4, sizeof(value));
+    return value;
+}
+
+static void trace_sqe(const struct dnvme_trace_file *trace, const struct dnvme_trace_record *record, uint64_t ns,
+    struct trace_summary *summary, int quiet)
+{
+    uint8_t opcode = record->sqe[0];
+
+    summary->sqes++;
+    dnvme_trace_match_submit(&summary->match, record->qid, record->unique_id, ns, opcode);
+    if (quiet)
+        return;
+    printf("%14.3f t%-3d SQ %-5d cid %-5d %-20s nsid %u cdw10 0x%08x cdw11 0x%08x cdw12 0x%08x\n",
+        (ns - trace->header.start_ns)/1000.0, record->thread, record->qid, record->unique_id,
+        dnvme_trace_opcode_name(record->qid, opcode), trace_dword(record->sqe, 1), trace_dword(record->sqe, 10),
+        trace_dword(record->sqe, 11), trace_dword(record->sqe, 12));
+}
+
+static void trace_cqes(const struct dnvme_trace_file *trace, const struct dnvme_trace_record *record, uint64_t ns,
+    struct trace_summary *summary, int quiet)
+{
+    const struct nvme_completion *cqe;
+    uint64_t submit_ns, opcode;
+    uint16_t status;
+    int i, found;
+
+    for (i=0; i<record->count && i<DNVME_TRACE_CQES; i++)
+    {
+        cqe = &record->cqe[i];
+        status = NVME_CQE_STATUS(cqe) & 0x7FF;
+        found = dnvme_trace_match_complete(&summary->match, cqe, &submit_ns, &opcode) == SUCCESS;
+        summary->cqes++;
+        if (status)
+            summary->failed++;
+        if (found)
+            dnvme_lat_add(cqe->sq_id ? &summary->io : &summary->admin, ns - submit_ns);
+        else
+            summary->unmatched++;
+        if (quiet)
+            continue;
+        printf("%14.3f t%-3d CQ %-5d cid %-5d SQ %-5d %-20s result 0x%08x", (ns - trace->header.start_ns)/1000.0,
+            record->thread, record->qid, cqe->command_id, cqe->sq_id,
+            found ? dnvme_trace_opcode_name(cqe->sq_id, opcode) : "?", cqe->result);
+        if (found)
+            printf(" %9.3fus", (ns - submit_ns)/1000.0);
+        if (status)
+            printf(" %s (SCT %d SC 0x%02x)", dnvme_status_name(status), NVME_CQE_SCT(cqe), NVME_CQE_SC(cqe));
+        printf("\n");
+    }
+}
+
+static void trace_show_lat(const char *name, const struct dnvme_lat_hist *hist)
+{
+    if (!hist->count)
+        return;
+    printf("%-6s %10lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, hist->count, dnvme_lat_mean(hist)/1000.0,
+        dnvme_lat_percentile(hist, 50)/1000.0, dnvme_lat_percentile(hist, 99)/1000.0,
+        dnvme_lat_percentile(hist, 99.9)/1000.0, hist->max_ns/1000.0);
+}
+
+static void trace_usage(const char *name)
+{
+    printf("Usage: %s [options] TRACE\n"
+        "  --summary, -s       print the summary only, no event listing\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"summary", no_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct dnvme_trace_file trace;
+    struct trace_summary summary;
+    struct dnvme_trace_record *record;
+    uint64_t i, ns, last_ns = 0;
+    int opt, ret, quiet = 0;
+
+    while ((opt = getopt_long(argc, argv, "sh", long_options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 's': quiet = 1; break;
+        default:
+            trace_usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+    if (optind != argc-1)
+    {
+        trace_usage(argv[0]);
+        return -1;
+    }
+
+    ret = dnvme_trace_load(argv[optind], &trace);
+    if (ret)
+    {
+        printf("Can't read trace %s: %s\n", argv[optind], strerror(-ret));
+        return ret;
+    }
+
+    memset(&summary, 0, sizeof(summary));
+    ret = dnvme_trace_match_init(&summary.match, 0);
+    if (ret)
+        return ret;
+    dnvme_lat_init(&summary.admin);
+    dnvme_lat_init(&summary.io);
+    for (i=0; i<trace.count; i++)
+    {
+        record = &trace.records[i];
+        ns = dnvme_trace_time_ns(&trace, record->ts);
+        switch (record->type)
+        {
+        case DNVME_TRACE_SQE:
+            trace_sqe(&trace, record, ns, &summary, quiet);
+            break;
+        case DNVME_TRACE_CQE:
+            trace_cqes(&trace, record, ns, &summary, quiet);
+            break;
+        case DNVME_TRACE_SYNC:
+            break;
+        default:
+            printf("Record %lu: unknown type %d\n", i, record->type);
+            break;
+        }
+        if (record->type != DNVME_TRACE_SYNC && ns > last_ns)
+            last_ns = ns;
+    }
+
+    printf("%s: %lu records over %.3f ms, %s clock\n", argv[optind], trace.count,
+        last_ns > trace.header.start_ns ? (last_ns - trace.header.start_ns)/1e6 : 0,
+        trace.header.clock == DNVME_TRACE_CLOCK_TSC ? "TSC" : "monotonic");
+    printf("commands %lu, completions %lu, failed %lu, unmatched %lu, dropped %lu\n", summary.sqes, summary.cqes,
+        summary.failed, summary.unmatched, trace.dropped);
+    if (summary.admin.count || summary.io.count)
+    {
+        printf("%-6s %10s %10s %10s %10s %10s %10s\n", "queue", "cmds", "mean(us)", "p50(us)", "p99(us)",
+            "p99.9(us)", "max(us)");
+        trace_show_lat("admin", &summary.admin);
+        trace_show_lat("io", &summary.io);
+    }
+    dnvme_trace_match_free(&summary.match);
+    dnvme_trace_unload(&trace);
+    return 0;
+}
@@ -0,0 +1,386 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_trim.c
+ * Description: LBA range deallocation and zeroing through DSM and Write Zeroes.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_trim.h"
+#include "dnvme_commands.h"
+#include "dnvme_pool.h"
+
+#define DNVME_DSM_LIST_SIZE     (DNVME_DSM_MAX_RANGES*sizeof(struct nvme_dsm_range))
+
+struct dnvme_trim_job;
+
+struct dnvme_trim_slot {
+    struct dnvme_trim_job *job;
+    struct nvme_dsm_range *list;    /* DSM range list, one page from the pool */
+    uint16_t index;
+};
+
+/* Lives on the heap for the same reason as a transfer: late completions point at it. */
+struct dnvme_trim_job {
+    uint16_t inflight;
+    uint16_t nr_free;
+    uint16_t *free_slots;
+    uint8_t abandoned;
+    uint16_t status;
+    struct dnvme_trim_slot *slots;
+    uint16_t nr_slots;
+};
+
+int dnvme_range_set_init(struct dnvme_range_set *set, uint32_t capacity)
+{
+    memset(set, 0, sizeof(*set));
+    if (capacity == 0)
+        capacity = DNVME_DSM_MAX_RANGES;
+    set->ranges = calloc(capacity, sizeof(struct dnvme_lba_range));
+    if (!set->ranges)
+        return -ENOMEM;
+    set->capacity = capacity;
+    return SUCCESS;
+}
+
+void dnvme_range_set_free(struct dnvme_range_set *set)
+{
+    free(set->ranges);
+    memset(set, 0, sizeof(*set));
+}
+
+void dnvme_range_set_reset(struct dnvme_range_set *set)
+{
+    set->count = 0;
+}
+
+int dnvme_range_set_add(struct dnvme_range_set *set, uint64_t slba, uint64_t nlb)
+{
+    if (nlb == 0)
+        return SUCCESS;
+    if (slba + nlb < slba)
+        return -EINVAL;
+    if (set->count == set->capacity)
+    {
+        uint32_t capacity = set->capacity ? set->capacity*2 : DNVME_DSM_MAX_RANGES;
+        struct dnvme_lba_range *ranges = realloc(set->ranges, capacity*sizeof(struct dnvme_lba_range));
+        if (!ranges)
+            return -ENOMEM;
+        set->ranges = ranges;
+        set->capacity = capacity;
+    }
+    set->ranges[set->count].slba = slba;
+    set->ranges[set->count].nlb = nlb;
+    set->count++;
+    return SUCCESS;
+}
+
+static int dnvme_range_compare(const void *a, const void *b)
+{
+    const struct dnvme_lba_range *ra = a;
+    const struct dnvme_lba_range *rb = b;
+    if (ra->slba != rb->slba)
+        return ra->slba < rb->slba ? -1 : 1;
+    return 0;
+}
+
+/* Sort by start LBA and merge ranges that overlap or touch, returns the new count. */
+uint32_t dnvme_range_set_coalesce(struct dnvme_range_set *set)
+{
+    uint32_t i, out = 0;
+    if (set->count < 2)
+        return set->count;
+    qsort(set->ranges, set->count, sizeof(struct dnvme_lba_range), dnvme_range_compare);
+    for (i=1; i<set->count; i++)
+    {
+        struct dnvme_lba_range *cur = &set->ranges[out];
+        struct dnvme_lba_range *next = &set->ranges[i];
+        if (next->slba <= cur->slba + cur->nlb)
+        {
+            if (next->slba + next->nlb > cur->slba + cur->nlb)
+                cur->nlb = next->slba + next->nlb - cur->slba;
+        }
+        else
+        {
+            set->ranges[++out] = *next;
+        }
+    }
+    set->count = out+1;
+    return set->count;
+}
+
+uint64_t dnvme_range_set_blocks(const struct dnvme_range_set *set)
+{
+    uint64_t blocks = 0;
+    uint32_t i;
+    for (i=0; i<set->count; i++)
+        blocks += set->ranges[i].nlb;
+    return blocks;
+}
+
+/* ONCS, DLFEAT and the namespace size, through the admin queue. */
+int dnvme_trim_get_caps(int fd, uint32_t nsid, struct dnvme_trim_caps *caps)
+{
+    struct nvme_completion cqe;
+    uint8_t *buffer = create_buffer(4096, 1);
+    struct nvme_id_ctrl *ctrl = (struct nvme_id_ctrl *)buffer;
+    struct nvme_id_ns *ns = (struct nvme_id_ns *)buffer;
+    int ret;
+    if (!buffer)
+        return -ENOMEM;
+    memset(caps, 0, sizeof(*caps));
+    ret = dnvme_admin_identify_ctrl(fd, 0, 0, 0, buffer);
+    if (ret == 0)
+        ret = dnvme_admin_complete(fd, &cqe);
+    if (ret == 0 && NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+        ret = -EIO;
+    if (ret == 0)
+    {
+        caps->oncs = ctrl->oncs;
+        ret = dnvme_admin_identify_ns(fd, nsid, 0, 0, buffer);
+    }
+    if (ret == 0)
+        ret = dnvme_admin_complete(fd, &cqe);
+    if (ret == 0 && NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+        ret = -EIO;
+    if (ret == 0)
+    {
+        caps->dlfeat = ns->dlfeat;
+        caps->nsze = ns->nsze;
+    }
+    free_buffer(buffer);
+    return ret;
+}
+
+static void dnvme_trim_release(struct dnvme_trim_job *job)
+{
+    uint16_t i;
+    for (i=0; i<job->nr_slots; i++)
+        free_buffer(job->slots[i].list);
+    free(job->slots);
+    free(job->free_slots);
+    free(job);
+}
+
+static void dnvme_trim_complete(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    struct dnvme_trim_slot *slot = ctx;
+    struct dnvme_trim_job *job = slot->job;
+    job->inflight--;
+    if (NVME_CQE_STATUS(cqe) != NVME_SC_SUCCESS && !job->status)
+        job->status = NVME_CQE_STATUS(cqe);
+    job->free_slots[job->nr_free++] = slot->index;
+    if (job->abandoned && job->inflight == 0)
+        dnvme_trim_release(job);
+}
+
+/*
+ * Zeroing prefers Write Zeroes with the deallocate hint, and only uses DSM
+ * when deallocated blocks are known to read back as zeroes. Deallocation
+ * prefers DSM, which takes 256 ranges per command against Write Zeroes'
+ * single range of at most 64K LBAs.
+ */
+static int dnvme_trim_use_dsm(enum dnvme_trim_op op, const struct dnvme_trim_caps *caps)
+{
+    int dsm = caps->oncs & NVME_CTRL_ONCS_DSM;
+    int wz = caps->oncs & NVME_CTRL_ONCS_WRITE_ZEROES;
+    if (op == DNVME_TRIM_ZERO)
+    {
+        if (wz)
+            return 0;
+        if (dsm && (caps->dlfeat & NVME_NS_DLFEAT_READ_MASK) == NVME_NS_DLFEAT_READ_ZEROES)
+            return 1;
+        return -EOPNOTSUPP;
+    }
+    if (dsm)
+        return 1;
+    return wz ? 0 : -EOPNOTSUPP;
+}
+
+/*
+ * Coalesce 'set' and issue it on 'queue' with up to 'depth' commands in
+ * flight. Ranges longer than one command allows are split; a DSM command
+ * packs up to 256 ranges.
+ */
+int dnvme_trim(struct dnvme_queue *queue, uint32_t nsid, struct dnvme_range_set *set, enum dnvme_trim_op op,
+    const struct dnvme_trim_caps *caps, uint16_t depth, struct dnvme_trim_stats *stats)
+{
+    uint64_t start = dnvme_get_time_ns();
+    int use_dsm = dnvme_trim_use_dsm(op, caps);
+    struct dnvme_trim_job *job;
+    struct nvme_io_cmd cmd;
+    uint32_t range = 0;
+    uint64_t done = 0;          /* LBAs of ranges[range] already issued */
+    void **ctx;
+    int err = SUCCESS;
+    int ret = SUCCESS;
+    uint16_t i;
+
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+    if (use_dsm < 0)
+        return use_dsm;
+    dnvme_range_set_coalesce(set);
+    if (caps->nsze && set->count && set->ranges[set->count-1].slba + set->ranges[set->count-1].nlb > caps->nsze)
+        return -EINVAL;
+    if (stats)
+    {
+        stats->ranges = set->count;
+        stats->blocks = dnvme_range_set_blocks(set);
+    }
+    if (depth == 0)
+        depth = DNVME_TRIM_DEFAULT_DEPTH;
+    if (depth > queue->depth-1)
+        depth = queue->depth-1;
+
+    job = calloc(1, sizeof(*job));
+    ctx = calloc(depth, sizeof(void *));
+    if (!job || !ctx)
+    {
+        free(job);
+        free(ctx);
+        return -ENOMEM;
+    }
+    job->slots = calloc(depth, sizeof(struct dnvme_trim_slot));
+    job->free_slots = calloc(depth, sizeof(uint16_t));
+    if (!job->slots || !job->free_slots)
+        err = -ENOMEM;
+    for (i=0; err == 0 && i<depth; i++)
+    {
+        struct dnvme_trim_slot *slot = &job->slots[i];
+        slot->job = job;
+        slot->index = i;
+        job->nr_slots++;
+        if (use_dsm)
+        {
+            slot->list = dnvme_pool_alloc(queue->pool, DNVME_DSM_LIST_SIZE);
+            if (!slot->list)
+                err = -ENOMEM;
+        }
+        job->free_slots[job->nr_free++] = i;
+    }
+
+    while (err == 0 && ((range < set->count && !job->status) || job->inflight))
+    {
+        uint16_t n = 0;
+        int submitted;
+        while (!job->status && range < set->count && job->nr_free)
+        {
+            struct dnvme_trim_slot *slot = &job->slots[job->free_slots[--job->nr_free]];
+            struct dnvme_lba_range *r;
+            uint64_t nlb;
+            memset(&cmd, 0, sizeof(cmd));
+            cmd.nsid = nsid;
+            if (use_dsm)
+            {
+                uint16_t nr = 0;
+                while (nr < DNVME_DSM_MAX_RANGES && range < set->count)
+                {
+                    r = &set->ranges[range];
+                    nlb = r->nlb - done < DNVME_DSM_MAX_NLB ? r->nlb - done : DNVME_DSM_MAX_NLB;
+                    slot->list[nr].cattr = 0;
+                    slot->list[nr].nlb = nlb;
+                    slot->list[nr].slba = r->slba + done;
+                    nr++;
+                    done += nlb;
+                    if (done == r->nlb)
+                    {
+                        range++;
+                        done = 0;
+                    }
+                }
+                cmd.opcode = NVME_CMD_DATASET_MANAGEMENT;
+                cmd.cdw10.dataset_management.nr = nr-1;
+                cmd.cdw11.dataset_management.deallocate = 1;
+                dnvme_batch_add(&queue->batch, &cmd, MASK_PRP1_PAGE, (uint8_t *)slot->list,
+                    nr*sizeof(struct nvme_dsm_range), DATA_DIR_TO_DEVICE);
+                if (stats)
+                    stats->dsm_cmds++;
+            }
+            else
+            {
+                r = &set->ranges[range];
+                nlb = r->nlb - done < DNVME_WZ_MAX_NLB ? r->nlb - done : DNVME_WZ_MAX_NLB;
+                cmd.opcode = NVME_CMD_WRITE_ZEROES;
+                cmd.cdw10.write_zeros.start_lba_low = (r->slba + done) & 0xFFFFFFFF;
+                cmd.cdw11.write_zeros.start_lba_up = ((r->slba + done)>>32) & 0xFFFFFFFF;
+                cmd.cdw12.write_zeros.nlb = nlb-1;
+                cmd.cdw12.write_zeros.deallocate = 1;
+                dnvme_batch_add(&queue->batch, &cmd, 0, NULL, 0, DATA_DIR_NONE);
+                done += nlb;
+                if (done == r->nlb)
+                {
+                    range++;
+                    done = 0;
+                }
+                if (stats)
+                    stats->wz_cmds++;
+            }
+            ctx[n++] = slot;
+            job->inflight++;
+        }
+        if (n)
+        {
+            /* slots that went out stay registered until they complete */
+            submitted = dnvme_queue_submit(queue, dnvme_trim_complete, ctx, &err);
+            if (err == 0 && submitted < n)
+                err = -EIO;
+            for (i=submitted; i<n; i++)
+            {
+                job->free_slots[job->nr_free++] = ((struct dnvme_trim_slot *)ctx[i])->index;
+                job->inflight--;
+            }
+            if (err && job->inflight == 0)
+                break;
+        }
+        if (job->inflight)
+        {
+            ret = dnvme_queue_wait(queue, 1, 0);
+            if (ret < 0)
+                break;
+            ret = SUCCESS;
+        }
+    }
+    while (ret == 0 && job->inflight)
+    {
+        ret = dnvme_queue_wait(queue, 1, 0);
+        ret = ret < 0 ? ret : SUCCESS;
+    }
+
+    if (stats)
+    {
+        stats->elapsed_ns = dnvme_get_time_ns() - start;
+        stats->status = job->status;
+    }
+    if (ret == 0 && err == 0 && job->status)
+        err = -EIO;
+    free(ctx);
+    if (job->inflight)
+        job->abandoned = 1;
+    else
+        dnvme_trim_release(job);
+    return ret ? ret : err;
+}
+
+/* Deallocate or zero every LBA of the namespace. */
+int dnvme_trim_namespace(struct dnvme_queue *queue, uint32_t nsid, enum dnvme_trim_op op,
+    const struct dnvme_trim_caps *caps, uint16_t depth, struct dnvme_trim_stats *stats)
+{
+    struct dnvme_range_set set;
+    int ret;
+    if (caps->nsze == 0)
+        return -EINVAL;
+    ret = dnvme_range_set_init(&set, 1);
+    if (ret)
+        return ret;
+    dnvme_range_set_add(&set, 0, caps->nsze);
+    ret = dnvme_trim(queue, nsid, &set, op, caps, depth, stats);
+    dnvme_range_set_free(&set);
+    return ret;
+}
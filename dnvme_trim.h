@@ -0,0 +1,64 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_trim.h
+ * Description: LBA range deallocation and zeroing through DSM and Write Zeroes.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_TRIM_H__
+#define __DNVME_TRIM_H__
+#include <stdint.h>
+#include "dnvme_engine.h"
+
+#define DNVME_DSM_MAX_RANGES        256
+#define DNVME_DSM_MAX_NLB           UINT32_MAX      /* per range */
+#define DNVME_WZ_MAX_NLB            65536           /* per command, 16 bit 0's based NLB */
+#define DNVME_TRIM_DEFAULT_DEPTH    16
+
+struct dnvme_lba_range {
+    uint64_t slba;
+    uint64_t nlb;               /* LBA count, 1's based */
+};
+
+/* Ranges collected from callers, kept unsorted until dnvme_range_set_coalesce(). */
+struct dnvme_range_set {
+    struct dnvme_lba_range *ranges;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+enum dnvme_trim_op {
+    DNVME_TRIM_DEALLOCATE,      /* contents are undefined afterwards */
+    DNVME_TRIM_ZERO,            /* reads return zeroes afterwards */
+};
+
+struct dnvme_trim_caps {
+    uint16_t oncs;              /* Identify Controller ONCS */
+    uint8_t dlfeat;             /* Identify Namespace DLFEAT */
+    uint64_t nsze;
+};
+
+struct dnvme_trim_stats {
+    uint64_t elapsed_ns;
+    uint64_t blocks;            /* LBAs covered after coalescing */
+    uint32_t ranges;            /* ranges after coalescing */
+    uint32_t dsm_cmds;
+    uint32_t wz_cmds;
+    uint16_t status;            /* first failing CQE status, 0 = none */
+};
+
+int dnvme_range_set_init(struct dnvme_range_set *set, uint32_t capacity);
+void dnvme_range_set_free(struct dnvme_range_set *set);
+void dnvme_range_set_reset(struct dnvme_range_set *set);
+int dnvme_range_set_add(struct dnvme_range_set *set, uint64_t slba, uint64_t nlb);
+uint32_t dnvme_range_set_coalesce(struct dnvme_range_set *set);
+uint64_t dnvme_range_set_blocks(const struct dnvme_range_set *set);
+
+int dnvme_trim_get_caps(int fd, uint32_t nsid, struct dnvme_trim_caps *caps);
+int dnvme_trim(struct dnvme_queue *queue, uint32_t nsid, struct dnvme_range_set *set, enum dnvme_trim_op op,
+    const struct dnvme_trim_caps *caps, uint16_t depth, struct dnvme_trim_stats *stats);
+int dnvme_trim_namespace(struct dnvme_queue *queue, uint32_t nsid, enum dnvme_trim_op op,
+    const struct dnvme_trim_caps *caps, uint16_t depth, struct dnvme_trim_stats *stats);
+
+#endif
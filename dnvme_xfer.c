@@ -0,0 +1,381 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_xfer.c
+ * Description: large reads and writes split by MDTS and pipelined on a queue.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dnvme.h>
+#include "dnvme_xfer.h"
+#include "dnvme_commands.h"
+#include "dnvme_pool.h"
+
+#define DNVME_XFER_NO_LBA   UINT64_MAX
+
+struct dnvme_xfer;
+
+struct dnvme_xfer_chunk {
+    struct dnvme_xfer *xfer;
+    uint64_t slba;
+    uint32_t nlb;
+    uint8_t *bounce;            /* pool buffer, NULL = straight into the caller's memory */
+    uint16_t index;
+};
+
+/*
+ * State of one transfer. It lives on the heap because chunks still queued
+ * when a wait fails keep pointing at it; the last completion frees it.
+ */
+struct dnvme_xfer {
+    uint32_t lba_size;
+    uint8_t opcode;
+    uint64_t offset;            /* caller's byte range */
+    uint64_t bytes;
+    uint8_t *user;
+    uint8_t *edges;             /* old head and tail LBA of an unaligned write */
+    uint64_t edge_head;
+    uint64_t edge_tail;
+    uint64_t first_lba;
+    struct dnvme_xfer_pi *pi;   /* NULL = no protection information */
+    uint16_t inflight;
+    uint16_t nr_free;
+    uint16_t *free_chunks;
+    uint8_t abandoned;
+    uint16_t status;            /* first failing CQE status */
+    struct dnvme_xfer_chunk *chunks;
+    uint16_t nr_chunks;
+};
+
+/* Read MDTS, NOIOB and the LBA format. Uses the admin queue. */
+int dnvme_xfer_get_limits(int fd, uint32_t nsid, struct dnvme_xfer_limits *limits)
+{
+    struct nvme_completion cqe;
+    struct nvme_id_ns *ns = create_buffer(sizeof(struct nvme_id_ns), 1);
+    uint32_t max_transfer;
+    int ret;
+    if (!ns)
+        return -ENOMEM;
+    memset(limits, 0, sizeof(*limits));
+    ret = dnvme_admin_identify_ns(fd, nsid, 0, 0, (uint8_t *)ns);
+    if (ret == 0)
+        ret = dnvme_admin_complete(fd, &cqe);
+    if (ret == 0 && NVME_CQE_STATUS(&cqe) != NVME_SC_SUCCESS)
+        ret = -EIO;
+    if (ret == 0)
+    {
+        /* metadata of an extended LBA format moves with the data of each LBA */
+        limits->lba_size = 1 << ns->lbaf[ns->flbas & NVME_NS_FLBAS_LBA_MASK].ds;
+        if (ns->flbas & NVME_NS_FLBAS_META_EXT)
+            limits->lba_size += ns->lbaf[ns->flbas & NVME_NS_FLBAS_LBA_MASK].ms;
+        limits->boundary_lbas = ns->noiob;
+        limits->nsze = ns->nsze;
+    }
+    free_buffer(ns);
+    if (ret)
+        return ret;
+    max_transfer = dnvme_controller_get_max_transfer(fd);
+    limits->max_lbas = DNVME_XFER_MAX_NLB;
+    if (max_transfer && max_transfer/limits->lba_size < limits->max_lbas)
+        limits->max_lbas = max_transfer/limits->lba_size;
+    return limits->max_lbas ? SUCCESS : -EINVAL;
+}
+
+static void dnvme_xfer_release(struct dnvme_xfer *xfer)
+{
+    uint16_t i;
+    for (i=0; i<xfer->nr_chunks; i++)
+        free_buffer(xfer->chunks[i].bounce);
+    free_buffer(xfer->edges);
+    free(xfer->chunks);
+    free(xfer->free_chunks);
+    free(xfer);
+}
+
+/* Overlap of a chunk with the caller's range, as offsets into both and a length. */
+static uint64_t dnvme_xfer_overlap(struct dnvme_xfer *xfer, struct dnvme_xfer_chunk *chunk, uint64_t *user_off,
+    uint64_t *chunk_off)
+{
+    uint64_t start = chunk->slba*xfer->lba_size;
+    uint64_t end = start + (uint64_t)chunk->nlb*xfer->lba_size;
+    uint64_t lo = start > xfer->offset ? start : xfer->offset;
+    uint64_t hi = end < xfer->offset+xfer->bytes ? end : xfer->offset+xfer->bytes;
+    *user_off = lo - xfer->offset;
+    *chunk_off = lo - start;
+    return hi - lo;
+}
+
+static void dnvme_xfer_fill(struct dnvme_xfer *xfer, struct dnvme_xfer_chunk *chunk)
+{
+    uint64_t user_off, chunk_off, len;
+    if (xfer->edges && xfer->edge_head >= chunk->slba && xfer->edge_head < chunk->slba+chunk->nlb)
+        memcpy(chunk->bounce + (xfer->edge_head-chunk->slba)*xfer->lba_size, xfer->edges, xfer->lba_size);
+    if (xfer->edges && xfer->edge_tail >= chunk->slba && xfer->edge_tail < chunk->slba+chunk->nlb)
+        memcpy(chunk->bounce + (xfer->edge_tail-chunk->slba)*xfer->lba_size, xfer->edges+xfer->lba_size,
+            xfer->lba_size);
+    len = dnvme_xfer_overlap(xfer, chunk, &user_off, &chunk_off);
+    memcpy(chunk->bounce + chunk_off, xfer->user + user_off, len);
+}
+
+/* The reference tag of a chunk is that of the transfer moved on by the LBAs before it, except for type 3. */
+static void dnvme_xfer_pi_tags(const struct dnvme_xfer *xfer, const struct dnvme_xfer_chunk *chunk,
+    struct dnvme_pi_tags *tags)
+{
+    *tags = xfer->pi->tags;
+    if (xfer->pi->format.type != NVME_NS_DPS_PI_TYPE3)
+        tags->ref += chunk->slba - xfer->first_lba;
+}
+
+static uint8_t *dnvme_xfer_data(struct dnvme_xfer *xfer, struct dnvme_xfer_chunk *chunk)
+{
+    return chunk->bounce ? chunk->bounce : xfer->user + (chunk->slba*xfer->lba_size - xfer->offset);
+}
+
+/* A PI failure of a read chunk stops the transfer like a failed CQE would. */
+static void dnvme_xfer_verify(struct dnvme_xfer *xfer, struct dnvme_xfer_chunk *chunk)
+{
+    struct dnvme_pi_tags tags;
+    struct dnvme_pi_error error;
+    dnvme_xfer_pi_tags(xfer, chunk, &tags);
+    if (dnvme_pi_verify(&xfer->pi->format, NULL, dnvme_xfer_data(xfer, chunk), NULL, chunk->nlb, chunk->slba,
+        &tags, &error, NULL) == SUCCESS || xfer->status)
+        return;
+    error.index += chunk->slba - xfer->first_lba;
+    xfer->pi->error = error;
+    xfer->status = error.status;
+}
+
+static void dnvme_xfer_complete(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    struct dnvme_xfer_chunk *chunk = ctx;
+    struct dnvme_xfer *xfer = chunk->xfer;
+    uint64_t user_off, chunk_off, len;
+    xfer->inflight--;
+    if (NVME_CQE_STATUS(cqe) != NVME_SC_SUCCESS)
+    {
+        if (!xfer->status)
+            xfer->status = NVME_CQE_STATUS(cqe);
+    }
+    else if (!xfer->abandoned && xfer->opcode == NVME_CMD_READ)
+    {
+        if (xfer->pi)
+            dnvme_xfer_verify(xfer, chunk);
+        if (chunk->bounce)
+        {
+            len = dnvme_xfer_overlap(xfer, chunk, &user_off, &chunk_off);
+            memcpy(xfer->user + user_off, chunk->bounce + chunk_off, len);
+        }
+    }
+    xfer->free_chunks[xfer->nr_free++] = chunk->index;
+    if (xfer->abandoned && xfer->inflight == 0)
+        dnvme_xfer_release(xfer);
+}
+
+/* Fetch the LBAs an unaligned write only partly covers, so they can be written back whole. */
+static int dnvme_xfer_read_edges(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    struct dnvme_xfer *xfer, uint64_t first_lba, uint64_t end_lba)
+{
+    uint32_t lba_size = limits->lba_size;
+    int ret = SUCCESS;
+    xfer->edge_head = xfer->offset % lba_size ? first_lba : DNVME_XFER_NO_LBA;
+    xfer->edge_tail = (xfer->offset+xfer->bytes) % lba_size ? end_lba-1 : DNVME_XFER_NO_LBA;
+    xfer->edges = dnvme_pool_alloc(queue->pool, 2*lba_size);
+    if (!xfer->edges)
+        return -ENOMEM;
+    if (xfer->edge_head != DNVME_XFER_NO_LBA)
+        ret = dnvme_xfer_read(queue, limits, nsid, xfer->edge_head*lba_size, xfer->edges, lba_size, 1, NULL, NULL);
+    if (ret == 0 && xfer->edge_tail != DNVME_XFER_NO_LBA)
+    {
+        if (xfer->edge_tail == xfer->edge_head)
+            memcpy(xfer->edges+lba_size, xfer->edges, lba_size);
+        else
+            ret = dnvme_xfer_read(queue, limits, nsid, xfer->edge_tail*lba_size, xfer->edges+lba_size, lba_size,
+                1, NULL, NULL);
+    }
+    return ret;
+}
+
+/*
+ * Split [offset, offset+bytes) into commands of at most limits->max_lbas
+ * that never cross a NOIOB boundary, and keep up to 'depth' of them on the
+ * queue. LBA aligned ranges in dword aligned memory go straight to the
+ * caller's buffer; anything else is staged in pool buffers, and unaligned
+ * writes read the partial LBAs at either end first. Writes with PI are
+ * always staged, the caller's buffer is not ours to put tuples in.
+ */
+static int dnvme_xfer_run(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    uint8_t opcode, uint64_t offset, uint8_t *buffer, uint64_t bytes, uint16_t depth, struct dnvme_xfer_pi *pi,
+    struct dnvme_xfer_stats *stats)
+{
+    uint64_t start = dnvme_get_time_ns();
+    uint32_t lba_size = limits->lba_size;
+    uint64_t next_lba, end_lba;
+    uint32_t chunk_lbas;
+    uint8_t dir = opcode == NVME_CMD_READ ? DATA_DIR_FROM_DEVICE : DATA_DIR_TO_DEVICE;
+    struct dnvme_xfer *xfer;
+    struct nvme_io_cmd cmd;
+    struct dnvme_pi_tags tags;
+    void **ctx;
+    int bounce;
+    int err = SUCCESS;
+    int ret = SUCCESS;
+    uint16_t i;
+
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+    if (!lba_size || !limits->max_lbas || !buffer)
+        return -EINVAL;
+    if (pi && ((pi->format.ms && !pi->format.extended) || dnvme_pi_block_size(&pi->format) != lba_size ||
+        pi->prinfo & DNVME_PI_PRACT))
+        return -EINVAL;
+    if (bytes == 0)
+        return SUCCESS;
+    next_lba = offset/lba_size;
+    end_lba = (offset+bytes+lba_size-1)/lba_size;
+    if (limits->nsze && end_lba > limits->nsze)
+        return -EINVAL;
+    if (depth == 0)
+        depth = DNVME_XFER_DEFAULT_DEPTH;
+    if (depth > queue->depth-1)
+        depth = queue->depth-1;
+    bounce = offset % lba_size || bytes % lba_size || (uintptr_t)buffer & 3 || (pi && opcode == NVME_CMD_WRITE);
+    chunk_lbas = end_lba-next_lba < limits->max_lbas ? end_lba-next_lba : limits->max_lbas;
+
+    xfer = calloc(1, sizeof(*xfer));
+    ctx = calloc(depth, sizeof(void *));
+    if (!xfer || !ctx)
+    {
+        free(xfer);
+        free(ctx);
+        return -ENOMEM;
+    }
+    xfer->lba_size = lba_size;
+    xfer->opcode = opcode;
+    xfer->offset = offset;
+    xfer->bytes = bytes;
+    xfer->user = buffer;
+    xfer->first_lba = next_lba;
+    xfer->pi = pi;
+    xfer->chunks = calloc(depth, sizeof(struct dnvme_xfer_chunk));
+    xfer->free_chunks = calloc(depth, sizeof(uint16_t));
+    if (!xfer->chunks || !xfer->free_chunks)
+        err = -ENOMEM;
+    for (i=0; err == 0 && i<depth; i++)
+    {
+        struct dnvme_xfer_chunk *chunk = &xfer->chunks[i];
+        chunk->xfer = xfer;
+        chunk->index = i;
+        xfer->nr_chunks++;
+        if (bounce)
+        {
+            chunk->bounce = dnvme_pool_alloc(queue->pool, chunk_lbas*lba_size);
+            if (!chunk->bounce)
+                err = -ENOMEM;
+        }
+        xfer->free_chunks[xfer->nr_free++] = (depth-1)-i;
+    }
+    if (err == 0 && opcode == NVME_CMD_WRITE && bounce && (offset % lba_size || (offset+bytes) % lba_size))
+        err = dnvme_xfer_read_edges(queue, limits, nsid, xfer, next_lba, end_lba);
+
+    while (err == 0 && ((next_lba < end_lba && !xfer->status) || xfer->inflight))
+    {
+        uint16_t n = 0;
+        int submitted;
+        while (!xfer->status && next_lba < end_lba && xfer->nr_free)
+        {
+            struct dnvme_xfer_chunk *chunk = &xfer->chunks[xfer->free_chunks[--xfer->nr_free]];
+            uint32_t nlb = end_lba-next_lba < limits->max_lbas ? end_lba-next_lba : limits->max_lbas;
+            uint8_t *data;
+            if (limits->boundary_lbas && nlb > limits->boundary_lbas - next_lba%limits->boundary_lbas)
+                nlb = limits->boundary_lbas - next_lba%limits->boundary_lbas;
+            chunk->slba = next_lba;
+            chunk->nlb = nlb;
+            next_lba += nlb;
+            data = dnvme_xfer_data(xfer, chunk);
+            if (chunk->bounce && opcode == NVME_CMD_WRITE)
+                dnvme_xfer_fill(xfer, chunk);
+            dnvme_nvm_rw_prepare(&cmd, opcode, nsid, chunk->slba, nlb);
+            if (pi)
+            {
+                dnvme_xfer_pi_tags(xfer, chunk, &tags);
+                if (opcode == NVME_CMD_WRITE)
+                    dnvme_pi_generate(&pi->format, NULL, data, NULL, nlb, chunk->slba, &tags);
+                dnvme_pi_set_tags(&cmd, &tags, pi->prinfo);
+            }
+            dnvme_batch_add_io(&queue->batch, &cmd, data, nlb*lba_size, dir);
+            ctx[n++] = chunk;
+            xfer->inflight++;
+        }
+        if (n)
+        {
+            /* only what never went out is reclaimed, the rest completes normally */
+            submitted = dnvme_queue_submit(queue, dnvme_xfer_complete, ctx, &err);
+            if (err == 0 && submitted < n)
+                err = -EIO;
+            for (i=submitted; i<n; i++)
+            {
+                xfer->free_chunks[xfer->nr_free++] = ((struct dnvme_xfer_chunk *)ctx[i])->index;
+                xfer->inflight--;
+            }
+            if (stats)
+            {
+                stats->commands += submitted;
+                if (xfer->inflight > stats->max_inflight)
+                    stats->max_inflight = xfer->inflight;
+            }
+            if (err && xfer->inflight == 0)
+                break;
+        }
+        if (xfer->inflight)
+        {
+            ret = dnvme_queue_wait(queue, 1, 0);
+            if (ret < 0)
+                break;
+            ret = SUCCESS;
+        }
+    }
+    /* After a submit error keep draining what did go out. */
+    while (ret == 0 && xfer->inflight)
+    {
+        ret = dnvme_queue_wait(queue, 1, 0);
+        ret = ret < 0 ? ret : SUCCESS;
+    }
+
+    if (stats)
+    {
+        stats->elapsed_ns = dnvme_get_time_ns() - start;
+        stats->bounced = bounce;
+        stats->status = xfer->status;
+    }
+    if (ret == 0 && err == 0 && xfer->status)
+        err = -EIO;
+    free(ctx);
+    if (xfer->inflight)
+        xfer->abandoned = 1;
+    else
+        dnvme_xfer_release(xfer);
+    return ret ? ret : err;
+}
+
+/* 'pi' NULL reads the blocks as they are, metadata included on an extended LBA format. */
+int dnvme_xfer_read(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    uint64_t offset, void *buffer, uint64_t bytes, uint16_t depth, struct dnvme_xfer_pi *pi,
+    struct dnvme_xfer_stats *stats)
+{
+    if (pi)
+        memset(&pi->error, 0, sizeof(pi->error));
+    return dnvme_xfer_run(queue, limits, nsid, NVME_CMD_READ, offset, buffer, bytes, depth, pi, stats);
+}
+
+/* The caller's buffer is only read; unaligned ranges are staged in pool buffers. */
+int dnvme_xfer_write(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    uint64_t offset, const void *buffer, uint64_t bytes, uint16_t depth, struct dnvme_xfer_pi *pi,
+    struct dnvme_xfer_stats *stats)
+{
+    return dnvme_xfer_run(queue, limits, nsid, NVME_CMD_WRITE, offset, (uint8_t *)buffer, bytes, depth, pi, stats);
+}
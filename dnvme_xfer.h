@@ -0,0 +1,53 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_xfer.h
+ * Description: large reads and writes split by MDTS and pipelined on a queue.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_XFER_H__
+#define __DNVME_XFER_H__
+#include <stdint.h>
+#include "dnvme_engine.h"
+#include "dnvme_pi.h"
+
+#define DNVME_XFER_MAX_NLB          65536   /* 16 bit 0's based NLB */
+#define DNVME_XFER_DEFAULT_DEPTH    8
+
+struct dnvme_xfer_limits {
+    uint32_t lba_size;          /* bytes per LBA in a data buffer, with extended metadata */
+    uint32_t max_lbas;          /* LBAs per command, from MDTS and NLB */
+    uint32_t boundary_lbas;     /* NOIOB, no command crosses a multiple of it, 0 = none */
+    uint64_t nsze;              /* LBAs in the namespace */
+};
+
+/*
+ * Protection information of a transfer on an extended LBA format: writes
+ * generate the tuple of every LBA, overwriting what the caller's buffer
+ * holds there, and reads check it chunk by chunk as completions come in.
+ */
+struct dnvme_xfer_pi {
+    struct dnvme_pi_format format;  /* from dnvme_pi_get_format(), block size must be limits->lba_size */
+    struct dnvme_pi_tags tags;      /* tags of the first LBA, the reference tag advances with the LBA */
+    uint8_t prinfo;                 /* DNVME_PI_PRCHK_* the controller checks, PRACT is not supported */
+    struct dnvme_pi_error error;    /* read: first failure seen, index counted from the first LBA */
+};
+
+struct dnvme_xfer_stats {
+    uint64_t elapsed_ns;
+    uint32_t commands;          /* chunks issued */
+    uint16_t max_inflight;      /* most chunks outstanding at once */
+    uint8_t bounced;            /* data went through pool buffers */
+    uint16_t status;            /* first failing CQE status, 0 = none */
+};
+
+int dnvme_xfer_get_limits(int fd, uint32_t nsid, struct dnvme_xfer_limits *limits);
+int dnvme_xfer_read(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    uint64_t offset, void *buffer, uint64_t bytes, uint16_t depth, struct dnvme_xfer_pi *pi,
+    struct dnvme_xfer_stats *stats);
+int dnvme_xfer_write(struct dnvme_queue *queue, const struct dnvme_xfer_limits *limits, uint32_t nsid,
+    uint64_t offset, const void *buffer, uint64_t bytes, uint16_t depth, struct dnvme_xfer_pi *pi,
+    struct dnvme_xfer_stats *stats);
+
+#endif
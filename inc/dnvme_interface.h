@@ -664,7 +664,7 @@ union dw15_u {
             uint32_t hmdlec; //Host Memory Descriptor List Entry Count
         } hmb; //Host Memory Buffer (Feature Identifier 0Dh)
     } feature;
-} cdw15;
+};
 
 
 /**
@@ -1127,4 +1127,25 @@ struct nvme_io_cmd {
     union dw15_io_u cdw15;
 };
 
+/**
+ * Format of completion queue entry DW0-DW3
+ */
+struct nvme_completion {
+    uint32_t result;        /* command specific result, DW0 */
+    uint32_t rsvd;
+    uint16_t sq_head;       /* SQ head pointer when the entry was posted */
+    uint16_t sq_id;         /* SQ the completed command was issued to */
+    uint16_t command_id;    /* unique_id of the completed command */
+    uint16_t status;        /* bit 0 is the phase tag, bits 15:1 the status */
+};
+
+/**
+ * Dataset Management range definition, up to 256 per command
+ */
+struct nvme_dsm_range {
+    uint32_t cattr;         /* context attributes */
+    uint32_t nlb;           /* 1's based, unlike the NLB in commands */
+    uint64_t slba;          /* starting LBA */
+};
+
 #endif
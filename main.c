@@ -25,18 +25,38 @@
 #include "dnvme_ioctrl.h"
 #include "dnvme_commands.h"
 #include "dnvme_show.h"
+#include "dnvme_pool.h"
+#include "dnvme_regcache.h"
+#include "dnvme_pci.h"
+#include "dnvme_adminpipe.h"
+#include "dnvme_cqe.h"
 
 #define DEVICE_FILE_NAME "/dev/nvme0"
 
 int show_pcie_capability(int fd)
 {
-    uint32_t bytes = 0x100;
-    uint8_t *data = (uint8_t*)malloc(sizeof(char)*bytes);
-    int ret = dnvme_pcie_capability_read_block(fd, 0, bytes, data);
+    const struct dnvme_pci_config *cfg;
+    struct dnvme_pci_link link;
+    uint32_t id;
+    int ret = dnvme_pcie_capability_snapshot(fd);
     if (ret)
         return ret;
-    show_raw_data(data, bytes, "PCIE capability");
-    free(data);
+    cfg = dnvme_pci_get(fd);
+    printf("PCIE capability (%u bytes of config space):\n", cfg->size);
+    for (id=0; id<DNVME_PCI_CAP_IDS; id++)
+    {
+        if (dnvme_pci_find_cap(cfg, id))
+            printf("  [%03x] %02x %s\n", dnvme_pci_find_cap(cfg, id), id, dnvme_pci_cap_name(id));
+    }
+    for (id=0; id<DNVME_PCI_EXT_CAP_IDS; id++)
+    {
+        if (dnvme_pci_find_ext_cap(cfg, id))
+            printf("  [%03x] %04x %s\n", dnvme_pci_find_ext_cap(cfg, id), id, dnvme_pci_ext_cap_name(id));
+    }
+    if (dnvme_pci_get_link(cfg, &link) == 0)
+        printf("  Link: %s x%u (max %s x%u)\n", dnvme_pci_link_speed_name(link.speed), link.width,
+            dnvme_pci_link_speed_name(link.max_speed), link.max_width);
+    printf("  MSI-X table size: %u\n", dnvme_pci_msix_table_size(cfg));
     return 0;
 }
 
@@ -60,10 +80,33 @@ int show_csts(int fd)
     return 0;
 }
 
+void show_wait_stats(struct dnvme_wait_stats *stats, char *description)
+{
+    printf("%s wait: %u remaining, %lu ns, %u inquiries, %u sleeps\n", description, stats->remaining,
+        stats->elapsed_ns, stats->inquiries, stats->sleeps);
+}
+
+/* Decode the failed CQEs of 'buffer'; 'commands' names what each entry completed. */
+void show_cqe_failures(const uint8_t *buffer, uint32_t count, const char *const *commands, char *description)
+{
+    struct dnvme_cqe_failure failures[16];
+    struct dnvme_cqe_view view;
+    uint32_t failed, i;
+    dnvme_cqe_view_init(&view, buffer, count);
+    failed = dnvme_cqe_failures(&view, failures, 16);
+    printf("%s: %u of %u commands failed (%s scan)\n", description, failed, count, dnvme_cqe_scan_isa());
+    for (i=0; i<failed && i<16; i++)
+    {
+        printf("  %-20s cid %-5u SCT %x SC %02x %s%s\n", commands ? commands[failures[i].index] : "",
+            failures[i].command_id, failures[i].status >> 8, failures[i].status & 0xFF, failures[i].name,
+            failures[i].dnr ? ", do not retry" : "");
+    }
+}
+
 int main(int argc, char *argv[])
 {
     int fd = 0;
-    uint16_t qsize = 65280; //NVME_QUEUE_ELEMENTS;
+    uint16_t qsize = 65280; //0's based, NVME_QUEUE_ELEMENTS;
     uint16_t cq_id = 1;
     uint16_t sq_id = 1;
     uint16_t irq_no = 1;
@@ -77,9 +120,19 @@ int main(int argc, char *argv[])
     void *cq_buffer = NULL;
     uint16_t cq_remaining = 0;
     uint16_t cq_buffer_size = 0;
+    /* create IOCQ/IOSQ, identify ctrl/ns and five set/get power state pairs */
+    struct nvme_completion admin_cqes[14];
+    static const char *const admin_commands[14] = {
+        "Create IOCQ", "Identify controller", "Identify namespace", "Set PS 0", "Create IOSQ",
+        "Get PS", "Set PS 1", "Get PS", "Set PS 2", "Get PS", "Set PS 3", "Get PS", "Set PS 4", "Get PS",
+    };
+    struct dnvme_admin_pipe pipe;
+    uint8_t ps;
+    struct dnvme_wait_stats wait_stats;
     int ret = 0;
     struct nvme_id_ctrl ctrl_info;
     struct nvme_id_ns ns_info;
+    uint64_t reg_hits, reg_fetches;
     fd = open_dev(DEVICE_FILE_NAME);
     if (fd < 0) {
         printf("Can't open device file: %s\n", DEVICE_FILE_NAME);
@@ -101,10 +154,10 @@ int main(int argc, char *argv[])
 //    //ioctl_device_metrics(fd);
 //    if (ret)
 //        return ret;
-    ret = malloc_4k_aligned_buffer(&iocq_buffer, NVME_IOCQ_ELEMENT_SIZE, qsize);
+    ret = malloc_4k_aligned_buffer(&iocq_buffer, NVME_IOCQ_ELEMENT_SIZE, qsize+1);
     if (ret)
         return ret;
-    ret = malloc_4k_aligned_buffer(&iosq_buffer, NVME_IOSQ_ELEMENT_SIZE, qsize);
+    ret = malloc_4k_aligned_buffer(&iosq_buffer, NVME_IOSQ_ELEMENT_SIZE, qsize+1);
     if (ret)
         return ret;
     ret = malloc_4k_aligned_buffer(&identify_ctrl_buffer, sizeof(struct nvme_id_ctrl), 1);
@@ -138,66 +191,40 @@ int main(int argc, char *argv[])
         return ret;
     //dnvme_pcie_msix_enable(fd, msix_cap);
     //ioctl_device_metrics(fd);
-    printf("Create IOCQ\n");
-    ret = dnvme_admin_create_iocq(fd, 0, cq_id, irq_no, qsize, contig, iocq_buffer);
-    if (ret)
-        return ret;
-    printf("Create IOSQ\n");
-    ret = dnvme_admin_create_iosq(fd, 0, sq_id, cq_id, qsize, contig, iosq_buffer, 1, 0);
-    if (ret)
-        return ret;
-    printf("Identify controller\n");
-    ret = dnvme_admin_identify_ctrl(fd, 0, 0, 0, identify_ctrl_buffer);
-    if (ret)
-        return ret;
-    printf("Identify namespace\n");
-    ret = dnvme_admin_identify_ns(fd, 1, 0, 0, identify_ns_buffer);
-    if (ret)
-        return ret;
-    //ret = dnvme_admin_abort(fd, 0, NVME_ADMIN_IDENTIFY);
-    ret = dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 0, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_get_power_state(fd, NVME_NSID_ALL, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 1, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_get_power_state(fd, NVME_NSID_ALL, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 2, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_get_power_state(fd, NVME_NSID_ALL, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 3, 0);
+    /*
+     * Everything independent shares a flush; Create IOSQ waits for its CQ
+     * and every Get Power State for the Set before it. Commands that fail
+     * (-EIO) show up in the CQ data dump below.
+     */
+    ret = dnvme_admin_pipe_init(&pipe, fd);
     if (ret)
         return ret;
-    ret = dnvme_get_power_state(fd, NVME_NSID_ALL, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 4, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_get_power_state(fd, NVME_NSID_ALL, 0);
-    if (ret)
-        return ret;
-    ret = dnvme_ring_doorbell(fd, 0);
-    if (ret)
-        return ret;
-    sleep(2);
-    cq_remaining = dnvme_cq_remain(fd, 0);
-    cq_buffer_size = cq_remaining*16;
-    ret = malloc_4k_aligned_buffer(&cq_buffer, cq_buffer_size, 1);
-    if (ret)
-        return ret;
-    ret = dnvme_cq_reap(fd, 0, cq_remaining, cq_buffer, cq_buffer_size);
-    if (ret)
+    printf("Create IOCQ, identify controller and namespace\n");
+    dnvme_admin_pipe_add(&pipe, dnvme_admin_create_iocq(fd, 0, cq_id, irq_no, qsize, contig, iocq_buffer),
+        &admin_cqes[0]);
+    dnvme_admin_pipe_add(&pipe, dnvme_admin_identify_ctrl(fd, 0, 0, 0, identify_ctrl_buffer), &admin_cqes[1]);
+    dnvme_admin_pipe_add(&pipe, dnvme_admin_identify_ns(fd, 1, 0, 0, identify_ns_buffer), &admin_cqes[2]);
+    dnvme_admin_pipe_add(&pipe, dnvme_set_power_state(fd, NVME_NSID_ALL, 0, 0, 0), &admin_cqes[3]);
+    ret = dnvme_admin_pipe_flush(&pipe);
+    for (ps=1; (ret == 0 || ret == -EIO) && ps<=5; ps++)
+    {
+        if (ps == 1)
+        {
+            printf("Create IOSQ\n");
+            dnvme_admin_pipe_add(&pipe, dnvme_admin_create_iosq(fd, 0, sq_id, cq_id, qsize, contig, iosq_buffer, 1, 0),
+                &admin_cqes[4]);
+        }
+        dnvme_admin_pipe_add(&pipe, dnvme_get_power_state(fd, NVME_NSID_ALL, 0), &admin_cqes[3+ps*2]);
+        if (ps < 5)
+            dnvme_admin_pipe_add(&pipe, dnvme_set_power_state(fd, NVME_NSID_ALL, 0, ps, 0), &admin_cqes[4+ps*2]);
+        ret = dnvme_admin_pipe_flush(&pipe);
+    }
+    printf("Admin pipeline: %u commands in %u flushes, %lu ns\n", pipe.commands, pipe.flushes, pipe.elapsed_ns);
+    dnvme_admin_pipe_free(&pipe);
+    if (ret && ret != -EIO)
         return ret;
-    show_raw_data(cq_buffer, cq_buffer_size, "CQ data");
+    show_raw_data((uint8_t *)admin_cqes, sizeof(admin_cqes), "CQ data");
+    show_cqe_failures((uint8_t *)admin_cqes, 14, admin_commands, "Admin pipeline");
     memcpy(&ctrl_info, identify_ctrl_buffer, sizeof(struct nvme_id_ctrl));
     memcpy(&ns_info, identify_ns_buffer, sizeof(struct nvme_id_ns));
     show_raw_data((uint8_t *)identify_ctrl_buffer, sizeof(struct nvme_id_ctrl), "Identify controller");
@@ -227,18 +254,32 @@ int main(int argc, char *argv[])
         ret = dnvme_ring_doorbell(fd, 1);
         if (ret)
             return ret;
-        sleep(2);
-        cq_remaining = dnvme_cq_remain(fd, 1);
+        ret = dnvme_cq_wait(fd, 1, 1, 0, &wait_stats);
+        show_wait_stats(&wait_stats, "IO CQ 1");
+        if (ret < 0)
+            return ret;
+        cq_remaining = ret;
+        ret = 0;
         cq_buffer_size = cq_remaining*16;
-        //ret = malloc_4k_aligned_buffer(&cq_buffer, cq_buffer_size, 1);
+        ret = malloc_4k_aligned_buffer(&cq_buffer, cq_buffer_size, 1);
         if (ret)
             return ret;
         ret = dnvme_cq_reap(fd, 1, cq_remaining, cq_buffer, cq_buffer_size);
         if (ret)
             return ret;
         show_raw_data(cq_buffer, cq_buffer_size, "CQ data");
+        show_cqe_failures(cq_buffer, cq_remaining, NULL, "IO CQ 1");
+        free_buffer(cq_buffer);
         show_raw_data((uint8_t *)data_buffer, buffer_size, "Read data");
+        free_buffer(data_buffer);
     }
+    /* IO queue memory stays with the live queues until the device is reset. */
+    free_buffer(identify_ns_buffer);
+    free_buffer(identify_ctrl_buffer);
+    dnvme_pool_report_all();
+    if (dnvme_regcache_stats(fd, &reg_hits, &reg_fetches) == 0)
+        printf("Register cache: %lu hits, %lu fetches\n", reg_hits, reg_fetches);
+    close_dev(fd);
     return 0;
 }
 
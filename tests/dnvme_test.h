@@ -0,0 +1,42 @@
+/*
+ ************************************************************************
+ * FileName: dnvme_test.h
+ * Description: checks shared by the unit tests under tests/.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#ifndef __DNVME_TEST_H__
+#define __DNVME_TEST_H__
+#include <stdio.h>
+
+/*
+ * Every test is its own program: CHECK() reports a failed condition and
+ * counts it, TEST_RESULT() turns the count into the exit status that
+ * 'make test' looks at.
+ */
+static int test_failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        unsigned long long _a = (unsigned long long)(actual), _e = (unsigned long long)(expected); \
+        if (_a != _e) \
+        { \
+            fprintf(stderr, "%s:%d: %s is 0x%llx, expected 0x%llx\n", __FILE__, __LINE__, #actual, _a, _e); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT(name) \
+    (printf("%s: %s\n", name, test_failures ? "FAIL" : "PASS"), test_failures ? 1 : 0)
+
+#endif
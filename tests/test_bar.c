@@ -0,0 +1,98 @@
+/*
+ ************************************************************************
+ * FileName: test_bar.c
+ * Description: register access through a regular file mapped as BAR0.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dnvme.h"
+#include "dnvme_bar.h"
+#include "dnvme_commands.h"
+#include "tests/dnvme_test.h"
+
+#define TEST_BAR_SIZE   (16*1024)
+#define TEST_BAR_FD     1000        /* the mapping is keyed by the dnvme fd only, it is never used */
+
+static volatile int unmapped;
+
+static void *test_bar_unmap_thread(void *arg)
+{
+    (void)arg;
+    dnvme_bar_unmap(TEST_BAR_FD);
+    unmapped = 1;
+    return NULL;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/dnvme-bar-XXXXXX";
+    uint32_t dword;
+    uint64_t qword = 0x0123456789abcdefULL;
+    uint8_t bytes[8];
+    struct dnvme_bar *bar;
+    pthread_t thread;
+    int file = mkstemp(path);
+
+    CHECK(file >= 0);
+    CHECK(ftruncate(file, TEST_BAR_SIZE) == 0);
+
+    CHECK(dnvme_bar_get(TEST_BAR_FD) == NULL);
+    CHECK_EQ(dnvme_bar_map(TEST_BAR_FD, path), 0);
+
+    /* Stores through the register calls land in the file. */
+    dword = 0x00460001;
+    CHECK_EQ(dnvme_controller_reg_write_dword(TEST_BAR_FD, NVME_REG_CC, &dword), 0);
+    CHECK(pread(file, &dword, 4, NVME_REG_CC) == 4);
+    CHECK_EQ(dword, 0x00460001);
+    CHECK_EQ(dnvme_controller_reg_write_block(TEST_BAR_FD, 0x1000, 8, (uint8_t *)&qword), 0);
+    CHECK(pread(file, bytes, 8, 0x1000) == 8);
+    CHECK(memcmp(bytes, &qword, 8) == 0);
+
+    /* A byte store is merged into its dword, a read at the last dword of the BAR still fits. */
+    bytes[0] = 0xa5;
+    CHECK_EQ(dnvme_controller_reg_write_byte(TEST_BAR_FD, NVME_REG_CC + 2, bytes), 0);
+    CHECK_EQ(dnvme_controller_reg_read_dword(TEST_BAR_FD, NVME_REG_CC, &dword), 0);
+    CHECK_EQ(dword, 0x00a50001);
+    dword = 0xfeedf00d;
+    CHECK(pwrite(file, &dword, 4, TEST_BAR_SIZE - 4) == 4);
+    CHECK_EQ(dnvme_controller_reg_read_dword(TEST_BAR_FD, TEST_BAR_SIZE - 4, &dword), 0);
+    CHECK_EQ(dword, 0xfeedf00d);
+
+    /* Accesses past the end are refused. */
+    bar = dnvme_bar_get(TEST_BAR_FD);
+    CHECK(bar != NULL);
+    if (bar)
+    {
+        CHECK_EQ(bar->size, TEST_BAR_SIZE);
+        CHECK(dnvme_bar_read(bar, TEST_BAR_SIZE - 2, 4, bytes) < 0);
+        CHECK(dnvme_bar_write(bar, TEST_BAR_SIZE, 1, bytes) < 0);
+        dnvme_bar_put(bar);
+    }
+
+    CHECK_EQ(dnvme_bar_set_active(TEST_BAR_FD, 0), 0);
+    CHECK(dnvme_bar_get(TEST_BAR_FD) == NULL);
+    CHECK_EQ(dnvme_bar_set_active(TEST_BAR_FD, 1), 0);
+    CHECK(dnvme_bar_set_active(TEST_BAR_FD + 1, 1) < 0);
+
+    /* Unmapping waits for the reference still held. */
+    bar = dnvme_bar_get(TEST_BAR_FD);
+    CHECK(bar != NULL);
+    CHECK(pthread_create(&thread, NULL, test_bar_unmap_thread, NULL) == 0);
+    usleep(50000);
+    CHECK(!unmapped);
+    if (bar)
+        dnvme_bar_put(bar);
+    pthread_join(thread, NULL);
+    CHECK(unmapped);
+    CHECK(dnvme_bar_get(TEST_BAR_FD) == NULL);
+
+    close(file);
+    unlink(path);
+    return TEST_RESULT("bar");
+}
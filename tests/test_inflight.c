@@ -0,0 +1,96 @@
+/*
+ ************************************************************************
+ * FileName: test_inflight.c
+ * Description: open-addressed table of outstanding commands.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include "dnvme_inflight.h"
+#include "tests/dnvme_test.h"
+
+#define TEST_QID        3
+
+static int completed[4];
+static uint16_t completed_cid;
+
+static void test_inflight_done(void *ctx, const struct nvme_completion *cqe, uint64_t latency_ns)
+{
+    (void)latency_ns;
+    (*(int *)ctx)++;
+    completed_cid = cqe->command_id;
+}
+
+static struct nvme_completion test_cqe(uint16_t sq_id, uint16_t cid)
+{
+    struct nvme_completion cqe;
+    memset(&cqe, 0, sizeof(cqe));
+    cqe.sq_id = sq_id;
+    cqe.command_id = cid;
+    return cqe;
+}
+
+int main(void)
+{
+    struct dnvme_inflight table;
+    struct nvme_completion cqe, cqes[3];
+    uint16_t cid;
+
+    /* Depth 8 gives 16 slots; 1, 17 and 33 share home slot 1 and probe into 2 and 3. */
+    CHECK_EQ(dnvme_inflight_init(&table, TEST_QID, 8), 0);
+    CHECK_EQ(table.mask, 15);
+    CHECK_EQ(dnvme_inflight_add(&table, 1, test_inflight_done, &completed[0]), 0);
+    CHECK_EQ(dnvme_inflight_add(&table, 17, test_inflight_done, &completed[1]), 0);
+    CHECK_EQ(dnvme_inflight_add(&table, 33, test_inflight_done, &completed[2]), 0);
+    CHECK_EQ(dnvme_inflight_add(&table, 2, test_inflight_done, &completed[3]), 0);
+    CHECK_EQ(dnvme_inflight_add(&table, 17, test_inflight_done, NULL), -EEXIST);
+    CHECK_EQ(table.count, 4);
+    CHECK(dnvme_inflight_find(&table, 33) != NULL);
+    CHECK(dnvme_inflight_find(&table, 49) == NULL);
+
+    /* Removing the middle of the chain must keep the entries behind it reachable. */
+    cqe = test_cqe(TEST_QID, 17);
+    CHECK_EQ(dnvme_inflight_complete(&table, &cqe), 0);
+    CHECK_EQ(completed[1], 1);
+    CHECK_EQ(completed_cid, 17);
+    CHECK(dnvme_inflight_find(&table, 17) == NULL);
+    CHECK(dnvme_inflight_find(&table, 1) != NULL);
+    CHECK(dnvme_inflight_find(&table, 33) != NULL);
+    CHECK(dnvme_inflight_find(&table, 2) != NULL);
+    CHECK_EQ(table.count, 3);
+
+    /* A CQE of another SQ or an unknown command is counted as an orphan. */
+    cqe = test_cqe(TEST_QID + 1, 1);
+    CHECK_EQ(dnvme_inflight_complete(&table, &cqe), -ENOENT);
+    cqe = test_cqe(TEST_QID, 17);
+    CHECK_EQ(dnvme_inflight_complete(&table, &cqe), -ENOENT);
+    CHECK_EQ(table.orphans, 2);
+    CHECK_EQ(completed[0], 0);
+
+    cqes[0] = test_cqe(TEST_QID, 33);
+    cqes[1] = test_cqe(TEST_QID, 99);
+    cqes[2] = test_cqe(TEST_QID, 1);
+    CHECK_EQ(dnvme_inflight_dispatch(&table, (const uint8_t *)cqes, 3), 2);
+    CHECK_EQ(completed[0], 1);
+    CHECK_EQ(completed[2], 1);
+    CHECK_EQ(completed[3], 0);
+    CHECK_EQ(table.count, 1);
+    CHECK(dnvme_inflight_find(&table, 2) != NULL);
+
+    /* At most half the slots are used. */
+    for (cid=100; table.count < 8; cid++)
+        CHECK_EQ(dnvme_inflight_add(&table, cid, NULL, NULL), 0);
+    CHECK_EQ(dnvme_inflight_add(&table, cid, NULL, NULL), -ENOSPC);
+    for (cid=100; table.count > 1; cid++)
+    {
+        cqe = test_cqe(TEST_QID, cid);
+        CHECK_EQ(dnvme_inflight_complete(&table, &cqe), 0);
+    }
+    CHECK(dnvme_inflight_find(&table, 2) != NULL);
+
+    dnvme_inflight_free(&table);
+    return TEST_RESULT("inflight");
+}
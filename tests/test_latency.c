@@ -0,0 +1,79 @@
+/*
+ ************************************************************************
+ * FileName: test_latency.c
+ * Description: latency histogram and percentiles.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <stdint.h>
+#include "dnvme_latency.h"
+#include "tests/dnvme_test.h"
+
+/* 'value' within 'pct' percent of 'expected'. */
+static int test_near(uint64_t value, uint64_t expected, double pct)
+{
+    double diff = value > expected ? value - expected : expected - value;
+    return diff <= expected*pct/100.0;
+}
+
+static struct dnvme_lat_hist hist, other;
+
+int main(void)
+{
+    uint64_t ns;
+
+    dnvme_lat_init(&hist);
+    CHECK_EQ(dnvme_lat_mean(&hist), 0);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 50), 0);
+
+    /* Below DNVME_LAT_LINEAR every value has its own bucket. */
+    for (ns=1; ns<=50; ns++)
+        dnvme_lat_add(&hist, ns);
+    CHECK_EQ(hist.count, 50);
+    CHECK_EQ(hist.min_ns, 1);
+    CHECK_EQ(hist.max_ns, 50);
+    CHECK_EQ(dnvme_lat_mean(&hist), 25);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 50), 25);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 90), 45);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 100), 50);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 0), 1);
+
+    /* 1us..1ms in 1us steps: every percentile within the 3% bucket error. */
+    dnvme_lat_init(&hist);
+    for (ns=1000; ns<=1000000; ns+=1000)
+        dnvme_lat_add(&hist, ns);
+    CHECK(test_near(dnvme_lat_percentile(&hist, 50), 500000, 3));
+    CHECK(test_near(dnvme_lat_percentile(&hist, 99), 990000, 3));
+    CHECK(test_near(dnvme_lat_percentile(&hist, 99.9), 999000, 3));
+    CHECK(dnvme_lat_percentile(&hist, 99.99) <= hist.max_ns);
+    CHECK_EQ(dnvme_lat_mean(&hist), 500500);
+
+    /* A percentile is reported as the middle of its bucket: 1500 is in [1472, 1504). */
+    dnvme_lat_init(&other);
+    dnvme_lat_add(&other, 10);
+    for (ns=0; ns<100; ns++)
+        dnvme_lat_add(&other, 1500);
+    dnvme_lat_add(&other, 10000);
+    CHECK_EQ(dnvme_lat_percentile(&other, 50), 1488);
+
+    /* Very large values land in the last groups without overflowing the table. */
+    dnvme_lat_init(&other);
+    dnvme_lat_add(&other, UINT64_MAX);
+    dnvme_lat_add(&other, 1ULL << 40);
+    CHECK_EQ(other.buckets[DNVME_LAT_BUCKETS-1], 1);
+    CHECK_EQ(dnvme_lat_percentile(&other, 100), UINT64_MAX);
+
+    /* Merging adds counts and keeps the extremes of both. */
+    dnvme_lat_init(&other);
+    dnvme_lat_add(&other, 10);
+    dnvme_lat_add(&other, 5000000);
+    dnvme_lat_merge(&hist, &other);
+    CHECK_EQ(hist.count, 1002);
+    CHECK_EQ(hist.min_ns, 10);
+    CHECK_EQ(hist.max_ns, 5000000);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 0.01), 10);
+    CHECK_EQ(dnvme_lat_percentile(&hist, 100), 5000000);
+
+    return TEST_RESULT("latency");
+}
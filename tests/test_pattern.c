@@ -0,0 +1,79 @@
+/*
+ ************************************************************************
+ * FileName: test_pattern.c
+ * Description: data pattern fill and read-back verification.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dnvme_pattern.h"
+#include "tests/dnvme_test.h"
+
+#define TEST_LBA_SIZE   512
+#define TEST_LBAS       64
+#define TEST_LBA        1000
+#define TEST_BYTES      (TEST_LBA_SIZE*TEST_LBAS)
+
+static uint32_t buffer[TEST_BYTES/4 + 1], part[TEST_BYTES/4];
+
+int main(void)
+{
+    struct dnvme_pattern pattern = {.lba_size = TEST_LBA_SIZE, .seed = 0x1122334455667788ULL};
+    struct dnvme_pattern_check check;
+    uint64_t tag[2];
+    uint32_t i;
+
+    for (pattern.type=0; pattern.type<DNVME_PATTERN_TYPES; pattern.type++)
+    {
+        /* Round trip, and a slice filled on its own matches the same LBAs of the whole buffer. */
+        CHECK_EQ(dnvme_pattern_fill(&pattern, buffer, TEST_BYTES, TEST_LBA), 0);
+        CHECK_EQ(dnvme_pattern_verify(&pattern, buffer, TEST_BYTES, TEST_LBA, &check), 0);
+        CHECK_EQ(check.mismatches, 0);
+        CHECK_EQ(check.offset, TEST_BYTES);
+        CHECK_EQ(dnvme_pattern_fill(&pattern, part, 5*TEST_LBA_SIZE, TEST_LBA + 3), 0);
+        CHECK(memcmp(part, (uint8_t *)buffer + 3*TEST_LBA_SIZE, 5*TEST_LBA_SIZE) == 0);
+        if (pattern.type != DNVME_PATTERN_FIXED)
+            CHECK_EQ(dnvme_pattern_verify(&pattern, buffer, TEST_BYTES, TEST_LBA + 1, NULL), -EIO);
+
+        /* Three bad bytes in two words: the first one is reported with the word holding it. */
+        ((uint8_t *)buffer)[777] ^= 0x5a;
+        ((uint8_t *)buffer)[779] ^= 0x01;
+        ((uint8_t *)buffer)[TEST_BYTES - 1] ^= 0x80;
+        CHECK_EQ(dnvme_pattern_verify(&pattern, buffer, TEST_BYTES, TEST_LBA, &check), -EIO);
+        CHECK_EQ(check.mismatches, 3);
+        CHECK_EQ(check.offset, 777);
+        CHECK_EQ(check.actual, buffer[776/4]);
+        CHECK_EQ(check.expected ^ check.actual, 0x01005a00);
+    }
+
+    /* Word values of the simple patterns, on an odd word count and a buffer not aligned to a vector. */
+    pattern.type = DNVME_PATTERN_FIXED;
+    CHECK_EQ(dnvme_pattern_fill(&pattern, buffer + 1, 37*4, 0), 0);
+    for (i=0; i<37; i++)
+        CHECK_EQ(buffer[1 + i], 0x55667788);
+    pattern.type = DNVME_PATTERN_INCREMENT;
+    CHECK_EQ(dnvme_pattern_fill(&pattern, buffer + 1, 37*4, 2), 0);
+    for (i=0; i<37; i++)
+        CHECK_EQ(buffer[1 + i], 0x55667788 + 2*TEST_LBA_SIZE/4 + i);
+    CHECK_EQ(dnvme_pattern_verify(&pattern, buffer + 1, 37*4, 2, NULL), 0);
+
+    /* Every LBA of the LBA pattern starts with its number and the seed. */
+    pattern.type = DNVME_PATTERN_LBA;
+    CHECK_EQ(dnvme_pattern_fill(&pattern, buffer, TEST_BYTES, TEST_LBA), 0);
+    for (i=0; i<TEST_LBAS; i++)
+    {
+        memcpy(tag, (uint8_t *)buffer + i*TEST_LBA_SIZE, sizeof(tag));
+        CHECK_EQ(tag[0], TEST_LBA + i);
+        CHECK_EQ(tag[1], pattern.seed);
+    }
+
+    CHECK_EQ(dnvme_pattern_fill(&pattern, buffer, TEST_LBA_SIZE + 4, 0), -EINVAL);
+    pattern.type = DNVME_PATTERN_RANDOM;
+    CHECK_EQ(dnvme_pattern_fill(&pattern, buffer, 6, 0), -EINVAL);
+    CHECK_EQ(dnvme_pattern_verify(&pattern, (uint8_t *)buffer + 2, 8, 0, NULL), -EINVAL);
+    return TEST_RESULT("pattern");
+}
@@ -0,0 +1,120 @@
+/*
+ ************************************************************************
+ * FileName: test_pi.c
+ * Description: T10 PI guard CRC, generation and checking.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dnvme.h"
+#include "dnvme_pi.h"
+#include "tests/dnvme_test.h"
+
+#define TEST_LBAS       32
+#define TEST_LBA        100
+
+/* CRC16 T10-DIF one bit at a time, polynomial 0x8BB7, no reflection, no final xor. */
+static uint16_t test_crc16_bitwise(uint16_t crc, const uint8_t *p, size_t bytes)
+{
+    size_t i;
+    int bit;
+    for (i=0; i<bytes; i++)
+    {
+        crc ^= p[i] << 8;
+        for (bit=0; bit<8; bit++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x8BB7 : crc << 1;
+    }
+    return crc;
+}
+
+static uint8_t random_data[1 << 17], data[TEST_LBAS*(4096+16)], meta[TEST_LBAS*16];
+
+int main(void)
+{
+    struct dnvme_pi_format format = {.lba_size = 512, .ms = 16, .type = NVME_NS_DPS_PI_TYPE1, .extended = 1};
+    struct dnvme_pattern pattern = {.type = DNVME_PATTERN_LBA, .lba_size = 512, .seed = 7};
+    struct dnvme_pi_tags tags = {.ref = TEST_LBA, .app = 0x1234, .app_mask = 0xffff, .check = DNVME_PI_PRCHK_ALL};
+    struct dnvme_pattern_check check;
+    struct dnvme_pi_error error;
+    uint32_t block, i;
+    size_t offset, bytes;
+    uint16_t seed;
+
+    /* The check value of the CRC catalogue, then random lengths, offsets and seeds against the reference. */
+    CHECK_EQ(dnvme_crc16_t10dif(0, "123456789", 9), 0xD0DB);
+    CHECK_EQ(dnvme_crc16_t10dif(0x1234, "", 0), 0x1234);
+    srand(1);
+    for (i=0; i<sizeof(random_data); i++)
+        random_data[i] = rand();
+    for (i=0; i<4000; i++)
+    {
+        offset = rand() % 64;
+        bytes = i < 2000 ? (size_t)rand() % 300 : (size_t)rand() % (sizeof(random_data) - 64);
+        seed = rand();
+        CHECK_EQ(dnvme_crc16_t10dif(seed, random_data + offset, bytes),
+            test_crc16_bitwise(seed, random_data + offset, bytes));
+    }
+    /* Feeding a buffer in pieces gives the CRC of the whole. */
+    CHECK_EQ(dnvme_crc16_t10dif(dnvme_crc16_t10dif(0, random_data, 1000), random_data + 1000, 3096),
+        test_crc16_bitwise(0, random_data, 4096));
+
+    /* Type 1, PI in the last 8 of 16 metadata bytes, extended LBAs. */
+    block = dnvme_pi_block_size(&format);
+    CHECK_EQ(block, 528);
+    CHECK_EQ(dnvme_pi_generate(&format, &pattern, data, NULL, TEST_LBAS, TEST_LBA, &tags), 0);
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, &check), 0);
+    CHECK_EQ(test_crc16_bitwise(test_crc16_bitwise(0, data + 5*block, 512), data + 5*block + 512, 8),
+        (data[5*block + 520] << 8) | data[5*block + 521]);
+    CHECK_EQ(data[5*block + 527], TEST_LBA + 5);
+
+    /* A flipped data bit fails both the guard and the pattern. */
+    data[3*block + 5] ^= 1;
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, &check), -EIO);
+    CHECK_EQ(error.index, 3);
+    CHECK_EQ(error.status, NVME_SC_GUARD_CHECK);
+    CHECK_EQ(check.offset, 3*block + 5);
+    CHECK_EQ(check.mismatches, 1);
+    data[3*block + 5] ^= 1;
+
+    /* Reference and application tags that do not match what the command says. */
+    tags.ref = TEST_LBA + 1;
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, &check), -EIO);
+    CHECK_EQ(error.status, NVME_SC_REFTAG_CHECK);
+    CHECK_EQ(error.index, 0);
+    CHECK_EQ(error.expected, TEST_LBA + 1);
+    CHECK_EQ(error.actual, TEST_LBA);
+    tags.check = DNVME_PI_PRCHK_GUARD | DNVME_PI_PRCHK_APP;
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, &check), 0);
+    tags.ref = TEST_LBA;
+    tags.app = 0x1235;
+    CHECK_EQ(dnvme_pi_verify(&format, NULL, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, NULL), -EIO);
+    CHECK_EQ(error.status, NVME_SC_APPTAG_CHECK);
+    tags.app_mask = 0xfffe;
+    CHECK_EQ(dnvme_pi_verify(&format, NULL, data, NULL, TEST_LBAS, TEST_LBA, &tags, &error, NULL), 0);
+
+    /* Type 3 with PI first in a separate metadata buffer: the reference tag is the host's and not checked. */
+    format = (struct dnvme_pi_format){.lba_size = 4096, .ms = 16, .type = NVME_NS_DPS_PI_TYPE3, .first = 1};
+    pattern.lba_size = 4096;
+    tags = (struct dnvme_pi_tags){.ref = 5, .app = 0xbeef, .app_mask = 0xffff, .check = DNVME_PI_PRCHK_ALL};
+    CHECK_EQ(dnvme_pi_generate(&format, &pattern, data, meta, TEST_LBAS, 0, &tags), 0);
+    CHECK_EQ(meta[31*16 + 7], 5);
+    CHECK_EQ(test_crc16_bitwise(0, data + 4096, 4096), (meta[16] << 8) | meta[17]);
+    tags.ref = 9;
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, meta, TEST_LBAS, 0, &tags, &error, &check), 0);
+    CHECK_EQ(dnvme_pi_verify(&format, &pattern, data, NULL, TEST_LBAS, 0, &tags, &error, &check), -EINVAL);
+
+    /* An application tag of all ones, for type 3 with a reference tag of all ones, turns checking off. */
+    meta[2*16 + 2] = meta[2*16 + 3] = 0xff;
+    data[2*4096] ^= 0xff;
+    CHECK_EQ(dnvme_pi_verify(&format, NULL, data, meta, TEST_LBAS, 0, &tags, &error, NULL), -EIO);
+    CHECK_EQ(error.status, NVME_SC_GUARD_CHECK);
+    CHECK_EQ(error.index, 2);
+    memset(meta + 2*16 + 4, 0xff, 4);
+    CHECK_EQ(dnvme_pi_verify(&format, NULL, data, meta, TEST_LBAS, 0, &tags, &error, NULL), 0);
+
+    return TEST_RESULT("pi");
+}
@@ -0,0 +1,59 @@
+/*
+ ************************************************************************
+ * FileName: test_ranges.c
+ * Description: LBA range collection and coalescing for trim.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include "dnvme_trim.h"
+#include "tests/dnvme_test.h"
+
+#define CHECK_RANGE(set, i, start, count) \
+    do { \
+        CHECK_EQ((set)->ranges[i].slba, start); \
+        CHECK_EQ((set)->ranges[i].nlb, count); \
+    } while (0)
+
+int main(void)
+{
+    struct dnvme_range_set set;
+    uint32_t i;
+
+    CHECK_EQ(dnvme_range_set_init(&set, 2), 0);
+    CHECK_EQ(dnvme_range_set_add(&set, 5, 0), 0);
+    CHECK_EQ(set.count, 0);
+    CHECK_EQ(dnvme_range_set_add(&set, UINT64_MAX, 2), -EINVAL);
+
+    /* Out of order, overlapping, touching, contained and disjoint ranges; the set grows past its capacity. */
+    CHECK_EQ(dnvme_range_set_add(&set, 100, 10), 0);    /* 100-109 */
+    CHECK_EQ(dnvme_range_set_add(&set, 0, 8), 0);       /* 0-7 */
+    CHECK_EQ(dnvme_range_set_add(&set, 110, 5), 0);     /* touches 100-109 */
+    CHECK_EQ(dnvme_range_set_add(&set, 102, 3), 0);     /* inside 100-109 */
+    CHECK_EQ(dnvme_range_set_add(&set, 4, 10), 0);      /* overlaps 0-7 */
+    CHECK_EQ(dnvme_range_set_add(&set, 15, 1), 0);      /* one LBA gap after 4-13 */
+    CHECK_EQ(dnvme_range_set_add(&set, 1000, 1), 0);
+    CHECK(set.capacity >= set.count);
+    CHECK_EQ(set.count, 7);
+    CHECK_EQ(dnvme_range_set_coalesce(&set), 4);
+    CHECK_RANGE(&set, 0, 0, 14);
+    CHECK_RANGE(&set, 1, 15, 1);
+    CHECK_RANGE(&set, 2, 100, 15);
+    CHECK_RANGE(&set, 3, 1000, 1);
+    CHECK_EQ(dnvme_range_set_blocks(&set), 31);
+    for (i=1; i<set.count; i++)
+        CHECK(set.ranges[i].slba > set.ranges[i-1].slba + set.ranges[i-1].nlb);
+
+    /* Coalescing is idempotent, and a duplicate collapses into one range. */
+    CHECK_EQ(dnvme_range_set_coalesce(&set), 4);
+    dnvme_range_set_reset(&set);
+    CHECK_EQ(dnvme_range_set_add(&set, 7, 3), 0);
+    CHECK_EQ(dnvme_range_set_add(&set, 7, 3), 0);
+    CHECK_EQ(dnvme_range_set_coalesce(&set), 1);
+    CHECK_RANGE(&set, 0, 7, 3);
+
+    dnvme_range_set_free(&set);
+    return TEST_RESULT("ranges");
+}
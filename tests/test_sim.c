@@ -0,0 +1,256 @@
+/*
+ ************************************************************************
+ * FileName: test_sim.c
+ * Description: bring-up, engine, transfers and trim against the simulated controller.
+ * Author: agent
+ * Date: Oct-17-2026
+ ************************************************************************
+*/
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dnvme.h"
+#include "dnvme_commands.h"
+#include "dnvme_engine.h"
+#include "dnvme_ioctrl.h"
+#include "dnvme_pattern.h"
+#include "dnvme_pi.h"
+#include "dnvme_sim.h"
+#include "dnvme_trim.h"
+#include "dnvme_xfer.h"
+#include "tests/dnvme_test.h"
+
+#define TEST_QUEUES         2
+#define TEST_NSID           1
+#define TEST_XFER_BYTES     (1 << 20)       /* per queue, several MDTS sized chunks */
+#define TEST_XFER_DEPTH     4
+#define TEST_PI_LBAS        256
+#define TEST_PI_APP         0x1234
+
+struct test_sim {
+    struct dnvme_xfer_limits limits;
+    struct dnvme_trim_caps caps;
+    struct dnvme_pattern pattern;
+    struct dnvme_pi_format format;
+};
+
+/* Zero 'nlb' LBAs at 'slba' of a buffer that holds the LBAs from 'base' on. */
+static void test_sim_zero(uint8_t *buffer, uint32_t lba_size, uint64_t base, uint64_t slba, uint64_t nlb)
+{
+    memset(buffer + (slba - base)*lba_size, 0, nlb*lba_size);
+}
+
+/*
+ * Every queue writes its own megabyte with the LBA pattern and reads it
+ * back; queue 0 then zeroes and deallocates ranges inside its megabyte.
+ */
+static int test_sim_worker(struct dnvme_queue *queue, void *arg)
+{
+    struct test_sim *test = arg;
+    uint32_t lba_size = test->limits.lba_size;
+    uint64_t offset = (uint64_t)queue->index*TEST_XFER_BYTES;
+    uint64_t lba = offset/lba_size;
+    struct dnvme_xfer_stats xstats;
+    struct dnvme_trim_stats tstats;
+    struct dnvme_pattern_check check;
+    struct dnvme_range_set set;
+    uint32_t i;
+    uint8_t *data = malloc(TEST_XFER_BYTES);
+    uint8_t *back = malloc(TEST_XFER_BYTES);
+    int ret = -ENOMEM;
+
+    if (!data || !back)
+        goto out;
+    CHECK_EQ(dnvme_pattern_fill(&test->pattern, data, TEST_XFER_BYTES, lba), 0);
+    ret = dnvme_xfer_write(queue, &test->limits, TEST_NSID, offset, data, TEST_XFER_BYTES, TEST_XFER_DEPTH, NULL, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(xstats.status, 0);
+    CHECK(xstats.commands >= TEST_XFER_BYTES/(test->limits.max_lbas*lba_size));
+    CHECK(xstats.max_inflight > 1);
+    memset(back, 0xee, TEST_XFER_BYTES);
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, offset, back, TEST_XFER_BYTES, TEST_XFER_DEPTH, NULL, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(dnvme_pattern_verify(&test->pattern, back, TEST_XFER_BYTES, lba, &check), 0);
+    if (ret || queue->index != 0)
+        goto out;
+
+    /* Write Zeroes over overlapping and touching ranges, which coalesce into two. */
+    ret = dnvme_range_set_init(&set, 0);
+    if (ret)
+        goto out;
+    dnvme_range_set_add(&set, lba + 40, 8);
+    dnvme_range_set_add(&set, lba + 10, 20);
+    dnvme_range_set_add(&set, lba + 30, 4);
+    dnvme_range_set_add(&set, lba + 12, 2);
+    ret = dnvme_trim(queue, TEST_NSID, &set, DNVME_TRIM_ZERO, &test->caps, 0, &tstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(tstats.status, 0);
+    CHECK_EQ(tstats.ranges, 2);
+    CHECK_EQ(tstats.blocks, 32);
+    CHECK_EQ(tstats.wz_cmds, 2);
+    test_sim_zero(data, lba_size, lba, lba + 10, 24);
+    test_sim_zero(data, lba_size, lba, lba + 40, 8);
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, offset, back, TEST_XFER_BYTES, TEST_XFER_DEPTH, NULL, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK(memcmp(data, back, TEST_XFER_BYTES) == 0);
+
+    /* More ranges than one Dataset Management command carries. */
+    dnvme_range_set_reset(&set);
+    for (i=0; i<DNVME_DSM_MAX_RANGES + 10; i++)
+        dnvme_range_set_add(&set, lba + 2*i, 1);
+    ret = dnvme_trim(queue, TEST_NSID, &set, DNVME_TRIM_DEALLOCATE, &test->caps, 0, &tstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(tstats.status, 0);
+    CHECK_EQ(tstats.ranges, DNVME_DSM_MAX_RANGES + 10);
+    CHECK_EQ(tstats.dsm_cmds, 2);
+
+    /* A range past the end of the namespace is refused before anything is sent. */
+    dnvme_range_set_reset(&set);
+    dnvme_range_set_add(&set, test->caps.nsze - 1, 2);
+    CHECK_EQ(dnvme_trim(queue, TEST_NSID, &set, DNVME_TRIM_DEALLOCATE, &test->caps, 0, &tstats), -EINVAL);
+    dnvme_range_set_free(&set);
+out:
+    free(data);
+    free(back);
+    return ret;
+}
+
+/*
+ * Type 1 PI through dnvme_xfer: tuples generated on write pass the
+ * controller's checks and the host's on read, an unaligned write keeps
+ * them right, and a block changed behind their back is caught.
+ */
+static int test_sim_pi_worker(struct dnvme_queue *queue, void *arg)
+{
+    struct test_sim *test = arg;
+    uint32_t block = test->limits.lba_size;
+    uint64_t bytes = (uint64_t)TEST_PI_LBAS*block;
+    uint64_t lba = 16;
+    struct dnvme_xfer_stats xstats;
+    struct dnvme_xfer_pi pi = {
+        .format = test->format,
+        .tags = {.ref = lba, .app = TEST_PI_APP, .app_mask = 0xFFFF, .check = DNVME_PI_PRCHK_ALL},
+        .prinfo = DNVME_PI_PRCHK_ALL,
+    };
+    uint8_t *data = malloc(bytes);
+    uint8_t *back = malloc(bytes);
+    uint32_t i;
+    int ret = -ENOMEM;
+
+    if (!data || !back)
+        goto out;
+    for (i=0; i<bytes; i++)
+        data[i] = i*7 + (i >> 9);
+    ret = dnvme_xfer_write(queue, &test->limits, TEST_NSID, lba*block, data, bytes, TEST_XFER_DEPTH, &pi, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(xstats.status, 0);
+    CHECK(xstats.commands > 1);
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, lba*block, back, bytes, TEST_XFER_DEPTH, &pi, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(pi.error.status, 0);
+    for (i=0; i<TEST_PI_LBAS; i++)
+        CHECK(memcmp(data + i*block, back + i*block, test->format.lba_size) == 0);
+
+    /*
+     * Part of one LBA: the rest of it is read first and the tuple generated
+     * over the whole block. Reading from there on splits the range into
+     * other chunks than the write did, so every reference tag has to match
+     * its LBA.
+     */
+    pi.tags.ref = lba + 7;
+    ret = dnvme_xfer_write(queue, &test->limits, TEST_NSID, (lba+7)*block + 100, data, 50, 1, &pi, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(xstats.status, 0);
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, (lba+7)*block, back, bytes - 7*block, TEST_XFER_DEPTH,
+        &pi, &xstats);
+    CHECK_EQ(ret, 0);
+    CHECK_EQ(pi.error.status, 0);
+    CHECK(memcmp(back + 100, data, 50) == 0);
+    pi.tags.ref = lba;
+
+    /* Change a byte without PI, then read with only the host checking. */
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, (lba+5)*block, back, block, 1, NULL, NULL);
+    CHECK_EQ(ret, 0);
+    back[10] ^= 0x01;
+    ret = dnvme_xfer_write(queue, &test->limits, TEST_NSID, (lba+5)*block, back, block, 1, NULL, NULL);
+    CHECK_EQ(ret, 0);
+    pi.prinfo = 0;
+    ret = dnvme_xfer_read(queue, &test->limits, TEST_NSID, lba*block, back, bytes, TEST_XFER_DEPTH, &pi, &xstats);
+    CHECK_EQ(ret, -EIO);
+    CHECK_EQ(xstats.status, NVME_SC_GUARD_CHECK);
+    CHECK_EQ(pi.error.status, NVME_SC_GUARD_CHECK);
+    CHECK_EQ(pi.error.index, 5);
+    ret = SUCCESS;
+
+    /* PRACT and a separate metadata buffer are refused. */
+    pi.prinfo = DNVME_PI_PRACT;
+    CHECK_EQ(dnvme_xfer_read(queue, &test->limits, TEST_NSID, 0, back, block, 1, &pi, NULL), -EINVAL);
+    pi.prinfo = 0;
+    pi.format.extended = 0;
+    CHECK_EQ(dnvme_xfer_read(queue, &test->limits, TEST_NSID, 0, back, block, 1, &pi, NULL), -EINVAL);
+out:
+    free(data);
+    free(back);
+    return ret;
+}
+
+int main(void)
+{
+    struct dnvme_engine_config config = {
+        .nr_queues = TEST_QUEUES,
+        .qdepth = 32,
+        .contig = 1,
+    };
+    struct test_sim test = {
+        .pattern = {.type = DNVME_PATTERN_LBA, .seed = 0x5eed},
+    };
+    struct dnvme_sim_config pi_config = {
+        .lba_size = 512,
+        .ms = 8,
+        .pi = NVME_NS_DPS_PI_TYPE1,
+    };
+    struct dnvme_engine engine;
+    int fd;
+
+    dnvme_sim_configure(NULL);
+    ioctl_set_backend(&dnvme_sim_backend);
+    CHECK(open_dev("/dev/nvme0") < 0);
+    fd = open_dev(DNVME_SIM_PATH);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return TEST_RESULT("sim");
+    CHECK(open_dev(DNVME_SIM_PATH) < 0);
+
+    CHECK_EQ(init_drive(fd), 0);
+    CHECK_EQ(dnvme_xfer_get_limits(fd, TEST_NSID, &test.limits), 0);
+    CHECK_EQ(dnvme_trim_get_caps(fd, TEST_NSID, &test.caps), 0);
+    CHECK_EQ(test.limits.lba_size, 512);
+    CHECK(test.limits.nsze >= TEST_QUEUES*TEST_XFER_BYTES/512);
+    test.pattern.lba_size = test.limits.lba_size;
+
+    CHECK_EQ(dnvme_engine_init(&engine, fd, &config), 0);
+    CHECK_EQ(engine.nr_queues, TEST_QUEUES);
+    CHECK_EQ(dnvme_engine_run(&engine, test_sim_worker, &test), 0);
+    dnvme_engine_destroy(&engine);
+
+    /* A second bring-up of the same controller starts from a clean state. */
+    CHECK_EQ(init_drive(fd), 0);
+    close_dev(fd);
+
+    dnvme_sim_configure(&pi_config);
+    fd = open_dev(DNVME_SIM_PATH);
+    CHECK(fd >= 0);
+    if (fd < 0)
+        return TEST_RESULT("sim");
+    CHECK_EQ(init_drive(fd), 0);
+    CHECK_EQ(dnvme_xfer_get_limits(fd, TEST_NSID, &test.limits), 0);
+    CHECK_EQ(test.limits.lba_size, 520);
+    CHECK_EQ(dnvme_pi_get_format(fd, TEST_NSID, &test.format), 0);
+    config.nr_queues = 1;
+    CHECK_EQ(dnvme_engine_init(&engine, fd, &config), 0);
+    CHECK_EQ(dnvme_engine_run(&engine, test_sim_pi_worker, &test), 0);
+    dnvme_engine_destroy(&engine);
+    close_dev(fd);
+    return TEST_RESULT("sim");
+}